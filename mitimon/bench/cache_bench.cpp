@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache.h"
+
+// The frame cache of mitimon, and frames with names of the usual length.
+#define CACHE_SIZE (64 * 1024 * 1024)
+#define FRAME_COUNT 50000
+#define IMAGE_COUNT 50
+#define LOOKUPS_PER_THREAD 1000000
+#define MAX_THREADS 8
+
+static std::shared_ptr<const FrameInfo> makeFrame(uint64_t i)
+{
+    return std::make_shared<const FrameInfo>(FrameInfo{ std::format(L"mozilla::interceptor::function_{}", i), 0x10,
+        std::format(L"/builds/worker/checkouts/gecko/toolkit/file_{}.cpp", i % 1000), 100, 4, L"" });
+}
+
+// Spreads the keys over images and offsets, as the frames of many stacks do.
+static uint32_t imageIdOf(uint64_t i)
+{
+    return static_cast<uint32_t>(1 + i % IMAGE_COUNT);
+}
+
+static uint64_t offsetOf(uint64_t i)
+{
+    return (i / IMAGE_COUNT) * 0x37;
+}
+
+// Hits look up frames all in the cache. Misses look up frames that are not, then insert them as SymbolSession does,
+// which evicts others once the cache is full.
+static void run(int threadCount, bool hits)
+{
+    FrameCache cache{ CACHE_SIZE };
+    for (uint64_t i = 0; i < FRAME_COUNT; ++i) {
+        cache.insert(imageIdOf(i), offsetOf(i), makeFrame(i));
+    }
+
+    auto frame = makeFrame(0);
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<std::jthread> threads;
+        for (int thread = 0; thread < threadCount; ++thread) {
+            threads.emplace_back([&cache, &frame, hits, thread]() {
+                uint64_t found = 0;
+                for (uint64_t i = 0; i < LOOKUPS_PER_THREAD; ++i) {
+                    auto key = hits ? (i * 7919 + thread) % FRAME_COUNT : FRAME_COUNT + i * MAX_THREADS + thread;
+                    if (cache.find(imageIdOf(key), offsetOf(key))) {
+                        ++found;
+                    }
+                    else {
+                        cache.insert(imageIdOf(key), offsetOf(key), frame);
+                    }
+                }
+                // Keeps the lookups from being optimized away.
+                if (found == 0 && hits) {
+                    std::wcout << L"No frame found." << std::endl;
+                }
+            });
+        }
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    auto stats = cache.stats();
+    auto lookups = static_cast<double>(threadCount) * LOOKUPS_PER_THREAD;
+    std::wcout << std::format(L"Threads: {} {}, {:.1f} ns per lookup, {:.1f} M lookups/s, hit rate: {:.1f}%, evictions: {}.",
+        threadCount, hits ? L"hits" : L"misses", elapsed * threadCount / lookups, lookups * 1000.0 / elapsed,
+        100.0 * static_cast<double>(stats.hits) / static_cast<double>(stats.hits + stats.misses), stats.evictions) << std::endl;
+}
+
+// Measures the hit and the miss paths of the frame cache from 1 to 8 workers.
+int main()
+{
+    for (bool hits : { true, false }) {
+        for (int threadCount : { 1, 2, 4, MAX_THREADS }) {
+            run(threadCount, hits);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "decoder.h"
+
+// Schemas seen by a decoding thread, and events decoded per measurement.
+#define SCHEMA_COUNT 16
+#define EVENT_COUNT 1000000
+
+// A kernel memory event, whose properties are all at fixed offsets, with the flag tested before decoding.
+static const std::vector<FieldLayout> MEMORY_LAYOUT = {
+    { L"ProcessId", FieldType::UInt32, 0, 0, 0 },
+    { L"BaseAddress", FieldType::UInt64, 0, 0, 0 },
+    { L"RegionSize", FieldType::UInt64, 0, 0, 0 },
+    { L"Protection", FieldType::UInt32, 0, 0, 0 },
+    { L"AcgFlag", FieldType::UInt32, 0, 0, 0 },
+};
+
+// A mitigation event, whose properties after the counted path are found by walking it.
+static const std::vector<FieldLayout> MITIGATION_LAYOUT = {
+    { L"ProcessPathLength", FieldType::UInt16, 0, 0, 0 },
+    { L"ProcessPath", FieldType::CountedString, 0, 0, 0 },
+    { L"ProcessCommandLineLength", FieldType::UInt16, 0, 0, 0 },
+    { L"ProcessCommandLine", FieldType::CountedString, 0, 0, 2 },
+    { L"ProcessId", FieldType::UInt32, 0, 0, 0 },
+};
+
+template<typename T>
+static void append(std::vector<uint8_t>& data, T value)
+{
+    auto size = data.size();
+    data.resize(size + sizeof value);
+    std::memcpy(data.data() + size, &value, sizeof value);
+}
+
+static void appendCounted(std::vector<uint8_t>& data, const std::u16string& value)
+{
+    append<uint16_t>(data, static_cast<uint16_t>(value.size()));
+    for (auto unit : value) {
+        append<uint16_t>(data, unit);
+    }
+}
+
+static std::vector<uint8_t> memoryEvent()
+{
+    std::vector<uint8_t> data;
+    append<uint32_t>(data, 0x1a2c);
+    append<uint64_t>(data, 0x1f4a8c30000);
+    append<uint64_t>(data, 0x10000);
+    append<uint32_t>(data, 0x40);
+    append<uint32_t>(data, 0x80000000);
+    return data;
+}
+
+static std::vector<uint8_t> mitigationEvent()
+{
+    std::vector<uint8_t> data;
+    appendCounted(data, u"\\Device\\HarddiskVolume3\\Program Files\\Mozilla Firefox\\firefox.exe");
+    appendCounted(data, u"\"C:\\Program Files\\Mozilla Firefox\\firefox.exe\" -contentproc --channel=1234 -isForBrowser tab");
+    append<uint32_t>(data, 0x1a2c);
+    return data;
+}
+
+template<typename Function>
+static double measure(Function&& function)
+{
+    auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / EVENT_COUNT;
+}
+
+// Times the steps of decoding an event straight from its user data: finding the decoder of its schema, testing a
+// flag, and formatting its properties. Only kernel memory events are tested before being decoded.
+static void run(const wchar_t* name, const std::vector<FieldLayout>& layout, const std::vector<uint8_t>& data, bool tested)
+{
+    DecoderCache decoders;
+    auto acgFailure = decoders.addTest(L"AcgFlag", 0x80000000);
+    std::vector<SchemaKey> keys(SCHEMA_COUNT);
+    for (size_t i = 0; i < keys.size(); ++i) {
+        keys[i].provider[0] = static_cast<uint8_t>(i);
+        keys[i].eventId = static_cast<uint16_t>(i);
+        keys[i].pointerSize = 8;
+        decoders.find(keys[i], [&layout]() { return layout; });
+    }
+    auto decoder = decoders.find(keys[0], [&layout]() { return layout; });
+    if (!decoder) {
+        std::wcout << L"Cannot compile the layout." << std::endl;
+        return;
+    }
+
+    size_t count = 0;
+    auto find = measure([&]() {
+        for (size_t i = 0; i < EVENT_COUNT; ++i) {
+            count += decoders.find(keys[i % SCHEMA_COUNT], [&layout]() { return layout; }) != nullptr;
+        }
+    });
+    auto test = measure([&]() {
+        for (size_t i = 0; i < EVENT_COUNT; ++i) {
+            count += decoder->test(acgFailure, data.data(), data.size());
+        }
+    });
+    auto decode = measure([&]() {
+        for (size_t i = 0; i < EVENT_COUNT; ++i) {
+            std::vector<std::wstring> properties;
+            count += decoder->decode(data.data(), data.size(), properties);
+        }
+    });
+    auto all = measure([&]() {
+        for (size_t i = 0; i < EVENT_COUNT; ++i) {
+            auto found = decoders.find(keys[i % SCHEMA_COUNT], [&layout]() { return layout; });
+            if (!tested || found->test(acgFailure, data.data(), data.size())) {
+                std::vector<std::wstring> properties;
+                count += found->decode(data.data(), data.size(), properties);
+            }
+        }
+    });
+
+    // Keeps the decoding from being optimized away.
+    if (count == 0) {
+        std::wcout << L"Nothing decoded." << std::endl;
+    }
+    std::wcout << std::format(L"{}: {} bytes, find: {:.1f} ns, test: {:.1f} ns, decode: {:.1f} ns, all: {:.1f} ns per event.",
+        name, data.size(), find, test, decode, all) << std::endl;
+}
+
+int main()
+{
+    run(L"Kernel memory", MEMORY_LAYOUT, memoryEvent(), true);
+    run(L"Mitigation", MITIGATION_LAYOUT, mitigationEvent(), false);
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "data.h"
+
+// Stacks of this depth, in runs of frames sharing a module, as in the mitigation events of Firefox.
+#define STACK_DEPTH 60
+#define FRAMES_PER_MODULE 3
+#define STACK_COUNT 1000
+#define PASSES 5
+// Unloads and reloads of an image, each making a new version of the set.
+#define VERSION_COUNT 20000
+
+// Address lookup as it was before the range index: a scan of the image map, for every frame.
+static std::pair<void*, size_t> scanImageMap(const std::unordered_map<void*, ImageData>& imageMap, void* address)
+{
+    for (auto const& [imageBase, imageData] : imageMap) {
+        auto imageEnd = reinterpret_cast<void*>(reinterpret_cast<size_t>(imageBase) + imageData.size());
+        if (imageBase <= address && address < imageEnd) {
+            auto offset = reinterpret_cast<size_t>(address) - reinterpret_cast<size_t>(imageBase);
+            return std::make_pair(imageBase, offset);
+        }
+    }
+    return std::make_pair(nullptr, 0);
+}
+
+template<typename Lookup>
+static double measure(const std::vector<std::vector<void*>>& stacks, Lookup&& lookup)
+{
+    size_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; ++pass) {
+        for (const auto& stack : stacks) {
+            found += lookup(stack);
+        }
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // Keeps the lookups from being optimized away.
+    if (found == 0) {
+        std::wcout << L"No frame found." << std::endl;
+    }
+    return elapsed / (static_cast<double>(PASSES) * STACK_COUNT * STACK_DEPTH);
+}
+
+static void run(size_t moduleCount, std::mt19937_64& random)
+{
+    std::unordered_map<void*, ImageData> imageMap;
+    auto modules = ModuleSet::empty();
+    std::vector<ImageData> images;
+
+    uint64_t base = 0x7ff000000000;
+    std::uniform_int_distribution<uint64_t> sizes(0x10000, 0x400000);
+    for (size_t i = 0; i < moduleCount; ++i) {
+        auto size = sizes(random) & ~uint64_t{ 0xfff };
+        ImageData image{ reinterpret_cast<void*>(base), static_cast<size_t>(size), 0, std::format(L"\\image{}.dll", i) };
+        imageMap.emplace(image.base(), image);
+        modules = modules->withImage(image);
+        images.push_back(image);
+        base += size + 0x10000;
+    }
+
+    std::vector<std::vector<void*>> stacks(STACK_COUNT);
+    std::uniform_int_distribution<size_t> pick(0, moduleCount - 1);
+    for (auto& stack : stacks) {
+        while (stack.size() < STACK_DEPTH) {
+            const auto& image = images[pick(random)];
+            std::uniform_int_distribution<size_t> offsets(0, image.size() - 1);
+            for (int i = 0; i < FRAMES_PER_MODULE && stack.size() < STACK_DEPTH; ++i) {
+                stack.push_back(static_cast<char*>(image.base()) + offsets(random));
+            }
+        }
+    }
+
+    auto scan = measure(stacks, [&imageMap](const std::vector<void*>& stack) {
+        size_t found = 0;
+        for (auto address : stack) {
+            found += scanImageMap(imageMap, address).first != nullptr;
+        }
+        return found;
+    });
+
+    auto search = measure(stacks, [&modules](const std::vector<void*>& stack) {
+        size_t found = 0;
+        for (auto address : stack) {
+            size_t lastHit = SIZE_MAX;
+            found += modules->decompose(address, lastHit).first != nullptr;
+        }
+        return found;
+    });
+
+    auto lastHit = measure(stacks, [&modules](const std::vector<void*>& stack) {
+        size_t found = 0;
+        size_t lastHit = 0;
+        for (auto address : stack) {
+            found += modules->decompose(address, lastHit).first != nullptr;
+        }
+        return found;
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < VERSION_COUNT / 2; ++i) {
+        const auto& image = images[pick(random)];
+        modules = modules->withoutImage(image.base())->withImage(image);
+    }
+    auto version = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / VERSION_COUNT;
+
+    std::wcout << std::format(L"Modules: {}, map scan: {:.1f} ns, range index: {:.1f} ns, with last hit: {:.1f} ns per frame, "
+        L"new version: {:.1f} ns.", moduleCount, scan, search, lastHit, version) << std::endl;
+}
+
+// Compares the lookup of stack frames in the image map scanned before and in the sorted range index.
+int main()
+{
+    std::mt19937_64 random{ 1 };
+    for (size_t moduleCount : { 50, 500, 5000 }) {
+        run(moduleCount, random);
+    }
+    return 0;
+}
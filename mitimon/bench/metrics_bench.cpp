@@ -0,0 +1,146 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache.h"
+#include "data.h"
+#include "decoder.h"
+#include "metrics.h"
+#include "symbols.h"
+
+#define OPERATIONS_PER_THREAD 10000000
+#define EVENTS_PER_THREAD 20000
+#define MAX_THREADS 4
+// Mean stack depth of the synthetic workload of mitimon --benchmark.
+#define STACK_DEPTH 24
+
+// A mitigation event with its process path.
+static const std::vector<FieldLayout> MITIGATION_LAYOUT = {
+    { L"ProcessPathLength", FieldType::UInt16, 0, 0, 0 },
+    { L"ProcessPath", FieldType::CountedString, 0, 0, 0 },
+    { L"ProcessId", FieldType::UInt32, 0, 0, 0 },
+};
+
+static std::vector<uint8_t> mitigationEvent()
+{
+    std::u16string path = u"\\Device\\HarddiskVolume3\\Program Files\\Mozilla Firefox\\firefox.exe";
+    std::vector<uint8_t> data(sizeof(uint16_t) + path.size() * sizeof(char16_t) + sizeof(uint32_t));
+    auto length = static_cast<uint16_t>(path.size());
+    std::memcpy(data.data(), &length, sizeof length);
+    std::memcpy(data.data() + sizeof length, path.data(), path.size() * sizeof(char16_t));
+    return data;
+}
+
+// Nanoseconds per iteration of the loop, on each of the threads at the same time.
+template<typename Body>
+static double measure(int threadCount, uint64_t iterations, Body&& body)
+{
+    std::atomic<uint64_t> total{ 0 };
+    {
+        std::vector<std::jthread> threads;
+        for (int thread = 0; thread < threadCount; ++thread) {
+            threads.emplace_back([&total, &body, iterations]() {
+                auto start = std::chrono::steady_clock::now();
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    body(i);
+                    // Keeps the compiler from folding iterations, without any instruction.
+                    std::atomic_signal_fence(std::memory_order_seq_cst);
+                }
+                auto elapsed = std::chrono::steady_clock::now() - start;
+                total += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+            });
+        }
+    }
+    return static_cast<double>(total) / threadCount / iterations;
+}
+
+// Instruments an event as the pipeline does: clock reads at intake, at handling, after symbolication and after
+// writing, one latency per stage, and the events handled.
+static void instrument(uint64_t receivedAt)
+{
+    auto queuedAt = Metrics::now();
+    Metrics::record(LatencyStage::Queued, queuedAt - receivedAt);
+    auto symbolicatedAt = Metrics::now();
+    Metrics::record(LatencyStage::Symbolicated, symbolicatedAt - queuedAt);
+    Metrics::record(LatencyStage::Written, Metrics::now() - symbolicatedAt);
+    Metrics::add(MetricCounter::EventsHandled);
+}
+
+// An event whose frames are all in the frame cache: its properties are decoded and its frames formatted, without
+// the symbolication that usually dominates, so that the overhead is not understated.
+struct Event {
+    const EventDecoder& decoder;
+    std::vector<uint8_t> data;
+    ImageData image;
+    FrameInfo frame;
+};
+
+static bool handle(const Event& event)
+{
+    std::vector<std::wstring> properties;
+    bool decoded = event.decoder.decode(event.data.data(), event.data.size(), properties);
+    std::wstring stack;
+    for (size_t i = 0; i < STACK_DEPTH; ++i) {
+        auto offset = 0x1000 + i * 0x40;
+        stack += formatFrame(static_cast<char*>(event.image.base()) + offset, &event.image, offset, &event.frame);
+        stack += L"\n";
+    }
+    return decoded && !stack.empty();
+}
+
+static void run(int threadCount, const Event& event)
+{
+    auto noop = measure(threadCount, OPERATIONS_PER_THREAD, [](uint64_t) {});
+    auto add = measure(threadCount, OPERATIONS_PER_THREAD, [](uint64_t) { Metrics::add(MetricCounter::EventsHandled); });
+    auto record = measure(threadCount, OPERATIONS_PER_THREAD, [](uint64_t i) {
+        Metrics::record(LatencyStage::Symbolicated, (i * 7919) % 1000000);
+    });
+    auto now = measure(threadCount, OPERATIONS_PER_THREAD, [](uint64_t) { Metrics::now(); });
+
+    auto instrumentation = measure(threadCount, OPERATIONS_PER_THREAD / 10, [](uint64_t) { instrument(Metrics::now()); });
+
+    // Timed apart rather than as the difference of two event timings, which is lost in their noise.
+    std::atomic<uint64_t> decoded{ 0 };
+    auto plain = measure(threadCount, EVENTS_PER_THREAD, [&](uint64_t) {
+        decoded += handle(event);
+    });
+    if (decoded != static_cast<uint64_t>(threadCount) * EVENTS_PER_THREAD) {
+        std::wcout << L"Events not decoded." << std::endl;
+    }
+
+    std::wcout << std::format(L"Threads: {}, no-op: {:.1f} ns, add: {:.1f} ns, record: {:.1f} ns, now: {:.1f} ns.",
+        threadCount, noop, add, record, now) << std::endl;
+    std::wcout << std::format(L"Threads: {}, instrumentation: {:.1f} ns per event, event: {:.1f} ns, overhead: {:.2f}%.",
+        threadCount, instrumentation - noop, plain, 100.0 * (instrumentation - noop) / plain) << std::endl;
+}
+
+// Measures the cost of recording metrics against a no-op loop, and the overhead of instrumenting an event as the
+// pipeline does against an event handled without metrics.
+int main()
+{
+    auto decoder = EventDecoder::compile(MITIGATION_LAYOUT, {});
+    if (!decoder) {
+        std::wcout << L"Cannot compile the layout." << std::endl;
+        return 1;
+    }
+    Event event{ *decoder, mitigationEvent(),
+        ImageData{ reinterpret_cast<void*>(0x7ffa50800000), 0x100000, 0x5f0a1b2c, L"\\Device\\HarddiskVolume3\\app\\xul.dll" },
+        FrameInfo{ L"mozilla::dom::ContentParent::RecvCreateWindow(int, void*)", 0x24,
+            L"/builds/worker/checkouts/gecko/dom/ipc/ContentParent.cpp", 5120, 6, L"" } };
+    for (int threadCount : { 1, MAX_THREADS }) {
+        run(threadCount, event);
+    }
+
+    auto snapshot = Metrics::snapshot();
+    std::wcout << std::format(L"Recorded: {} symbolicated, {} events handled.",
+        snapshot.latencies[static_cast<size_t>(LatencyStage::Symbolicated)].count,
+        snapshot.counters[static_cast<size_t>(MetricCounter::EventsHandled)]) << std::endl;
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "ring.h"
+
+// Slots shaped like those of the ETW intake: a header, a full stack and some user data.
+#define RECORD_STACK_SIZE 192
+#define RECORD_USER_DATA_SIZE 2048
+#define RECORD_STACK_DEPTH 60
+#define RECORD_USER_DATA_LENGTH 200
+
+#define RING_CAPACITY 4096
+#define RECORDS_PER_PRODUCER 1000000
+
+struct Record {
+    uint64_t header[10];
+    uint16_t stackSize;
+    uint16_t userDataSize;
+    uint64_t stack[RECORD_STACK_SIZE];
+    uint8_t userData[RECORD_USER_DATA_SIZE];
+};
+
+// Dropping producers give up on a record when the ring is full, as the ETW callbacks do for the events of interest,
+// waiting ones wait for a slot, as they do for process events.
+static void run(int producerCount, bool wait)
+{
+    MpscRing<Record> ring{ RING_CAPACITY };
+    std::atomic<int> producersLeft{ producerCount };
+    uint64_t popped = 0;
+    uint64_t checksum = 0;
+
+    std::vector<uint64_t> stack(RECORD_STACK_DEPTH, 0x7ff012345678);
+    std::vector<uint8_t> userData(RECORD_USER_DATA_LENGTH, 0x5a);
+
+    auto start = std::chrono::steady_clock::now();
+    std::jthread consumer([&ring, &producersLeft, &popped, &checksum]() {
+        auto consume = [&popped, &checksum](const Record& record) {
+            ++popped;
+            checksum += record.stack[record.stackSize - 1] + record.userData[record.userDataSize - 1];
+        };
+        while (producersLeft.load(std::memory_order_relaxed) > 0) {
+            if (!ring.tryPop(consume)) {
+                std::this_thread::yield();
+            }
+        }
+        while (ring.tryPop(consume)) {
+        }
+    });
+    {
+        std::vector<std::jthread> producers;
+        for (int producer = 0; producer < producerCount; ++producer) {
+            producers.emplace_back([&ring, &producersLeft, &stack, &userData, wait]() {
+                auto fill = [&stack, &userData](Record& record) {
+                    record.stackSize = static_cast<uint16_t>(stack.size());
+                    record.userDataSize = static_cast<uint16_t>(userData.size());
+                    std::memcpy(record.stack, stack.data(), stack.size() * sizeof(uint64_t));
+                    std::memcpy(record.userData, userData.data(), userData.size());
+                };
+                for (int i = 0; i < RECORDS_PER_PRODUCER; ++i) {
+                    if (wait) {
+                        ring.pushWaiting(fill);
+                    }
+                    else {
+                        ring.tryPush(fill);
+                    }
+                }
+                --producersLeft;
+            });
+        }
+    }
+    consumer.join();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Keeps the copies from being optimized away.
+    if (checksum == 0) {
+        std::wcout << L"Nothing popped." << std::endl;
+    }
+
+    auto stats = ring.stats();
+    auto offered = static_cast<double>(producerCount) * RECORDS_PER_PRODUCER;
+    std::wcout << std::format(L"Producers: {} {}, offered: {:.1f} M/s, delivered: {:.1f} M/s, pushes rejected: {:.1f}%, high watermark: {}.",
+        producerCount, wait ? L"waiting" : L"dropping", offered / elapsed / 1e6, static_cast<double>(popped) / elapsed / 1e6,
+        100.0 * static_cast<double>(stats.dropped) / offered, stats.highWatermark) << std::endl;
+}
+
+// Measures how many events per second the intake ring takes from producers pushing as fast as they can, and how many
+// a consumer doing nothing else delivers.
+int main()
+{
+    for (bool wait : { false, true }) {
+        for (int producerCount : { 1, 2, 4, 8 }) {
+            run(producerCount, wait);
+        }
+    }
+    return 0;
+}
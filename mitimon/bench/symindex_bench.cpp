@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "cache.h"
+#include "pe.h"
+#include "symindex.h"
+
+// Symbols of a module the size of xul.dll: functions with a few lines and inlined calls each, and publics.
+#define FUNCTION_COUNT 300000
+#define LINES_PER_FUNCTION 8
+#define INLINES_PER_FUNCTION 2
+#define PUBLIC_COUNT 100000
+#define FUNCTION_SIZE 0x100
+
+#define OPEN_COUNT 1000
+#define LOOKUP_COUNT 1000000
+// Frames of one image in the events of a batch, looked up in increasing order.
+#define BATCH_SIZE 64
+
+template<typename Function>
+static double measure(Function&& function)
+{
+    auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Measures the time to build an index, to map it, and to look up offsets one at a time and in batches.
+int main()
+{
+    ImageIndexInfo indexInfo{ 0x5f0a1b2c, 0x9000000, L"bench.pdb", {}, 1 };
+    auto path = std::filesystem::temp_directory_path() / std::format("mitimon-bench-{:x}.symidx", std::random_device{}());
+
+    SymbolIndexWriter writer;
+    for (uint32_t i = 0; i < FUNCTION_COUNT; ++i) {
+        uint32_t rva = 0x1000 + i * FUNCTION_SIZE;
+        writer.addFunction(rva, FUNCTION_SIZE - 0x10, std::format("mozilla::namespace{}::Class{}::Method{}(int, void*)", i % 50, i % 5000, i));
+        for (uint32_t line = 0; line < LINES_PER_FUNCTION; ++line) {
+            writer.addLine(rva + line * 0x1c, 0x1c, 100 + line * 3, std::format("/builds/worker/checkouts/gecko/dom/file{}.cpp", i % 3000));
+        }
+        for (uint32_t inline_ = 0; inline_ < INLINES_PER_FUNCTION; ++inline_) {
+            writer.addInline(rva + 0x20 + inline_ * 0x10, 0x30, inline_, std::format("mozilla::Inlined{}", i % 2000 + inline_));
+        }
+    }
+    for (uint32_t i = 0; i < PUBLIC_COUNT; ++i) {
+        writer.addPublic(0x1000 + FUNCTION_COUNT * FUNCTION_SIZE + i * 0x40, std::format("public_{}", i));
+    }
+
+    std::vector<uint8_t> contents;
+    auto build = measure([&]() { contents = writer.finish(indexInfo); });
+    auto fileSize = contents.size();
+    SymbolIndex::save(path, std::move(contents));
+
+    size_t opened = 0;
+    auto open = measure([&]() {
+        for (int i = 0; i < OPEN_COUNT; ++i) {
+            opened += SymbolIndex::open(path, indexInfo) != nullptr;
+        }
+    });
+    auto index = SymbolIndex::open(path, indexInfo);
+    if (!index || opened != OPEN_COUNT) {
+        std::wcout << L"Cannot open the symbol index." << std::endl;
+        return 1;
+    }
+
+    std::mt19937_64 random{ 1 };
+    std::uniform_int_distribution<uint64_t> offsets(0x1000, 0x1000 + FUNCTION_COUNT * FUNCTION_SIZE + PUBLIC_COUNT * 0x40);
+    std::vector<uint64_t> lookups(LOOKUP_COUNT);
+    for (auto& offset : lookups) {
+        offset = offsets(random);
+    }
+
+    size_t named = 0;
+    auto point = measure([&]() {
+        for (auto offset : lookups) {
+            FrameInfo frame{};
+            index->lookup(offset, frame);
+            named += !frame.symbolName.empty();
+        }
+    });
+
+    for (size_t i = 0; i < lookups.size(); i += BATCH_SIZE) {
+        std::sort(lookups.begin() + i, lookups.begin() + std::min(i + BATCH_SIZE, lookups.size()));
+    }
+    auto batched = measure([&]() {
+        for (size_t i = 0; i < lookups.size(); i += BATCH_SIZE) {
+            SymbolIndex::Cursor cursor;
+            for (size_t j = i; j < std::min(i + BATCH_SIZE, lookups.size()); ++j) {
+                FrameInfo frame{};
+                index->lookup(lookups[j], frame, cursor);
+                named += !frame.symbolName.empty();
+            }
+        }
+    });
+
+    index.reset();
+    std::error_code error;
+    std::filesystem::remove(path, error);
+
+    // Keeps the lookups from being optimized away.
+    if (named == 0) {
+        std::wcout << L"No frame found." << std::endl;
+    }
+
+    std::wcout << std::format(L"Functions: {}, publics: {}, index: {:.1f} MB, built in {:.1f} ms.",
+        FUNCTION_COUNT, PUBLIC_COUNT, fileSize / 1e6, build / 1e6) << std::endl;
+    std::wcout << std::format(L"Open: {:.1f} us, lookup: {:.1f} ns, batched lookup: {:.1f} ns.",
+        open / OPEN_COUNT / 1e3, point / LOOKUP_COUNT, batched / LOOKUP_COUNT) << std::endl;
+    return 0;
+}
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include "winkrabs.h"
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "benchmark.h"
+#include "capture.h"
+#include "data.h"
+#include "output.h"
+#include "symbols.h"
+#include "synthetic.h"
+
+// Large enough for the frames of the default workload to stay cached.
+#define BENCHMARK_FRAME_CACHE_SIZE (64 * 1024 * 1024)
+
+// Latency samples of a stage, one per event, in nanoseconds.
+struct Stage {
+    const wchar_t* name;
+    std::vector<uint64_t> samples;
+};
+
+static void writePercentiles(Stage& stage, std::wostream& report)
+{
+    auto& samples = stage.samples;
+    if (samples.empty()) {
+        return;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double rank) {
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(rank * samples.size()))];
+    };
+    report << std::format(L"{:<15} p50 {:>8} ns, p90 {:>8} ns, p99 {:>8} ns, p99.9 {:>8} ns, max {:>8} ns.",
+        stage.name, percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999), samples.back()) << std::endl;
+}
+
+void runBenchmark(const SyntheticConfig& config, std::wostream& report)
+{
+    SyntheticWorkload workload{ config };
+    // The whole history is kept, at about 1.5 KB per version of a few hundred modules.
+    ModuleTimeline timeline{ UINT64_MAX };
+    auto kernelModules = ModuleSet::empty();
+
+    SyntheticBackend backend;
+    SymbolSession session{ backend, BENCHMARK_FRAME_CACHE_SIZE };
+
+    Stage registry{ L"Registry", {} };
+    Stage decomposition{ L"Decomposition", {} };
+    Stage symbolication{ L"Symbolication", {} };
+    Stage formatting{ L"Formatting", {} };
+    for (auto* stage : { &registry, &decomposition, &symbolication, &formatting }) {
+        stage->samples.reserve(config.events);
+    }
+
+    CaptureRecord record{};
+    std::string text;
+    uint64_t frameCount = 0;
+    size_t unknownFrames = 0;
+
+    // Events waiting to be symbolicated together, reused from one batch to the next.
+    struct Pending {
+        Event event;
+        std::vector<std::wstring> frames;
+    };
+    std::vector<Pending> batch(config.batch);
+    std::vector<StackRequest> requests;
+    size_t pendingCount = 0;
+
+    using Clock = std::chrono::steady_clock;
+    auto elapsed = [](Clock::time_point start, Clock::time_point end) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+    };
+
+    // Events of a batch are all given the mean symbolication time of the batch.
+    auto flush = [&]() {
+        auto begin = Clock::now();
+        if (config.batch == 1) {
+            auto& pending = batch[0];
+            pending.frames.clear();
+            Symbolicator symbolicator{ session, pending.event.modules };
+            for (auto address : pending.event.stackTrace) {
+                pending.frames.push_back(symbolicator.symbolicate(reinterpret_cast<void*>(address)));
+            }
+        }
+        else {
+            requests.clear();
+            for (size_t i = 0; i < pendingCount; ++i) {
+                auto& event = batch[i].event;
+                requests.push_back(StackRequest{ event.modules.get(), event.stackTrace.data(), event.stackTrace.size(), &batch[i].frames });
+            }
+            symbolicateBatch(session, requests);
+        }
+        auto symbolicationEnd = Clock::now();
+
+        for (size_t i = 0; i < pendingCount; ++i) {
+            symbolication.samples.push_back(elapsed(begin, symbolicationEnd) / pendingCount);
+
+            auto formattingStart = Clock::now();
+            text.clear();
+            formatText(text, batch[i].event, batch[i].frames);
+            formatting.samples.push_back(elapsed(formattingStart, Clock::now()));
+        }
+        pendingCount = 0;
+    };
+
+    auto start = Clock::now();
+    while (workload.next(record)) {
+        switch (record.type) {
+        case CaptureRecordType::KernelImage:
+            kernelModules = kernelModules->withImage(ImageData{ reinterpret_cast<void*>(record.imageBase),
+                static_cast<size_t>(record.imageSize), record.imageTimeStamp, record.imageName, record.indexInfo });
+            break;
+
+        case CaptureRecordType::ProcessStart:
+            timeline.addProcess(record.timestamp, record.pid, record.imageName, kernelModules);
+            break;
+
+        case CaptureRecordType::ImageLoad:
+            timeline.addImage(record.timestamp, record.pid, ImageData{ reinterpret_cast<void*>(record.imageBase),
+                static_cast<size_t>(record.imageSize), record.imageTimeStamp, record.imageName, record.indexInfo });
+            break;
+
+        case CaptureRecordType::Event:
+        {
+            auto begin = Clock::now();
+            auto modules = timeline.modules(record.pid, record.timestamp);
+            if (!modules) {
+                modules = kernelModules;
+            }
+            auto registryEnd = Clock::now();
+
+            size_t lastHit = 0;
+            for (auto address : record.stack) {
+                if (!modules->decompose(reinterpret_cast<void*>(address), lastHit).first) {
+                    ++unknownFrames;
+                }
+            }
+            auto decompositionEnd = Clock::now();
+
+            registry.samples.push_back(elapsed(begin, registryEnd));
+            decomposition.samples.push_back(elapsed(registryEnd, decompositionEnd));
+            frameCount += record.stack.size();
+
+            // Swap the buffers, so that the workload reuses the ones of an event already written.
+            auto& event = batch[pendingCount++].event;
+            event.timestamp = record.timestamp;
+            event.taskName = record.taskName;
+            event.eventId = record.eventId;
+            event.pid = record.pid;
+            event.tid = record.tid;
+            event.stackTrace.swap(record.stack);
+            event.properties.swap(record.properties);
+            event.modules = std::move(modules);
+            if (pendingCount == batch.size()) {
+                flush();
+            }
+            break;
+        }
+
+        default:
+            break;
+        }
+    }
+    if (pendingCount) {
+        flush();
+    }
+    auto seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto events = registry.samples.size();
+    report << std::format(L"Synthetic workload: {} processes, {} images, {} modules per process, {} functions per image, "
+        L"mean stack depth {}, {} events, symbolicated {}.", config.processes, config.images, config.modules, config.functions,
+        config.depth, events, config.batch == 1 ? std::wstring{ L"one address at a time" } : std::format(L"in batches of {}", config.batch)) << std::endl;
+    report << std::format(L"Throughput: {:.0f} events/s, {:.0f} frames/s, {:.3f} s in total.",
+        events / seconds, frameCount / seconds, seconds) << std::endl;
+    report << std::format(L"Frames outside of any image: {} of {}.", unknownFrames, frameCount) << std::endl;
+    for (auto* stage : { &registry, &decomposition, &symbolication, &formatting }) {
+        writePercentiles(*stage, report);
+    }
+
+    auto cacheStats = session.cacheStats();
+    report << std::format(L"Frame cache hits: {}, misses: {}, evictions: {}, entries: {}, bytes: {}.",
+        cacheStats.hits, cacheStats.misses, cacheStats.evictions, cacheStats.entries, cacheStats.bytes) << std::endl;
+    report << std::format(L"Peak resident memory: {} MB.", peakResidentBytes() / (1024 * 1024)) << std::endl;
+}
+
+uint64_t peakResidentBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (!::GetProcessMemoryInfo(::GetCurrentProcess(), &counters, sizeof counters)) {
+        return 0;
+    }
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage{};
+    if (::getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#else
+    // Linux reports kilobytes.
+    return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
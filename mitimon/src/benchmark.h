@@ -0,0 +1,18 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <cstdint>
+#include <ostream>
+
+#include "synthetic.h"
+
+// Runs the platform-neutral stages of the pipeline on a synthetic workload, one event at a time on the calling thread:
+// module snapshot lookups in the process registry, address decomposition, symbolication through the frame cache
+// against a backend making up symbol names, and output formatting. Writes the throughput, the latency percentiles
+// of each stage and the peak memory use to the report.
+void runBenchmark(const SyntheticConfig& config, std::wostream& report);
+
+// Peak resident memory of the current process, in bytes, 0 if unknown.
+uint64_t peakResidentBytes();
+
+#endif // BENCHMARK_H
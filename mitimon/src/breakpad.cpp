@@ -0,0 +1,409 @@
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "breakpad.h"
+#include "cache.h"
+#include "data.h"
+#include "mapping.h"
+#include "pe.h"
+#include "symindex.h"
+#include "text.h"
+
+// Smaller files are not worth splitting across threads.
+#define MIN_PARSE_RANGE_SIZE (4 * 1024 * 1024)
+
+// Splits off the next space separated token.
+static std::string_view token(std::string_view& rest)
+{
+    auto end = rest.find(' ');
+    auto result = rest.substr(0, end);
+    rest = end == std::string_view::npos ? std::string_view{} : rest.substr(end + 1);
+    return result;
+}
+
+template<typename T>
+static bool number(std::string_view& rest, T& value, int base)
+{
+    auto text = token(rest);
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, base);
+    return error == std::errc{} && end == text.data() + text.size() && !text.empty();
+}
+
+// FUNC and PUBLIC records have an optional flag for code shared by several functions.
+static void skipMultiple(std::string_view& rest)
+{
+    if (rest.starts_with("m ")) {
+        rest.remove_prefix(2);
+    }
+}
+
+// Returns the record whose range covers the offset, the records must be sorted by address.
+template<typename T>
+static const T* findCovering(const std::vector<T>& records, uint64_t offset)
+{
+    auto it = std::upper_bound(records.begin(), records.end(), offset,
+        [](uint64_t offset, const T& record) { return offset < record.address; });
+    if (it == records.begin()) {
+        return nullptr;
+    }
+    --it;
+    return offset - it->address < it->size ? &*it : nullptr;
+}
+
+template<typename T>
+static void sortByAddress(std::vector<T>& records)
+{
+    auto byAddress = [](const T& left, const T& right) { return left.address < right.address; };
+
+    // Records usually come out of dump_syms already sorted.
+    if (!std::is_sorted(records.begin(), records.end(), byAddress)) {
+        std::sort(records.begin(), records.end(), byAddress);
+    }
+}
+
+BreakpadModule::BreakpadModule(const std::filesystem::path& path, size_t threadCount) :
+    mFile{ path },
+    mDebugId{},
+    mFunctions{},
+    mLines{},
+    mPublics{},
+    mInlines{},
+    mFiles{},
+    mOrigins{}
+{
+    std::string_view text{ reinterpret_cast<const char*>(mFile.data()), mFile.size() };
+
+    // MODULE <os> <arch> <debug id> <name>
+    auto header = text.substr(0, text.find('\n'));
+    if (token(header) != "MODULE") {
+        throw std::runtime_error("Not a Breakpad symbol file.");
+    }
+    token(header);
+    token(header);
+    mDebugId = token(header);
+
+    size_t rangeCount = std::clamp<size_t>(text.size() / MIN_PARSE_RANGE_SIZE, 1, std::max<size_t>(threadCount, 1));
+
+    // Ranges start right after a line break, so that each one is made of whole lines.
+    std::vector<size_t> bounds{ 0 };
+    for (size_t i = 1; i < rangeCount; ++i) {
+        auto bound = text.find('\n', std::max(bounds.back(), text.size() / rangeCount * i));
+        if (bound == std::string_view::npos) {
+            break;
+        }
+        bounds.push_back(bound + 1);
+    }
+    bounds.push_back(text.size());
+
+    std::vector<Records> parts(bounds.size() - 1);
+    {
+        std::vector<std::jthread> threads;
+        for (size_t i = 1; i < parts.size(); ++i) {
+            threads.emplace_back(&BreakpadModule::parse, text.substr(bounds[i], bounds[i + 1] - bounds[i]), std::ref(parts[i]));
+        }
+        parse(text.substr(0, bounds[1]), parts[0]);
+    }
+
+    auto concatenate = [&parts](auto member) {
+        std::remove_reference_t<decltype(parts[0].*member)> result;
+
+        size_t count = 0;
+        for (auto& part : parts) {
+            count += (part.*member).size();
+        }
+        result.reserve(count);
+
+        for (auto& part : parts) {
+            result.insert(result.end(), (part.*member).begin(), (part.*member).end());
+            (part.*member) = {};
+        }
+        return result;
+    };
+
+    mFunctions = concatenate(&Records::functions);
+    mLines = concatenate(&Records::lines);
+    mPublics = concatenate(&Records::publics);
+    mInlines = concatenate(&Records::inlines);
+
+    sortByAddress(mFunctions);
+    sortByAddress(mLines);
+    sortByAddress(mPublics);
+    sortByAddress(mInlines);
+
+    auto files = concatenate(&Records::files);
+    mFiles = index(files);
+    auto origins = concatenate(&Records::origins);
+    mOrigins = index(origins);
+}
+
+void BreakpadModule::parse(std::string_view text, Records& records)
+{
+    while (!text.empty()) {
+        auto end = text.find('\n');
+        auto line = text.substr(0, end);
+        text = end == std::string_view::npos ? std::string_view{} : text.substr(end + 1);
+
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        // <address> <size> <line> <file number>, for the function before it.
+        if ((line[0] >= '0' && line[0] <= '9') || (line[0] >= 'a' && line[0] <= 'f')) {
+            Line record{};
+            if (number(line, record.address, 16) && number(line, record.size, 16) &&
+                number(line, record.lineNumber, 10) && number(line, record.file, 10)) {
+                records.lines.push_back(record);
+            }
+            continue;
+        }
+
+        auto keyword = token(line);
+
+        if (keyword == "FUNC") {
+            // FUNC [m] <address> <size> <parameter size> <name>
+            skipMultiple(line);
+            Function record{};
+            uint64_t parameterSize;
+            if (number(line, record.address, 16) && number(line, record.size, 16) && number(line, parameterSize, 16)) {
+                record.name = line;
+                records.functions.push_back(record);
+            }
+        }
+        else if (keyword == "PUBLIC") {
+            // PUBLIC [m] <address> <parameter size> <name>
+            skipMultiple(line);
+            Public record{};
+            uint64_t parameterSize;
+            if (number(line, record.address, 16) && number(line, parameterSize, 16)) {
+                record.name = line;
+                records.publics.push_back(record);
+            }
+        }
+        else if (keyword == "INLINE") {
+            // INLINE <depth> <call line> <call file number> <origin number> [<address> <size>]+
+            Inline record{};
+            uint32_t callLine, callFile;
+            if (!number(line, record.depth, 10) || !number(line, callLine, 10) ||
+                !number(line, callFile, 10) || !number(line, record.origin, 10)) {
+                continue;
+            }
+            while (number(line, record.address, 16) && number(line, record.size, 16)) {
+                records.inlines.push_back(record);
+            }
+        }
+        else if (keyword == "FILE" || keyword == "INLINE_ORIGIN") {
+            // FILE <number> <name>, INLINE_ORIGIN <number> <name>
+            Numbered record{};
+            if (number(line, record.id, 10)) {
+                record.name = line;
+                (keyword == "FILE" ? records.files : records.origins).push_back(record);
+            }
+        }
+    }
+}
+
+std::vector<std::string_view> BreakpadModule::index(std::vector<Numbered>& numbered)
+{
+    std::vector<std::string_view> result;
+    for (const auto& record : numbered) {
+        if (record.id >= result.size()) {
+            result.resize(size_t(record.id) + 1);
+        }
+        result[record.id] = record.name;
+    }
+    return result;
+}
+
+void BreakpadModule::lookup(uint64_t offset, FrameInfo& frame) const
+{
+    auto function = findCovering(mFunctions, offset);
+    if (!function) {
+        auto it = std::upper_bound(mPublics.begin(), mPublics.end(), offset,
+            [](uint64_t offset, const Public& record) { return offset < record.address; });
+        if (it != mPublics.begin()) {
+            --it;
+            frame.symbolName = fromUtf8(it->name.data(), it->name.size());
+            frame.displacement = offset - it->address;
+        }
+        return;
+    }
+
+    frame.symbolName = fromUtf8(function->name.data(), function->name.size());
+    frame.displacement = offset - function->address;
+
+    // With inlining, line records give the location in the innermost inlined function.
+    if (auto line = findCovering(mLines, offset)) {
+        if (line->file < mFiles.size()) {
+            frame.fileName = fromUtf8(mFiles[line->file].data(), mFiles[line->file].size());
+        }
+        frame.lineNumber = line->lineNumber;
+        frame.lineDisplacement = static_cast<uint32_t>(offset - line->address);
+    }
+
+    // Inlined ranges nest, so all the ranges starting within the function are candidates.
+    const Inline* innermost = nullptr;
+    auto it = std::upper_bound(mInlines.begin(), mInlines.end(), offset,
+        [](uint64_t offset, const Inline& record) { return offset < record.address; });
+    while (it != mInlines.begin()) {
+        --it;
+        if (it->address < function->address) {
+            break;
+        }
+        if (offset - it->address < it->size && (!innermost || it->depth > innermost->depth)) {
+            innermost = &*it;
+        }
+    }
+    if (innermost && innermost->origin < mOrigins.size()) {
+        frame.inlineName = fromUtf8(mOrigins[innermost->origin].data(), mOrigins[innermost->origin].size());
+    }
+}
+
+void BreakpadModule::addTo(SymbolIndexWriter& writer) const
+{
+    for (const auto& function : mFunctions) {
+        writer.addFunction(static_cast<uint32_t>(function.address), static_cast<uint32_t>(function.size), function.name);
+    }
+    for (const auto& public_ : mPublics) {
+        writer.addPublic(static_cast<uint32_t>(public_.address), public_.name);
+    }
+    for (const auto& line : mLines) {
+        writer.addLine(static_cast<uint32_t>(line.address), static_cast<uint32_t>(line.size), line.lineNumber,
+            line.file < mFiles.size() ? mFiles[line.file] : std::string_view{});
+    }
+    for (const auto& inline_ : mInlines) {
+        if (inline_.origin < mOrigins.size()) {
+            writer.addInline(static_cast<uint32_t>(inline_.address), static_cast<uint32_t>(inline_.size), inline_.depth, mOrigins[inline_.origin]);
+        }
+    }
+}
+
+std::filesystem::path breakpadSymbolPath(const ImageIndexInfo& indexInfo)
+{
+    std::filesystem::path symFile{ indexInfo.pdbFile };
+    symFile.replace_extension(L".sym");
+    return std::filesystem::path{ indexInfo.pdbFile } / pdbDebugId(indexInfo) / symFile;
+}
+
+const ImageIndexInfo* BreakpadBackend::indexInfo(const ImageData& imageData)
+{
+    if (auto indexInfo = imageData.indexInfo()) {
+        return indexInfo;
+    }
+    // The cache keeps what it read for good.
+    return mIndexCache.get(imageData.path()).get();
+}
+
+void BreakpadBackend::symbolicate(const ImageData& imageData, size_t offset, FrameInfo& frame)
+{
+    auto indexInfo = this->indexInfo(imageData);
+    if (!indexInfo) {
+        return;
+    }
+
+    if (auto module_ = module(*indexInfo)) {
+        module_->lookup(offset, frame);
+    }
+}
+
+void BreakpadBackend::symbolicateBatch(const ImageData& imageData, const std::vector<size_t>& offsets, std::vector<FrameInfo>& frames)
+{
+    frames.resize(offsets.size());
+    auto indexInfo = this->indexInfo(imageData);
+    if (!indexInfo) {
+        return;
+    }
+
+    if (auto module_ = module(*indexInfo)) {
+        SymbolIndex::Cursor cursor;
+        for (size_t i = 0; i < offsets.size(); ++i) {
+            module_->lookup(offsets[i], frames[i], cursor);
+        }
+    }
+}
+
+void BreakpadBackend::prefetch(const ImageData& imageData)
+{
+    if (auto indexInfo = this->indexInfo(imageData)) {
+        module(*indexInfo);
+    }
+}
+
+std::shared_ptr<const SymbolIndex> BreakpadBackend::module(const ImageIndexInfo& indexInfo)
+{
+    auto key = symbolIndexPath(indexInfo).wstring();
+
+    std::promise<std::shared_ptr<const SymbolIndex>> promise;
+    std::shared_future<std::shared_ptr<const SymbolIndex>> future;
+    bool isLoader = false;
+    {
+        std::lock_guard guard(mMutex);
+
+        auto it = mModules.find(key);
+        if (it == mModules.end()) {
+            future = promise.get_future().share();
+            mModules.emplace(key, future);
+            isLoader = true;
+        }
+        else {
+            future = it->second;
+        }
+    }
+
+    if (!isLoader) {
+        return future.get();
+    }
+
+    auto result = load(indexInfo);
+    promise.set_value(result);
+    return result;
+}
+
+std::shared_ptr<const SymbolIndex> BreakpadBackend::load(const ImageIndexInfo& indexInfo)
+{
+    auto indexPath = mStoreDir / symbolIndexPath(indexInfo);
+    if (auto index = SymbolIndex::open(indexPath, indexInfo)) {
+        return index;
+    }
+
+    auto relativePath = breakpadSymbolPath(indexInfo);
+    auto path = mStoreDir / relativePath;
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error) && !(mDownloader && mDownloader->fetch(relativePath))) {
+        return nullptr;
+    }
+
+    std::wcout << L"Converting symbols file " << relativePath.wstring() << L"..." << std::endl;
+
+    try {
+        BreakpadModule module_{ path, mParseThreads };
+        auto debugId = module_.debugId();
+        if (std::wstring{ debugId.begin(), debugId.end() } != pdbDebugId(indexInfo)) {
+            std::wcout << L"Ignoring symbols file " << relativePath.wstring() << L" with a mismatched debug id." << std::endl;
+            return nullptr;
+        }
+
+        SymbolIndexWriter writer;
+        module_.addTo(writer);
+        return SymbolIndex::save(indexPath, writer.finish(indexInfo));
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+    return nullptr;
+}
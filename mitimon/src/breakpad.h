@@ -0,0 +1,161 @@
+#ifndef BREAKPAD_H
+#define BREAKPAD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.h"
+#include "data.h"
+#include "download.h"
+#include "mapping.h"
+#include "pe.h"
+#include "symbols.h"
+#include "symindex.h"
+
+// Symbols of one module, parsed from a Breakpad symbol file into arrays sorted by address.
+// Names are views into the mapped file, which stays mapped for as long as the module lives.
+class BreakpadModule {
+public:
+    // The file is split into ranges of lines parsed by separate threads, records do not depend on
+    // the lines before them. Throws std::runtime_error if the file cannot be mapped or is not a symbol file.
+    BreakpadModule(const std::filesystem::path& path, size_t threadCount);
+
+    BreakpadModule(BreakpadModule&) = delete;
+    BreakpadModule& operator=(const BreakpadModule&) = delete;
+
+    BreakpadModule(BreakpadModule&&) = delete;
+    BreakpadModule& operator=(BreakpadModule&&) = delete;
+
+    // Debug id from the MODULE record, the PDB GUID and age in hexadecimal.
+    std::string_view debugId() const { return mDebugId; }
+
+    // Fills in the frame from the FUNC record covering the offset, or else from the closest PUBLIC record before it.
+    void lookup(uint64_t offset, FrameInfo& frame) const;
+
+    // Adds all the records to a symbol index.
+    void addTo(SymbolIndexWriter& writer) const;
+
+    struct Stats {
+        size_t functions;
+        size_t lines;
+        size_t publics;
+        size_t inlines;
+    };
+
+    Stats stats() const { return Stats{ mFunctions.size(), mLines.size(), mPublics.size(), mInlines.size() }; }
+
+private:
+    struct Function {
+        uint64_t address;
+        uint64_t size;
+        std::string_view name;
+    };
+
+    struct Line {
+        uint64_t address;
+        uint64_t size;
+        uint32_t lineNumber;
+        uint32_t file;
+    };
+
+    struct Public {
+        uint64_t address;
+        std::string_view name;
+    };
+
+    // One address range of an inlined call, a call inlined in several ranges has one record per range.
+    struct Inline {
+        uint64_t address;
+        uint64_t size;
+        uint32_t depth;
+        uint32_t origin;
+    };
+
+    // FILE and INLINE_ORIGIN records.
+    struct Numbered {
+        uint32_t id;
+        std::string_view name;
+    };
+
+    struct Records {
+        std::vector<Function> functions;
+        std::vector<Line> lines;
+        std::vector<Public> publics;
+        std::vector<Inline> inlines;
+        std::vector<Numbered> files;
+        std::vector<Numbered> origins;
+    };
+
+    static void parse(std::string_view text, Records& records);
+
+    static std::vector<std::string_view> index(std::vector<Numbered>& numbered);
+
+private:
+    MappedFile mFile;
+    std::string_view mDebugId;
+
+    std::vector<Function> mFunctions;
+    std::vector<Line> mLines;
+    std::vector<Public> mPublics;
+    std::vector<Inline> mInlines;
+
+    // Indexed by file and origin numbers.
+    std::vector<std::string_view> mFiles;
+    std::vector<std::string_view> mOrigins;
+};
+
+// Location of the symbol file of an image in a symbol store, laid out the way symbol servers do:
+// <pdb file>/<debug id>/<pdb file without .pdb>.sym
+std::filesystem::path breakpadSymbolPath(const ImageIndexInfo& indexInfo);
+
+// Backend reading Breakpad symbol files from a local symbol store, which does not need DbgHelp.
+// Symbol files are converted to symbol indexes stored next to them the first time they are used.
+class BreakpadBackend : public SymbolBackend {
+public:
+    // With a downloader, symbol files missing from the store are downloaded into it.
+    BreakpadBackend(const std::filesystem::path& storeDir, size_t parseThreads, SymbolDownloader* downloader = nullptr) :
+        mStoreDir{ storeDir },
+        mParseThreads{ parseThreads },
+        mDownloader{ downloader },
+        mMutex{},
+        mModules{},
+        mIndexCache{}
+    {
+    }
+
+    void symbolicate(const ImageData& imageData, size_t offset, FrameInfo& frame) override;
+
+    void symbolicateBatch(const ImageData& imageData, const std::vector<size_t>& offsets, std::vector<FrameInfo>& frames) override;
+
+    void prefetch(const ImageData& imageData) override;
+
+    // Returns the symbol index for a PDB identity, or nullptr if the store has no usable symbol file for it.
+    // Each module is only loaded once, concurrent callers wait for the first one to be done.
+    std::shared_ptr<const SymbolIndex> module(const ImageIndexInfo& indexInfo);
+
+private:
+    std::filesystem::path mStoreDir;
+    size_t mParseThreads;
+    SymbolDownloader* mDownloader;
+
+    std::mutex mMutex;
+    std::unordered_map<std::wstring, std::shared_future<std::shared_ptr<const SymbolIndex>>> mModules;
+
+    std::shared_ptr<const SymbolIndex> load(const ImageIndexInfo& indexInfo);
+
+    // The PDB identity recorded with the image, as its file may have changed since or be on another machine.
+    // Images recorded without one are read from their path, or nullptr if that fails.
+    const ImageIndexInfo* indexInfo(const ImageData& imageData);
+
+    ImageIndexCache mIndexCache;
+};
+
+#endif // BREAKPAD_H
@@ -0,0 +1,88 @@
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "cache.h"
+
+FrameCache::FrameCache(size_t maxBytes) :
+    mMaxShardBytes{ maxBytes / shardCount },
+    mShards{},
+    mHits{ 0 },
+    mMisses{ 0 },
+    mEvictions{ 0 }
+{
+}
+
+std::shared_ptr<const FrameInfo> FrameCache::find(uint32_t imageId, uint64_t offset)
+{
+    Key key{ imageId, offset };
+    auto& shard_ = shard(key);
+
+    std::lock_guard guard(shard_.mutex);
+
+    auto it = shard_.index.find(key);
+    if (it == shard_.index.end()) {
+        ++mMisses;
+        return nullptr;
+    }
+
+    // Move the entry to the front of the recency list.
+    shard_.entries.splice(shard_.entries.begin(), shard_.entries, it->second);
+    ++mHits;
+    return it->second->frame;
+}
+
+void FrameCache::insert(uint32_t imageId, uint64_t offset, std::shared_ptr<const FrameInfo> frame)
+{
+    Key key{ imageId, offset };
+    auto& shard_ = shard(key);
+    auto bytes = footprint(*frame);
+
+    std::lock_guard guard(shard_.mutex);
+
+    auto it = shard_.index.find(key);
+    if (it != shard_.index.end()) {
+        shard_.bytes -= it->second->bytes;
+        shard_.entries.erase(it->second);
+        shard_.index.erase(it);
+    }
+
+    shard_.entries.emplace_front(Entry{ key, std::move(frame), bytes });
+    shard_.index.emplace(key, shard_.entries.begin());
+    shard_.bytes += bytes;
+
+    while (shard_.bytes > mMaxShardBytes && shard_.entries.size() > 1) {
+        auto& last = shard_.entries.back();
+        shard_.bytes -= last.bytes;
+        shard_.index.erase(last.key);
+        shard_.entries.pop_back();
+        ++mEvictions;
+    }
+}
+
+FrameCache::Stats FrameCache::stats() const
+{
+    Stats result{ mHits.load(), mMisses.load(), mEvictions.load(), 0, 0 };
+    for (auto& shard_ : mShards) {
+        std::lock_guard guard(shard_.mutex);
+        result.entries += shard_.entries.size();
+        result.bytes += shard_.bytes;
+    }
+    return result;
+}
+
+FrameCache::Shard& FrameCache::shard(const Key& key)
+{
+    return mShards[mix(key) >> (64 - shardBits)];
+}
+
+size_t FrameCache::footprint(const FrameInfo& frame)
+{
+    // Approximation of the list node, index node and shared allocation overheads.
+    constexpr size_t overhead = sizeof(Entry) + sizeof(FrameInfo) + 8 * sizeof(void*);
+    return overhead + (frame.symbolName.capacity() + frame.fileName.capacity() + frame.inlineName.capacity()) * sizeof(wchar_t);
+}
@@ -0,0 +1,105 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Symbol and line information for an offset in an image.
+// An empty symbol name means that the offset could not be symbolicated.
+struct FrameInfo {
+    std::wstring symbolName;
+    uint64_t displacement;
+    std::wstring fileName;
+    uint32_t lineNumber;
+    uint32_t lineDisplacement;
+    // Innermost function inlined at the offset, only known to some backends.
+    std::wstring inlineName;
+};
+
+// Cache of symbolicated frames shared by all events, keyed by image identity and offset,
+// so that it also applies to processes loading the same image at different addresses.
+// Least recently used entries are evicted once the memory cap is reached.
+class FrameCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        uint64_t entries;
+        uint64_t bytes;
+    };
+
+    FrameCache(size_t maxBytes);
+
+    FrameCache(FrameCache&) = delete;
+    FrameCache& operator=(const FrameCache&) = delete;
+
+    FrameCache(FrameCache&&) = delete;
+    FrameCache& operator=(FrameCache&&) = delete;
+
+    std::shared_ptr<const FrameInfo> find(uint32_t imageId, uint64_t offset);
+
+    void insert(uint32_t imageId, uint64_t offset, std::shared_ptr<const FrameInfo> frame);
+
+    Stats stats() const;
+
+private:
+    struct Key {
+        uint32_t imageId;
+        uint64_t offset;
+
+        bool operator==(const Key&) const = default;
+    };
+
+    // Multiplicative hash, whose top bits pick the shard. The buckets of the shard index use the low bits instead,
+    // folded with the middle ones, so that the keys of a shard still spread across all its buckets.
+    static uint64_t mix(const Key& key)
+    {
+        return (key.offset ^ (uint64_t{ key.imageId } << 32)) * 0x9e3779b97f4a7c15;
+    }
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const
+        {
+            auto mixed = mix(key);
+            return static_cast<size_t>(mixed ^ (mixed >> 32));
+        }
+    };
+
+    struct Entry {
+        Key key;
+        std::shared_ptr<const FrameInfo> frame;
+        size_t bytes;
+    };
+
+    // Entries are spread across shards to limit contention between workers.
+    struct Shard {
+        mutable std::mutex mutex;
+        std::list<Entry> entries;
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        size_t bytes = 0;
+    };
+
+    static constexpr unsigned shardBits = 4;
+    static constexpr size_t shardCount = size_t{ 1 } << shardBits;
+
+    Shard& shard(const Key& key);
+
+    static size_t footprint(const FrameInfo& frame);
+
+private:
+    size_t mMaxShardBytes;
+    Shard mShards[shardCount];
+
+    std::atomic<uint64_t> mHits;
+    std::atomic<uint64_t> mMisses;
+    std::atomic<uint64_t> mEvictions;
+};
+
+#endif // CACHE_H
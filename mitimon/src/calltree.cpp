@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "calltree.h"
+#include "data.h"
+
+CallTree::CallTree(size_t maxNodes) :
+    mMutex{},
+    mMaxNodes{ maxNodes },
+    mNodes{},
+    mCategories{},
+    mLabels{},
+    mImages{},
+    mTruncated{ 0 }
+{
+    // Index 0 is reserved so that it can mean "no node", and label 0 "no label".
+    mNodes.emplace_back(Node{});
+    mLabels.emplace_back();
+}
+
+void CallTree::insert(const std::wstring& taskName, int eventId, const ModuleSet& modules, const std::vector<uint64_t>& stack)
+{
+    std::lock_guard guard(mMutex);
+
+    auto node = root(taskName, eventId);
+    mNodes[node].hits++;
+
+    size_t lastHit = 0;
+    for (auto it = stack.rbegin(); it != stack.rend(); ++it) {
+        uint32_t imageId = 0;
+        uint64_t offset = *it;
+
+        auto [image, imageOffset] = modules.decompose(reinterpret_cast<void*>(*it), lastHit);
+        if (image) {
+            imageId = image->id();
+            offset = imageOffset;
+            mImages.emplace(imageId, *image);
+        }
+
+        auto next = child(node, imageId, offset);
+        if (next == noNode) {
+            mTruncated++;
+            break;
+        }
+        node = next;
+        mNodes[node].hits++;
+    }
+
+    mNodes[node].ends++;
+}
+
+void CallTree::write(const Labeler& labeler, std::wostream& report, std::wostream& folded)
+{
+    // Copy the tree so that labeling, which may need to download symbols, happens without blocking insertions.
+    std::vector<Node> nodes;
+    std::vector<Category> categories;
+    std::unordered_map<uint32_t, ImageData> images;
+    uint64_t truncated;
+    {
+        std::lock_guard guard(mMutex);
+        nodes = mNodes;
+        categories = mCategories;
+        images = mImages;
+        truncated = mTruncated;
+    }
+
+    std::vector<std::pair<uint32_t, std::wstring>> newLabels;
+    for (uint32_t i = 1; i < nodes.size(); ++i) {
+        auto& node = nodes[i];
+        if (node.label != noLabel || (node.imageId == 0 && node.offset == 0)) {
+            continue;
+        }
+        auto image = images.find(node.imageId);
+        auto label = labeler(image == images.end() ? nullptr : &image->second, node.offset);
+        newLabels.emplace_back(i, std::move(label));
+    }
+
+    std::vector<std::wstring> labels;
+    {
+        std::lock_guard guard(mMutex);
+        for (auto& [index, label] : newLabels) {
+            mNodes[index].label = static_cast<uint32_t>(mLabels.size());
+            nodes[index].label = mNodes[index].label;
+            mLabels.emplace_back(std::move(label));
+        }
+        labels = mLabels;
+    }
+
+    for (const auto& category : categories) {
+        report << std::endl << std::endl;
+        report << L"TaskName " << category.taskName << std::endl;
+        report << L"EventId " << category.eventId << std::endl;
+        report << L"Count " << nodes[category.root].hits << std::endl;
+
+        // Collect the unique stacks of this category, most frequent first.
+        std::vector<std::pair<uint64_t, std::vector<uint32_t>>> stacks;
+        std::vector<std::pair<uint32_t, size_t>> pending{ { category.root, 0 } };
+        std::vector<uint32_t> path;
+        while (!pending.empty()) {
+            auto [index, depth] = pending.back();
+            pending.pop_back();
+
+            path.resize(depth);
+            if (index != category.root) {
+                path.push_back(index);
+            }
+            if (nodes[index].ends) {
+                stacks.emplace_back(nodes[index].ends, path);
+            }
+            for (auto next = nodes[index].firstChild; next != noNode; next = nodes[next].nextSibling) {
+                pending.emplace_back(next, path.size());
+            }
+        }
+        std::stable_sort(stacks.begin(), stacks.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+        for (const auto& [count, frames] : stacks) {
+            report << std::endl;
+            report << L"Call Stack (" << count << L" hits):" << std::endl;
+            for (auto it = frames.rbegin(); it != frames.rend(); ++it) {
+                report << L"   " << labels[nodes[*it].label] << std::endl;
+            }
+
+            folded << category.taskName << L"/" << category.eventId;
+            for (auto index : frames) {
+                auto label = labels[nodes[index].label];
+                std::replace(label.begin(), label.end(), L';', L':');
+                std::replace(label.begin(), label.end(), L' ', L'_');
+                folded << L";" << label;
+            }
+            folded << L" " << count << std::endl;
+        }
+    }
+
+    if (truncated) {
+        report << std::endl << L"Truncated stacks " << truncated << std::endl;
+    }
+}
+
+uint32_t CallTree::root(const std::wstring& taskName, int eventId)
+{
+    for (const auto& category : mCategories) {
+        if (category.eventId == eventId && category.taskName == taskName) {
+            return category.root;
+        }
+    }
+
+    auto index = static_cast<uint32_t>(mNodes.size());
+    mNodes.emplace_back(Node{});
+    mCategories.emplace_back(Category{ taskName, eventId, index });
+    return index;
+}
+
+uint32_t CallTree::child(uint32_t parent, uint32_t imageId, uint64_t offset)
+{
+    for (auto index = mNodes[parent].firstChild; index != noNode; index = mNodes[index].nextSibling) {
+        if (mNodes[index].imageId == imageId && mNodes[index].offset == offset) {
+            return index;
+        }
+    }
+
+    if (mNodes.size() >= mMaxNodes) {
+        return noNode;
+    }
+
+    auto index = static_cast<uint32_t>(mNodes.size());
+    mNodes.emplace_back(Node{ offset, 0, 0, imageId, noNode, mNodes[parent].firstChild, noLabel });
+    mNodes[parent].firstChild = index;
+    return index;
+}
@@ -0,0 +1,76 @@
+#ifndef CALLTREE_H
+#define CALLTREE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "data.h"
+
+// Aggregates call stacks into a prefix tree per (TaskName, EventId), outermost frame first,
+// so that identical stacks are only stored and symbolicated once however often they occur.
+class CallTree {
+public:
+    // Produces the label of a frame, image is nullptr when the offset is an absolute address.
+    using Labeler = std::function<std::wstring(const ImageData* image, uint64_t offset)>;
+
+    CallTree(size_t maxNodes);
+
+    CallTree(CallTree&) = delete;
+    CallTree& operator=(const CallTree&) = delete;
+
+    CallTree(CallTree&&) = delete;
+    CallTree& operator=(CallTree&&) = delete;
+
+    // The stack is ordered as returned by ETW, innermost frame first.
+    void insert(const std::wstring& taskName, int eventId, const ModuleSet& modules, const std::vector<uint64_t>& stack);
+
+    // Labels the frames that were not labeled yet, then writes a report with one entry per unique stack,
+    // and the same stacks in the folded format accepted by flame graph tools.
+    void write(const Labeler& labeler, std::wostream& report, std::wostream& folded);
+
+private:
+    static constexpr uint32_t noNode = 0;
+    static constexpr uint32_t noLabel = 0;
+
+    // Nodes live in a single arena and refer to each other by index.
+    // Children form a singly linked list through nextSibling.
+    struct Node {
+        uint64_t offset;
+        uint64_t hits;
+        uint64_t ends;
+        uint32_t imageId;
+        uint32_t firstChild;
+        uint32_t nextSibling;
+        uint32_t label;
+    };
+
+    struct Category {
+        std::wstring taskName;
+        int eventId;
+        uint32_t root;
+    };
+
+    uint32_t root(const std::wstring& taskName, int eventId);
+    uint32_t child(uint32_t parent, uint32_t imageId, uint64_t offset);
+
+private:
+    std::mutex mMutex;
+    size_t mMaxNodes;
+    std::vector<Node> mNodes;
+    std::vector<Category> mCategories;
+    std::vector<std::wstring> mLabels;
+
+    // Images referenced by nodes, needed to label them later on.
+    std::unordered_map<uint32_t, ImageData> mImages;
+
+    // Stacks that were cut short because the node limit was reached.
+    uint64_t mTruncated;
+};
+
+#endif // CALLTREE_H
@@ -0,0 +1,511 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "mapping.h"
+#include "pe.h"
+
+#define FILE_MAGIC "MTMCAP01"
+#define FILE_VERSION 2
+// Version of the first captures, without the PDB identity of images.
+#define FILE_VERSION_NO_INDEX_INFO 1
+#define FILE_HEADER_SIZE 16
+#define CHUNK_MAGIC 0x4b4e4843u // "CHNK"
+#define CHUNK_HEADER_SIZE 24
+#define INDEX_ENTRY_SIZE 24
+#define INDEX_MAGIC 0x5844494du // "MIDX"
+#define FOOTER_SIZE 16
+
+template <typename T>
+static void store(uint8_t* destination, T value)
+{
+    std::memcpy(destination, &value, sizeof(value));
+}
+
+template <typename T>
+static T load(const uint8_t* source)
+{
+    T value;
+    std::memcpy(&value, source, sizeof(value));
+    return value;
+}
+
+CaptureWriter::CaptureWriter(const std::filesystem::path& path) :
+    mMutex{},
+    mFile{ path, std::ios::binary | std::ios::trunc },
+    mOffset{ 0 },
+    mChunks{},
+    mBuffer{},
+    mRecordCount{ 0 },
+    mFirstTimestamp{ 0 },
+    mLastTimestamp{ 0 },
+    mClosed{ false }
+{
+    if (!mFile) {
+        throw std::runtime_error("Failed to create the capture file.");
+    }
+
+    uint8_t header[FILE_HEADER_SIZE]{};
+    std::memcpy(header, FILE_MAGIC, 8);
+    store<uint32_t>(header + 8, FILE_VERSION);
+    mFile.write(reinterpret_cast<const char*>(header), sizeof(header));
+    mOffset = sizeof(header);
+
+    mBuffer.reserve(chunkSize + CHUNK_HEADER_SIZE);
+    mBuffer.resize(CHUNK_HEADER_SIZE);
+}
+
+CaptureWriter::~CaptureWriter()
+{
+    close();
+}
+
+void CaptureWriter::writeProcessStart(uint64_t timestamp, uint32_t pid, const std::wstring& imageName)
+{
+    std::lock_guard guard(mMutex);
+    begin(CaptureRecordType::ProcessStart, timestamp);
+    putVarint(pid);
+    putString(imageName);
+    end();
+}
+
+void CaptureWriter::writeProcessStop(uint64_t timestamp, uint32_t pid)
+{
+    std::lock_guard guard(mMutex);
+    begin(CaptureRecordType::ProcessStop, timestamp);
+    putVarint(pid);
+    end();
+}
+
+void CaptureWriter::writeImageLoad(uint64_t timestamp, uint32_t pid, uint64_t imageBase, uint64_t imageSize, uint32_t imageTimeStamp,
+    const std::wstring& imageName, const ImageIndexInfo* indexInfo)
+{
+    std::lock_guard guard(mMutex);
+    begin(CaptureRecordType::ImageLoad, timestamp);
+    putVarint(pid);
+    putVarint(imageBase);
+    putVarint(imageSize);
+    putVarint(imageTimeStamp);
+    putString(imageName);
+    putIndexInfo(indexInfo);
+    end();
+}
+
+void CaptureWriter::writeImageUnload(uint64_t timestamp, uint32_t pid, uint64_t imageBase)
+{
+    std::lock_guard guard(mMutex);
+    begin(CaptureRecordType::ImageUnload, timestamp);
+    putVarint(pid);
+    putVarint(imageBase);
+    end();
+}
+
+void CaptureWriter::writeKernelImage(uint64_t imageBase, uint64_t imageSize, uint32_t imageTimeStamp, const std::wstring& imageName,
+    const ImageIndexInfo* indexInfo)
+{
+    std::lock_guard guard(mMutex);
+    begin(CaptureRecordType::KernelImage, mLastTimestamp);
+    putVarint(0);
+    putVarint(imageBase);
+    putVarint(imageSize);
+    putVarint(imageTimeStamp);
+    putString(imageName);
+    putIndexInfo(indexInfo);
+    end();
+}
+
+void CaptureWriter::writeEvent(uint64_t timestamp, const std::wstring& taskName, int eventId, uint32_t pid, uint32_t tid,
+    const uint64_t* stack, size_t stackSize, const std::vector<std::wstring>& properties)
+{
+    std::lock_guard guard(mMutex);
+    begin(CaptureRecordType::Event, timestamp);
+    putVarint(pid);
+    putString(taskName);
+    putSigned(eventId);
+    putVarint(tid);
+
+    putVarint(stackSize);
+    uint64_t previous = 0;
+    for (size_t i = 0; i < stackSize; ++i) {
+        putSigned(static_cast<int64_t>(stack[i] - previous));
+        previous = stack[i];
+    }
+
+    putVarint(properties.size());
+    for (const auto& property : properties) {
+        putString(property);
+    }
+    end();
+}
+
+void CaptureWriter::close()
+{
+    std::lock_guard guard(mMutex);
+
+    if (mClosed) {
+        return;
+    }
+    mClosed = true;
+
+    writeChunk();
+
+    auto indexOffset = mOffset;
+    for (const auto& chunk : mChunks) {
+        uint8_t entry[INDEX_ENTRY_SIZE]{};
+        store<uint64_t>(entry, chunk.offset);
+        store<uint64_t>(entry + 8, chunk.firstTimestamp);
+        store<uint32_t>(entry + 16, chunk.byteCount);
+        store<uint32_t>(entry + 20, chunk.recordCount);
+        mFile.write(reinterpret_cast<const char*>(entry), sizeof(entry));
+    }
+
+    uint8_t footer[FOOTER_SIZE]{};
+    store<uint64_t>(footer, indexOffset);
+    store<uint32_t>(footer + 8, static_cast<uint32_t>(mChunks.size()));
+    store<uint32_t>(footer + 12, INDEX_MAGIC);
+    mFile.write(reinterpret_cast<const char*>(footer), sizeof(footer));
+    mFile.close();
+}
+
+void CaptureWriter::begin(CaptureRecordType type, uint64_t timestamp)
+{
+    if (mRecordCount == 0) {
+        mFirstTimestamp = timestamp;
+        mLastTimestamp = timestamp;
+    }
+
+    mBuffer.push_back(static_cast<uint8_t>(type));
+    putSigned(static_cast<int64_t>(timestamp - mLastTimestamp));
+    mLastTimestamp = timestamp;
+}
+
+void CaptureWriter::end()
+{
+    ++mRecordCount;
+    if (mBuffer.size() >= chunkSize) {
+        writeChunk();
+    }
+}
+
+void CaptureWriter::flush()
+{
+    std::lock_guard guard(mMutex);
+
+    if (mClosed) {
+        return;
+    }
+    writeChunk();
+    mFile.flush();
+}
+
+void CaptureWriter::writeChunk()
+{
+    if (mRecordCount == 0) {
+        return;
+    }
+
+    auto byteCount = static_cast<uint32_t>(mBuffer.size() - CHUNK_HEADER_SIZE);
+    store<uint32_t>(mBuffer.data(), CHUNK_MAGIC);
+    store<uint32_t>(mBuffer.data() + 4, byteCount);
+    store<uint32_t>(mBuffer.data() + 8, mRecordCount);
+    store<uint32_t>(mBuffer.data() + 12, 0);
+    store<uint64_t>(mBuffer.data() + 16, mFirstTimestamp);
+    mFile.write(reinterpret_cast<const char*>(mBuffer.data()), mBuffer.size());
+
+    mChunks.emplace_back(ChunkInfo{ mOffset, mFirstTimestamp, byteCount, mRecordCount });
+    mOffset += mBuffer.size();
+
+    mBuffer.resize(CHUNK_HEADER_SIZE);
+    mRecordCount = 0;
+}
+
+void CaptureWriter::putVarint(uint64_t value)
+{
+    while (value >= 0x80) {
+        mBuffer.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    mBuffer.push_back(static_cast<uint8_t>(value));
+}
+
+void CaptureWriter::putSigned(int64_t value)
+{
+    putVarint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+void CaptureWriter::putString(const std::wstring& value)
+{
+    // wchar_t holds UTF-16 code units on Windows, but full code points elsewhere.
+    std::vector<uint16_t> units;
+    units.reserve(value.size());
+    for (auto character : value) {
+        auto codePoint = static_cast<uint32_t>(character);
+        if (codePoint > 0xffff) {
+            codePoint -= 0x10000;
+            units.push_back(static_cast<uint16_t>(0xd800 + (codePoint >> 10)));
+            units.push_back(static_cast<uint16_t>(0xdc00 + (codePoint & 0x3ff)));
+        }
+        else {
+            units.push_back(static_cast<uint16_t>(codePoint));
+        }
+    }
+
+    putVarint(units.size());
+    auto bytes = reinterpret_cast<const uint8_t*>(units.data());
+    mBuffer.insert(mBuffer.end(), bytes, bytes + units.size() * sizeof(uint16_t));
+}
+
+void CaptureWriter::putIndexInfo(const ImageIndexInfo* indexInfo)
+{
+    if (!indexInfo) {
+        putVarint(0);
+        return;
+    }
+
+    putVarint(1);
+    putString(indexInfo->pdbFile);
+    mBuffer.insert(mBuffer.end(), std::begin(indexInfo->pdbGuid), std::end(indexInfo->pdbGuid));
+    putVarint(indexInfo->pdbAge);
+}
+
+CaptureReader::CaptureReader(const std::filesystem::path& path) :
+    mFile{ std::make_unique<MappedFile>(path) },
+    mData{ mFile->data() },
+    mSize{ mFile->size() },
+    mVersion{ 0 },
+    mChunks{},
+    mChunk{ 0 },
+    mPosition{ nullptr },
+    mEnd{ nullptr },
+    mRemaining{ 0 },
+    mLastTimestamp{ 0 }
+{
+    if (mSize < FILE_HEADER_SIZE || std::memcmp(mData, FILE_MAGIC, 8) != 0) {
+        throw std::runtime_error("Not a capture file.");
+    }
+    mVersion = load<uint32_t>(mData + 8);
+    if (mVersion < FILE_VERSION_NO_INDEX_INFO || mVersion > FILE_VERSION) {
+        throw std::runtime_error("Unsupported capture file version.");
+    }
+
+    readIndex();
+    seek(0);
+}
+
+CaptureReader::~CaptureReader() = default;
+
+void CaptureReader::seek(size_t chunk)
+{
+    mChunk = chunk;
+    mRemaining = 0;
+    mPosition = nullptr;
+    mEnd = nullptr;
+
+    if (chunk < mChunks.size()) {
+        const auto& info = mChunks[chunk];
+        mPosition = mData + info.offset + CHUNK_HEADER_SIZE;
+        mEnd = mPosition + info.byteCount;
+        mRemaining = info.recordCount;
+        mLastTimestamp = info.firstTimestamp;
+    }
+}
+
+bool CaptureReader::next(CaptureRecord& record)
+{
+    while (mRemaining == 0) {
+        if (mChunk + 1 >= mChunks.size()) {
+            return false;
+        }
+        seek(mChunk + 1);
+    }
+    --mRemaining;
+
+    if (mPosition >= mEnd) {
+        throw std::runtime_error("Corrupted capture file.");
+    }
+    record.type = static_cast<CaptureRecordType>(*mPosition++);
+    mLastTimestamp += static_cast<uint64_t>(getSigned());
+    record.timestamp = mLastTimestamp;
+    record.pid = static_cast<uint32_t>(getVarint());
+
+    switch (record.type) {
+    case CaptureRecordType::ProcessStart:
+        getString(record.imageName);
+        break;
+
+    case CaptureRecordType::ProcessStop:
+        break;
+
+    case CaptureRecordType::ImageLoad:
+    case CaptureRecordType::KernelImage:
+        record.imageBase = getVarint();
+        record.imageSize = getVarint();
+        record.imageTimeStamp = static_cast<uint32_t>(getVarint());
+        getString(record.imageName);
+        getIndexInfo(record);
+        break;
+
+    case CaptureRecordType::ImageUnload:
+        record.imageBase = getVarint();
+        break;
+
+    case CaptureRecordType::Event:
+    {
+        getString(record.taskName);
+        record.eventId = static_cast<int>(getSigned());
+        record.tid = static_cast<uint32_t>(getVarint());
+
+        // Each address delta and each string takes at least one byte.
+        record.stack.resize(getCount());
+        uint64_t previous = 0;
+        for (auto& address : record.stack) {
+            address = previous + static_cast<uint64_t>(getSigned());
+            previous = address;
+        }
+
+        record.properties.resize(getCount());
+        for (auto& property : record.properties) {
+            getString(property);
+        }
+        break;
+    }
+
+    default:
+        throw std::runtime_error("Corrupted capture file.");
+    }
+
+    return true;
+}
+
+void CaptureReader::readIndex()
+{
+    if (mSize < FILE_HEADER_SIZE + FOOTER_SIZE) {
+        scanChunks();
+        return;
+    }
+
+    const uint8_t* footer = mData + mSize - FOOTER_SIZE;
+    auto indexOffset = load<uint64_t>(footer);
+    auto chunkCount = load<uint32_t>(footer + 8);
+    if (load<uint32_t>(footer + 12) != INDEX_MAGIC || indexOffset > mSize - FOOTER_SIZE ||
+        indexOffset + uint64_t(chunkCount) * INDEX_ENTRY_SIZE != mSize - FOOTER_SIZE) {
+        // The capture was not closed properly, rebuild the index from the chunk headers.
+        scanChunks();
+        return;
+    }
+
+    mChunks.reserve(chunkCount);
+    for (uint32_t i = 0; i < chunkCount; ++i) {
+        const uint8_t* entry = mData + indexOffset + size_t(i) * INDEX_ENTRY_SIZE;
+        ChunkInfo info{ load<uint64_t>(entry), load<uint64_t>(entry + 8), load<uint32_t>(entry + 16), load<uint32_t>(entry + 20) };
+        if (info.offset < FILE_HEADER_SIZE || info.offset > indexOffset ||
+            CHUNK_HEADER_SIZE + uint64_t(info.byteCount) > indexOffset - info.offset) {
+            throw std::runtime_error("Corrupted capture file.");
+        }
+        mChunks.push_back(info);
+    }
+}
+
+void CaptureReader::scanChunks()
+{
+    size_t offset = FILE_HEADER_SIZE;
+    while (offset + CHUNK_HEADER_SIZE <= mSize) {
+        const uint8_t* header = mData + offset;
+        if (load<uint32_t>(header) != CHUNK_MAGIC) {
+            break;
+        }
+
+        ChunkInfo info{ offset, load<uint64_t>(header + 16), load<uint32_t>(header + 4), load<uint32_t>(header + 8) };
+        if (offset + CHUNK_HEADER_SIZE + info.byteCount > mSize) {
+            // Truncated last chunk.
+            break;
+        }
+        mChunks.push_back(info);
+        offset += CHUNK_HEADER_SIZE + info.byteCount;
+    }
+}
+
+uint64_t CaptureReader::getVarint()
+{
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (mPosition >= mEnd) {
+            break;
+        }
+        auto byte = *mPosition++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    throw std::runtime_error("Corrupted capture file.");
+}
+
+uint64_t CaptureReader::getCount()
+{
+    auto count = getVarint();
+    if (count > size_t(mEnd - mPosition)) {
+        throw std::runtime_error("Corrupted capture file.");
+    }
+    return count;
+}
+
+int64_t CaptureReader::getSigned()
+{
+    auto value = getVarint();
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void CaptureReader::getString(std::wstring& value)
+{
+    auto count = getVarint();
+    if (count > size_t(mEnd - mPosition) / sizeof(uint16_t)) {
+        throw std::runtime_error("Corrupted capture file.");
+    }
+
+    value.clear();
+    value.reserve(count);
+    for (uint64_t i = 0; i < count; ++i) {
+        uint32_t unit = load<uint16_t>(mPosition + i * sizeof(uint16_t));
+        if constexpr (sizeof(wchar_t) > sizeof(uint16_t)) {
+            if (unit >= 0xd800 && unit < 0xdc00 && i + 1 < count) {
+                uint32_t low = load<uint16_t>(mPosition + (i + 1) * sizeof(uint16_t));
+                if (low >= 0xdc00 && low < 0xe000) {
+                    unit = 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+                    ++i;
+                }
+            }
+        }
+        value.push_back(static_cast<wchar_t>(unit));
+    }
+    mPosition += count * sizeof(uint16_t);
+}
+
+void CaptureReader::getIndexInfo(CaptureRecord& record)
+{
+    record.indexInfo = nullptr;
+    if (mVersion == FILE_VERSION_NO_INDEX_INFO || getVarint() == 0) {
+        return;
+    }
+
+    auto indexInfo = std::make_shared<ImageIndexInfo>();
+    indexInfo->timeDateStamp = record.imageTimeStamp;
+    indexInfo->sizeOfImage = static_cast<uint32_t>(record.imageSize);
+    getString(indexInfo->pdbFile);
+    if (size_t(mEnd - mPosition) < sizeof(indexInfo->pdbGuid)) {
+        throw std::runtime_error("Corrupted capture file.");
+    }
+    std::memcpy(indexInfo->pdbGuid, mPosition, sizeof(indexInfo->pdbGuid));
+    mPosition += sizeof(indexInfo->pdbGuid);
+    indexInfo->pdbAge = static_cast<uint32_t>(getVarint());
+    record.indexInfo = std::move(indexInfo);
+}
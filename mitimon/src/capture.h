@@ -0,0 +1,181 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "mapping.h"
+#include "pe.h"
+
+// Capture files store the raw events and the process and image records needed to symbolicate them later on.
+//
+// Layout, all integers being little endian:
+//   file header: magic "MTMCAP01", uint32 version, uint32 reserved
+//   chunks:      uint32 magic "CHNK", uint32 byte count, uint32 record count, uint32 reserved,
+//                uint64 first timestamp, followed by the records
+//   index:       per chunk, uint64 offset, uint64 first timestamp, uint32 byte count, uint32 record count
+//   footer:      uint64 index offset, uint32 chunk count, uint32 magic "MIDX"
+//
+// Records start with their type byte and the zigzag varint delta of their timestamp from the previous record.
+// Integers are varints, strings are a varint count of UTF-16 code units followed by these code units,
+// stack addresses are zigzag varint deltas from the previous address. Each chunk can be decoded on its own.
+//
+// Since version 2, image load and kernel image records end with the PDB identity of the image, so that it can be
+// symbolicated where its file is not available: varint 1, the PDB file name, the 16 bytes of the PDB GUID and
+// the varint PDB age, or varint 0 if the image has no known identity.
+
+enum class CaptureRecordType : uint8_t {
+    ProcessStart = 1,
+    ProcessStop = 2,
+    ImageLoad = 3,
+    ImageUnload = 4,
+    Event = 5,
+    KernelImage = 6,
+};
+
+struct CaptureRecord {
+    CaptureRecordType type;
+    uint64_t timestamp;
+    uint32_t pid;
+
+    // ProcessStart, ImageLoad, KernelImage.
+    std::wstring imageName;
+
+    // ImageLoad, ImageUnload, KernelImage.
+    uint64_t imageBase;
+    uint64_t imageSize;
+    uint32_t imageTimeStamp;
+    // ImageLoad, KernelImage. Null if unknown, as in captures of version 1.
+    std::shared_ptr<const ImageIndexInfo> indexInfo;
+
+    // Event.
+    std::wstring taskName;
+    int eventId;
+    uint32_t tid;
+    std::vector<uint64_t> stack;
+    std::vector<std::wstring> properties;
+};
+
+class CaptureWriter {
+public:
+    CaptureWriter(const std::filesystem::path& path);
+
+    ~CaptureWriter();
+
+    CaptureWriter(CaptureWriter&) = delete;
+    CaptureWriter& operator=(const CaptureWriter&) = delete;
+
+    CaptureWriter(CaptureWriter&&) = delete;
+    CaptureWriter& operator=(CaptureWriter&&) = delete;
+
+    void writeProcessStart(uint64_t timestamp, uint32_t pid, const std::wstring& imageName);
+    void writeProcessStop(uint64_t timestamp, uint32_t pid);
+    // The index information may be null if the image could not be identified.
+    void writeImageLoad(uint64_t timestamp, uint32_t pid, uint64_t imageBase, uint64_t imageSize, uint32_t imageTimeStamp,
+        const std::wstring& imageName, const ImageIndexInfo* indexInfo);
+    void writeImageUnload(uint64_t timestamp, uint32_t pid, uint64_t imageBase);
+    void writeKernelImage(uint64_t imageBase, uint64_t imageSize, uint32_t imageTimeStamp, const std::wstring& imageName,
+        const ImageIndexInfo* indexInfo);
+    void writeEvent(uint64_t timestamp, const std::wstring& taskName, int eventId, uint32_t pid, uint32_t tid,
+        const uint64_t* stack, size_t stackSize, const std::vector<std::wstring>& properties);
+
+    // Writes the records since the last chunk as a chunk of their own, and hands them to the system, so that they
+    // are read back even if the process ends before close. Chunks are smaller than usual then.
+    void flush();
+
+    // Writes the pending chunk, the index and the footer. Nothing can be written afterwards.
+    void close();
+
+private:
+    struct ChunkInfo {
+        uint64_t offset;
+        uint64_t firstTimestamp;
+        uint32_t byteCount;
+        uint32_t recordCount;
+    };
+
+    static constexpr size_t chunkSize = 1024 * 1024;
+
+    void begin(CaptureRecordType type, uint64_t timestamp);
+    void end();
+    void writeChunk();
+
+    void putVarint(uint64_t value);
+    void putSigned(int64_t value);
+    void putString(const std::wstring& value);
+    void putIndexInfo(const ImageIndexInfo* indexInfo);
+
+private:
+    std::mutex mMutex;
+    std::ofstream mFile;
+    uint64_t mOffset;
+    std::vector<ChunkInfo> mChunks;
+
+    std::vector<uint8_t> mBuffer;
+    uint32_t mRecordCount;
+    uint64_t mFirstTimestamp;
+    uint64_t mLastTimestamp;
+    bool mClosed;
+};
+
+class CaptureReader {
+public:
+    // Throws std::runtime_error if the file cannot be mapped or is not a capture file of a supported version.
+    CaptureReader(const std::filesystem::path& path);
+
+    ~CaptureReader();
+
+    CaptureReader(CaptureReader&) = delete;
+    CaptureReader& operator=(const CaptureReader&) = delete;
+
+    CaptureReader(CaptureReader&&) = delete;
+    CaptureReader& operator=(CaptureReader&&) = delete;
+
+    size_t chunkCount() const { return mChunks.size(); }
+    uint64_t chunkTimestamp(size_t chunk) const { return mChunks[chunk].firstTimestamp; }
+
+    // Restarts reading from the first record of a chunk.
+    void seek(size_t chunk);
+
+    // Decodes the next record into an existing one, so that its buffers get reused. Returns false at the end.
+    bool next(CaptureRecord& record);
+
+private:
+    struct ChunkInfo {
+        uint64_t offset;
+        uint64_t firstTimestamp;
+        uint32_t byteCount;
+        uint32_t recordCount;
+    };
+
+    void readIndex();
+    void scanChunks();
+
+    uint64_t getVarint();
+    // Count of the items following it, which cannot be more than the bytes left in the chunk.
+    uint64_t getCount();
+    int64_t getSigned();
+    void getString(std::wstring& value);
+    void getIndexInfo(CaptureRecord& record);
+
+private:
+    std::unique_ptr<MappedFile> mFile;
+    const uint8_t* mData;
+    size_t mSize;
+    uint32_t mVersion;
+
+    std::vector<ChunkInfo> mChunks;
+    size_t mChunk;
+    const uint8_t* mPosition;
+    const uint8_t* mEnd;
+    uint32_t mRemaining;
+    uint64_t mLastTimestamp;
+};
+
+#endif // CAPTURE_H
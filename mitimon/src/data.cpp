@@ -1,89 +1,415 @@
+#include <algorithm>
 #include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-
-#include "winkrabs.h"
+#include <vector>
 
 #include "data.h"
+#include "metrics.h"
 
-std::unordered_map<uint32_t, ProcessData> ProcessData::processMap;
+// Everything is kept until a grace period is set.
+ModuleTimeline ProcessData::timeline{ UINT64_MAX };
 
 ImageData ProcessData::kernelImageData;
 
-bool ProcessData::add(uint32_t pid, const std::wstring& imageName)
+ModuleSet::Pointer ProcessData::kernelModuleSet = ModuleSet::empty();
+
+std::mutex ImageData::internMutex;
+
+std::unordered_map<std::wstring, ImageNames> ImageData::namesMap;
+
+std::unordered_map<ImageIdentity, uint32_t, ImageIdentityHash> ImageData::identityMap;
+
+std::unordered_map<uint32_t, std::shared_ptr<const ImageIndexInfo>> ImageData::indexInfoMap;
+
+const ImageNames ImageData::noNames;
+
+bool ProcessData::add(uint64_t timestamp, uint32_t pid, const std::wstring& imageName)
+{
+    return timeline.addProcess(timestamp, pid, imageName, kernelModuleSet);
+}
+
+bool ProcessData::remove(uint64_t timestamp, uint32_t pid)
 {
-    auto [it, isNew] = processMap.emplace(std::make_pair(pid, ProcessData(pid, imageName)));
-    return isNew;
+    return timeline.removeProcess(timestamp, pid);
 }
 
-bool ProcessData::remove(uint32_t pid)
+bool ProcessData::addImage(uint64_t timestamp, uint32_t pid, const ImageData& imageData)
 {
-    return bool(processMap.erase(pid));
+    Metrics::add(MetricCounter::ModuleLoads);
+    return timeline.addImage(timestamp, pid, imageData);
 }
 
-bool ProcessData::exists(uint32_t pid)
+bool ProcessData::removeImage(uint64_t timestamp, uint32_t pid, void* imageBase)
 {
-    return bool(processMap.count(pid));
+    return timeline.removeImage(timestamp, pid, imageBase);
 }
 
-ProcessData& ProcessData::get(uint32_t pid)
+ModuleSet::Pointer ProcessData::modules(uint32_t pid, uint64_t timestamp)
 {
-    return processMap.at(pid);
+    auto modules = timeline.modules(pid, timestamp);
+    return modules ? modules : kernelModuleSet;
 }
 
-bool ProcessData::addImage(const ImageData& imageData)
+bool ModuleTimeline::addProcess(uint64_t timestamp, uint32_t pid, const std::wstring& imageName, ModuleSet::Pointer modules)
 {
-    return addImage(ImageData(imageData));
+    retire(timestamp);
+
+    auto& instances = mProcesses[pid];
+    if (!instances.empty() && instances.back().startTime == timestamp) {
+        return false;
+    }
+
+    // The stop of the previous instance was missed.
+    if (!instances.empty() && !instances.back().stopTime) {
+        stop(instances.back(), pid, timestamp);
+    }
+
+    auto& instance = instances.emplace_back(Instance{ timestamp, std::nullopt, imageName, {} });
+    instance.versions.push_back(Version{ timestamp, std::move(modules) });
+    ++mVersionCount;
+    return true;
+}
+
+bool ModuleTimeline::removeProcess(uint64_t timestamp, uint32_t pid)
+{
+    retire(timestamp);
+
+    auto instance = latest(pid);
+    if (!instance || instance->stopTime) {
+        return false;
+    }
+
+    stop(*instance, pid, timestamp);
+    return true;
+}
+
+bool ModuleTimeline::addImage(uint64_t timestamp, uint32_t pid, const ImageData& imageData)
+{
+    auto instance = latest(pid);
+    if (!instance || instance->stopTime) {
+        return false;
+    }
+
+    auto modules = instance->versions.back().modules->withImage(imageData);
+    if (!modules) {
+        return false;
+    }
+    addVersion(*instance, timestamp, std::move(modules));
+    return true;
+}
+
+bool ModuleTimeline::removeImage(uint64_t timestamp, uint32_t pid, void* imageBase)
+{
+    auto instance = latest(pid);
+    if (!instance || instance->stopTime) {
+        return false;
+    }
+
+    auto modules = instance->versions.back().modules->withoutImage(imageBase);
+    if (!modules) {
+        return false;
+    }
+    addVersion(*instance, timestamp, std::move(modules));
+    return true;
 }
 
-bool ProcessData::addImage(ImageData&& imageData)
+ModuleSet::Pointer ModuleTimeline::modules(uint32_t pid, uint64_t timestamp) const
 {
-    auto [it, isNew] = mImageMap.emplace(std::make_pair(imageData.base(), std::move(imageData)));
-    return isNew;
+    auto instance = find(pid, timestamp);
+    if (!instance) {
+        return nullptr;
+    }
+
+    // Events older than the versions kept, which were retired, have no known modules either.
+    const auto& versions = instance->versions;
+    auto version = std::upper_bound(versions.begin(), versions.end(), timestamp,
+        [](uint64_t timestamp, const Version& version) { return timestamp < version.timestamp; });
+    if (version == versions.begin()) {
+        return nullptr;
+    }
+    return std::prev(version)->modules;
 }
 
-bool ProcessData::removeImage(void* imageBase)
+std::wstring_view ModuleTimeline::imageName(uint32_t pid, uint64_t timestamp) const
 {
-    return bool(mImageMap.erase(imageBase));
+    auto instance = find(pid, timestamp);
+    if (!instance) {
+        return {};
+    }
+
+    return ImageData::fileNameFromEtwName(instance->imageName);
 }
 
-ImageData& ProcessData::getImage(void* imageBase)
+const ModuleTimeline::Instance* ModuleTimeline::find(uint32_t pid, uint64_t timestamp) const
 {
-    return mImageMap.at(imageBase);
+    auto it = mProcesses.find(pid);
+    if (it == mProcesses.end() || it->second.empty()) {
+        return nullptr;
+    }
+
+    // Events predating all the instances belong to none of them: the first one may be a later process given the pid.
+    const auto& instances = it->second;
+    auto instance = std::upper_bound(instances.begin(), instances.end(), timestamp,
+        [](uint64_t timestamp, const Instance& instance) { return timestamp < instance.startTime; });
+    if (instance == instances.begin()) {
+        return nullptr;
+    }
+    return &*std::prev(instance);
 }
 
-std::pair<void*, size_t> ProcessData::decompose(void* address)
+void ModuleTimeline::retire(uint64_t timestamp)
 {
-    for (auto const& [imageBase, imageData] : mImageMap) {
-        auto imageEnd = reinterpret_cast<void*>(
-            reinterpret_cast<size_t>(imageBase) + imageData.size()
-        );
-        if (imageBase <= address && address < imageEnd) {
-            auto offset = reinterpret_cast<size_t>(address) - reinterpret_cast<size_t>(imageBase);
-            return std::make_pair(imageBase, offset);
+    while (!mStopped.empty() && isRetired(mStopped.front().stopTime, timestamp)) {
+        auto stopped = mStopped.front();
+        mStopped.pop_front();
+
+        auto it = mProcesses.find(stopped.pid);
+        if (it == mProcesses.end()) {
+            continue;
+        }
+
+        auto& instances = it->second;
+        auto instance = std::find_if(instances.begin(), instances.end(),
+            [&stopped](const Instance& instance) { return instance.startTime == stopped.startTime; });
+        if (instance == instances.end()) {
+            continue;
+        }
+
+        mVersionCount -= instance->versions.size();
+        ++mRetiredCount;
+        instances.erase(instance);
+        if (instances.empty()) {
+            mProcesses.erase(it);
         }
     }
-    return std::make_pair(nullptr, 0);
 }
 
+ModuleTimeline::Stats ModuleTimeline::stats() const
+{
+    uint64_t processes = 0;
+    for (const auto& [pid, instances] : mProcesses) {
+        processes += instances.size();
+    }
+    return Stats{ processes, mVersionCount, mRetiredCount };
+}
 
-bool ImageData::add(uint32_t pid, void* imageBase, std::size_t imageSize, const std::wstring& imageName)
+ModuleTimeline::Instance* ModuleTimeline::latest(uint32_t pid)
 {
-    if (!ProcessData::exists(pid)) {
-        return false;
+    auto it = mProcesses.find(pid);
+    if (it == mProcesses.end() || it->second.empty()) {
+        return nullptr;
     }
-    auto& processData = ProcessData::get(pid);
-    return processData.addImage(ImageData(imageBase, imageSize, imageName));
+    return &it->second.back();
 }
 
-bool ImageData::remove(uint32_t pid, void* imageBase)
+void ModuleTimeline::stop(Instance& instance, uint32_t pid, uint64_t timestamp)
 {
-    if (!ProcessData::exists(pid)) {
-        return false;
+    instance.stopTime = timestamp;
+    mStopped.push_back(StoppedInstance{ timestamp, pid, instance.startTime });
+}
+
+void ModuleTimeline::addVersion(Instance& instance, uint64_t timestamp, ModuleSet::Pointer modules)
+{
+    auto& versions = instance.versions;
+    versions.push_back(Version{ timestamp, std::move(modules) });
+    ++mVersionCount;
+
+    // Keep the last version that started before the grace period, events may still be handled against it.
+    while (versions.size() > 1 && isRetired(versions[1].timestamp, timestamp)) {
+        versions.pop_front();
+        --mVersionCount;
     }
-    auto& processData = ProcessData::get(pid);
-    return processData.removeImage(imageBase);
+}
+
+ModuleSet::Pointer ModuleSet::empty()
+{
+    static const Pointer emptySet = std::make_shared<const ModuleSet>();
+    return emptySet;
+}
+
+ModuleSet::Pointer ModuleSet::withImage(const ImageData& imageData) const
+{
+    auto begin = reinterpret_cast<size_t>(imageData.base());
+    ImageRange range{ begin, begin + imageData.size(), imageData };
+    auto result = std::make_shared<ModuleSet>(*this);
+    ++result->mSize;
+    if (mChunks.empty()) {
+        result->mChunks.push_back(ChunkEntry{});
+        result->setChunk(0, Chunk{ range });
+        return result;
+    }
+
+    auto index = findChunk(begin);
+    const auto& ranges = *mChunks[index].chunk;
+    auto position = std::lower_bound(ranges.begin(), ranges.end(), begin,
+        [](const ImageRange& range, size_t address) { return range.begin < address; });
+    if (position != ranges.end() && position->begin == begin) {
+        return nullptr;
+    }
+
+    Chunk chunk;
+    chunk.reserve(ranges.size() + 1);
+    chunk.insert(chunk.end(), ranges.begin(), position);
+    chunk.push_back(range);
+    chunk.insert(chunk.end(), position, ranges.end());
+
+    // A full chunk is split in halves.
+    if (chunk.size() > MODULE_SET_CHUNK_SIZE) {
+        auto half = chunk.size() / 2;
+        result->mChunks.insert(result->mChunks.begin() + index + 1, ChunkEntry{});
+        result->setChunk(index + 1, Chunk(chunk.begin() + half, chunk.end()));
+        chunk.erase(chunk.begin() + half, chunk.end());
+    }
+    result->setChunk(index, std::move(chunk));
+    return result;
+}
+
+ModuleSet::Pointer ModuleSet::withoutImage(void* imageBase) const
+{
+    auto begin = reinterpret_cast<size_t>(imageBase);
+    if (mChunks.empty()) {
+        return nullptr;
+    }
+    auto index = findChunk(begin);
+    const auto& ranges = *mChunks[index].chunk;
+    auto position = std::lower_bound(ranges.begin(), ranges.end(), begin,
+        [](const ImageRange& range, size_t address) { return range.begin < address; });
+    if (position == ranges.end() || position->begin != begin) {
+        return nullptr;
+    }
+
+    auto result = std::make_shared<ModuleSet>(*this);
+    --result->mSize;
+    Chunk chunk;
+    chunk.reserve(ranges.size() - 1);
+    chunk.insert(chunk.end(), ranges.begin(), position);
+    chunk.insert(chunk.end(), position + 1, ranges.end());
+
+    // Small neighbours are merged, so that unloads do not leave many tiny chunks.
+    if (index + 1 < mChunks.size() && chunk.size() + mChunks[index + 1].chunk->size() <= MODULE_SET_CHUNK_SIZE / 2) {
+        const auto& next = *mChunks[index + 1].chunk;
+        chunk.insert(chunk.end(), next.begin(), next.end());
+        result->mChunks.erase(result->mChunks.begin() + index + 1);
+    }
+    if (chunk.empty()) {
+        result->mChunks.erase(result->mChunks.begin() + index);
+    }
+    else {
+        result->setChunk(index, std::move(chunk));
+    }
+    return result;
+}
+
+size_t ModuleSet::findChunk(size_t address) const
+{
+    // The last chunk starting at or before the address, or the first one.
+    auto position = std::upper_bound(mChunks.begin(), mChunks.end(), address,
+        [](size_t address, const ChunkEntry& entry) { return address < entry.begin; });
+    if (position == mChunks.begin()) {
+        return 0;
+    }
+    return static_cast<size_t>(position - mChunks.begin()) - 1;
+}
+
+void ModuleSet::setChunk(size_t index, Chunk&& chunk)
+{
+    auto begin = chunk.front().begin;
+    mChunks[index] = ChunkEntry{ begin, std::make_shared<const Chunk>(std::move(chunk)) };
+}
+
+const ImageData* ModuleSet::getImage(void* imageBase) const
+{
+    auto begin = reinterpret_cast<size_t>(imageBase);
+    if (mChunks.empty()) {
+        return nullptr;
+    }
+    const auto& ranges = *mChunks[findChunk(begin)].chunk;
+    auto position = std::lower_bound(ranges.begin(), ranges.end(), begin,
+        [](const ImageRange& range, size_t address) { return range.begin < address; });
+    if (position == ranges.end() || position->begin != begin) {
+        return nullptr;
+    }
+    return &position->image;
+}
+
+std::pair<const ImageData*, size_t> ModuleSet::decompose(void* address, size_t& lastHit) const
+{
+    auto value = reinterpret_cast<size_t>(address);
+
+    // The last hit is the chunk index times the chunk size, plus the position in the chunk.
+    if (lastHit / MODULE_SET_CHUNK_SIZE < mChunks.size()) {
+        const auto& ranges = *mChunks[lastHit / MODULE_SET_CHUNK_SIZE].chunk;
+        if (lastHit % MODULE_SET_CHUNK_SIZE < ranges.size()) {
+            const auto& range = ranges[lastHit % MODULE_SET_CHUNK_SIZE];
+            if (range.begin <= value && value < range.end) {
+                return std::make_pair(&range.image, value - range.begin);
+            }
+        }
+    }
+    if (mChunks.empty()) {
+        return std::make_pair(nullptr, 0);
+    }
+
+    // Find the last range starting at or before the address.
+    auto index = findChunk(value);
+    const auto& ranges = *mChunks[index].chunk;
+    auto position = std::upper_bound(ranges.begin(), ranges.end(), value,
+        [](size_t address, const ImageRange& range) { return address < range.begin; });
+    if (position == ranges.begin()) {
+        return std::make_pair(nullptr, 0);
+    }
+    --position;
+
+    if (value >= position->end) {
+        return std::make_pair(nullptr, 0);
+    }
+
+    lastHit = index * MODULE_SET_CHUNK_SIZE + static_cast<size_t>(position - ranges.begin());
+    return std::make_pair(&position->image, value - position->begin);
+}
+
+bool ImageData::add(uint64_t timestamp, uint32_t pid, void* imageBase, std::size_t imageSize, uint32_t timeStamp, const std::wstring& imageName,
+    const std::shared_ptr<const ImageIndexInfo>& indexInfo)
+{
+    return ProcessData::addImage(timestamp, pid, ImageData(imageBase, imageSize, timeStamp, imageName, indexInfo));
+}
+
+bool ImageData::remove(uint64_t timestamp, uint32_t pid, void* imageBase)
+{
+    return ProcessData::removeImage(timestamp, pid, imageBase);
+}
+
+const ImageNames* ImageData::intern(const std::wstring& imageName)
+{
+    std::lock_guard guard(internMutex);
+
+    auto it = namesMap.find(imageName);
+    if (it == namesMap.end()) {
+        ImageNames names{ nameFromEtwName(imageName), pathFromEtwName(imageName) };
+        it = namesMap.emplace(std::make_pair(imageName, std::move(names))).first;
+    }
+    return &it->second;
+}
+
+uint32_t ImageData::identify(const ImageIdentity& identity)
+{
+    std::lock_guard guard(internMutex);
+    auto [it, isNew] = identityMap.emplace(std::make_pair(identity, static_cast<uint32_t>(identityMap.size() + 1)));
+    return it->second;
+}
+
+const ImageIndexInfo* ImageData::internIndexInfo(uint32_t id, const std::shared_ptr<const ImageIndexInfo>& indexInfo)
+{
+    std::lock_guard guard(internMutex);
+    return indexInfoMap.emplace(std::make_pair(id, indexInfo)).first->second.get();
 }
 
 std::wstring ImageData::nameFromEtwName(const std::wstring& imageName)
@@ -105,6 +431,12 @@ std::wstring ImageData::nameFromEtwName(const std::wstring& imageName)
     return imageName.substr(start, count);
 }
 
+std::wstring_view ImageData::fileNameFromEtwName(std::wstring_view imageName)
+{
+    auto start = imageName.rfind(L'\\');
+    return start == std::wstring_view::npos ? imageName : imageName.substr(start + 1);
+}
+
 std::wstring ImageData::pathFromEtwName(const std::wstring& imageName)
 {
     if (!imageName.starts_with(L"\\")) {
@@ -115,3 +447,19 @@ std::wstring ImageData::pathFromEtwName(const std::wstring& imageName)
     result += imageName;
     return result;
 }
+
+void ProcessImageNames::start(uint32_t pid, std::wstring_view imageName)
+{
+    mNames[pid] = ImageData::fileNameFromEtwName(imageName);
+}
+
+void ProcessImageNames::stop(uint32_t pid)
+{
+    mNames.erase(pid);
+}
+
+const std::wstring* ProcessImageNames::find(uint32_t pid) const
+{
+    auto it = mNames.find(pid);
+    return it == mNames.end() ? nullptr : &it->second;
+}
@@ -3,93 +3,341 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
+#include <vector>
+
+#include "pe.h"
+
+// Strings derived from an ETW image name. They are interned once per distinct
+// ETW image name and never freed, so that images can refer to them by pointer.
+struct ImageNames {
+    std::wstring name;
+    std::wstring path;
+};
+
+// Identifies an image file independently of the process and address it is loaded at.
+struct ImageIdentity {
+    const ImageNames* names;
+    size_t size;
+    uint32_t timeStamp;
+
+    bool operator==(const ImageIdentity&) const = default;
+};
+
+struct ImageIdentityHash {
+    size_t operator()(const ImageIdentity& identity) const
+    {
+        size_t hash = std::hash<const ImageNames*>{}(identity.names);
+        hash ^= std::hash<size_t>{}(identity.size) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+        hash ^= std::hash<uint32_t>{}(identity.timeStamp) + 0x9e3779b97f4a7c15 + (hash << 6) + (hash >> 2);
+        return hash;
+    }
+};
 
 class ImageData {
 public:
-    static bool add(uint32_t pid, void* imageBase, size_t imageSize, const std::wstring& imageName);
-    static bool remove(uint32_t pid, void* imageBase);
+    static bool add(uint64_t timestamp, uint32_t pid, void* imageBase, size_t imageSize, uint32_t timeStamp, const std::wstring& imageName,
+        const std::shared_ptr<const ImageIndexInfo>& indexInfo);
+    static bool remove(uint64_t timestamp, uint32_t pid, void* imageBase);
 
     static std::wstring nameFromEtwName(const std::wstring& imageName);
     static std::wstring pathFromEtwName(const std::wstring& imageName);
+    // The file name with its extension, as image filters see it. The view is into the ETW image name.
+    static std::wstring_view fileNameFromEtwName(std::wstring_view imageName);
+
+    // Returns the interned strings for an ETW image name, they are only derived on first sight.
+    static const ImageNames* intern(const std::wstring& imageName);
+
+    // Returns a small id that is the same for all images sharing the same identity, never 0.
+    static uint32_t identify(const ImageIdentity& identity);
+
+    // Returns the PDB identity kept for the image id, the first one given for it. Never freed either.
+    static const ImageIndexInfo* internIndexInfo(uint32_t id, const std::shared_ptr<const ImageIndexInfo>& indexInfo);
+
+private:
+    static std::mutex internMutex;
+    static std::unordered_map<std::wstring, ImageNames> namesMap;
+    static std::unordered_map<ImageIdentity, uint32_t, ImageIdentityHash> identityMap;
+    static std::unordered_map<uint32_t, std::shared_ptr<const ImageIndexInfo>> indexInfoMap;
+    static const ImageNames noNames;
 
 public:
     ImageData() :
         mBase{ nullptr },
         mSize{ 0 },
-        mName{},
-        mPath{}
+        mTimeStamp{ 0 },
+        mNames{ &noNames },
+        mId{ 0 },
+        mIndexInfo{ nullptr }
     {
     }
 
-    ImageData(void* base, size_t size, const std::wstring& name) :
+    // The PDB identity is the one read from the image file when it was loaded, if known.
+    ImageData(void* base, size_t size, uint32_t timeStamp, const std::wstring& name,
+        const std::shared_ptr<const ImageIndexInfo>& indexInfo = nullptr) :
         mBase{ base },
         mSize{ size },
-        mName{ nameFromEtwName(name) },
-        mPath{ pathFromEtwName(name) }
+        mTimeStamp{ timeStamp },
+        mNames{ intern(name) },
+        mId{ identify(identity()) },
+        mIndexInfo{ indexInfo ? internIndexInfo(mId, indexInfo) : nullptr }
     {
     }
 
     void* base() const { return mBase; }
     size_t size() const { return mSize; }
-    const std::wstring& name() const { return mName; }
-    const std::wstring& path() const { return mPath; }
+    uint32_t timeStamp() const { return mTimeStamp; }
+    const std::wstring& name() const { return mNames->name; }
+    const std::wstring& path() const { return mNames->path; }
+
+    ImageIdentity identity() const { return ImageIdentity{ mNames, mSize, mTimeStamp }; }
+    uint32_t id() const { return mId; }
+    // Null if unknown, symbol backends then read it from the file at path.
+    const ImageIndexInfo* indexInfo() const { return mIndexInfo; }
 
 private:
     void* mBase;
     size_t mSize;
-    std::wstring mName;
-    std::wstring mPath;
+    uint32_t mTimeStamp;
+    const ImageNames* mNames;
+    uint32_t mId;
+    const ImageIndexInfo* mIndexInfo;
 };
 
-class ProcessData {
+static_assert(std::is_trivially_copyable_v<ImageData>);
+
+// Ranges per chunk of a module set, a new version copies one chunk and the chunk pointers.
+#define MODULE_SET_CHUNK_SIZE 16
+
+// Immutable set of the images loaded in a process, indexed by address range.
+// The ranges are split in chunks shared between versions: loading or unloading an image copies the
+// chunk it changes and the list of chunks, so that a version costs about a chunk rather than the whole
+// set, and taking a snapshot is a pointer copy.
+class ModuleSet {
 public:
-    ProcessData(uint32_t pid, const std::wstring& imageName) :
-        mPid{ pid },
-        mImageName{ imageName },
-        mImageMap{}
+    using Pointer = std::shared_ptr<const ModuleSet>;
+
+    ModuleSet() :
+        mChunks{},
+        mSize{ 0 }
     {
-        if (kernelImageData.base()) {
-            addImage(kernelImageData);
-        }
+    }
+
+    static Pointer empty();
+
+    // These return nullptr when the set would be left unchanged.
+    Pointer withImage(const ImageData& imageData) const;
+    Pointer withoutImage(void* imageBase) const;
+
+    size_t size() const { return mSize; }
+    const ImageData* getImage(void* imageBase) const;
+
+    // The last hit index is owned by the caller, consecutive frames often share the same image.
+    std::pair<const ImageData*, size_t> decompose(void* address, size_t& lastHit) const;
+
+private:
+    struct ImageRange {
+        size_t begin;
+        size_t end;
+        ImageData image;
     };
 
-    static bool add(uint32_t pid, const std::wstring& imageName);
-    static bool remove(uint32_t pid);
-    static bool exists(uint32_t pid);
-    static ProcessData& get(uint32_t pid);
+    // At most MODULE_SET_CHUNK_SIZE ranges, sorted by begin address.
+    using Chunk = std::vector<ImageRange>;
 
-    static void setKernelImage(ImageData && imageData)
+    struct ChunkEntry {
+        // Begin of the first range, so that chunks can be found without following the pointer.
+        size_t begin;
+        std::shared_ptr<const Chunk> chunk;
+    };
+
+    // Index of the chunk that holds the address, or would hold it.
+    size_t findChunk(size_t address) const;
+    void setChunk(size_t index, Chunk&& chunk);
+
+    // Sorted by begin address and never empty, so that decompose can use binary search.
+    std::vector<ChunkEntry> mChunks;
+    size_t mSize;
+};
+
+// History of the modules of each process, so that events get symbolicated against the modules loaded when they
+// happened, even when they are handled after the process exited or after its pid got reused. Process instances are
+// identified by their pid and start time, and each keeps the versions of its module set with the time they started.
+// Lookups are logarithmic in the number of instances sharing a pid and in the number of versions kept.
+//
+// Timestamps are ETW timestamps, and changes are expected in timestamp order. Stopped processes and superseded
+// versions are retired once they are older than the grace period, the current version of a process is always kept.
+class ModuleTimeline {
+public:
+    struct Stats {
+        uint64_t processes;
+        uint64_t versions;
+        uint64_t retiredProcesses;
+    };
+
+    // A grace period of UINT64_MAX keeps the whole history, as needed to replay a capture in any order.
+    ModuleTimeline(uint64_t gracePeriod) :
+        mGracePeriod{ gracePeriod },
+        mProcesses{},
+        mStopped{},
+        mVersionCount{ 0 },
+        mRetiredCount{ 0 }
     {
-        kernelImageData = std::move(imageData);
     }
 
-    static const ImageData& kernelImage()
+    ModuleTimeline(ModuleTimeline&) = delete;
+    ModuleTimeline& operator=(const ModuleTimeline&) = delete;
+
+    ModuleTimeline(ModuleTimeline&&) = delete;
+    ModuleTimeline& operator=(ModuleTimeline&&) = delete;
+
+    void setGracePeriod(uint64_t gracePeriod) { mGracePeriod = gracePeriod; }
+
+    // Starts a new instance of the pid, with an initial module set. A previous instance still running is stopped.
+    bool addProcess(uint64_t timestamp, uint32_t pid, const std::wstring& imageName, ModuleSet::Pointer modules);
+    bool removeProcess(uint64_t timestamp, uint32_t pid);
+
+    // These apply to the latest instance of the pid, and return false if the module set is left unchanged.
+    bool addImage(uint64_t timestamp, uint32_t pid, const ImageData& imageData);
+    bool removeImage(uint64_t timestamp, uint32_t pid, void* imageBase);
+
+    // Returns the modules of the instance of the pid running at the timestamp, as of that timestamp,
+    // or nullptr if no instance is known, or if the timestamp predates the versions kept.
+    ModuleSet::Pointer modules(uint32_t pid, uint64_t timestamp) const;
+
+    // Returns the file name of the image of the instance of the pid running at the timestamp,
+    // or an empty view if no instance is known. The view is valid until the next change.
+    std::wstring_view imageName(uint32_t pid, uint64_t timestamp) const;
+
+    // Forgets the processes that stopped more than the grace period before the timestamp.
+    void retire(uint64_t timestamp);
+
+    Stats stats() const;
+
+private:
+    struct Version {
+        uint64_t timestamp;
+        ModuleSet::Pointer modules;
+    };
+
+    struct Instance {
+        uint64_t startTime;
+        std::optional<uint64_t> stopTime;
+        std::wstring imageName;
+        // Sorted by timestamp, never empty.
+        std::deque<Version> versions;
+    };
+
+    struct StoppedInstance {
+        uint64_t stopTime;
+        uint32_t pid;
+        uint64_t startTime;
+    };
+
+    bool isRetired(uint64_t time, uint64_t now) const { return now > time && now - time > mGracePeriod; }
+
+    Instance* latest(uint32_t pid);
+
+    // The last instance started at or before the timestamp, or nullptr for events predating all of them.
+    const Instance* find(uint32_t pid, uint64_t timestamp) const;
+
+    // The instance stays available for lookups until it is retired.
+    void stop(Instance& instance, uint32_t pid, uint64_t timestamp);
+
+    void addVersion(Instance& instance, uint64_t timestamp, ModuleSet::Pointer modules);
+
+private:
+    uint64_t mGracePeriod;
+
+    // Instances of each pid, sorted by start time.
+    std::unordered_map<uint32_t, std::vector<Instance>> mProcesses;
+    // Stopped instances in the order they stopped, waiting for retirement.
+    std::deque<StoppedInstance> mStopped;
+
+    uint64_t mVersionCount;
+    uint64_t mRetiredCount;
+};
+
+// File names of the running processes, for the filters evaluated before the process registry is updated.
+// Names are derived as ProcessData::imageName does, so that image filters give the same results in both places.
+class ProcessImageNames {
+public:
+    ProcessImageNames() :
+        mNames{}
     {
-        return kernelImageData;
     }
 
+    ProcessImageNames(ProcessImageNames&) = delete;
+    ProcessImageNames& operator=(const ProcessImageNames&) = delete;
+
+    ProcessImageNames(ProcessImageNames&&) = delete;
+    ProcessImageNames& operator=(ProcessImageNames&&) = delete;
+
+    void start(uint32_t pid, std::wstring_view imageName);
+    void stop(uint32_t pid);
+
+    // Returns nullptr if the process is unknown.
+    const std::wstring* find(uint32_t pid) const;
+
 private:
-    static std::unordered_map<uint32_t, ProcessData> processMap;
-    static ImageData kernelImageData;
+    std::unordered_map<uint32_t, std::wstring> mNames;
+};
 
+// Processes seen by the process provider and their modules over time. This is only used from the intake thread.
+class ProcessData {
 public:
-    uint32_t pid() const { return mPid; }
-    const std::wstring& imageName() const { return mImageName; }
+    static bool add(uint64_t timestamp, uint32_t pid, const std::wstring& imageName);
+    static bool remove(uint64_t timestamp, uint32_t pid);
+
+    static bool addImage(uint64_t timestamp, uint32_t pid, const ImageData& imageData);
+    static bool removeImage(uint64_t timestamp, uint32_t pid, void* imageBase);
+
+    // Snapshot of the modules of a process as of a timestamp, unaffected by future loads and unloads.
+    // Only contains the kernel image if the process is not tracked.
+    static ModuleSet::Pointer modules(uint32_t pid, uint64_t timestamp);
+
+    // File name of the image of a process as of a timestamp, empty if the process is not tracked.
+    static std::wstring_view imageName(uint32_t pid, uint64_t timestamp) { return timeline.imageName(pid, timestamp); }
+
+    // Processes are kept this long after they stopped, for the events still being handled.
+    static void setGracePeriod(uint64_t gracePeriod) { timeline.setGracePeriod(gracePeriod); }
+
+    static ModuleTimeline::Stats stats() { return timeline.stats(); }
+
+    static void setKernelImage(ImageData && imageData)
+    {
+        kernelImageData = std::move(imageData);
+
+        auto modules = ModuleSet::empty();
+        if (kernelImageData.base()) {
+            modules = modules->withImage(kernelImageData);
+        }
+        kernelModuleSet = std::move(modules);
+    }
 
-    bool addImage(const ImageData& imageData);
-    bool addImage(ImageData&& imageData);
-    bool removeImage(void* imageBase);
-    ImageData& getImage(void* imageBase);
+    static const ImageData& kernelImage()
+    {
+        return kernelImageData;
+    }
 
-    std::pair<void*, size_t> decompose(void* address);
+    // Modules of a process that is not tracked, this only contains the kernel image.
+    static const ModuleSet::Pointer& kernelModules()
+    {
+        return kernelModuleSet;
+    }
 
 private:
-    uint32_t mPid;
-    std::wstring mImageName;
-    std::unordered_map<void*, ImageData> mImageMap;
+    static ModuleTimeline timeline;
+    static ImageData kernelImageData;
+    static ModuleSet::Pointer kernelModuleSet;
 };
 
 #endif // DATA_H
@@ -0,0 +1,317 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "decoder.h"
+
+template<typename T>
+static T load(const uint8_t* data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof value);
+    return value;
+}
+
+static size_t fixedSize(FieldType type)
+{
+    switch (type) {
+    case FieldType::UInt8:
+        return 1;
+    case FieldType::UInt16:
+        return 2;
+    case FieldType::UInt32:
+        return 4;
+    case FieldType::UInt64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static uint64_t loadUnsigned(FieldType type, const uint8_t* data)
+{
+    switch (type) {
+    case FieldType::UInt8:
+        return load<uint8_t>(data);
+    case FieldType::UInt16:
+        return load<uint16_t>(data);
+    case FieldType::UInt32:
+        return load<uint32_t>(data);
+    default:
+        return load<uint64_t>(data);
+    }
+}
+
+// Same as std::format(L" 0x{:0Nx}", value), N being twice the size.
+static void appendHex(std::wstring& result, uint64_t value, size_t size)
+{
+    static const wchar_t digits[] = L"0123456789abcdef";
+    result += L" 0x";
+    for (size_t i = size * 2; i > 0; --i) {
+        result.push_back(digits[(value >> ((i - 1) * 4)) & 0xf]);
+    }
+}
+
+// wchar_t holds UTF-16 code units on Windows, but full code points elsewhere.
+static void appendUtf16(std::wstring& result, const uint8_t* data, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t unit = load<uint16_t>(data + i * sizeof(uint16_t));
+        if constexpr (sizeof(wchar_t) > sizeof(uint16_t)) {
+            if (unit >= 0xd800 && unit < 0xdc00 && i + 1 < count) {
+                uint32_t low = load<uint16_t>(data + (i + 1) * sizeof(uint16_t));
+                if (low >= 0xdc00 && low < 0xe000) {
+                    unit = 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+                    ++i;
+                }
+            }
+        }
+        result.push_back(static_cast<wchar_t>(unit));
+    }
+}
+
+// Returns the number of code units before the terminator, or before the end of the data if there is none.
+static size_t stringLength(const uint8_t* data, size_t size)
+{
+    size_t count = 0;
+    while ((count + 1) * sizeof(uint16_t) <= size && load<uint16_t>(data + count * sizeof(uint16_t)) != 0) {
+        ++count;
+    }
+    return count;
+}
+
+size_t SchemaKeyHash::operator()(const SchemaKey& key) const
+{
+    // FNV-1a over the key fields.
+    uint64_t hash = 0xcbf29ce484222325;
+    auto mix = [&hash](uint8_t byte) {
+        hash = (hash ^ byte) * 0x100000001b3;
+    };
+    for (auto byte : key.provider) {
+        mix(byte);
+    }
+    mix(static_cast<uint8_t>(key.eventId));
+    mix(static_cast<uint8_t>(key.eventId >> 8));
+    mix(key.version);
+    mix(key.pointerSize);
+    return static_cast<size_t>(hash);
+}
+
+std::optional<EventDecoder> EventDecoder::compile(const std::vector<FieldLayout>& layout, const std::vector<FieldTest>& tests)
+{
+    EventDecoder decoder;
+    decoder.mSteps.reserve(layout.size());
+
+    size_t offset = 0;
+    for (size_t i = 0; i < layout.size(); ++i) {
+        const auto& field = layout[i];
+        bool isString = field.type == FieldType::UnicodeString || field.type == FieldType::CountedString;
+        size_t size = field.type == FieldType::Unsupported || field.type == FieldType::CountedString ? field.size : fixedSize(field.type);
+        if (size == 0 && !isString && i + 1 != layout.size()) {
+            return std::nullopt;
+        }
+
+        size_t lengthStep = SIZE_MAX;
+        if (field.type == FieldType::CountedString && size == 0) {
+            if (field.lengthField >= i || fixedSize(layout[field.lengthField].type) == 0) {
+                return std::nullopt;
+            }
+            lengthStep = field.lengthField;
+        }
+
+        decoder.mSteps.push_back(Step{ field.type, field.inType, static_cast<uint32_t>(size), offset, lengthStep, field.name });
+
+        // Properties after a string are at a different offset in each event.
+        if (offset != SIZE_MAX && size != 0) {
+            offset += size;
+        }
+        else {
+            offset = SIZE_MAX;
+        }
+    }
+
+    for (const auto& test : tests) {
+        size_t step = SIZE_MAX;
+        for (size_t i = 0; i < layout.size(); ++i) {
+            if (layout[i].name == test.name && fixedSize(layout[i].type) != 0) {
+                step = i;
+                break;
+            }
+        }
+        decoder.mTests.push_back(CompiledTest{ step, test.mask });
+    }
+
+    return decoder;
+}
+
+bool EventDecoder::decode(const uint8_t* data, size_t size, std::vector<std::wstring>& properties) const
+{
+    auto count = properties.size();
+    size_t offset = 0;
+    for (const auto& step : mSteps) {
+        auto stepSize = measure(step, data, size, offset);
+        if (!stepSize) {
+            properties.resize(count);
+            return false;
+        }
+
+        auto& result = properties.emplace_back();
+        result.reserve(step.name.size() + 20);
+        result += step.name;
+
+        switch (step.type) {
+        case FieldType::UnicodeString:
+        case FieldType::CountedString:
+            result += L" L\"";
+            appendUtf16(result, data + offset, stringLength(data + offset, *stepSize));
+            result += L"\"";
+            break;
+
+        case FieldType::Unsupported:
+            result += L" ? <unsupported data type ";
+            result += std::to_wstring(step.inType);
+            result += L">";
+            break;
+
+        default:
+            appendHex(result, loadUnsigned(step.type, data + offset), step.size);
+            break;
+        }
+
+        offset += *stepSize;
+    }
+
+    // Trailing data means that the schema has properties the layout does not account for, such as arrays.
+    if (offset != size) {
+        properties.resize(count);
+        return false;
+    }
+    return true;
+}
+
+bool EventDecoder::test(size_t test, const uint8_t* data, size_t size) const
+{
+    const auto& compiledTest = mTests[test];
+    if (compiledTest.step == SIZE_MAX) {
+        return false;
+    }
+
+    auto offset = locate(compiledTest.step, data, size);
+    const auto& step = mSteps[compiledTest.step];
+    if (!offset || step.size > size - *offset) {
+        return false;
+    }
+    return (loadUnsigned(step.type, data + *offset) & compiledTest.mask) != 0;
+}
+
+bool EventDecoder::read(std::wstring_view name, const uint8_t* data, size_t size, FilterValue& value) const
+{
+    for (size_t i = 0; i < mSteps.size(); ++i) {
+        const auto& step = mSteps[i];
+        if (step.name != name) {
+            continue;
+        }
+        if (step.type == FieldType::Unsupported) {
+            return false;
+        }
+
+        auto offset = locate(i, data, size);
+        if (!offset || *offset > size) {
+            return false;
+        }
+        if (step.type == FieldType::UnicodeString || step.type == FieldType::CountedString) {
+            auto stepSize = measure(step, data, size, *offset);
+            if (!stepSize) {
+                return false;
+            }
+            std::wstring text;
+            appendUtf16(text, data + *offset, stringLength(data + *offset, *stepSize));
+            value = std::move(text);
+            return true;
+        }
+        if (step.size > size - *offset) {
+            return false;
+        }
+        value = loadUnsigned(step.type, data + *offset);
+        return true;
+    }
+    return false;
+}
+
+std::optional<size_t> EventDecoder::locate(size_t step, const uint8_t* data, size_t size) const
+{
+    if (mSteps[step].offset != SIZE_MAX) {
+        return mSteps[step].offset;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < step; ++i) {
+        auto stepSize = measure(mSteps[i], data, size, offset);
+        if (!stepSize) {
+            return std::nullopt;
+        }
+        offset += *stepSize;
+    }
+    return offset;
+}
+
+std::optional<size_t> EventDecoder::measure(const Step& step, const uint8_t* data, size_t size, size_t offset) const
+{
+    if (offset > size) {
+        return std::nullopt;
+    }
+
+    if (step.type == FieldType::UnicodeString) {
+        // Includes the terminator, when there is one.
+        size_t length = stringLength(data + offset, size - offset);
+        return std::min((length + 1) * sizeof(uint16_t), size - offset);
+    }
+    if (step.lengthStep != SIZE_MAX) {
+        const auto& lengthStep = mSteps[step.lengthStep];
+        auto lengthOffset = locate(step.lengthStep, data, size);
+        if (!lengthOffset || *lengthOffset > size || lengthStep.size > size - *lengthOffset) {
+            return std::nullopt;
+        }
+        auto length = loadUnsigned(lengthStep.type, data + *lengthOffset);
+        if (length > (size - offset) / sizeof(uint16_t)) {
+            return std::nullopt;
+        }
+        return static_cast<size_t>(length) * sizeof(uint16_t);
+    }
+    if (step.size == 0) {
+        // Unsupported last property of unknown size.
+        return size - offset;
+    }
+    if (step.size > size - offset) {
+        return std::nullopt;
+    }
+    return step.size;
+}
+
+DecoderCache::DecoderCache() :
+    mTests{},
+    mDecoders{},
+    mStats{}
+{
+}
+
+size_t DecoderCache::addTest(std::wstring name, uint64_t mask)
+{
+    mTests.push_back(FieldTest{ std::move(name), mask });
+    return mTests.size() - 1;
+}
+
+void DecoderCache::countFallback()
+{
+    ++mStats.fallbacks;
+}
+
+DecoderCache::Stats DecoderCache::stats() const
+{
+    return mStats;
+}
@@ -0,0 +1,164 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "filter.h"
+
+// How a property is stored in the user data of an event, and how it gets formatted.
+enum class FieldType : uint8_t {
+    // Null-terminated UTF-16 string.
+    UnicodeString,
+    // UTF-16 string of a fixed size, or of the length given by an earlier integer property, in code units.
+    // It ends early at a terminator.
+    CountedString,
+    UInt8,
+    UInt16,
+    UInt32,
+    UInt64,
+    // Skipped, shown as unsupported.
+    Unsupported,
+};
+
+// A property as described by the event schema. Pointers must already be resolved to UInt32 or UInt64.
+struct FieldLayout {
+    std::wstring name;
+    FieldType type;
+    // The TDH input type, only shown for unsupported properties.
+    uint16_t inType;
+    // Size of unsupported properties and of counted strings, 0 if it is not fixed.
+    uint32_t size;
+    // Index of the property giving the length of a counted string of no fixed size.
+    uint32_t lengthField;
+};
+
+// Identifies an event schema. The pointer size is part of the key, since it changes the layout.
+struct SchemaKey {
+    std::array<uint8_t, 16> provider;
+    uint16_t eventId;
+    uint8_t version;
+    uint8_t pointerSize;
+
+    bool operator==(const SchemaKey&) const = default;
+};
+
+struct SchemaKeyHash {
+    size_t operator()(const SchemaKey& key) const;
+};
+
+// A flag tested directly on the user data of events, registered with the decoder cache.
+struct FieldTest {
+    std::wstring name;
+    uint64_t mask;
+};
+
+// Decodes the properties of the events of one schema straight from their user data, with the property layout
+// resolved once into a list of steps. Properties found at the same offset in every event can be read without
+// walking the ones before them.
+class EventDecoder {
+public:
+    // Returns std::nullopt if a property other than the last one does not have a fixed or self-delimited size,
+    // or if the length of a counted string is not given by an integer property before it.
+    static std::optional<EventDecoder> compile(const std::vector<FieldLayout>& layout, const std::vector<FieldTest>& tests);
+
+    // Appends one "<name> <value>" string per property, formatted as the TDH based decoding did. Returns false
+    // if the user data does not match the layout, leaving the properties as they were.
+    bool decode(const uint8_t* data, size_t size, std::vector<std::wstring>& properties) const;
+
+    // Whether the tested field is present and has one of the bits of the mask set. The test is given by its index
+    // in the tests the decoder was compiled with.
+    bool test(size_t test, const uint8_t* data, size_t size) const;
+
+    // Reads a property as an integer or a string, for event filters. Returns false if the schema has no such
+    // property, if its type is unsupported, or if the user data is too short.
+    bool read(std::wstring_view name, const uint8_t* data, size_t size, FilterValue& value) const;
+
+private:
+    struct Step {
+        FieldType type;
+        uint16_t inType;
+        uint32_t size;
+        // Offset from the start of the user data, SIZE_MAX if it depends on the properties before.
+        size_t offset;
+        // Step giving the length of a counted string of no fixed size.
+        size_t lengthStep;
+        std::wstring name;
+    };
+
+    struct CompiledTest {
+        // Index of the step, SIZE_MAX if the schema has no such field.
+        size_t step;
+        uint64_t mask;
+    };
+
+    EventDecoder() = default;
+
+    // Returns the offset of the step in the user data, or std::nullopt if the user data is too short.
+    std::optional<size_t> locate(size_t step, const uint8_t* data, size_t size) const;
+
+    // Returns the size of the step at the given offset, or std::nullopt if the user data is too short.
+    std::optional<size_t> measure(const Step& step, const uint8_t* data, size_t size, size_t offset) const;
+
+private:
+    std::vector<Step> mSteps;
+    std::vector<CompiledTest> mTests;
+};
+
+// Compiled decoders by schema. Each thread decoding events has its own.
+class DecoderCache {
+public:
+    struct Stats {
+        uint64_t schemas;
+        // Schemas decoded through TDH because their layout could not be compiled.
+        uint64_t rejected;
+        // Events decoded through TDH because their user data did not match the compiled layout.
+        uint64_t fallbacks;
+    };
+
+    DecoderCache();
+
+    DecoderCache(DecoderCache&) = delete;
+    DecoderCache& operator=(const DecoderCache&) = delete;
+
+    DecoderCache(DecoderCache&&) = delete;
+    DecoderCache& operator=(DecoderCache&&) = delete;
+
+    // Registers a test to compile into every decoder. Must be called before any decoder is compiled.
+    size_t addTest(std::wstring name, uint64_t mask);
+
+    // Returns the decoder for the schema, compiling it from the layout given by describe on first sight.
+    // Returns nullptr if the layout cannot be compiled.
+    template<typename Describe>
+    const EventDecoder* find(const SchemaKey& key, Describe&& describe)
+    {
+        auto it = mDecoders.find(key);
+        if (it == mDecoders.end()) {
+            it = mDecoders.emplace(key, EventDecoder::compile(describe(), mTests)).first;
+            if (it->second) {
+                ++mStats.schemas;
+            }
+            else {
+                ++mStats.rejected;
+            }
+        }
+        return it->second ? &*it->second : nullptr;
+    }
+
+    void countFallback();
+
+    Stats stats() const;
+
+private:
+    std::vector<FieldTest> mTests;
+    std::unordered_map<SchemaKey, std::optional<EventDecoder>, SchemaKeyHash> mDecoders;
+    Stats mStats;
+};
+
+#endif // DECODER_H
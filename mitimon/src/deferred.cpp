@@ -0,0 +1,292 @@
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "breakpad.h"
+#include "data.h"
+#include "deferred.h"
+#include "mapping.h"
+#include "pe.h"
+#include "symbols.h"
+#include "symindex.h"
+#include "text.h"
+
+#define MODULE_PREFIX "Module\t"
+// Frame lines start with the indentation of the call stack and the address.
+#define FRAME_PREFIX "   0x"
+#define FRAME_ADDRESS_DIGITS 16
+
+// The rewritten file is written in chunks of about this size.
+#define WRITE_CHUNK_SIZE (64 * 1024)
+
+std::wstring formatDeferredFrame(void* address, const ImageData* image, size_t offset)
+{
+    if (!image) {
+        return std::format(L"0x{:016x}", reinterpret_cast<size_t>(address));
+    }
+    return std::format(L"0x{:016x} m{}+0x{:x}", reinterpret_cast<size_t>(address), image->id(), offset);
+}
+
+void ModuleTable::describe(const ImageData& image, std::string& text)
+{
+    {
+        std::lock_guard guard(mMutex);
+        if (!mDescribed.insert(image.id()).second) {
+            return;
+        }
+    }
+
+    // Only the headers of images recorded without their PDB identity are read, outside of the lock.
+    // The cache keeps what it read for good.
+    auto indexInfo = image.indexInfo();
+    if (!indexInfo) {
+        indexInfo = mIndexCache.get(image.path()).get();
+    }
+    text += std::format(MODULE_PREFIX "{}\t", image.id());
+    if (indexInfo) {
+        appendUtf8(text, pdbDebugId(*indexInfo));
+        text += "\t";
+        appendUtf8(text, indexInfo->pdbFile);
+    }
+    else {
+        text += "-\t-";
+    }
+    text += "\t";
+    appendUtf8(text, image.name());
+    text += "\n";
+}
+
+size_t ModuleTable::size() const
+{
+    std::lock_guard guard(mMutex);
+    return mDescribed.size();
+}
+
+// A module of the file, with the distinct RVAs of its frames and what they resolve to.
+struct DeferredModule {
+    ImageData image;
+    std::shared_ptr<ImageIndexInfo> indexInfo;
+    std::vector<size_t> offsets;
+    std::vector<FrameInfo> frames;
+    bool found;
+};
+
+// A frame line referencing a module.
+struct DeferredFrame {
+    uint64_t address;
+    uint32_t moduleId;
+    size_t offset;
+};
+
+template<typename T>
+static bool parseNumber(std::string_view text, T& value, int base)
+{
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, base);
+    return error == std::errc{} && end == text.data() + text.size();
+}
+
+static bool parseModule(std::string_view line, uint32_t& id, DeferredModule& module_)
+{
+    std::string_view fields[4];
+    line.remove_prefix(sizeof(MODULE_PREFIX) - 1);
+    for (size_t i = 0; i < 3; ++i) {
+        auto tab = line.find('\t');
+        if (tab == std::string_view::npos) {
+            return false;
+        }
+        fields[i] = line.substr(0, tab);
+        line.remove_prefix(tab + 1);
+    }
+    fields[3] = line;
+
+    if (!parseNumber(fields[0], id, 10)) {
+        return false;
+    }
+
+    module_.image = ImageData{ nullptr, 0, 0, fromUtf8(fields[3].data(), fields[3].size()) };
+    if (fields[1] != "-") {
+        auto indexInfo = std::make_shared<ImageIndexInfo>();
+        indexInfo->pdbFile = fromUtf8(fields[2].data(), fields[2].size());
+        if (parsePdbDebugId(fields[1], *indexInfo)) {
+            module_.indexInfo = std::move(indexInfo);
+        }
+    }
+    return true;
+}
+
+static bool parseFrame(std::string_view line, DeferredFrame& frame)
+{
+    if (!line.starts_with(FRAME_PREFIX) || line.size() < sizeof(FRAME_PREFIX) - 1 + FRAME_ADDRESS_DIGITS + 3) {
+        return false;
+    }
+    line.remove_prefix(sizeof(FRAME_PREFIX) - 1);
+    if (!parseNumber(line.substr(0, FRAME_ADDRESS_DIGITS), frame.address, 16)) {
+        return false;
+    }
+    line.remove_prefix(FRAME_ADDRESS_DIGITS);
+
+    if (!line.starts_with(" m")) {
+        return false;
+    }
+    line.remove_prefix(2);
+    auto plus = line.find("+0x");
+    return plus != std::string_view::npos
+        && parseNumber(line.substr(0, plus), frame.moduleId, 10)
+        && parseNumber(line.substr(plus + 3), frame.offset, 16);
+}
+
+// Calls the function with each line of the text, without its line ending, and whether it ends with \r\n.
+template<typename Function>
+static void forEachLine(std::string_view text, Function&& function)
+{
+    while (!text.empty()) {
+        auto end = text.find('\n');
+        auto line = text.substr(0, end);
+        text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+
+        bool carriageReturn = line.ends_with('\r');
+        if (carriageReturn) {
+            line.remove_suffix(1);
+        }
+        function(line, carriageReturn);
+    }
+}
+
+ResolveStats resolveDeferred(const std::filesystem::path& path, const std::filesystem::path& storeDir, size_t threadCount)
+{
+    ResolveStats stats{};
+    auto temporaryPath = path;
+    temporaryPath += L".tmp";
+    {
+        MappedFile file{ path };
+        std::string_view text{ reinterpret_cast<const char*>(file.data()), file.size() };
+
+        // Collect the module table and the RVAs of every module first, wherever they are in the file.
+        std::unordered_map<uint32_t, DeferredModule> modules;
+        std::vector<DeferredFrame> frames;
+        forEachLine(text, [&](std::string_view line, bool) {
+            DeferredFrame frame;
+            if (line.starts_with(MODULE_PREFIX)) {
+                uint32_t id = 0;
+                DeferredModule module_{};
+                if (parseModule(line, id, module_)) {
+                    modules.insert_or_assign(id, std::move(module_));
+                }
+            }
+            else if (parseFrame(line, frame)) {
+                frames.push_back(frame);
+            }
+        });
+        for (const auto& frame : frames) {
+            auto it = modules.find(frame.moduleId);
+            if (it != modules.end()) {
+                it->second.offsets.push_back(frame.offset);
+            }
+        }
+
+        std::vector<DeferredModule*> pending;
+        for (auto& [id, module_] : modules) {
+            auto& offsets = module_.offsets;
+            std::sort(offsets.begin(), offsets.end());
+            offsets.erase(std::unique(offsets.begin(), offsets.end()), offsets.end());
+            if (module_.indexInfo && !offsets.empty()) {
+                pending.push_back(&module_);
+            }
+        }
+
+        // Each thread takes the next module left, loads its symbols and resolves its RVAs in increasing order.
+        BreakpadBackend backend{ storeDir, threadCount };
+        std::atomic<size_t> next{ 0 };
+        auto resolve = [&backend, &next, &pending]() {
+            for (size_t i = next++; i < pending.size(); i = next++) {
+                auto& module_ = *pending[i];
+                auto index = backend.module(*module_.indexInfo);
+                if (!index) {
+                    continue;
+                }
+
+                module_.frames.resize(module_.offsets.size());
+                SymbolIndex::Cursor cursor;
+                for (size_t j = 0; j < module_.offsets.size(); ++j) {
+                    index->lookup(module_.offsets[j], module_.frames[j], cursor);
+                }
+                module_.found = true;
+            }
+        };
+        {
+            std::vector<std::jthread> threads;
+            for (size_t i = 1; i < std::min(std::max<size_t>(threadCount, 1), pending.size()); ++i) {
+                threads.emplace_back(resolve);
+            }
+            resolve();
+        }
+
+        std::ofstream output{ temporaryPath, std::ios::binary | std::ios::trunc };
+        std::string buffer;
+        forEachLine(text, [&](std::string_view line, bool carriageReturn) {
+            DeferredFrame frame;
+            if (line.starts_with(MODULE_PREFIX)) {
+                return;
+            }
+
+            auto it = parseFrame(line, frame) ? modules.find(frame.moduleId) : modules.end();
+            if (it == modules.end()) {
+                buffer += line;
+            }
+            else {
+                auto& module_ = it->second;
+                const FrameInfo* frameInfo = nullptr;
+                if (module_.found) {
+                    auto position = std::lower_bound(module_.offsets.begin(), module_.offsets.end(), frame.offset);
+                    frameInfo = &module_.frames[position - module_.offsets.begin()];
+                    if (!frameInfo->symbolName.empty()) {
+                        ++stats.framesResolved;
+                    }
+                }
+                ++stats.frames;
+
+                buffer += "   ";
+                appendUtf8(buffer, formatFrame(reinterpret_cast<void*>(frame.address), &module_.image, frame.offset, frameInfo));
+            }
+            buffer += carriageReturn ? "\r\n" : "\n";
+
+            if (buffer.size() >= WRITE_CHUNK_SIZE) {
+                output.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        });
+        output.write(buffer.data(), buffer.size());
+        output.close();
+        if (!output) {
+            std::error_code error;
+            std::filesystem::remove(temporaryPath, error);
+            throw std::runtime_error(std::format("Failed to write {}.", temporaryPath.string()));
+        }
+
+        stats.modules = modules.size();
+        for (const auto& [id, module_] : modules) {
+            stats.modulesFound += module_.found;
+        }
+    }
+
+    // The input is unmapped before being replaced.
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    if (error) {
+        throw std::runtime_error(std::format("Failed to replace {}.", path.string()));
+    }
+    return stats;
+}
@@ -0,0 +1,66 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+
+#include "data.h"
+#include "pe.h"
+
+// Deferred symbolication: while monitoring, frames are written in the text format as a module id and an RVA,
+//   0x00007ffb2c3a1f40 m12+0x1f40
+// and each module is described once by a line of its own, with the PDB identity symbols are looked up by:
+//   Module<TAB>12<TAB><debug id><TAB><pdb file><TAB><image name>
+// Frames outside of any image keep their address only. The debug id and PDB file are "-" for images
+// which could not be read. Module ids are only meaningful within one file.
+
+// Formats a frame for deferred symbolication.
+std::wstring formatDeferredFrame(void* address, const ImageData* image, size_t offset);
+
+// Modules described so far, shared by the workers. Each module is described by the first record referencing it.
+class ModuleTable {
+public:
+    ModuleTable() :
+        mMutex{},
+        mDescribed{},
+        mIndexCache{}
+    {
+    }
+
+    ModuleTable(ModuleTable&) = delete;
+    ModuleTable& operator=(const ModuleTable&) = delete;
+
+    ModuleTable(ModuleTable&&) = delete;
+    ModuleTable& operator=(ModuleTable&&) = delete;
+
+    // Appends the line describing the image, unless it was already described.
+    void describe(const ImageData& image, std::string& text);
+
+    size_t size() const;
+
+private:
+    mutable std::mutex mMutex;
+    std::unordered_set<uint32_t> mDescribed;
+
+    ImageIndexCache mIndexCache;
+};
+
+struct ResolveStats {
+    size_t modules;
+    // Modules with symbols in the store.
+    size_t modulesFound;
+    size_t frames;
+    size_t framesResolved;
+};
+
+// Rewrites a file written with deferred symbolication into the regular text format, with symbols read from
+// a local symbol store laid out as for BreakpadBackend. The whole file is read first, so that the symbols of each
+// module are loaded once and all its distinct RVAs resolved in one pass, modules being resolved in parallel.
+// Throws std::runtime_error if the file cannot be read or rewritten.
+ResolveStats resolveDeferred(const std::filesystem::path& path, const std::filesystem::path& storeDir, size_t threadCount);
+
+#endif // DEFERRED_H
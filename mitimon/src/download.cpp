@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <semaphore>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "download.h"
+#include "http.h"
+#include "metrics.h"
+#include "text.h"
+
+// Holds one of the connections for as long as it lives.
+struct ConnectionSlot {
+    std::counting_semaphore<>& connections;
+
+    ConnectionSlot(std::counting_semaphore<>& connections_) :
+        connections{ connections_ }
+    {
+        connections.acquire();
+    }
+
+    ~ConnectionSlot()
+    {
+        connections.release();
+    }
+};
+
+SymbolDownloader::SymbolDownloader(const std::filesystem::path& storeDir, const std::vector<std::string>& servers, size_t maxConnections) :
+    mStoreDir{ storeDir },
+    mServers{ servers },
+    mConnections{ static_cast<std::ptrdiff_t>(std::max<size_t>(maxConnections, 1)) },
+    mMutex{},
+    mInFlight{},
+    mRequests{ 0 },
+    mCoalesced{ 0 },
+    mDownloads{ 0 },
+    mResumed{ 0 },
+    mFailures{ 0 },
+    mBytes{ 0 }
+{
+}
+
+bool SymbolDownloader::fetch(const std::filesystem::path& relativePath)
+{
+    ++mRequests;
+
+    std::error_code error;
+    if (std::filesystem::is_regular_file(mStoreDir / relativePath, error)) {
+        return true;
+    }
+
+    auto key = relativePath.wstring();
+    std::promise<bool> promise;
+    std::shared_future<bool> future;
+    bool isLeader = false;
+    {
+        std::lock_guard guard(mMutex);
+
+        auto it = mInFlight.find(key);
+        if (it == mInFlight.end()) {
+            future = promise.get_future().share();
+            mInFlight.emplace(key, future);
+            isLeader = true;
+        }
+        else {
+            future = it->second;
+        }
+    }
+
+    if (!isLeader) {
+        ++mCoalesced;
+        return future.get();
+    }
+
+    bool result = false;
+    try {
+        result = download(relativePath);
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+    promise.set_value(result);
+
+    // Later requests check the store first, or try again after a failure.
+    std::lock_guard guard(mMutex);
+    mInFlight.erase(key);
+    return result;
+}
+
+SymbolDownloader::Stats SymbolDownloader::stats() const
+{
+    return Stats{ mRequests.load(), mCoalesced.load(), mDownloads.load(), mResumed.load(), mFailures.load(), mBytes.load() };
+}
+
+bool SymbolDownloader::download(const std::filesystem::path& relativePath)
+{
+    std::wcout << L"Downloading symbols file " << relativePath.filename().wstring() << L"..." << std::endl;
+
+    for (const auto& server : mServers) {
+        ConnectionSlot slot{ mConnections };
+        auto start = Metrics::now();
+        bool downloaded = downloadFrom(server, relativePath);
+        Metrics::add(MetricCounter::DownloadMicroseconds, (Metrics::now() - start) / 1000);
+        if (downloaded) {
+            ++mDownloads;
+            return true;
+        }
+    }
+
+    ++mFailures;
+    return false;
+}
+
+bool SymbolDownloader::downloadFrom(const std::string& server, const std::filesystem::path& relativePath)
+{
+    auto path = mStoreDir / relativePath;
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    auto partialPath = path;
+    partialPath += L".partial";
+    uint64_t offset = 0;
+    if (std::filesystem::is_regular_file(partialPath, error)) {
+        offset = std::filesystem::file_size(partialPath, error);
+        if (error) {
+            offset = 0;
+        }
+    }
+
+    std::ofstream file{ partialPath, std::ios::binary | std::ios::app };
+    if (!file) {
+        return false;
+    }
+
+    uint64_t received = 0;
+    bool restarted = false;
+    HttpResponse response{};
+    try {
+        auto url = server + "/" + toUtf8(relativePath.generic_wstring());
+        response = httpGet(url, offset, [&](const HttpResponse& response, const char* data, size_t size) {
+            // The server sent the whole file instead of the rest of it.
+            if (response.status == 200 && offset && !restarted) {
+                file.close();
+                file.open(partialPath, std::ios::binary | std::ios::trunc);
+                restarted = true;
+            }
+            file.write(data, static_cast<std::streamsize>(size));
+            received += size;
+        });
+    }
+    catch (const std::exception& e) {
+        // What was received so far stays in the partial file.
+        std::cout << e.what() << std::endl;
+        mBytes += received;
+        return false;
+    }
+    file.close();
+    mBytes += received;
+
+    // The partial file does not match what the server has, it is probably already complete but start over anyway.
+    if (response.status == 416) {
+        std::filesystem::remove(partialPath, error);
+        return false;
+    }
+
+    if (response.status != 200 && response.status != 206) {
+        // Do not leave empty partial files behind for files the server does not have.
+        if (!offset) {
+            std::filesystem::remove(partialPath, error);
+        }
+        return false;
+    }
+
+    if (!file || (response.contentLength && received != *response.contentLength)) {
+        return false;
+    }
+
+    if (response.status == 206) {
+        ++mResumed;
+    }
+
+    // Readers of the store only ever see complete files.
+    std::filesystem::rename(partialPath, path, error);
+    return !error;
+}
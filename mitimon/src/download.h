@@ -0,0 +1,66 @@
+#ifndef DOWNLOAD_H
+#define DOWNLOAD_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <mutex>
+#include <semaphore>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Downloads symbol files from symbol servers into a local store laid out the same way,
+// as <file>/<id>/<file>. Each file is only downloaded once even when several threads need it,
+// and the number of connections open at the same time is bounded.
+class SymbolDownloader {
+public:
+    struct Stats {
+        uint64_t requests;
+        uint64_t coalesced;
+        uint64_t downloads;
+        uint64_t resumed;
+        uint64_t failures;
+        uint64_t bytes;
+    };
+
+    // Servers are tried in order, they are URLs without a trailing slash.
+    SymbolDownloader(const std::filesystem::path& storeDir, const std::vector<std::string>& servers, size_t maxConnections);
+
+    SymbolDownloader(SymbolDownloader&) = delete;
+    SymbolDownloader& operator=(const SymbolDownloader&) = delete;
+
+    SymbolDownloader(SymbolDownloader&&) = delete;
+    SymbolDownloader& operator=(SymbolDownloader&&) = delete;
+
+    // Returns true once the file is in the store, downloading it first if needed.
+    // Concurrent requests for the same file wait for the download started by the first one.
+    bool fetch(const std::filesystem::path& relativePath);
+
+    Stats stats() const;
+
+private:
+    bool download(const std::filesystem::path& relativePath);
+
+    // Downloads into a partial file, which is resumed on the next attempt if this one is interrupted.
+    bool downloadFrom(const std::string& server, const std::filesystem::path& relativePath);
+
+private:
+    std::filesystem::path mStoreDir;
+    std::vector<std::string> mServers;
+    std::counting_semaphore<> mConnections;
+
+    std::mutex mMutex;
+    std::unordered_map<std::wstring, std::shared_future<bool>> mInFlight;
+
+    std::atomic<uint64_t> mRequests;
+    std::atomic<uint64_t> mCoalesced;
+    std::atomic<uint64_t> mDownloads;
+    std::atomic<uint64_t> mResumed;
+    std::atomic<uint64_t> mFailures;
+    std::atomic<uint64_t> mBytes;
+};
+
+#endif // DOWNLOAD_H
@@ -0,0 +1,479 @@
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cwctype>
+#include <format>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+#include "filter.h"
+#include "text.h"
+
+// Recursive descent parser emitting the program as it goes, with jumps patched once their target is known.
+class EventFilter::Parser {
+public:
+    Parser(EventFilter& filter, std::string_view expression) :
+        mFilter{ filter },
+        mExpression{ expression },
+        mPosition{ 0 },
+        mNesting{ 0 },
+        mDepth{ 0 }
+    {
+    }
+
+    void parse()
+    {
+        parseOr();
+        skipSpaces();
+        if (mPosition != mExpression.size()) {
+            fail("unexpected text");
+        }
+    }
+
+private:
+    void parseOr()
+    {
+        parseAnd();
+        while (accept("||")) {
+            auto jump = emit(Opcode::JumpIfTrue, 0);
+            parseAnd();
+            emit(Opcode::Or, 0);
+            patch(jump);
+        }
+    }
+
+    void parseAnd()
+    {
+        parseUnary();
+        while (accept("&&")) {
+            auto jump = emit(Opcode::JumpIfFalse, 0);
+            parseUnary();
+            emit(Opcode::And, 0);
+            patch(jump);
+        }
+    }
+
+    void parseUnary()
+    {
+        if (++mNesting > FILTER_MAX_DEPTH) {
+            fail("too much nesting");
+        }
+
+        if (accept("!")) {
+            parseUnary();
+            emit(Opcode::Not, 0);
+        }
+        else if (accept("(")) {
+            parseOr();
+            expect(")");
+        }
+        else {
+            parseTest();
+        }
+
+        --mNesting;
+    }
+
+    void parseTest()
+    {
+        auto name = identifier();
+        Test test{};
+        if (name == "stack") {
+            expect("(");
+            test.field = FilterField::Stack;
+            // Modules are known by their name without extension, as in the reports.
+            test.text = lowerCase(string());
+            if (test.text.ends_with(L".dll") || test.text.ends_with(L".exe")) {
+                test.text.resize(test.text.size() - 4);
+            }
+            expect(")");
+            addTest(std::move(test));
+            return;
+        }
+
+        if (name == "image") {
+            test.field = FilterField::Image;
+        }
+        else if (name == "pid") {
+            test.field = FilterField::Pid;
+        }
+        else if (name == "task") {
+            test.field = FilterField::Task;
+        }
+        else if (name == "id") {
+            test.field = FilterField::EventId;
+        }
+        else if (name.starts_with("prop.") && name.size() > 5) {
+            test.field = FilterField::Property;
+            test.text = fromUtf8(name.data() + 5, name.size() - 5);
+        }
+        else {
+            fail("unknown field");
+        }
+
+        test.comparison = comparison();
+
+        skipSpaces();
+        bool isString = mPosition < mExpression.size() && mExpression[mPosition] == '"';
+        if (isString) {
+            auto pattern = lowerCase(string());
+            if (test.comparison != Comparison::Equal && test.comparison != Comparison::NotEqual) {
+                fail("strings can only be compared with == and !=");
+            }
+            if (test.field == FilterField::Property) {
+                test.value = std::move(pattern);
+            }
+            else {
+                test.text = std::move(pattern);
+            }
+        }
+        else {
+            test.value = number();
+        }
+
+        bool isStringField = test.field == FilterField::Image || test.field == FilterField::Task;
+        if (test.field != FilterField::Property && isString != isStringField) {
+            fail(isStringField ? "expected a string" : "expected a number");
+        }
+
+        addTest(std::move(test));
+    }
+
+    Comparison comparison()
+    {
+        if (accept("==")) {
+            return Comparison::Equal;
+        }
+        if (accept("!=")) {
+            return Comparison::NotEqual;
+        }
+        if (accept("<=")) {
+            return Comparison::LessEqual;
+        }
+        if (accept(">=")) {
+            return Comparison::GreaterEqual;
+        }
+        if (accept("<")) {
+            return Comparison::Less;
+        }
+        if (accept(">")) {
+            return Comparison::Greater;
+        }
+        fail("expected a comparison");
+    }
+
+    std::string_view identifier()
+    {
+        skipSpaces();
+        auto start = mPosition;
+        while (mPosition < mExpression.size()) {
+            auto character = static_cast<unsigned char>(mExpression[mPosition]);
+            if (!std::isalnum(character) && character != '_' && character != '.') {
+                break;
+            }
+            ++mPosition;
+        }
+        if (start == mPosition) {
+            fail("expected a field");
+        }
+        return mExpression.substr(start, mPosition - start);
+    }
+
+    std::wstring string()
+    {
+        skipSpaces();
+        if (mPosition >= mExpression.size() || mExpression[mPosition] != '"') {
+            fail("expected a string");
+        }
+
+        std::string text;
+        for (++mPosition; mPosition < mExpression.size() && mExpression[mPosition] != '"'; ++mPosition) {
+            if (mExpression[mPosition] == '\\' && mPosition + 1 < mExpression.size()) {
+                ++mPosition;
+            }
+            text.push_back(mExpression[mPosition]);
+        }
+        if (mPosition >= mExpression.size()) {
+            fail("unterminated string");
+        }
+        ++mPosition;
+        return fromUtf8(text.data(), text.size());
+    }
+
+    uint64_t number()
+    {
+        skipSpaces();
+        int base = 10;
+        if (mExpression.substr(mPosition, 2) == "0x" || mExpression.substr(mPosition, 2) == "0X") {
+            base = 16;
+            mPosition += 2;
+        }
+
+        auto start = mPosition;
+        uint64_t value = 0;
+        while (mPosition < mExpression.size()) {
+            auto character = static_cast<unsigned char>(mExpression[mPosition]);
+            int digit = std::isdigit(character) ? character - '0'
+                : base == 16 && std::isxdigit(character) ? std::tolower(character) - 'a' + 10
+                : -1;
+            if (digit < 0) {
+                break;
+            }
+            value = value * base + digit;
+            ++mPosition;
+        }
+        if (start == mPosition) {
+            fail("expected a number");
+        }
+        return value;
+    }
+
+    static std::wstring lowerCase(std::wstring text)
+    {
+        for (auto& character : text) {
+            character = static_cast<wchar_t>(std::towlower(character));
+        }
+        return text;
+    }
+
+    void skipSpaces()
+    {
+        while (mPosition < mExpression.size() && std::isspace(static_cast<unsigned char>(mExpression[mPosition]))) {
+            ++mPosition;
+        }
+    }
+
+    bool accept(std::string_view token)
+    {
+        skipSpaces();
+        if (mExpression.substr(mPosition, token.size()) != token) {
+            return false;
+        }
+        // Keep "!=" from being taken for a negation.
+        if (token == "!" && mExpression.substr(mPosition, 2) == "!=") {
+            return false;
+        }
+        mPosition += token.size();
+        return true;
+    }
+
+    void expect(std::string_view token)
+    {
+        if (!accept(token)) {
+            fail(std::format("expected {}", token));
+        }
+    }
+
+    void addTest(Test&& test)
+    {
+        mFilter.mTests.push_back(std::move(test));
+        emit(Opcode::Test, static_cast<uint32_t>(mFilter.mTests.size() - 1));
+    }
+
+    size_t emit(Opcode opcode, uint32_t operand)
+    {
+        // Tests push an operand and And and Or pop one, whichever jumps are taken.
+        if (opcode == Opcode::Test) {
+            if (++mDepth > FILTER_MAX_STACK) {
+                fail("too many pending operands");
+            }
+        }
+        else if (opcode == Opcode::And || opcode == Opcode::Or) {
+            --mDepth;
+        }
+
+        mFilter.mProgram.push_back(Instruction{ opcode, operand });
+        return mFilter.mProgram.size() - 1;
+    }
+
+    void patch(size_t jump)
+    {
+        mFilter.mProgram[jump].operand = static_cast<uint32_t>(mFilter.mProgram.size());
+    }
+
+    [[noreturn]] void fail(std::string_view message)
+    {
+        throw std::runtime_error(std::format("Invalid filter at offset {}: {}.", mPosition, message));
+    }
+
+private:
+    EventFilter& mFilter;
+    std::string_view mExpression;
+    size_t mPosition;
+    size_t mNesting;
+    // Operands pending at this point of the program.
+    size_t mDepth;
+};
+
+EventFilter::EventFilter(std::string_view expression) :
+    mTests{},
+    mProgram{}
+{
+    Parser{ *this, expression }.parse();
+}
+
+FilterResult EventFilter::evaluate(FilterSubject& subject) const
+{
+    // The parser rejects programs needing more.
+    FilterResult stack[FILTER_MAX_STACK];
+    size_t depth = 0;
+
+    for (size_t i = 0; i < mProgram.size(); ++i) {
+        const auto& instruction = mProgram[i];
+        switch (instruction.opcode) {
+        case Opcode::Test:
+            stack[depth++] = run(mTests[instruction.operand], subject);
+            break;
+
+        case Opcode::Not:
+            if (stack[depth - 1] != FilterResult::Unknown) {
+                stack[depth - 1] = stack[depth - 1] == FilterResult::True ? FilterResult::False : FilterResult::True;
+            }
+            break;
+
+        case Opcode::And:
+        {
+            auto right = stack[--depth];
+            auto left = stack[depth - 1];
+            stack[depth - 1] = left == FilterResult::False || right == FilterResult::False ? FilterResult::False
+                : left == FilterResult::True && right == FilterResult::True ? FilterResult::True
+                : FilterResult::Unknown;
+            break;
+        }
+
+        case Opcode::Or:
+        {
+            auto right = stack[--depth];
+            auto left = stack[depth - 1];
+            stack[depth - 1] = left == FilterResult::True || right == FilterResult::True ? FilterResult::True
+                : left == FilterResult::False && right == FilterResult::False ? FilterResult::False
+                : FilterResult::Unknown;
+            break;
+        }
+
+        case Opcode::JumpIfFalse:
+            if (stack[depth - 1] == FilterResult::False) {
+                i = instruction.operand - 1;
+            }
+            break;
+
+        case Opcode::JumpIfTrue:
+            if (stack[depth - 1] == FilterResult::True) {
+                i = instruction.operand - 1;
+            }
+            break;
+        }
+    }
+
+    return stack[0];
+}
+
+bool EventFilter::uses(FilterField field) const
+{
+    for (const auto& test : mTests) {
+        if (test.field == field) {
+            return true;
+        }
+    }
+    return false;
+}
+
+FilterResult EventFilter::run(const Test& test, FilterSubject& subject) const
+{
+    if (!subject.has(test.field)) {
+        return FilterResult::Unknown;
+    }
+
+    bool result = false;
+    switch (test.field) {
+    case FilterField::Image:
+        result = matches(test.text, subject.imageName()) == (test.comparison == Comparison::Equal);
+        break;
+
+    case FilterField::Task:
+        result = matches(test.text, subject.taskName()) == (test.comparison == Comparison::Equal);
+        break;
+
+    case FilterField::Pid:
+        result = compare(test.comparison, subject.pid(), std::get<uint64_t>(test.value));
+        break;
+
+    case FilterField::EventId:
+        result = compare(test.comparison, static_cast<uint64_t>(subject.eventId()), std::get<uint64_t>(test.value));
+        break;
+
+    case FilterField::Property:
+    {
+        // Missing properties and mismatching types never match.
+        FilterValue value;
+        if (!subject.property(test.text, value) || value.index() != test.value.index()) {
+            break;
+        }
+        if (auto number = std::get_if<uint64_t>(&value)) {
+            result = compare(test.comparison, *number, std::get<uint64_t>(test.value));
+        }
+        else {
+            result = matches(std::get<std::wstring>(test.value), std::get<std::wstring>(value)) == (test.comparison == Comparison::Equal);
+        }
+        break;
+    }
+
+    case FilterField::Stack:
+        result = subject.hasModule(test.text);
+        break;
+    }
+
+    return result ? FilterResult::True : FilterResult::False;
+}
+
+bool EventFilter::compare(Comparison comparison, uint64_t left, uint64_t right)
+{
+    switch (comparison) {
+    case Comparison::Equal:
+        return left == right;
+    case Comparison::NotEqual:
+        return left != right;
+    case Comparison::Less:
+        return left < right;
+    case Comparison::LessEqual:
+        return left <= right;
+    case Comparison::Greater:
+        return left > right;
+    case Comparison::GreaterEqual:
+        return left >= right;
+    }
+    return false;
+}
+
+bool EventFilter::matches(std::wstring_view pattern, std::wstring_view text)
+{
+    // Backtrack to the last star only, which is enough for wildcard patterns.
+    size_t p = 0;
+    size_t t = 0;
+    size_t starPattern = std::wstring_view::npos;
+    size_t starText = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == L'?' || pattern[p] == static_cast<wchar_t>(std::towlower(text[t])))) {
+            ++p;
+            ++t;
+        }
+        else if (p < pattern.size() && pattern[p] == L'*') {
+            starPattern = p++;
+            starText = t;
+        }
+        else if (starPattern != std::wstring_view::npos) {
+            p = starPattern + 1;
+            t = ++starText;
+        }
+        else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == L'*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
@@ -0,0 +1,123 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+// Filters are compiled into programs with at most this much nesting.
+#define FILTER_MAX_DEPTH 32
+// Operands pending while a filter is evaluated: a left operand of both || and && at each nesting level, and the last one.
+#define FILTER_MAX_STACK (2 * FILTER_MAX_DEPTH + 1)
+
+// Outcome of a filter. Unknown when the result depends on fields that are not available yet.
+enum class FilterResult : uint8_t {
+    False,
+    True,
+    Unknown,
+};
+
+enum class FilterField : uint8_t {
+    // File name of the process image, such as firefox.exe.
+    Image,
+    Pid,
+    Task,
+    EventId,
+    Property,
+    // Whether a module is found in the stack.
+    Stack,
+};
+
+// Property values are either integers or strings.
+using FilterValue = std::variant<uint64_t, std::wstring>;
+
+// The event a filter is evaluated against. Fields are only read when a test needs them.
+class FilterSubject {
+public:
+    virtual ~FilterSubject() = default;
+
+    // Tests on fields that are not available evaluate to unknown.
+    virtual bool has(FilterField field) = 0;
+
+    virtual uint32_t pid() = 0;
+    // Empty when the process is unknown.
+    virtual std::wstring_view imageName() = 0;
+    virtual std::wstring_view taskName() = 0;
+    virtual int eventId() = 0;
+    // Returns false if the event has no such property.
+    virtual bool property(std::wstring_view name, FilterValue& value) = 0;
+    // The module name is in lower case.
+    virtual bool hasModule(std::wstring_view name) = 0;
+};
+
+// Event filter compiled once from an expression into a flat program, such as:
+//   image == "firefox.exe" && (id == 10 || prop.AcgFlag >= 0x80000000) && !stack("xul.dll")
+//
+// Fields are image, pid, task, id and prop.<property name>, compared with ==, !=, <, <=, > and >=.
+// Strings are quoted, compared case insensitively, and may contain * and ? wildcards. Numbers are decimal
+// or hexadecimal. stack("<module name>") tells whether a module is found in the stack, the .dll or .exe extension
+// being optional. Tests are combined with !, && and || in the usual precedence, and parentheses.
+class EventFilter {
+public:
+    // Throws std::runtime_error describing the syntax error.
+    EventFilter(std::string_view expression);
+
+    // Evaluates the tests as needed, in three-valued logic: unknown operands only matter if they can change the outcome.
+    FilterResult evaluate(FilterSubject& subject) const;
+
+    // Whether the filter reads the given field.
+    bool uses(FilterField field) const;
+
+private:
+    enum class Comparison : uint8_t {
+        Equal,
+        NotEqual,
+        Less,
+        LessEqual,
+        Greater,
+        GreaterEqual,
+    };
+
+    struct Test {
+        FilterField field;
+        Comparison comparison;
+        // Property or module name, or the lower case pattern of string comparisons.
+        std::wstring text;
+        FilterValue value;
+    };
+
+    enum class Opcode : uint8_t {
+        // Pushes the result of a test.
+        Test,
+        Not,
+        And,
+        Or,
+        // Jump if the top of the stack is false or true, leaving it there, to skip the other operand.
+        JumpIfFalse,
+        JumpIfTrue,
+    };
+
+    struct Instruction {
+        Opcode opcode;
+        // Test index or jump target.
+        uint32_t operand;
+    };
+
+    class Parser;
+
+    FilterResult run(const Test& test, FilterSubject& subject) const;
+
+    static bool compare(Comparison comparison, uint64_t left, uint64_t right);
+
+    // Case insensitive match with * and ? wildcards, the pattern being in lower case.
+    static bool matches(std::wstring_view pattern, std::wstring_view text);
+
+private:
+    std::vector<Test> mTests;
+    std::vector<Instruction> mProgram;
+};
+
+#endif // FILTER_H
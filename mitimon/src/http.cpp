@@ -0,0 +1,275 @@
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#include "winkrabs.h"
+#else
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include "http.h"
+#include "text.h"
+
+#define RECEIVE_BUFFER_SIZE (64 * 1024)
+
+#ifdef _WIN32
+
+struct HttpHandleCloser {
+    void operator()(HINTERNET handle) const
+    {
+        ::WinHttpCloseHandle(handle);
+    }
+};
+
+using HttpHandle = std::unique_ptr<void, HttpHandleCloser>;
+
+HttpResponse httpGet(const std::string& url, uint64_t offset, const HttpSink& sink)
+{
+    auto wideUrl = fromUtf8(url.data(), url.size());
+
+    wchar_t host[256]{};
+    wchar_t path[2048]{};
+    URL_COMPONENTS components{};
+    components.dwStructSize = sizeof components;
+    components.lpszHostName = host;
+    components.dwHostNameLength = static_cast<DWORD>(std::size(host));
+    components.lpszUrlPath = path;
+    components.dwUrlPathLength = static_cast<DWORD>(std::size(path));
+    if (!::WinHttpCrackUrl(wideUrl.c_str(), 0, 0, &components)) {
+        throw std::runtime_error("WinHttpCrackUrl failed.");
+    }
+
+    // WinHTTP follows redirects by default.
+    HttpHandle session{ ::WinHttpOpen(L"mitimon", WINHTTP_ACCESS_TYPE_DEFAULT_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0) };
+    if (!session) {
+        throw std::runtime_error("WinHttpOpen failed.");
+    }
+
+    HttpHandle connection{ ::WinHttpConnect(session.get(), host, components.nPort, 0) };
+    if (!connection) {
+        throw std::runtime_error("WinHttpConnect failed.");
+    }
+
+    DWORD flags = components.nScheme == INTERNET_SCHEME_HTTPS ? WINHTTP_FLAG_SECURE : 0;
+    HttpHandle request{ ::WinHttpOpenRequest(connection.get(), L"GET", path, nullptr, WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, flags) };
+    if (!request) {
+        throw std::runtime_error("WinHttpOpenRequest failed.");
+    }
+
+    std::wstring headers;
+    if (offset) {
+        headers = std::format(L"Range: bytes={}-\r\n", offset);
+    }
+    if (!::WinHttpSendRequest(request.get(), headers.empty() ? WINHTTP_NO_ADDITIONAL_HEADERS : headers.c_str(),
+            static_cast<DWORD>(headers.size()), WINHTTP_NO_REQUEST_DATA, 0, 0, 0) ||
+        !::WinHttpReceiveResponse(request.get(), nullptr)) {
+        throw std::runtime_error("WinHttpSendRequest failed.");
+    }
+
+    HttpResponse response{};
+
+    DWORD status = 0;
+    DWORD statusSize = sizeof status;
+    if (!::WinHttpQueryHeaders(request.get(), WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+            WINHTTP_HEADER_NAME_BY_INDEX, &status, &statusSize, WINHTTP_NO_HEADER_INDEX)) {
+        throw std::runtime_error("WinHttpQueryHeaders failed.");
+    }
+    response.status = static_cast<int>(status);
+
+    wchar_t length[32]{};
+    DWORD lengthSize = sizeof length;
+    if (::WinHttpQueryHeaders(request.get(), WINHTTP_QUERY_CONTENT_LENGTH,
+            WINHTTP_HEADER_NAME_BY_INDEX, length, &lengthSize, WINHTTP_NO_HEADER_INDEX)) {
+        response.contentLength = std::wcstoull(length, nullptr, 10);
+    }
+
+    if (response.status != 200 && response.status != 206) {
+        return response;
+    }
+
+    auto buffer = std::make_unique<char[]>(RECEIVE_BUFFER_SIZE);
+    for (;;) {
+        DWORD read = 0;
+        if (!::WinHttpReadData(request.get(), buffer.get(), RECEIVE_BUFFER_SIZE, &read)) {
+            throw std::runtime_error("WinHttpReadData failed.");
+        }
+        if (!read) {
+            break;
+        }
+        sink(response, buffer.get(), read);
+    }
+    return response;
+}
+
+#else
+
+#define MAX_REDIRECTS 5
+#define RECEIVE_TIMEOUT_SECONDS 30
+
+struct Socket {
+    int handle;
+
+    ~Socket()
+    {
+        if (handle >= 0) {
+            ::close(handle);
+        }
+    }
+};
+
+static bool startsWithNoCase(const std::string& text, const std::string& prefix)
+{
+    if (text.size() < prefix.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < prefix.size(); ++i) {
+        if (std::tolower(static_cast<unsigned char>(text[i])) != std::tolower(static_cast<unsigned char>(prefix[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static HttpResponse get(const std::string& url, uint64_t offset, const HttpSink& sink, int redirects)
+{
+    if (!url.starts_with("http://")) {
+        throw std::runtime_error("Only http URLs are supported.");
+    }
+
+    auto rest = url.substr(7);
+    auto slash = rest.find('/');
+    auto hostPort = rest.substr(0, slash);
+    auto path = slash == std::string::npos ? std::string{ "/" } : rest.substr(slash);
+    auto colon = hostPort.rfind(':');
+    auto host = hostPort.substr(0, colon);
+    auto port = colon == std::string::npos ? std::string{ "80" } : hostPort.substr(colon + 1);
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        throw std::runtime_error("getaddrinfo failed.");
+    }
+
+    Socket socket_{ -1 };
+    for (auto address = addresses; address; address = address->ai_next) {
+        socket_.handle = ::socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (socket_.handle >= 0 && ::connect(socket_.handle, address->ai_addr, address->ai_addrlen) == 0) {
+            break;
+        }
+        if (socket_.handle >= 0) {
+            ::close(socket_.handle);
+            socket_.handle = -1;
+        }
+    }
+    ::freeaddrinfo(addresses);
+    if (socket_.handle < 0) {
+        throw std::runtime_error("connect failed.");
+    }
+
+    timeval timeout{ RECEIVE_TIMEOUT_SECONDS, 0 };
+    ::setsockopt(socket_.handle, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+
+    // HTTP/1.0 keeps the body free of chunked encoding, and the connection closes at its end.
+    auto request = std::format("GET {} HTTP/1.0\r\nHost: {}\r\nUser-Agent: mitimon\r\n", path, hostPort);
+    if (offset) {
+        request += std::format("Range: bytes={}-\r\n", offset);
+    }
+    request += "\r\n";
+    for (size_t sent = 0; sent < request.size();) {
+        auto count = ::send(socket_.handle, request.data() + sent, request.size() - sent, 0);
+        if (count <= 0) {
+            throw std::runtime_error("send failed.");
+        }
+        sent += static_cast<size_t>(count);
+    }
+
+    HttpResponse response{};
+    std::optional<std::string> location;
+    std::string header;
+    bool inBody = false;
+
+    auto buffer = std::make_unique<char[]>(RECEIVE_BUFFER_SIZE);
+    for (;;) {
+        auto count = ::recv(socket_.handle, buffer.get(), RECEIVE_BUFFER_SIZE, 0);
+        if (count < 0) {
+            throw std::runtime_error("recv failed.");
+        }
+        if (count == 0) {
+            break;
+        }
+
+        if (inBody) {
+            sink(response, buffer.get(), static_cast<size_t>(count));
+            continue;
+        }
+
+        header.append(buffer.get(), static_cast<size_t>(count));
+        auto end = header.find("\r\n\r\n");
+        if (end == std::string::npos) {
+            continue;
+        }
+
+        // Status line, then one header per line.
+        size_t lineStart = 0;
+        while (lineStart < end) {
+            auto lineEnd = header.find("\r\n", lineStart);
+            auto line = header.substr(lineStart, lineEnd - lineStart);
+            if (lineStart == 0) {
+                auto space = line.find(' ');
+                response.status = space == std::string::npos ? 0 : std::atoi(line.c_str() + space + 1);
+            }
+            else if (startsWithNoCase(line, "Content-Length:")) {
+                response.contentLength = std::strtoull(line.c_str() + 15, nullptr, 10);
+            }
+            else if (startsWithNoCase(line, "Location:")) {
+                auto value = line.substr(9);
+                value.erase(0, value.find_first_not_of(' '));
+                location = value;
+            }
+            lineStart = lineEnd + 2;
+        }
+
+        if (response.status >= 300 && response.status < 400 && location) {
+            if (redirects == 0) {
+                throw std::runtime_error("Too many redirects.");
+            }
+            auto target = location->starts_with("/") ? std::format("http://{}{}", hostPort, *location) : *location;
+            return get(target, offset, sink, redirects - 1);
+        }
+        if (response.status != 200 && response.status != 206) {
+            return response;
+        }
+
+        inBody = true;
+        if (header.size() > end + 4) {
+            sink(response, header.data() + end + 4, header.size() - end - 4);
+        }
+    }
+
+    if (!inBody) {
+        throw std::runtime_error("Incomplete HTTP response.");
+    }
+    return response;
+}
+
+HttpResponse httpGet(const std::string& url, uint64_t offset, const HttpSink& sink)
+{
+    return get(url, offset, sink, MAX_REDIRECTS);
+}
+
+#endif
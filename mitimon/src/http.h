@@ -0,0 +1,23 @@
+#ifndef HTTP_H
+#define HTTP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+
+struct HttpResponse {
+    int status;
+    // Length of the body sent, which is the rest of the file for partial content.
+    std::optional<uint64_t> contentLength;
+};
+
+using HttpSink = std::function<void(const HttpResponse& response, const char* data, size_t size)>;
+
+// Performs a GET request following redirects, asking for the content starting at an offset when it is not 0.
+// The body of successful responses is passed to the sink as it arrives. This uses WinHTTP on Windows,
+// and plain sockets elsewhere, where only http URLs are supported. Throws std::runtime_error if the request cannot be made.
+HttpResponse httpGet(const std::string& url, uint64_t offset, const HttpSink& sink);
+
+#endif // HTTP_H
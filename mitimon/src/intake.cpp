@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "intake.h"
+#include "metrics.h"
+#include "ring.h"
+#include "winkrabs.h"
+
+// The processing thread spins for a while when the ring is empty, then sleeps between checks.
+#define INTAKE_SPIN_COUNT 64
+#define INTAKE_IDLE_SLEEP std::chrono::milliseconds(1)
+
+EventIntake::EventIntake(size_t capacity, Handler&& handler) :
+    mRing{ capacity },
+    mHandler{ std::move(handler) },
+    mOversized{ 0 },
+    mSchemaLocator{},
+    mThread{}
+{
+    mThread = std::jthread([this](std::stop_token stopToken) { run(stopToken); });
+}
+
+EventIntake::~EventIntake()
+{
+    stop();
+}
+
+bool EventIntake::push(EventKind kind, const EVENT_RECORD& record)
+{
+    // Copied before claiming a slot, so that the consumer is not held up by the allocation.
+    std::unique_ptr<uint8_t[]> largeUserData;
+    if (record.UserDataLength > RAW_EVENT_MAX_USER_DATA) {
+        mOversized.fetch_add(1, std::memory_order_relaxed);
+        largeUserData = std::make_unique_for_overwrite<uint8_t[]>(record.UserDataLength);
+        std::memcpy(largeUserData.get(), record.UserData, record.UserDataLength);
+    }
+
+    auto fill = [&kind, &record, &largeUserData](RawEvent& event) {
+        event.kind = kind;
+        event.receivedAt = Metrics::now();
+        event.header = record.EventHeader;
+        event.userDataSize = record.UserDataLength;
+        if (largeUserData) {
+            event.largeUserData = std::move(largeUserData);
+        }
+        else {
+            std::memcpy(event.userData, record.UserData, record.UserDataLength);
+        }
+
+        event.stackSize = 0;
+        for (USHORT i = 0; i < record.ExtendedDataCount; ++i) {
+            const auto& item = record.ExtendedData[i];
+            if (item.ExtType == EVENT_HEADER_EXT_TYPE_STACK_TRACE64) {
+                auto stackTrace = reinterpret_cast<const EVENT_EXTENDED_ITEM_STACK_TRACE64*>(item.DataPtr);
+                size_t count = (item.DataSize - sizeof stackTrace->MatchId) / sizeof(ULONG64);
+                count = std::min<size_t>(count, RAW_EVENT_MAX_STACK);
+                std::memcpy(event.stack, stackTrace->Address, count * sizeof(uint64_t));
+                event.stackSize = static_cast<uint16_t>(count);
+            }
+            else if (item.ExtType == EVENT_HEADER_EXT_TYPE_STACK_TRACE32) {
+                auto stackTrace = reinterpret_cast<const EVENT_EXTENDED_ITEM_STACK_TRACE32*>(item.DataPtr);
+                size_t count = (item.DataSize - sizeof stackTrace->MatchId) / sizeof(ULONG);
+                count = std::min<size_t>(count, RAW_EVENT_MAX_STACK);
+                for (size_t j = 0; j < count; ++j) {
+                    event.stack[j] = stackTrace->Address[j];
+                }
+                event.stackSize = static_cast<uint16_t>(count);
+            }
+        }
+    };
+
+    // Events are pushed from the single ETW consumer thread, so waiting keeps them in order.
+    if (kind == EventKind::Process) {
+        mRing.pushWaiting(fill);
+        return true;
+    }
+    return mRing.tryPush(fill);
+}
+
+void EventIntake::stop()
+{
+    if (mThread.joinable()) {
+        mThread.request_stop();
+        mThread.join();
+    }
+}
+
+EventIntake::Stats EventIntake::stats() const
+{
+    auto ringStats = mRing.stats();
+    return Stats{ ringStats.pushed, ringStats.dropped, ringStats.waited, mOversized.load(std::memory_order_relaxed),
+        ringStats.highWatermark, ringStats.capacity };
+}
+
+void EventIntake::run(std::stop_token stopToken)
+{
+    auto processOne = [this]() {
+        return mRing.tryPop([this](RawEvent& event) {
+            process(event);
+            event.largeUserData.reset();
+        });
+    };
+
+    size_t idleCount = 0;
+    while (!stopToken.stop_requested()) {
+        if (processOne()) {
+            idleCount = 0;
+        }
+        else if (++idleCount < INTAKE_SPIN_COUNT) {
+            std::this_thread::yield();
+        }
+        else {
+            std::this_thread::sleep_for(INTAKE_IDLE_SLEEP);
+        }
+    }
+
+    // The trace is stopped by then, nothing gets pushed anymore.
+    while (processOne()) {
+    }
+}
+
+void EventIntake::process(const RawEvent& event)
+{
+    Metrics::record(LatencyStage::Queued, Metrics::now() - event.receivedAt);
+
+    // Rebuild a record pointing to the copied data. It has no extended data, the stack was extracted already.
+    EVENT_RECORD record{};
+    record.EventHeader = event.header;
+    record.UserDataLength = event.userDataSize;
+    record.UserData = event.largeUserData ? event.largeUserData.get() : const_cast<uint8_t*>(event.userData);
+
+    std::vector<ULONG_PTR> stackTrace(event.stack, event.stack + event.stackSize);
+
+    try {
+        krabs::schema schema(record, mSchemaLocator);
+        krabs::parser parser(schema);
+        mHandler(event.kind, record, schema, parser, std::move(stackTrace));
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef INTAKE_H
+#define INTAKE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "ring.h"
+#include "winkrabs.h"
+
+// ETW does not record more frames than this.
+#define RAW_EVENT_MAX_STACK 192
+// User data larger than this is allocated on the side, the slots are sized for the common events.
+#define RAW_EVENT_MAX_USER_DATA 2048
+
+// Which provider callback an event came from, so that the processing stage can route it.
+enum class EventKind : uint8_t {
+    Process,
+    Mitigation,
+    KernelMemory,
+};
+
+// Everything the processing stage needs from an event record, copied out of the ETW buffers.
+struct RawEvent {
+    EventKind kind;
+    // When the provider callback received the event, as given by Metrics::now.
+    uint64_t receivedAt;
+    EVENT_HEADER header;
+    uint16_t stackSize;
+    uint16_t userDataSize;
+    uint64_t stack[RAW_EVENT_MAX_STACK];
+    uint8_t userData[RAW_EVENT_MAX_USER_DATA];
+    // Holds the user data instead when it is too large for the slot, until the event is processed.
+    std::unique_ptr<uint8_t[]> largeUserData;
+};
+
+// Decouples the ETW consumer thread from the processing of events. Provider callbacks only copy the event header,
+// the stack and the user data into a preallocated ring. When the ring is full, the events of interest are dropped
+// rather than blocking the callbacks, but the process and image events wait for a slot: the process registry cannot
+// do without them, and they are rare. A single processing thread then decodes the events in order, with its own
+// schema cache, and hands them to the handler.
+class EventIntake {
+public:
+    struct Stats {
+        uint64_t pushed;
+        uint64_t dropped;
+        // Process and image events which waited for a slot.
+        uint64_t waited;
+        // Events whose user data was allocated on the side.
+        uint64_t oversized;
+        uint64_t highWatermark;
+        uint64_t capacity;
+    };
+
+    using Handler = std::function<void(EventKind kind, const EVENT_RECORD& record, const krabs::schema& schema,
+        krabs::parser& parser, std::vector<ULONG_PTR>&& stackTrace)>;
+
+    EventIntake(size_t capacity, Handler&& handler);
+
+    // Processes the events still in the ring.
+    ~EventIntake();
+
+    EventIntake(EventIntake&) = delete;
+    EventIntake& operator=(const EventIntake&) = delete;
+
+    EventIntake(EventIntake&&) = delete;
+    EventIntake& operator=(EventIntake&&) = delete;
+
+    // Called from the provider callbacks. Returns false if the event was dropped because the ring was full,
+    // which never happens to process events.
+    bool push(EventKind kind, const EVENT_RECORD& record);
+
+    // Processes the events still in the ring, and stops the processing thread.
+    void stop();
+
+    Stats stats() const;
+
+private:
+    void run(std::stop_token stopToken);
+
+    void process(const RawEvent& event);
+
+private:
+    MpscRing<RawEvent> mRing;
+    Handler mHandler;
+    std::atomic<uint64_t> mOversized;
+
+    // Only used from the processing thread, the one of the trace context belongs to the ETW consumer thread.
+    krabs::schema_locator mSchemaLocator;
+
+    std::jthread mThread;
+};
+
+#endif // INTAKE_H
@@ -0,0 +1,117 @@
+#include <atomic>
+#include <cerrno>
+#include <semaphore>
+#include <stdexcept>
+#include <thread>
+
+#ifdef _WIN32
+#include "winkrabs.h"
+#else
+#include <csignal>
+#include <unistd.h>
+#endif
+
+#include "interrupt.h"
+#include "source.h"
+
+#ifdef _WIN32
+
+static std::atomic<EventSource*> sSource{ nullptr };
+static std::atomic<bool> sInterrupted{ false };
+// Released once the handler is uninstalled, after main cleaned up.
+static std::binary_semaphore sCleanedUp{ 0 };
+
+// Called on a thread of its own.
+static BOOL WINAPI handleConsoleControl(DWORD controlType)
+{
+    auto source = sSource.load();
+    if (!source || sInterrupted.exchange(true)) {
+        return FALSE;
+    }
+    source->stop();
+
+    // The process ends as soon as this returns when the console is closed or the session ends.
+    if (controlType == CTRL_CLOSE_EVENT || controlType == CTRL_LOGOFF_EVENT || controlType == CTRL_SHUTDOWN_EVENT) {
+        sCleanedUp.acquire();
+    }
+    return TRUE;
+}
+
+InterruptHandler::InterruptHandler(EventSource& source)
+{
+    sSource.store(&source);
+    if (!::SetConsoleCtrlHandler(handleConsoleControl, TRUE)) {
+        sSource.store(nullptr);
+        throw std::runtime_error("SetConsoleCtrlHandler failed.");
+    }
+}
+
+InterruptHandler::~InterruptHandler()
+{
+    ::SetConsoleCtrlHandler(handleConsoleControl, FALSE);
+    sSource.store(nullptr);
+    if (sInterrupted.load()) {
+        sCleanedUp.release();
+    }
+}
+
+#else
+
+static int sWritePipe = -1;
+
+static void handleSignal(int)
+{
+    char interrupted = 1;
+    auto savedErrno = errno;
+    [[maybe_unused]] auto written = ::write(sWritePipe, &interrupted, 1);
+    errno = savedErrno;
+}
+
+InterruptHandler::InterruptHandler(EventSource& source) :
+    mPipe{ -1, -1 },
+    mThread{}
+{
+    if (::pipe(mPipe) != 0) {
+        throw std::runtime_error("pipe failed.");
+    }
+    sWritePipe = mPipe[1];
+
+    mThread = std::jthread([this, &source]() {
+        char message = 0;
+        for (;;) {
+            auto count = ::read(mPipe[0], &message, 1);
+            if (count < 0 && errno == EINTR) {
+                continue;
+            }
+            // Woken up by the destructor otherwise.
+            if (count == 1 && message == 1) {
+                source.stop();
+            }
+            return;
+        }
+    });
+
+    // Reset to the default action once delivered, so that the next signal ends the process.
+    struct sigaction action{};
+    action.sa_handler = handleSignal;
+    action.sa_flags = SA_RESETHAND | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+}
+
+InterruptHandler::~InterruptHandler()
+{
+    ::signal(SIGINT, SIG_DFL);
+    ::signal(SIGTERM, SIG_DFL);
+
+    char done = 0;
+    [[maybe_unused]] auto written = ::write(mPipe[1], &done, 1);
+    mThread.join();
+
+    sWritePipe = -1;
+    ::close(mPipe[0]);
+    ::close(mPipe[1]);
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef INTERRUPT_H
+#define INTERRUPT_H
+
+#include <thread>
+
+#include "source.h"
+
+// Stops the source when the console is interrupted, so that run returns and the pending output, capture chunks
+// and reports get written: on Ctrl+C, Ctrl+Break or the console being closed on Windows, on SIGINT or SIGTERM
+// elsewhere. Only the first interruption is handled, the next ones end the process as usual.
+// Only one handler can be installed at a time.
+class InterruptHandler {
+public:
+    // The source must outlive the handler.
+    InterruptHandler(EventSource& source);
+
+    // Uninstalls the handler. On Windows, this lets a console being closed end the process, once cleaned up.
+    ~InterruptHandler();
+
+    InterruptHandler(InterruptHandler&) = delete;
+    InterruptHandler& operator=(const InterruptHandler&) = delete;
+
+    InterruptHandler(InterruptHandler&&) = delete;
+    InterruptHandler& operator=(InterruptHandler&&) = delete;
+
+private:
+#ifndef _WIN32
+    // Signal handlers cannot take locks, they only wake this thread through a pipe to stop the source.
+    int mPipe[2];
+    std::jthread mThread;
+#endif
+};
+
+#endif // INTERRUPT_H
@@ -0,0 +1,126 @@
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "kernel.h"
+#include "pe.h"
+#include "text.h"
+#include "winkrabs.h"
+
+// Layout, all integers being little endian:
+//   uint8[8] magic "MTMKRN01", uint32 time date stamp, uint32 size of image, uint8[16] PDB GUID, uint32 PDB age,
+//   uint32 boot id, uint64 symbol offset, uint64 image base, uint32 PDB file name size, UTF-8 PDB file name
+#define FILE_MAGIC "MTMKRN01"
+#define FILE_HEADER_SIZE 60
+
+#define BOOT_ID_KEY L"SYSTEM\\CurrentControlSet\\Control\\Session Manager\\Memory Management\\PrefetchParameters"
+#define BOOT_ID_VALUE L"BootId"
+
+template<typename T>
+static T load(const uint8_t* data)
+{
+    T value;
+    std::memcpy(&value, data, sizeof value);
+    return value;
+}
+
+template<typename T>
+static void store(uint8_t* data, T value)
+{
+    std::memcpy(data, &value, sizeof value);
+}
+
+bool KernelState::matches(const ImageIndexInfo& other) const
+{
+    return indexInfo.timeDateStamp == other.timeDateStamp && indexInfo.sizeOfImage == other.sizeOfImage &&
+        std::memcmp(indexInfo.pdbGuid, other.pdbGuid, sizeof indexInfo.pdbGuid) == 0 &&
+        indexInfo.pdbAge == other.pdbAge && indexInfo.pdbFile == other.pdbFile;
+}
+
+std::optional<KernelState> loadKernelState(const std::filesystem::path& path)
+{
+    std::ifstream file{ path, std::ios::binary };
+    std::vector<uint8_t> contents{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+    if (contents.size() < FILE_HEADER_SIZE || std::memcmp(contents.data(), FILE_MAGIC, 8) != 0) {
+        return std::nullopt;
+    }
+
+    const uint8_t* data = contents.data();
+    auto pdbFileSize = load<uint32_t>(data + 56);
+    if (contents.size() != FILE_HEADER_SIZE + pdbFileSize) {
+        return std::nullopt;
+    }
+
+    KernelState state{};
+    state.indexInfo.timeDateStamp = load<uint32_t>(data + 8);
+    state.indexInfo.sizeOfImage = load<uint32_t>(data + 12);
+    std::memcpy(state.indexInfo.pdbGuid, data + 16, sizeof state.indexInfo.pdbGuid);
+    state.indexInfo.pdbAge = load<uint32_t>(data + 32);
+    state.bootId = load<uint32_t>(data + 36);
+    state.symbolOffset = load<uint64_t>(data + 40);
+    state.imageBase = load<uint64_t>(data + 48);
+    state.indexInfo.pdbFile = fromUtf8(reinterpret_cast<const char*>(data + FILE_HEADER_SIZE), pdbFileSize);
+    return state;
+}
+
+void saveKernelState(const std::filesystem::path& path, const KernelState& state)
+{
+    auto pdbFile = toUtf8(state.indexInfo.pdbFile);
+    std::vector<uint8_t> contents(FILE_HEADER_SIZE + pdbFile.size());
+    uint8_t* data = contents.data();
+    std::memcpy(data, FILE_MAGIC, 8);
+    store<uint32_t>(data + 8, state.indexInfo.timeDateStamp);
+    store<uint32_t>(data + 12, state.indexInfo.sizeOfImage);
+    std::memcpy(data + 16, state.indexInfo.pdbGuid, sizeof state.indexInfo.pdbGuid);
+    store<uint32_t>(data + 32, state.indexInfo.pdbAge);
+    store<uint32_t>(data + 36, state.bootId);
+    store<uint64_t>(data + 40, state.symbolOffset);
+    store<uint64_t>(data + 48, state.imageBase);
+    store<uint32_t>(data + 56, static_cast<uint32_t>(pdbFile.size()));
+    std::memcpy(data + FILE_HEADER_SIZE, pdbFile.data(), pdbFile.size());
+
+    // Write to a temporary file renamed into place, so that concurrent runs never see a partial state.
+    auto temporaryPath = path;
+    temporaryPath += L".tmp";
+    std::error_code error;
+    {
+        std::ofstream file{ temporaryPath, std::ios::binary | std::ios::trunc };
+        file.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+        if (!file) {
+            error = std::make_error_code(std::errc::io_error);
+        }
+    }
+    if (!error) {
+        std::filesystem::rename(temporaryPath, path, error);
+    }
+    if (error) {
+        std::filesystem::remove(temporaryPath, error);
+    }
+}
+
+std::optional<uint32_t> currentBootId()
+{
+    DWORD bootId = 0;
+    DWORD size = sizeof bootId;
+    if (::RegGetValueW(HKEY_LOCAL_MACHINE, BOOT_ID_KEY, BOOT_ID_VALUE, RRF_RT_REG_DWORD, nullptr, &bootId, &size) != ERROR_SUCCESS) {
+        return std::nullopt;
+    }
+    return static_cast<uint32_t>(bootId);
+}
+
+uint64_t guessImageBase(uint64_t address, uint64_t symbolOffset)
+{
+    bool isOnNextPage = (address & 0xFFFUi64) < (symbolOffset & 0xFFFUi64);
+    uint64_t symbolPage = address & ~0xFFFUi64;
+    if (isOnNextPage) {
+        symbolPage -= 0x1000Ui64;
+    }
+
+    return symbolPage - (symbolOffset & ~0xFFFUi64);
+}
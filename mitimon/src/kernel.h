@@ -0,0 +1,39 @@
+#ifndef KERNEL_H
+#define KERNEL_H
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+
+#include "pe.h"
+
+// What earlier runs found out about the kernel image, so that startup does not need to load the kernel symbols
+// again for the same kernel file, nor to locate the kernel again during the same boot session.
+struct KernelState {
+    // Identifies the kernel file the state applies to.
+    ImageIndexInfo indexInfo;
+
+    // Offset from the image base of the symbol the kernel is located with.
+    uint64_t symbolOffset;
+
+    // The kernel is loaded at a different address on each boot. The image base is 0 if the boot session is unknown.
+    uint32_t bootId;
+    uint64_t imageBase;
+
+    bool matches(const ImageIndexInfo& indexInfo) const;
+};
+
+// Returns std::nullopt if there is no state file or if it is invalid.
+std::optional<KernelState> loadKernelState(const std::filesystem::path& path);
+
+// Failures are ignored, the state is only an optimization.
+void saveKernelState(const std::filesystem::path& path, const KernelState& state);
+
+// Identifies the current boot session, with the boot counter maintained by Windows.
+std::optional<uint32_t> currentBootId();
+
+// Guesses the base of an image from an address somewhere in a symbol, knowing the offset of the symbol from the base.
+// Images are loaded at page boundaries, and the address is assumed to be less than a page after the symbol start.
+uint64_t guessImageBase(uint64_t address, uint64_t symbolOffset);
+
+#endif // KERNEL_H
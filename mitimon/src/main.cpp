@@ -1,16 +1,75 @@
+#include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <format>
 #include <fstream>
 #include <future>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 
-#include "symbols.h"
+#ifdef _WIN32
+#include "kernel.h"
+#include "pdb.h"
 #include "trace.h"
 #include "winkrabs.h"
+#endif
+
+#include "benchmark.h"
+#include "breakpad.h"
+#include "calltree.h"
+#include "capture.h"
+#include "deferred.h"
+#include "download.h"
+#include "filter.h"
+#include "interrupt.h"
+#include "metrics.h"
+#include "output.h"
+#include "pe.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "sampler.h"
+#include "source.h"
+#include "symbols.h"
+#include "synthetic.h"
+#include "text.h"
 
 #define OUTPUT_FILE L"output.txt"
+#define JSON_OUTPUT_FILE L"output.jsonl"
+
+// Formatted events waiting for the output writer, beyond this the workers wait.
+#define OUTPUT_CAPACITY 1024
+
+#define USAGE "Usage: mitimon [--aggregate | --record <capture file> | [--json] [--reorder <milliseconds>] [--sample]] [--breakpad <symbol store>] [--prefetch]\n" \
+              "               [--filter <expression>] [--replay <capture file> | --synthetic <key>=<value>,...] [--realtime]\n" \
+              "       mitimon --defer [--reorder <milliseconds>] [--sample] [--filter <expression>]\n" \
+              "               [--replay <capture file> | --synthetic <key>=<value>,...] [--realtime]\n" \
+              "       mitimon --resolve <deferred output file> <symbol store>\n" \
+              "       mitimon --benchmark [<key>=<value>,...]"
+
+// Files rewritten periodically in aggregation mode.
+#define REPORT_FILE L"report.txt"
+#define FOLDED_FILE L"folded.txt"
+#define REPORT_INTERVAL std::chrono::seconds(60)
+
+// Pipeline metrics, appended as one JSON object per line.
+#define STATS_FILE L"stats.jsonl"
+#define STATS_INTERVAL std::chrono::seconds(10)
+
+// Recorded events are written at least this often, in chunks smaller than usual if needed.
+#define CAPTURE_FLUSH_INTERVAL std::chrono::seconds(5)
+
+// Each call tree node takes 40 bytes.
+#define CALL_TREE_MAX_NODES (4 * 1024 * 1024)
 
 #define SYM_DIR L"C:\\MozSym"
 
@@ -18,67 +77,140 @@
                  L"SRV*" SYM_DIR L"*https://symbols.mozilla.org;"                 \
                  L"SRV*" SYM_DIR L"*https://symbols.mozilla.org/try"
 
-#define SESSION_NAME L"mitimon"
+// Symbol files are downloaded directly from the same servers, with at most this many connections at a time.
+#define SYM_SERVERS { "https://msdl.microsoft.com/download/symbols", "https://symbols.mozilla.org", "https://symbols.mozilla.org/try" }
+#define DOWNLOAD_CONNECTIONS 4
 
-#define MITIGATIONS_PROVIDER L"Microsoft-Windows-Security-Mitigations"
-#define MITIGATIONS_ANY 0x8000000000000000Ui64
+// Memory cap for the symbolicated frames shared across events.
+#define FRAME_CACHE_SIZE (64 * 1024 * 1024)
 
-inline std::wstring stringify(const EVENT_RECORD& record, krabs::parser& parser, const krabs::property& property)
-{
-    std::wstring result(property.name());
+#define SESSION_NAME L"mitimon"
 
-    auto type = property.type();
-    if (type == TDH_INTYPE_POINTER) {
-        if (record.EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) {
-            type = TDH_INTYPE_UINT32;
-        }
-        else {
-            type = TDH_INTYPE_UINT64;
-        }
+#define KERNEL_PATH L"C:\\Windows\\System32\\ntoskrnl.exe"
+#define KERNEL_SYMBOL L"EtwWrite"
+// Where the kernel symbol offset and base are saved for later runs.
+#define KERNEL_STATE_FILE SYM_DIR L"\\kernel.state"
+// Delay between two ACG failures provoked to catch a kernel stack.
+#define KERNEL_PROBE_INTERVAL 50
+
+// Stopped processes and replaced module sets are kept this long, in ETW timestamp units of 100 ns,
+// for events handled after the process exited. Each version kept costs one chunk of its module set, about 1 KB,
+// plus the chunk pointers, about 24 bytes per 12 modules: a few MB for a busy desktop over this period.
+#define MODULE_HISTORY_GRACE_PERIOD (30 * 10000000ULL)
+
+// Raw events copied by the provider callbacks and waiting to be decoded, beyond this they are dropped.
+// Each slot takes about 4 KB.
+#define INTAKE_CAPACITY 2048
+
+// Events waiting for symbolication, beyond this the overflow policy applies.
+#define QUEUE_CAPACITY 1024
+#define OVERFLOW_POLICY WorkerPool::OverflowPolicy::Degrade
+// Replayed and synthetic events can wait for the workers instead, so that none is written without symbols.
+#define RECORD_OVERFLOW_POLICY WorkerPool::OverflowPolicy::Block
+
+// With --sample, each stack signature gets SAMPLE_BURST events written in full, then one per refill interval,
+// the others being counted and reported once per report interval. Intervals are in ETW timestamp units of 100 ns.
+#define SAMPLE_SIGNATURES (64 * 1024)
+#define SAMPLE_BURST 10
+#define SAMPLE_REFILL_INTERVAL (10 * 10000000ULL)
+#define SAMPLE_REPORT_INTERVAL (60 * 10000000ULL)
+
+// Events taken at once by a worker, their frames being symbolicated together.
+#define SYMBOLICATION_BATCH 64
+
+std::wstring labelFrame(SymbolSession& session, const ImageData* image, uint64_t offset)
+{
+    if (!image) {
+        return std::format(L"0x{:016x}", offset);
     }
 
-    switch (type) {
-    case TDH_INTYPE_UNICODESTRING:
-        result += std::format(L" L\"{}\"", parser.parse<std::wstring>(property.name()));
-        break;
+    auto frame = session.symbolicate(*image, offset);
+    if (frame->symbolName.empty()) {
+        return std::format(L"{}+0x{:x}", image->name(), offset);
+    }
+    return std::format(L"{}!{}+0x{:x}", image->name(), frame->symbolName, frame->displacement);
+}
 
-    case TDH_INTYPE_INT8:
-    case TDH_INTYPE_UINT8:
-        result += std::format(L" 0x{:02x}", parser.parse<uint8_t>(property.name()));
-        break;
+void writeCallTree(CallTree& callTree, SymbolSession& session)
+{
+    std::wofstream report{ std::filesystem::path{ REPORT_FILE } };
+    std::wofstream folded{ std::filesystem::path{ FOLDED_FILE } };
+    callTree.write([&session](const ImageData* image, uint64_t offset) {
+        return labelFrame(session, image, offset);
+    }, report, folded);
+}
 
-    case TDH_INTYPE_INT16:
-    case TDH_INTYPE_UINT16:
-        result += std::format(L" 0x{:04x}", parser.parse<uint16_t>(property.name()));
-        break;
+// Appends a JSON line with the latencies and counters merged across threads, and the statistics of the components.
+// Events are dropped from the batch queue, the tasks the pool drops only leave more events for the next ones.
+void writeStats(std::ofstream& file, uint64_t uptime, const EventSource::Stats& source, const WorkerPool::Stats& pool,
+    const BatchQueue<Event>::Stats& queue, const FrameCache::Stats& cache, const SymbolDownloader::Stats& downloads)
+{
+    auto metrics = Metrics::snapshot();
+
+    std::string text = std::format("{{\"uptimeMs\":{},\"latenciesNs\":{{", uptime);
+    for (size_t i = 0; i < metrics.latencies.size(); ++i) {
+        const auto& latency = metrics.latencies[i];
+        text += std::format("{}\"{}\":{{\"count\":{},\"p50\":{},\"p90\":{},\"p99\":{},\"p999\":{},\"max\":{}}}",
+            i ? "," : "", Metrics::name(static_cast<LatencyStage>(i)),
+            latency.count, latency.p50, latency.p90, latency.p99, latency.p999, latency.max);
+    }
+    text += "},\"counters\":{";
+    for (size_t i = 0; i < metrics.counters.size(); ++i) {
+        text += std::format("\"{}\":{},", Metrics::name(static_cast<MetricCounter>(i)), metrics.counters[i]);
+    }
+    text += std::format("\"liveThreads\":{},\"eventsReceived\":{},\"eventsDroppedByIntake\":{},\"eventsWaited\":{},\"eventsOversized\":{},"
+        "\"eventsQueued\":{},\"eventsDroppedByPool\":{},\"eventsDegraded\":{},\"eventsCompleted\":{},"
+        "\"frameCacheHits\":{},\"frameCacheMisses\":{},\"frameCacheBytes\":{},"
+        "\"downloads\":{},\"downloadFailures\":{},\"downloadBytes\":{}}}}}\n",
+        metrics.liveThreads, source.received, source.dropped, source.waited, source.oversized,
+        pool.queued, queue.dropped, pool.degraded + queue.degraded, pool.completed,
+        cache.hits, cache.misses, cache.bytes,
+        downloads.downloads, downloads.failures, downloads.bytes);
+
+    file << text;
+    file.flush();
+}
 
-    case TDH_INTYPE_INT32:
-    case TDH_INTYPE_UINT32:
-        result += std::format(L" 0x{:08x}", parser.parse<uint32_t>(property.name()));
-        break;
+// Measures the startup phases, so that it is clear where the time goes before events can be caught.
+class StartupTimer {
+public:
+    StartupTimer() :
+        mStart{ std::chrono::steady_clock::now() },
+        mPhaseStart{ mStart }
+    {
+    }
 
-    case TDH_INTYPE_INT64:
-    case TDH_INTYPE_UINT64:
-    case TDH_INTYPE_FILETIME:
-        result += std::format(L" 0x{:016x}", parser.parse<uint64_t>(property.name()));
-        break;
+    void endPhase(const wchar_t* phase)
+    {
+        auto now = std::chrono::steady_clock::now();
+        std::wcout << std::format(L"Startup phase {}: {:.1f} ms.", phase,
+            std::chrono::duration<double, std::milli>(now - mPhaseStart).count()) << std::endl;
+        mPhaseStart = now;
+    }
 
-    default:
-        result += std::format(L" ? <unsupported data type {}>", static_cast<int>(type));
-        break;
+    void end()
+    {
+        std::wcout << std::format(L"Startup: {:.1f} ms.",
+            std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - mStart).count()) << std::endl;
     }
 
-    return result;
-}
+private:
+    std::chrono::steady_clock::time_point mStart;
+    std::chrono::steady_clock::time_point mPhaseStart;
+};
 
-void locateKernel()
+#ifdef _WIN32
+// Returns the first return address of the kernel stack of an ACG failure provoked in this process,
+// which points somewhere in the kernel symbol. Returns 0 if the trace could not be started.
+uint64_t captureKernelAddress()
 {
     Tracer tracer(SESSION_NAME);
     std::atomic<bool> canStop{ false };
+    uint64_t kernelAddress = 0;
 
     // Use ACG failures originating from this process to guess the kernel address.
     tracer.addCustomProvider(MITIGATIONS_PROVIDER, MITIGATIONS_ANY,
-        [&canStop](const EVENT_RECORD& record, const krabs::trace_context& traceContext) {
+        [&canStop, &kernelAddress](const EVENT_RECORD& record, const krabs::trace_context& traceContext) {
 
         if (canStop.load()) {
                 return;
@@ -90,17 +222,16 @@ void locateKernel()
             return;
         }
 
-        // Locate the kernel based on the assumption that the first return address points somewhere in EtwWrite.
         auto stackTrace = schema.stack_trace();
-        Symbolicator symbolicator{ ProcessData{ pid, L"self" }, SYM_DIR, SYM_PATH };
-        ProcessData::setKernelImage(symbolicator.guessImageFromSymbol(
-            L"C:\\Windows\\System32\\ntoskrnl.exe", L"EtwWrite", reinterpret_cast<void*>(stackTrace[0])
-        ));
+        if (stackTrace.empty()) {
+            return;
+        }
+        kernelAddress = stackTrace[0];
 
         canStop.store(true);
     });
 
-    // Provoke ACG failures originating from this process.
+    // Provoke ACG failures originating from this process, until the trace is running and catches one.
     std::future<void> backgroundTask = std::async(std::launch::async, [&canStop, &tracer]() {
         while (!canStop.load()) {
             PROCESS_MITIGATION_DYNAMIC_CODE_POLICY policy{};
@@ -110,7 +241,7 @@ void locateKernel()
             if (address) {
                 ::VirtualFree(address, 0, MEM_RELEASE);
             }
-            ::Sleep(500);
+            ::Sleep(KERNEL_PROBE_INTERVAL);
         }
         tracer.stop();
     });
@@ -120,152 +251,506 @@ void locateKernel()
     }
     catch (std::runtime_error e) {
         std::cout << e.what() << std::endl;
+        canStop.store(true);
     }
+
+    return kernelAddress;
 }
 
-int main()
+// Locates the kernel based on the assumption that the first return address of the kernel stacks of ACG failures
+// points somewhere in EtwWrite. The offset of EtwWrite is saved per kernel file, and the guessed base per boot session,
+// so that later runs skip loading the kernel symbols, and during the same boot session, skip the trace as well.
+// Without a PDB backend, the kernel is only located from a saved symbol offset.
+void locateKernel(PdbBackend* pdbBackend, StartupTimer& timer)
 {
-    std::wcout << L"Please wait while the kernel base address is being guessed..." << std::endl;
+    auto indexInfo = readImageIndexInfo(KERNEL_PATH);
+    if (!indexInfo) {
+        return;
+    }
+
+    auto bootId = currentBootId();
+    auto savedState = loadKernelState(KERNEL_STATE_FILE);
+    timer.endPhase(L"loading the kernel state");
+
+    KernelState state{ *indexInfo, 0, 0, 0 };
+    if (savedState && savedState->matches(*indexInfo)) {
+        if (bootId && savedState->bootId == *bootId && savedState->imageBase) {
+            ProcessData::setKernelImage(ImageData{ reinterpret_cast<void*>(savedState->imageBase),
+                indexInfo->sizeOfImage, indexInfo->timeDateStamp, KERNEL_PATH, indexInfo });
+            return;
+        }
+        state.symbolOffset = savedState->symbolOffset;
+    }
+    else {
+        if (!pdbBackend) {
+            return;
+        }
+        auto symbolOffset = pdbBackend->findSymbolOffset(KERNEL_PATH, KERNEL_SYMBOL);
+        timer.endPhase(L"loading the kernel symbols");
+        if (!symbolOffset) {
+            return;
+        }
+        state.symbolOffset = *symbolOffset;
+    }
 
-    locateKernel();
+    auto kernelAddress = captureKernelAddress();
+    timer.endPhase(L"catching a kernel stack");
+    if (!kernelAddress) {
+        return;
+    }
 
-    std::wcout << L"Guessed kernel base address: " << ProcessData::kernelImage().base() << L"." << std::endl << std::endl;
+    // Without a boot id, only the symbol offset can be reused.
+    if (bootId) {
+        state.bootId = *bootId;
+        state.imageBase = guessImageBase(kernelAddress, state.symbolOffset);
+    }
+    saveKernelState(KERNEL_STATE_FILE, state);
 
-    std::wofstream sout{OUTPUT_FILE};
-    std::mutex soutMutex;
+    ProcessData::setKernelImage(ImageData{ reinterpret_cast<void*>(guessImageBase(kernelAddress, state.symbolOffset)),
+        indexInfo->sizeOfImage, indexInfo->timeDateStamp, KERNEL_PATH, indexInfo });
+}
+#endif
 
-    std::vector<std::future<void>> backgroundTasks;
-    Tracer tracer(SESSION_NAME);
+int main(int argc, char* argv[])
+{
+#ifndef _WIN32
+    // Narrow and wide messages are both written to the console, which the C stdout only allows once unsynchronized.
+    std::ios::sync_with_stdio(false);
+#endif
+
+    bool aggregate = false;
+    std::optional<std::string> recordPath;
+    std::optional<std::string> breakpadPath;
+    bool prefetch = false;
+    bool json = false;
+    std::optional<std::chrono::milliseconds> reorderWindow;
+    std::optional<EventFilter> filter;
+    bool sample = false;
+    bool defer = false;
+    std::optional<std::string> replayPath;
+    std::optional<SyntheticConfig> syntheticConfig;
+    bool realtime = false;
+    // Measures the platform-neutral stages on a synthetic workload, without tracing.
+    if (argc >= 2 && std::string_view{ argv[1] } == "--benchmark") {
+        auto config = argc == 3 ? parseSyntheticConfig(argv[2]) : std::optional<SyntheticConfig>{};
+        if (argc == 2) {
+            config.emplace();
+        }
+        if (!config) {
+            std::cout << USAGE << std::endl;
+            return 1;
+        }
+        runBenchmark(*config, std::wcout);
+        return 0;
+    }
 
-    // The process provider will track process creation and image loading,
-    // this is required for symbolication to work.
-    tracer.addProcessProvider();
+    // Rewrites the output of a deferred run with symbols, without tracing.
+    if (argc >= 2 && std::string_view{ argv[1] } == "--resolve") {
+        if (argc != 4) {
+            std::cout << USAGE << std::endl;
+            return 1;
+        }
+        try {
+            auto stats = resolveDeferred(argv[2], argv[3], WorkerPool::defaultWorkerCount());
+            std::wcout << std::format(L"Modules: {}, with symbols: {}, frames: {}, with a symbol: {}.",
+                stats.modules, stats.modulesFound, stats.frames, stats.framesResolved) << std::endl;
+        }
+        catch (std::runtime_error e) {
+            std::cout << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
 
-    // This adds the real provider we are interested in.
-    tracer.addCustomProvider(MITIGATIONS_PROVIDER, MITIGATIONS_ANY,
-        [&backgroundTasks, &sout, &soutMutex](const EVENT_RECORD& record, const krabs::trace_context& traceContext)
-        {
-            krabs::schema schema(record, traceContext.schema_locator);
-            auto taskName = schema.task_name();
-            auto eventId = schema.event_id();
-            auto pid = schema.process_id();
-            auto tid = schema.thread_id();
-            auto stackTrace = schema.stack_trace();
-
-            krabs::parser parser(schema);
-            std::vector<std::wstring> properties;
-            for (const krabs::property& property : parser.properties()) {
-                properties.emplace_back(stringify(record, parser, property));
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg{ argv[i] };
+        if (arg == "--aggregate") {
+            aggregate = true;
+        }
+        else if (arg == "--record" && i + 1 < argc) {
+            recordPath = argv[++i];
+        }
+        else if (arg == "--json") {
+            json = true;
+        }
+        else if (arg == "--reorder" && i + 1 < argc) {
+            reorderWindow = std::chrono::milliseconds{ std::strtoul(argv[++i], nullptr, 10) };
+        }
+        else if (arg == "--breakpad" && i + 1 < argc) {
+            breakpadPath = argv[++i];
+        }
+        else if (arg == "--prefetch") {
+            prefetch = true;
+        }
+        else if (arg == "--sample") {
+            sample = true;
+        }
+        else if (arg == "--defer") {
+            defer = true;
+        }
+        else if (arg == "--replay" && i + 1 < argc) {
+            replayPath = argv[++i];
+        }
+        else if (arg == "--synthetic" && i + 1 < argc) {
+            syntheticConfig = parseSyntheticConfig(argv[++i]);
+            if (!syntheticConfig) {
+                std::cout << "Invalid synthetic workload " << argv[i] << "." << std::endl;
+                std::cout << USAGE << std::endl;
+                return 1;
             }
-
-            ProcessData processData{ pid, L"unknown" };
-            if (ProcessData::exists(pid)) {
-                processData = ProcessData::get(pid);
+        }
+        else if (arg == "--realtime") {
+            realtime = true;
+        }
+        else if (arg == "--filter" && i + 1 < argc) {
+            try {
+                filter.emplace(argv[++i]);
+            }
+            catch (std::runtime_error e) {
+                std::cout << e.what() << std::endl;
+                std::cout << USAGE << std::endl;
+                return 1;
             }
+        }
+        else {
+            std::cout << "Unknown argument " << arg << "." << std::endl;
+            std::cout << USAGE << std::endl;
+            return 1;
+        }
+    }
 
-            // Defer symbolication to leave the main thread responsive to future events.
-            // Use a copy of the process data on the new thread, as it may get modified by future events.
-            backgroundTasks.emplace_back(std::async(std::launch::async, [&sout, &soutMutex, taskName, eventId, pid, tid, stackTrace, properties, processData]() mutable {
-                Symbolicator symbolicator{ std::move(processData), SYM_DIR, SYM_PATH };
+    // Nothing is symbolicated while recording, so there is nothing to prefetch either.
+    // Events are only written one by one to the output file when neither aggregating nor recording.
+    // Deferred output is in the text format, and does not symbolicate anything.
+    if (((aggregate || prefetch) && recordPath) || ((json || reorderWindow || sample) && (aggregate || recordPath))
+        || (defer && (aggregate || recordPath || json || breakpadPath || prefetch))
+        || (replayPath && syntheticConfig) || (realtime && !replayPath && !syntheticConfig)) {
+        std::cout << USAGE << std::endl;
+        return 1;
+    }
 
-                std::lock_guard guard(soutMutex);
+    // Without a recorded or synthetic source, events are traced live. The kernel image then has to be located,
+    // the other sources have a record of it.
+    bool live = !replayPath && !syntheticConfig;
+#ifndef _WIN32
+    if (live) {
+        std::cout << "Tracing requires Windows, events can be replayed with --replay or generated with --synthetic." << std::endl;
+        std::cout << USAGE << std::endl;
+        return 1;
+    }
+#endif
+
+    StartupTimer timer;
+
+    // The kernel is located through DbgHelp, Breakpad symbol files do not have the required information.
+    // DbgHelp is not loaded at all in deferred mode, nor when the symbols come from elsewhere.
+    std::vector<std::string> symServers SYM_SERVERS;
+    std::optional<SymbolDownloader> pdbDownloader;
+#ifdef _WIN32
+    std::optional<PdbBackend> pdbBackend;
+    if (!defer && (live || (!breakpadPath && !syntheticConfig))) {
+        pdbDownloader.emplace(SYM_DIR, symServers, DOWNLOAD_CONNECTIONS);
+        pdbBackend.emplace(SYM_DIR, SYM_PATH, &*pdbDownloader);
+    }
+#endif
 
-                std::cout << "Please wait while a new event is being processed..." << std::endl;
+    std::optional<SymbolDownloader> breakpadDownloader;
+    std::optional<BreakpadBackend> breakpadBackend;
+    if (breakpadPath) {
+        breakpadDownloader.emplace(*breakpadPath, symServers, DOWNLOAD_CONNECTIONS);
+        breakpadBackend.emplace(*breakpadPath, WorkerPool::defaultWorkerCount(), &*breakpadDownloader);
+    }
 
-                sout << std::endl << std::endl;
-                sout << L"TaskName " << taskName << std::endl;
-                sout << L"EventId " << eventId << std::endl;
-                sout << std::format(L"ProcessId 0x{:08x}", pid) << std::endl;
-                sout << std::format(L"ThreadId 0x{:08x}", tid) << std::endl;
-                sout << std::endl;
+    // Synthetic images have no symbols, names are made up for them instead.
+    std::optional<SyntheticBackend> syntheticBackend;
+    SymbolBackend* backend = nullptr;
+    if (breakpadBackend) {
+        backend = &*breakpadBackend;
+    }
+    else if (syntheticConfig) {
+        backend = &syntheticBackend.emplace();
+    }
+#ifdef _WIN32
+    else if (pdbBackend) {
+        backend = &*pdbBackend;
+    }
+#endif
 
-                sout << L"Call Stack:" << std::endl;
-                for (auto& return_address : stackTrace)
-                {
-                    sout << L"   " << symbolicator.symbolicate(reinterpret_cast<void*>(return_address)) << std::endl;
-                }
-                sout << std::endl;
+    std::optional<SymbolSession> session;
+    std::optional<ModuleTable> moduleTable;
+    if (defer) {
+        moduleTable.emplace();
+    }
+    else if (backend) {
+        session.emplace(*backend, FRAME_CACHE_SIZE);
+    }
+    else {
+        std::cout << "Symbols can only be read from Breakpad symbol files on this platform, use --breakpad or --defer." << std::endl;
+        return 1;
+    }
+    timer.endPhase(L"symbol backend initialization");
 
-                for (auto& property : properties) {
-                    sout << property << std::endl;
-                }
-                sout << std::endl;
+#ifdef _WIN32
+    if (live) {
+        std::wcout << L"Please wait while the kernel base address is being guessed..." << std::endl;
 
-                std::cout << "The event was successfully processed." << std::endl << std::endl;
-            }));
-        }
-    );
-
-    // This temporarily adds an extra provider for ACG failures.
-    // This provider catches more failures, but we only get kernel stack traces.
-    tracer.addCustomProvider(L"Microsoft-Windows-Kernel-Memory", 0x100,
-        [&backgroundTasks, &sout, &soutMutex](const EVENT_RECORD& record, const krabs::trace_context& traceContext)
-        {
-            krabs::schema schema(record, traceContext.schema_locator);
-            auto taskName = schema.task_name();
-            auto eventId = schema.event_id();
-            auto pid = schema.process_id();
-            auto tid = schema.thread_id();
-            auto stackTrace = schema.stack_trace();
-
-            krabs::parser parser(schema);
-            std::vector<std::wstring> properties;
-
-            uint32_t AcgFlag = parser.parse<uint32_t>(L"AcgFlag");
-            if ((AcgFlag & 0x80000000) == 0) {
-                return;
-            }
+        locateKernel(pdbBackend ? &*pdbBackend : nullptr, timer);
 
-            for (const krabs::property& property : parser.properties()) {
-                properties.emplace_back(stringify(record, parser, property));
-            }
+        std::wcout << L"Guessed kernel base address: " << ProcessData::kernelImage().base() << L"." << std::endl << std::endl;
+    }
+#endif
 
-            ProcessData processData{ pid, L"unknown" };
-            if (ProcessData::exists(pid)) {
-                processData = ProcessData::get(pid);
-            }
+    ProcessData::setGracePeriod(MODULE_HISTORY_GRACE_PERIOD);
 
-            // Defer symbolication to leave the main thread responsive to future events.
-            // Use a copy of the process data on the new thread, as it may get modified by future events.
-            backgroundTasks.emplace_back(std::async(std::launch::async, [&sout, &soutMutex, taskName, eventId, pid, tid, stackTrace, properties, processData]() mutable {
-                Symbolicator symbolicator{ std::move(processData), SYM_DIR, SYM_PATH };
+    std::optional<OutputWriter> output;
+    if (!aggregate && !recordPath) {
+        output.emplace(json ? JSON_OUTPUT_FILE : OUTPUT_FILE, OUTPUT_CAPACITY, reorderWindow.value_or(std::chrono::milliseconds{ 0 }));
+    }
 
-                std::lock_guard guard(soutMutex);
+    std::optional<CallTree> callTree;
+    if (aggregate) {
+        callTree.emplace(CALL_TREE_MAX_NODES);
+    }
 
-                std::cout << "Please wait while a new event is being processed..." << std::endl;
+    std::optional<CaptureWriter> capture;
+    if (recordPath) {
+        capture.emplace(*recordPath);
+    }
+    if (capture && live) {
+        const auto& kernelImage = ProcessData::kernelImage();
+        capture->writeKernelImage(reinterpret_cast<uint64_t>(kernelImage.base()), kernelImage.size(),
+            kernelImage.timeStamp(), kernelImage.path(), kernelImage.indexInfo());
+    }
 
-                sout << std::endl << std::endl;
-                sout << L"TaskName " << taskName << std::endl;
-                sout << L"EventId " << eventId << std::endl;
-                sout << std::format(L"ProcessId 0x{:08x}", pid) << std::endl;
-                sout << std::format(L"ThreadId 0x{:08x}", tid) << std::endl;
-                sout << std::endl;
+    std::optional<SymbolPrefetcher> prefetcher;
+    if (prefetch) {
+        prefetcher.emplace(*backend, PREFETCH_CONCURRENCY);
+    }
 
-                sout << L"Call Stack:" << std::endl;
-                for (auto& return_address : stackTrace)
-                {
-                    sout << L"   " << symbolicator.symbolicate(reinterpret_cast<void*>(return_address)) << std::endl;
-                }
-                sout << std::endl;
+    std::optional<StackSampler> sampler;
+    if (sample) {
+        sampler.emplace(SAMPLE_SIGNATURES, SAMPLE_BURST, SAMPLE_REFILL_INTERVAL, SAMPLE_REPORT_INTERVAL);
+    }
+
+    // The queued events must outlive the pool, which runs the tasks left when destroyed.
+    auto overflowPolicy = live ? OVERFLOW_POLICY : RECORD_OVERFLOW_POLICY;
+    BatchQueue<Event> events{ QUEUE_CAPACITY, overflowPolicy };
+    WorkerPool pool{ WorkerPool::defaultWorkerCount(), QUEUE_CAPACITY, overflowPolicy };
+
+    Pipeline pipeline{ filter ? &*filter : nullptr, sampler ? &*sampler : nullptr, session ? &*session : nullptr,
+        moduleTable ? &*moduleTable : nullptr, pool, events, SYMBOLICATION_BATCH, output ? &*output : nullptr,
+        json ? OutputFormat::JsonLines : OutputFormat::Text, callTree ? &*callTree : nullptr,
+        capture ? &*capture : nullptr, prefetcher ? &*prefetcher : nullptr };
+
+    std::unique_ptr<EventSource> source;
+#ifdef _WIN32
+    TraceSource* traceSource = nullptr;
+#endif
+    // Interrupting stops the source, so that everything below still runs.
+    std::optional<InterruptHandler> interruptHandler;
+    auto pacing = realtime ? RecordSource::Pacing::RealTime : RecordSource::Pacing::MaxSpeed;
+    try {
+        if (replayPath) {
+            source = std::make_unique<ReplaySource>(*replayPath, pacing);
+        }
+        else if (syntheticConfig) {
+            source = std::make_unique<SyntheticSource>(*syntheticConfig, pacing);
+        }
+#ifdef _WIN32
+        else {
+            auto ownTraceSource = std::make_unique<TraceSource>(SESSION_NAME, INTAKE_CAPACITY, filter ? &*filter : nullptr);
+            traceSource = ownTraceSource.get();
+            source = std::move(ownTraceSource);
+        }
+#endif
+        interruptHandler.emplace(*source);
+    }
+    catch (std::runtime_error e) {
+        std::cout << e.what() << std::endl;
+        return 1;
+    }
 
-                for (auto& property : properties) {
-                    sout << property << std::endl;
+    // Rewrite the aggregated reports periodically, so that they can be looked at while monitoring.
+    std::mutex reporterMutex;
+    std::condition_variable_any reporterCondition;
+    std::jthread reporter;
+    if (callTree) {
+        reporter = std::jthread([&](std::stop_token stopToken) {
+            std::unique_lock lock(reporterMutex);
+            for (;;) {
+                reporterCondition.wait_for(lock, stopToken, REPORT_INTERVAL, [] { return false; });
+                if (stopToken.stop_requested()) {
+                    break;
                 }
-                sout << std::endl;
+                writeCallTree(*callTree, *session);
+            }
+        });
+    }
 
-                std::cout << "The event was successfully processed." << std::endl << std::endl;
-            }));
+    // Dump the metrics periodically, so that they can be followed while monitoring.
+    auto startTime = std::chrono::steady_clock::now();
+    std::ofstream statsFile{ std::filesystem::path{ STATS_FILE } };
+    auto downloadStats = [&]() {
+        return breakpadDownloader ? breakpadDownloader->stats() : pdbDownloader ? pdbDownloader->stats() : SymbolDownloader::Stats{};
+    };
+    auto dumpStats = [&]() {
+        auto uptime = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - startTime);
+        writeStats(statsFile, static_cast<uint64_t>(uptime.count()), source->stats(), pool.stats(), events.stats(),
+            session ? session->cacheStats() : FrameCache::Stats{}, downloadStats());
+    };
+
+    std::mutex statsMutex;
+    std::condition_variable_any statsCondition;
+    std::jthread statsReporter([&](std::stop_token stopToken) {
+        std::unique_lock lock(statsMutex);
+        for (;;) {
+            statsCondition.wait_for(lock, stopToken, STATS_INTERVAL, [] { return false; });
+            if (stopToken.stop_requested()) {
+                break;
+            }
+            dumpStats();
         }
-    );
+    });
 
-    std::wcout << L"Ready to catch events! You may now start the processes you wish to monitor." << std::endl << std::endl;
+    // Write the recorded events periodically, so that they are kept even if the process gets killed.
+    std::mutex captureMutex;
+    std::condition_variable_any captureCondition;
+    std::jthread captureFlusher;
+    if (capture) {
+        captureFlusher = std::jthread([&](std::stop_token stopToken) {
+            std::unique_lock lock(captureMutex);
+            for (;;) {
+                captureCondition.wait_for(lock, stopToken, CAPTURE_FLUSH_INTERVAL, [] { return false; });
+                if (stopToken.stop_requested()) {
+                    break;
+                }
+                capture->flush();
+            }
+        });
+    }
+
+    timer.endPhase(L"pipeline setup");
+    timer.end();
+
+    if (live) {
+        std::wcout << L"Ready to catch events! You may now start the processes you wish to monitor." << std::endl << std::endl;
+    }
 
+    auto sourceStart = std::chrono::steady_clock::now();
     try {
-        tracer.start();
+        source->run([&pipeline](CaptureRecord& record, EventDetails* details) {
+            handleRecord(pipeline, record, details);
+        });
     }
     catch (std::runtime_error e) {
         std::cout << e.what() << std::endl;
     }
+    auto sourceSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - sourceStart).count();
+
+    // Let the workers finish the events queued, so that the reports and statistics below include them.
+    pool.drain();
+
+    // Report the counts left, now that no more events come.
+    if (sampler) {
+        std::vector<StackSampler::Suppressed> reports;
+        sampler->flush(reports);
+        writeSuppressed(pipeline, reports);
+    }
+
+    if (output) {
+        output->close();
+    }
+
+    if (capture) {
+        captureFlusher.request_stop();
+        captureFlusher.join();
+        capture->close();
+    }
+
+    if (callTree) {
+        reporter.request_stop();
+        reporter.join();
+        writeCallTree(*callTree, *session);
+    }
+
+    statsReporter.request_stop();
+    statsReporter.join();
+    dumpStats();
+
+    auto sourceStats = source->stats();
+    if (live) {
+        std::wcout << std::format(L"Events received: {}, dropped: {}, waited for: {}, oversized: {}, most waiting: {} of {}.",
+            sourceStats.received, sourceStats.dropped, sourceStats.waited, sourceStats.oversized, sourceStats.highWatermark,
+            sourceStats.capacity) << std::endl;
+    }
+    else {
+        std::wcout << std::format(L"Records delivered: {} in {:.3f} s, {:.0f} per second.",
+            sourceStats.received, sourceSeconds, sourceStats.received / sourceSeconds) << std::endl;
+    }
+
+    if (filter) {
+        auto counters = Metrics::snapshot().counters;
+        std::wcout << std::format(L"Events filtered out on the consumer thread: {}, on the intake thread: {}.",
+            counters[static_cast<size_t>(MetricCounter::EventsFilteredEarly)],
+            counters[static_cast<size_t>(MetricCounter::EventsFilteredLate)]) << std::endl;
+    }
+
+    if (sampler) {
+        auto samplerStats = sampler->stats();
+        std::wcout << std::format(L"Stack signatures tracked: {}, evicted: {}, events written: {}, suppressed: {}.",
+            samplerStats.signatures, samplerStats.evictions, samplerStats.admitted, samplerStats.suppressed) << std::endl;
+    }
+
+#ifdef _WIN32
+    if (traceSource) {
+        auto decoderStats = traceSource->decoderStats();
+        std::wcout << std::format(L"Event schemas compiled: {}, decoded through TDH: {}, events decoded through TDH: {}.",
+            decoderStats.schemas, decoderStats.rejected, decoderStats.fallbacks) << std::endl;
+    }
+#endif
+
+    auto timelineStats = ProcessData::stats();
+    std::wcout << std::format(L"Processes tracked: {}, module set versions: {}, processes retired: {}.",
+        timelineStats.processes, timelineStats.versions, timelineStats.retiredProcesses) << std::endl;
+
+    auto metrics = Metrics::snapshot();
+    for (size_t i = 0; i < metrics.latencies.size(); ++i) {
+        const auto& latency = metrics.latencies[i];
+        const char* name = Metrics::name(static_cast<LatencyStage>(i));
+        std::wcout << std::format(L"Latency {}: {} events, p50 {} us, p99 {} us, max {} us.",
+            fromUtf8(name, std::strlen(name)), latency.count,
+            latency.p50 / 1000, latency.p99 / 1000, latency.max / 1000) << std::endl;
+    }
+
+    auto stats = pool.stats();
+    auto queueStats = events.stats();
+    std::wcout << std::format(L"Events queued: {}, dropped: {}, degraded: {}, completed: {}.",
+        stats.queued, queueStats.dropped, stats.degraded + queueStats.degraded, stats.completed) << std::endl;
+
+    if (session) {
+        auto cacheStats = session->cacheStats();
+        std::wcout << std::format(L"Frame cache hits: {}, misses: {}, evictions: {}, entries: {}, bytes: {}.",
+            cacheStats.hits, cacheStats.misses, cacheStats.evictions, cacheStats.entries, cacheStats.bytes) << std::endl;
+    }
+
+    if (moduleTable) {
+        std::wcout << std::format(L"Modules described for deferred symbolication: {}.", moduleTable->size()) << std::endl;
+    }
+
+    if (prefetcher) {
+        auto prefetchStats = prefetcher->stats();
+        std::wcout << std::format(L"Images prefetched: {} of {}.", prefetchStats.completed, prefetchStats.queued) << std::endl;
+    }
+
+    if (output) {
+        auto outputStats = output->stats();
+        std::wcout << std::format(L"Output records written: {}, writes: {}, bytes: {}, late: {}.",
+            outputStats.records, outputStats.writes, outputStats.bytes, outputStats.late) << std::endl;
+    }
+
+    auto symbolDownloads = downloadStats();
+    std::wcout << std::format(L"Symbol downloads: {}, resumed: {}, failed: {}, coalesced requests: {}, bytes: {}.",
+        symbolDownloads.downloads, symbolDownloads.resumed, symbolDownloads.failures, symbolDownloads.coalesced, symbolDownloads.bytes) << std::endl;
 
     return 0;
 }
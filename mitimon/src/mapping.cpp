@@ -0,0 +1,91 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include "winkrabs.h"
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "mapping.h"
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::filesystem::path& path) :
+    mData{ nullptr },
+    mSize{ 0 },
+    mMapping{ nullptr }
+{
+    HANDLE file = ::CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("CreateFileW failed.");
+    }
+
+    LARGE_INTEGER size{};
+    if (!::GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        ::CloseHandle(file);
+        throw std::runtime_error("GetFileSizeEx failed.");
+    }
+
+    HANDLE mapping = ::CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    ::CloseHandle(file);
+    if (!mapping) {
+        throw std::runtime_error("CreateFileMappingW failed.");
+    }
+
+    auto data = ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        ::CloseHandle(mapping);
+        throw std::runtime_error("MapViewOfFile failed.");
+    }
+
+    mData = static_cast<const uint8_t*>(data);
+    mSize = static_cast<size_t>(size.QuadPart);
+    mMapping = mapping;
+}
+
+MappedFile::~MappedFile()
+{
+    ::UnmapViewOfFile(mData);
+    ::CloseHandle(mMapping);
+}
+
+#else
+
+MappedFile::MappedFile(const std::filesystem::path& path) :
+    mData{ nullptr },
+    mSize{ 0 },
+    mMapping{ nullptr }
+{
+    int file = ::open(path.c_str(), O_RDONLY);
+    if (file < 0) {
+        throw std::runtime_error("open failed.");
+    }
+
+    struct stat status{};
+    if (::fstat(file, &status) != 0 || status.st_size == 0) {
+        ::close(file);
+        throw std::runtime_error("fstat failed.");
+    }
+
+    auto data = ::mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    ::close(file);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("mmap failed.");
+    }
+
+    mData = static_cast<const uint8_t*>(data);
+    mSize = static_cast<size_t>(status.st_size);
+}
+
+MappedFile::~MappedFile()
+{
+    ::munmap(const_cast<uint8_t*>(mData), mSize);
+}
+
+#endif
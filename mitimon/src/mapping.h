@@ -0,0 +1,31 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+
+// Read-only memory mapping of a whole file. Pages are only read from disk when they are accessed.
+class MappedFile {
+public:
+    // Throws std::runtime_error if the file cannot be opened or mapped, or is empty.
+    MappedFile(const std::filesystem::path& path);
+
+    ~MappedFile();
+
+    MappedFile(MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&&) = delete;
+    MappedFile& operator=(MappedFile&&) = delete;
+
+    const uint8_t* data() const { return mData; }
+    size_t size() const { return mSize; }
+
+private:
+    const uint8_t* mData;
+    size_t mSize;
+    void* mMapping;
+};
+
+#endif // MAPPING_H
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "metrics.h"
+
+std::mutex Metrics::shardsMutex;
+std::vector<std::unique_ptr<Metrics::Shard>> Metrics::shards;
+std::atomic<uint64_t> Metrics::liveThreads{ 0 };
+
+LatencyHistogram::LatencyHistogram() :
+    mBuckets{},
+    mMax{ 0 }
+{
+    for (auto& bucket : mBuckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+size_t LatencyHistogram::bucketIndex(uint64_t value)
+{
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return static_cast<size_t>(value);
+    }
+
+    // Keep the 5 highest bits: the leading one and the position within the power of two.
+    size_t shift = std::bit_width(value) - 5;
+    return shift * (HISTOGRAM_SUB_BUCKETS / 2) + static_cast<size_t>(value >> shift);
+}
+
+uint64_t LatencyHistogram::bucketHighest(size_t index)
+{
+    if (index < HISTOGRAM_SUB_BUCKETS) {
+        return index;
+    }
+
+    size_t shift = index / (HISTOGRAM_SUB_BUCKETS / 2) - 1;
+    uint64_t subBucket = index - shift * (HISTOGRAM_SUB_BUCKETS / 2);
+    return ((subBucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < mBuckets.size(); ++i) {
+        auto count = other.mBuckets[i].load(std::memory_order_relaxed);
+        if (count) {
+            mBuckets[i].store(mBuckets[i].load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+        }
+    }
+    mMax.store(std::max(mMax.load(std::memory_order_relaxed), other.mMax.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+}
+
+LatencyHistogram::Summary LatencyHistogram::summarize() const
+{
+    // Copy the counts first, as they may change while summarizing.
+    std::array<uint64_t, HISTOGRAM_BUCKETS> counts;
+    uint64_t total = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        counts[i] = mBuckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    auto max = mMax.load(std::memory_order_relaxed);
+
+    auto percentile = [&counts, total, max](uint64_t perMille) {
+        // The rank of the value, counting from 1.
+        uint64_t rank = std::max<uint64_t>(1, (total * perMille + 999) / 1000);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return std::min(bucketHighest(i), max);
+            }
+        }
+        return max;
+    };
+
+    if (total == 0) {
+        return Summary{ 0, 0, 0, 0, 0, 0 };
+    }
+    return Summary{ total, percentile(500), percentile(900), percentile(990), percentile(999), max };
+}
+
+uint64_t Metrics::now()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+Metrics::Snapshot Metrics::snapshot()
+{
+    std::array<LatencyHistogram, static_cast<size_t>(LatencyStage::Count)> latencies;
+    Snapshot snapshot{};
+    {
+        std::lock_guard lock(shardsMutex);
+        for (const auto& shard : shards) {
+            for (size_t i = 0; i < latencies.size(); ++i) {
+                latencies[i].merge(shard->latencies[i]);
+            }
+            for (size_t i = 0; i < snapshot.counters.size(); ++i) {
+                snapshot.counters[i] += shard->counters[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < latencies.size(); ++i) {
+        snapshot.latencies[i] = latencies[i].summarize();
+    }
+    snapshot.liveThreads = liveThreads.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+const char* Metrics::name(LatencyStage stage)
+{
+    switch (stage) {
+    case LatencyStage::Queued:
+        return "queued";
+    case LatencyStage::Symbolicated:
+        return "symbolicated";
+    case LatencyStage::Written:
+        return "written";
+    default:
+        return "unknown";
+    }
+}
+
+const char* Metrics::name(MetricCounter counter)
+{
+    switch (counter) {
+    case MetricCounter::EventsHandled:
+        return "eventsHandled";
+    case MetricCounter::ModuleLoads:
+        return "moduleLoads";
+    case MetricCounter::DownloadMicroseconds:
+        return "downloadMicroseconds";
+    case MetricCounter::EventsFilteredEarly:
+        return "eventsFilteredEarly";
+    case MetricCounter::EventsFilteredLate:
+        return "eventsFilteredLate";
+    case MetricCounter::EventsSuppressed:
+        return "eventsSuppressed";
+    default:
+        return "unknown";
+    }
+}
+
+Metrics::ThreadShard::ThreadShard() :
+    shard{ nullptr }
+{
+    auto newShard = std::make_unique<Shard>();
+    for (auto& counter : newShard->counters) {
+        counter.store(0, std::memory_order_relaxed);
+    }
+    shard = newShard.get();
+
+    std::lock_guard lock(shardsMutex);
+    shards.push_back(std::move(newShard));
+    liveThreads.fetch_add(1, std::memory_order_relaxed);
+}
+
+Metrics::ThreadShard::~ThreadShard()
+{
+    liveThreads.fetch_sub(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,143 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Values below HISTOGRAM_SUB_BUCKETS are kept exactly, larger ones in half as many buckets per power of two,
+// for a relative precision of 1/16.
+#define HISTOGRAM_SUB_BUCKETS 32
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS + (HISTOGRAM_SUB_BUCKETS / 2) * (64 - 5))
+
+// Histogram of latencies in nanoseconds, in log-linear buckets as HDR histograms do, covering all 64-bit values
+// in 8 KB. Only one thread may record into a histogram, any thread may read it at the same time.
+class LatencyHistogram {
+public:
+    struct Summary {
+        uint64_t count;
+        uint64_t p50;
+        uint64_t p90;
+        uint64_t p99;
+        uint64_t p999;
+        uint64_t max;
+    };
+
+    LatencyHistogram();
+
+    LatencyHistogram(LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    LatencyHistogram(LatencyHistogram&&) = delete;
+    LatencyHistogram& operator=(LatencyHistogram&&) = delete;
+
+    void record(uint64_t value)
+    {
+        // A plain load and store, as there is a single writer.
+        auto& bucket = mBuckets[bucketIndex(value)];
+        bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (value > mMax.load(std::memory_order_relaxed)) {
+            mMax.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    // Adds the values recorded in another histogram to this one, which must not be recorded into concurrently.
+    void merge(const LatencyHistogram& other);
+
+    // Percentiles are given as the highest value of their bucket, or the maximum if lower.
+    Summary summarize() const;
+
+    static size_t bucketIndex(uint64_t value);
+
+    static uint64_t bucketHighest(size_t index);
+
+private:
+    std::array<std::atomic<uint64_t>, HISTOGRAM_BUCKETS> mBuckets;
+    std::atomic<uint64_t> mMax;
+};
+
+// Intervals between the stages an event goes through.
+enum class LatencyStage : uint8_t {
+    // From the ETW callback to the intake thread.
+    Queued,
+    // From the intake thread to the end of symbolication, including the wait for a worker.
+    Symbolicated,
+    // From the submission to the output writer to the file write.
+    Written,
+    Count,
+};
+
+enum class MetricCounter : uint8_t {
+    EventsHandled,
+    ModuleLoads,
+    DownloadMicroseconds,
+    // Events dropped by the filter on the ETW consumer thread, and on the intake thread.
+    EventsFilteredEarly,
+    EventsFilteredLate,
+    // Events counted instead of being written, their stack signature being over its rate.
+    EventsSuppressed,
+    Count,
+};
+
+// Pipeline instrumentation cheap enough to stay enabled: each thread records into its own shard, without
+// any atomic read-modify-write, and the shards are merged when a snapshot is taken.
+class Metrics {
+public:
+    struct Snapshot {
+        std::array<LatencyHistogram::Summary, static_cast<size_t>(LatencyStage::Count)> latencies;
+        std::array<uint64_t, static_cast<size_t>(MetricCounter::Count)> counters;
+        // Threads that recorded anything and are still running.
+        uint64_t liveThreads;
+    };
+
+    // Monotonic time in nanoseconds, for latencies.
+    static uint64_t now();
+
+    static void record(LatencyStage stage, uint64_t nanoseconds)
+    {
+        shard().latencies[static_cast<size_t>(stage)].record(nanoseconds);
+    }
+
+    static void add(MetricCounter counter, uint64_t value = 1)
+    {
+        auto& total = shard().counters[static_cast<size_t>(counter)];
+        total.store(total.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static Snapshot snapshot();
+
+    // Names used in the stats file.
+    static const char* name(LatencyStage stage);
+    static const char* name(MetricCounter counter);
+
+private:
+    struct Shard {
+        std::array<LatencyHistogram, static_cast<size_t>(LatencyStage::Count)> latencies;
+        std::array<std::atomic<uint64_t>, static_cast<size_t>(MetricCounter::Count)> counters;
+    };
+
+    // Registers a shard for the thread on first use. Shards outlive their thread, so that nothing is lost.
+    struct ThreadShard {
+        ThreadShard();
+        ~ThreadShard();
+
+        Shard* shard;
+    };
+
+    static Shard& shard()
+    {
+        thread_local ThreadShard threadShard;
+        return *threadShard.shard;
+    }
+
+private:
+    static std::mutex shardsMutex;
+    static std::vector<std::unique_ptr<Shard>> shards;
+    static std::atomic<uint64_t> liveThreads;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,309 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "metrics.h"
+#include "output.h"
+#include "sampler.h"
+#include "text.h"
+
+bool OutputWriter::isLater(const Record& left, const Record& right)
+{
+    if (left.timestamp != right.timestamp) {
+        return left.timestamp > right.timestamp;
+    }
+    return left.sequence > right.sequence;
+}
+
+OutputWriter::OutputWriter(const std::filesystem::path& path, size_t capacity, std::chrono::milliseconds reorderWindow) :
+    mFile{ path },
+    mCapacity{ std::max<size_t>(capacity, 1) },
+    mReorderWindow{ reorderWindow },
+    mMutex{},
+    mNotEmpty{},
+    mNotFull{},
+    mStopping{ false },
+    mPending{},
+    mFreeBuffers{},
+    mSequence{ 0 },
+    mLastTimestamp{ 0 },
+    mStats{},
+    mThread{}
+{
+    if (!mFile) {
+        throw std::runtime_error("Failed to create the output file.");
+    }
+
+    mPending.reserve(mCapacity);
+    mThread = std::thread([this]() { run(); });
+}
+
+OutputWriter::~OutputWriter()
+{
+    close();
+}
+
+std::string OutputWriter::buffer()
+{
+    std::lock_guard guard(mMutex);
+    if (mFreeBuffers.empty()) {
+        return std::string{};
+    }
+
+    auto result = std::move(mFreeBuffers.back());
+    mFreeBuffers.pop_back();
+    return result;
+}
+
+void OutputWriter::submit(uint64_t timestamp, std::string&& record)
+{
+    {
+        std::unique_lock lock(mMutex);
+        mNotFull.wait(lock, [this]() { return mPending.size() < mCapacity; });
+
+        if (timestamp < mLastTimestamp) {
+            ++mStats.late;
+        }
+
+        mPending.push_back(Record{ timestamp, mSequence++, std::chrono::steady_clock::now(), std::move(record) });
+        if (mReorderWindow.count()) {
+            std::push_heap(mPending.begin(), mPending.end(), isLater);
+        }
+    }
+    mNotEmpty.notify_one();
+}
+
+void OutputWriter::close()
+{
+    if (!mThread.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard guard(mMutex);
+        mStopping = true;
+    }
+    mNotEmpty.notify_all();
+    mThread.join();
+}
+
+OutputWriter::Stats OutputWriter::stats() const
+{
+    std::lock_guard guard(mMutex);
+    return mStats;
+}
+
+void OutputWriter::run()
+{
+    std::vector<Record> batch;
+    std::string data;
+
+    for (;;) {
+        bool stopping = false;
+        {
+            std::unique_lock lock(mMutex);
+            for (;;) {
+                if (mStopping) {
+                    break;
+                }
+                if (mPending.empty()) {
+                    mNotEmpty.wait(lock);
+                    continue;
+                }
+                if (!mReorderWindow.count() || mPending.size() >= mCapacity) {
+                    break;
+                }
+
+                // Wait for the earliest record to have been held for the whole window, unless it is already late.
+                const auto& first = mPending.front();
+                auto due = first.submitted + mReorderWindow;
+                if (first.timestamp <= mLastTimestamp || std::chrono::steady_clock::now() >= due) {
+                    break;
+                }
+                mNotEmpty.wait_until(lock, due);
+            }
+
+            stopping = mStopping;
+            takeDue(batch, stopping);
+        }
+        mNotFull.notify_all();
+
+        if (!batch.empty()) {
+            data.clear();
+            for (const auto& record : batch) {
+                data += record.text;
+            }
+            mFile.write(data.data(), static_cast<std::streamsize>(data.size()));
+            mFile.flush();
+
+            auto written = std::chrono::steady_clock::now();
+            for (const auto& record : batch) {
+                Metrics::record(LatencyStage::Written, static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(written - record.submitted).count()));
+            }
+
+            std::lock_guard guard(mMutex);
+            mStats.records += batch.size();
+            ++mStats.writes;
+            mStats.bytes += data.size();
+            for (auto& record : batch) {
+                if (mFreeBuffers.size() < mCapacity) {
+                    record.text.clear();
+                    mFreeBuffers.push_back(std::move(record.text));
+                }
+            }
+            batch.clear();
+        }
+
+        if (stopping) {
+            break;
+        }
+    }
+}
+
+void OutputWriter::takeDue(std::vector<Record>& batch, bool all)
+{
+    if (!mReorderWindow.count()) {
+        std::move(mPending.begin(), mPending.end(), std::back_inserter(batch));
+        mPending.clear();
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    while (!mPending.empty()) {
+        const auto& first = mPending.front();
+        bool isDue = all || mPending.size() >= mCapacity || first.timestamp <= mLastTimestamp ||
+            now >= first.submitted + mReorderWindow;
+        if (!isDue) {
+            break;
+        }
+
+        std::pop_heap(mPending.begin(), mPending.end(), isLater);
+        mLastTimestamp = std::max(mLastTimestamp, mPending.back().timestamp);
+        batch.push_back(std::move(mPending.back()));
+        mPending.pop_back();
+    }
+}
+
+void appendJsonString(std::string& result, std::wstring_view text)
+{
+    result.push_back('"');
+
+    // Copy the runs of characters that need no escaping as they are.
+    size_t runStart = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        auto character = text[i];
+        if (character >= 0x20 && character != L'"' && character != L'\\') {
+            continue;
+        }
+
+        appendUtf8(result, text.substr(runStart, i - runStart));
+        runStart = i + 1;
+        switch (character) {
+        case L'"':
+            result += "\\\"";
+            break;
+        case L'\\':
+            result += "\\\\";
+            break;
+        case L'\n':
+            result += "\\n";
+            break;
+        case L'\r':
+            result += "\\r";
+            break;
+        case L'\t':
+            result += "\\t";
+            break;
+        default:
+            result += std::format("\\u{:04x}", static_cast<unsigned>(character));
+            break;
+        }
+    }
+    appendUtf8(result, text.substr(runStart));
+
+    result.push_back('"');
+}
+
+void formatText(std::string& text, const Event& event, const std::vector<std::wstring>& frames)
+{
+    text += "\n\n";
+    text += "TaskName ";
+    appendUtf8(text, event.taskName);
+    text += std::format("\nEventId {}\n", event.eventId);
+    text += std::format("ProcessId 0x{:08x}\n", event.pid);
+    text += std::format("ThreadId 0x{:08x}\n", event.tid);
+    if (event.signature) {
+        text += std::format("Signature 0x{:016x}\n", event.signature);
+    }
+    text += "\n";
+
+    text += "Call Stack:\n";
+    for (const auto& frame : frames) {
+        text += "   ";
+        appendUtf8(text, frame);
+        text += "\n";
+    }
+    text += "\n";
+
+    for (const auto& property : event.properties) {
+        appendUtf8(text, property);
+        text += "\n";
+    }
+    text += "\n";
+}
+
+void formatJson(std::string& text, const Event& event, const std::vector<std::wstring>& frames, bool degraded)
+{
+    text += std::format("{{\"timestamp\":{},\"taskName\":", event.timestamp);
+    appendJsonString(text, event.taskName);
+    text += std::format(",\"eventId\":{},\"processId\":{},\"threadId\":{},\"degraded\":{},",
+        event.eventId, event.pid, event.tid, degraded ? "true" : "false");
+    if (event.signature) {
+        text += std::format("\"signature\":\"{:016x}\",", event.signature);
+    }
+    text += "\"stack\":[";
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (i) {
+            text += ",";
+        }
+        appendJsonString(text, frames[i]);
+    }
+    text += "],\"properties\":[";
+    for (size_t i = 0; i < event.properties.size(); ++i) {
+        if (i) {
+            text += ",";
+        }
+        appendJsonString(text, event.properties[i]);
+    }
+    text += "]}\n";
+}
+
+void formatSuppressedText(std::string& text, const StackSampler::Suppressed& suppressed)
+{
+    text += "\n\n";
+    text += "TaskName ";
+    appendUtf8(text, suppressed.taskName);
+    text += std::format("\nEventId {}\n", suppressed.eventId);
+    text += std::format("Signature 0x{:016x}\n", suppressed.signature);
+    text += std::format("Suppressed {} events with this signature, from {} to {}.\n\n",
+        suppressed.count, suppressed.firstTimestamp, suppressed.lastTimestamp);
+}
+
+void formatSuppressedJson(std::string& text, const StackSampler::Suppressed& suppressed)
+{
+    text += std::format("{{\"timestamp\":{},\"taskName\":", suppressed.lastTimestamp);
+    appendJsonString(text, suppressed.taskName);
+    text += std::format(",\"eventId\":{},\"signature\":\"{:016x}\",\"suppressed\":{},\"firstTimestamp\":{}}}\n",
+        suppressed.eventId, suppressed.signature, suppressed.count, suppressed.firstTimestamp);
+}
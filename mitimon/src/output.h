@@ -0,0 +1,129 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "data.h"
+#include "sampler.h"
+
+enum class OutputFormat {
+    // The human readable format, one block of lines per event.
+    Text,
+    // One UTF-8 JSON object per line, for machine ingestion.
+    JsonLines,
+};
+
+// Single writer thread for the output file. Workers format complete records off-lock into buffers taken
+// from the writer, and hand them back to it. The writer thread concatenates whatever records are pending
+// into large writes, and recycles the buffers.
+//
+// With a reorder window, records are held for that long after they are submitted, and written in timestamp order.
+// Records submitted after a record with a later timestamp was already written are written right away, and counted as late.
+class OutputWriter {
+public:
+    struct Stats {
+        uint64_t records;
+        uint64_t writes;
+        uint64_t bytes;
+        uint64_t late;
+    };
+
+    // Throws std::runtime_error if the file cannot be created. A zero reorder window writes records in submission order.
+    OutputWriter(const std::filesystem::path& path, size_t capacity, std::chrono::milliseconds reorderWindow);
+
+    // Writes all the pending records, if not closed already.
+    ~OutputWriter();
+
+    OutputWriter(OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    OutputWriter(OutputWriter&&) = delete;
+    OutputWriter& operator=(OutputWriter&&) = delete;
+
+    // Returns an empty buffer to format a record into, reusing the capacity of a record already written.
+    std::string buffer();
+
+    // Queues a formatted record, waiting if capacity records are already pending.
+    void submit(uint64_t timestamp, std::string&& record);
+
+    // Writes all the pending records and stops the writer thread. Nothing can be submitted afterwards.
+    void close();
+
+    Stats stats() const;
+
+private:
+    struct Record {
+        uint64_t timestamp;
+        uint64_t sequence;
+        std::chrono::steady_clock::time_point submitted;
+        std::string text;
+    };
+
+    // Orders the pending records as a min heap by timestamp, ties keeping the submission order.
+    static bool isLater(const Record& left, const Record& right);
+
+    void run();
+
+    // Moves the records due for writing to the batch, in order. Called with the mutex held.
+    void takeDue(std::vector<Record>& batch, bool all);
+
+private:
+    std::ofstream mFile;
+    size_t mCapacity;
+    std::chrono::milliseconds mReorderWindow;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+    bool mStopping;
+
+    // Pending records, a heap by timestamp with a reorder window, in submission order otherwise.
+    std::vector<Record> mPending;
+    std::vector<std::string> mFreeBuffers;
+    uint64_t mSequence;
+    uint64_t mLastTimestamp;
+
+    Stats mStats;
+
+    std::thread mThread;
+};
+
+// An event as handed to the workers, with the properties already decoded.
+struct Event {
+    uint64_t timestamp;
+    std::wstring taskName;
+    int eventId;
+    uint32_t pid;
+    uint32_t tid;
+    std::vector<uint64_t> stackTrace;
+    std::vector<std::wstring> properties;
+    ModuleSet::Pointer modules;
+    // When the intake thread handled the event, as given by Metrics::now.
+    uint64_t handledAt;
+    // Stack signature when sampling, 0 otherwise.
+    uint64_t signature;
+};
+
+// Appends text as a quoted JSON string.
+void appendJsonString(std::string& result, std::wstring_view text);
+
+// Append the record of an event with its symbolicated frames, in the text or JSON lines format.
+// Degraded events are the ones written without symbolication.
+void formatText(std::string& text, const Event& event, const std::vector<std::wstring>& frames);
+void formatJson(std::string& text, const Event& event, const std::vector<std::wstring>& frames, bool degraded);
+
+// Append the record of the events of a stack signature that were counted instead of being written.
+void formatSuppressedText(std::string& text, const StackSampler::Suppressed& suppressed);
+void formatSuppressedJson(std::string& text, const StackSampler::Suppressed& suppressed);
+
+#endif // OUTPUT_H
@@ -0,0 +1,264 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "data.h"
+#include "pdb.h"
+#include "symbols.h"
+#include "symindex.h"
+#include "text.h"
+#include "winkrabs.h"
+
+// Modules are loaded for conversion in a private address space, far from the addresses DbgHelp picks
+// when loading an image at its preferred base.
+#define CONVERSION_BASE 0x100000000000Ui64
+
+// Tags from cvconst.h.
+#define SYM_TAG_FUNCTION 5
+#define SYM_TAG_PUBLIC_SYMBOL 10
+
+PdbBackend::PdbBackend(const std::wstring& symDir, const std::wstring& symPath, SymbolDownloader* downloader) :
+    mMutex{},
+    mProcess{ reinterpret_cast<HANDLE>(1) },
+    mSymDir{ symDir },
+    mDownloader{ downloader },
+    mModuleMap{},
+    mIndexCache{}
+{
+    ::SymSetOptions(SYMOPT_IGNORE_NT_SYMPATH);
+
+    if (!::CreateDirectoryW(symDir.c_str(), nullptr) && ::GetLastError() != ERROR_ALREADY_EXISTS) {
+        throw std::runtime_error("CreateDirectoryW failed.");
+    }
+
+    if (!::SymInitializeW(mProcess, symPath.c_str(), FALSE)) {
+        throw std::runtime_error("SymInitializeW failed.");
+    }
+}
+
+PdbBackend::~PdbBackend()
+{
+    ::SymCleanup(mProcess);
+}
+
+void PdbBackend::symbolicate(const ImageData& imageData, size_t offset, FrameInfo& frame)
+{
+    auto index = load(imageData);
+
+    // Lookups only read the mapped index, they do not need to be serialized like DbgHelp calls.
+    if (index) {
+        index->lookup(offset, frame);
+    }
+}
+
+void PdbBackend::symbolicateBatch(const ImageData& imageData, const std::vector<size_t>& offsets, std::vector<FrameInfo>& frames)
+{
+    frames.resize(offsets.size());
+    auto index = load(imageData);
+    if (!index) {
+        return;
+    }
+
+    SymbolIndex::Cursor cursor;
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        index->lookup(offsets[i], frames[i], cursor);
+    }
+}
+
+void PdbBackend::prefetch(const ImageData& imageData)
+{
+    load(imageData);
+}
+
+std::shared_ptr<const SymbolIndex> PdbBackend::load(const ImageData& imageData)
+{
+    {
+        std::lock_guard guard(mMutex);
+        auto it = mModuleMap.find(imageData.id());
+        if (it != mModuleMap.end()) {
+            return it->second;
+        }
+    }
+
+    // Neither reading the image nor downloading needs DbgHelp, other images can be symbolicated meanwhile.
+    auto indexInfo = mIndexCache.get(imageData.path());
+    if (indexInfo && mDownloader) {
+        auto indexPath = std::filesystem::path{ mSymDir } / symbolIndexPath(*indexInfo);
+        std::error_code error;
+        if (!std::filesystem::is_regular_file(indexPath, error)) {
+            mDownloader->fetch(std::filesystem::path{ indexInfo->pdbFile } / pdbDebugId(*indexInfo) / indexInfo->pdbFile);
+        }
+    }
+
+    std::lock_guard guard(mMutex);
+    auto [it, isNew] = mModuleMap.emplace(imageData.id(), nullptr);
+
+    if (!isNew) {
+        auto & [imageId, index] = *it;
+        return index;
+    }
+
+    if (!indexInfo) {
+        return nullptr;
+    }
+
+    // A PDB converted by a previous run does not even need to be looked up on the symbol path.
+    auto indexPath = std::filesystem::path{ mSymDir } / symbolIndexPath(*indexInfo);
+    if (auto index = SymbolIndex::open(indexPath, *indexInfo)) {
+        it->second = index;
+        return index;
+    }
+
+    // A downloaded PDB is found in the symbol directory, which is the downstream store of the symbol path.
+    if (!findPdb(*indexInfo)) {
+        return nullptr;
+    }
+
+    const wchar_t* imagePath = imageData.path().c_str();
+    const wchar_t* imageName = imageData.name().c_str();
+    auto module_ = ::SymLoadModuleExW(
+        mProcess, nullptr, imagePath, imageName,
+        CONVERSION_BASE, static_cast<DWORD>(imageData.size()), nullptr, 0);
+    if (!module_) {
+        return nullptr;
+    }
+
+    IMAGEHLP_MODULEW64 moduleInfo{};
+    moduleInfo.SizeOfStruct = sizeof moduleInfo;
+    if (!::SymGetModuleInfoW64(mProcess, module_, &moduleInfo)) {
+        ::SymUnloadModule64(mProcess, module_);
+        return nullptr;
+    }
+
+    std::wcout << L"Converting symbols file " << indexInfo->pdbFile << L"..." << std::endl;
+
+    try {
+        SymbolIndexWriter writer;
+        convert(module_, writer);
+        it->second = SymbolIndex::save(indexPath, writer.finish(*indexInfo));
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+
+    ::SymUnloadModule64(mProcess, module_);
+    return it->second;
+}
+
+void PdbBackend::convert(DWORD64 module_, SymbolIndexWriter& writer)
+{
+    struct Line {
+        uint32_t rva;
+        uint32_t lineNumber;
+        const std::string* fileName;
+    };
+
+    struct Conversion {
+        DWORD64 base;
+        SymbolIndexWriter& writer;
+        std::vector<Line> lines;
+        std::unordered_map<std::wstring, std::string> fileNames;
+    };
+
+    Conversion conversion{ module_, writer, {}, {} };
+
+    ::SymEnumSymbolsW(mProcess, module_, L"*", [](PSYMBOL_INFOW symbol, ULONG, PVOID context) -> BOOL {
+        auto& conversion = *static_cast<Conversion*>(context);
+        if (symbol->Address < conversion.base || symbol->Address - conversion.base > UINT32_MAX) {
+            return TRUE;
+        }
+
+        auto rva = static_cast<uint32_t>(symbol->Address - conversion.base);
+        if (symbol->Tag == SYM_TAG_FUNCTION) {
+            conversion.writer.addFunction(rva, symbol->Size, toUtf8(std::wstring{ symbol->Name, symbol->NameLen }));
+        }
+        else if (symbol->Tag == SYM_TAG_PUBLIC_SYMBOL) {
+            conversion.writer.addPublic(rva, toUtf8(std::wstring{ symbol->Name, symbol->NameLen }));
+        }
+        return TRUE;
+    }, &conversion);
+
+    ::SymEnumLinesW(mProcess, module_, nullptr, nullptr, [](PSRCCODEINFOW line, PVOID context) -> BOOL {
+        auto& conversion = *static_cast<Conversion*>(context);
+        if (line->Address < conversion.base || line->Address - conversion.base > UINT32_MAX) {
+            return TRUE;
+        }
+
+        auto [it, isNew] = conversion.fileNames.emplace(line->FileName, std::string{});
+        if (isNew) {
+            it->second = toUtf8(it->first);
+        }
+        conversion.lines.push_back(Line{ static_cast<uint32_t>(line->Address - conversion.base), line->LineNumber, &it->second });
+        return TRUE;
+    }, &conversion);
+
+    // DbgHelp only gives line start addresses, each line ends where the next one starts.
+    auto& lines = conversion.lines;
+    std::sort(lines.begin(), lines.end(), [](const Line& left, const Line& right) { return left.rva < right.rva; });
+    for (size_t i = 0; i < lines.size(); ++i) {
+        uint32_t size = i + 1 < lines.size() ? lines[i + 1].rva - lines[i].rva : 1;
+        if (size) {
+            writer.addLine(lines[i].rva, size, lines[i].lineNumber, *lines[i].fileName);
+        }
+    }
+}
+
+bool PdbBackend::findPdb(const ImageIndexInfo& indexInfo)
+{
+    if (!mDownloader) {
+        std::wcout << L"Downloading symbols file " << indexInfo.pdbFile << L"..." << std::endl;
+    }
+
+    GUID guid;
+    std::memcpy(&guid, indexInfo.pdbGuid, sizeof(guid));
+
+    wchar_t foundFile[MAX_PATH + 1]{};
+    return ::SymFindFileInPathW(mProcess, nullptr, indexInfo.pdbFile.c_str(),
+        &guid, indexInfo.pdbAge, 0, SSRVOPT_GUIDPTR, foundFile,
+        nullptr, nullptr);
+}
+
+std::optional<uint64_t> PdbBackend::findSymbolOffset(const std::wstring& imagePath, const std::wstring& symbolName)
+{
+    std::lock_guard guard(mMutex);
+
+    auto indexInfo = mIndexCache.get(imagePath);
+    if (!indexInfo || !findPdb(*indexInfo)) {
+        return std::nullopt;
+    }
+
+    auto module_ = ::SymLoadModuleExW(
+        mProcess, nullptr, imagePath.c_str(), L"_temporary_guess_",
+        0, 0, nullptr, 0);
+    if (!module_) {
+        return std::nullopt;
+    }
+
+    IMAGEHLP_MODULEW64 moduleInfo{};
+    moduleInfo.SizeOfStruct = sizeof moduleInfo;
+    if (!::SymGetModuleInfoW64(mProcess, module_, &moduleInfo)) {
+        ::SymUnloadModule64(mProcess, module_);
+        return std::nullopt;
+    }
+
+    SYMBOL_INFOW symbol{};
+    symbol.SizeOfStruct = sizeof (symbol);
+    symbol.MaxNameLen = 0;
+    if (!::SymFromNameW(mProcess, std::format(L"_temporary_guess_!{}", symbolName).c_str(), &symbol)) {
+        ::SymUnloadModule64(mProcess, module_);
+        return std::nullopt;
+    }
+
+    ::SymUnloadModule64(mProcess, module_);
+
+    return symbol.Address - moduleInfo.BaseOfImage;
+}
@@ -0,0 +1,63 @@
+#ifndef PDB_H
+#define PDB_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.h"
+#include "data.h"
+#include "download.h"
+#include "pe.h"
+#include "symbols.h"
+#include "symindex.h"
+#include "winkrabs.h"
+
+// Long-lived DbgHelp session loading PDB files from the symbol path. Each PDB is converted once to a symbol index,
+// stored next to it in the symbol directory, and lookups are then made in the mapped index.
+// With a downloader, PDB files are downloaded into the symbol directory without holding up other DbgHelp calls.
+class PdbBackend : public SymbolBackend {
+public:
+    PdbBackend(const std::wstring& symDir, const std::wstring& symPath, SymbolDownloader* downloader = nullptr);
+
+    ~PdbBackend() override;
+
+    PdbBackend(PdbBackend&) = delete;
+    PdbBackend& operator=(const PdbBackend&) = delete;
+
+    PdbBackend(PdbBackend&&) = delete;
+    PdbBackend& operator=(PdbBackend&&) = delete;
+
+    void symbolicate(const ImageData& imageData, size_t offset, FrameInfo& frame) override;
+
+    void symbolicateBatch(const ImageData& imageData, const std::vector<size_t>& offsets, std::vector<FrameInfo>& frames) override;
+
+    void prefetch(const ImageData& imageData) override;
+
+    // Returns the offset of a symbol from the base of an image, loading the PDB of the image.
+    std::optional<uint64_t> findSymbolOffset(const std::wstring& imagePath, const std::wstring& symbolName);
+
+private:
+    // DbgHelp is single threaded, all calls must be made with this mutex held.
+    std::mutex mMutex;
+    HANDLE mProcess;
+
+    std::wstring mSymDir;
+    SymbolDownloader* mDownloader;
+
+    // Maps image ids to their symbol index, or to nullptr if loading failed.
+    std::unordered_map<uint32_t, std::shared_ptr<const SymbolIndex>> mModuleMap;
+
+    ImageIndexCache mIndexCache;
+
+    // Takes the mutex itself, and releases it while downloading.
+    std::shared_ptr<const SymbolIndex> load(const ImageData& imageData);
+    bool findPdb(const ImageIndexInfo& indexInfo);
+    void convert(DWORD64 module_, SymbolIndexWriter& writer);
+};
+
+#endif // PDB_H
@@ -0,0 +1,223 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "mapping.h"
+#include "pe.h"
+#include "text.h"
+
+#define IMAGE_DOS_SIGNATURE 0x5a4d // "MZ"
+#define IMAGE_NT_SIGNATURE 0x00004550 // "PE\0\0"
+#define IMAGE_NT_OPTIONAL_HDR32_MAGIC 0x10b
+#define IMAGE_NT_OPTIONAL_HDR64_MAGIC 0x20b
+#define IMAGE_DIRECTORY_ENTRY_DEBUG 6
+#define IMAGE_DEBUG_TYPE_CODEVIEW 2
+#define CODEVIEW_RSDS_SIGNATURE 0x53445352 // "RSDS"
+
+#define FILE_HEADER_SIZE 20
+#define SECTION_HEADER_SIZE 40
+#define DEBUG_DIRECTORY_SIZE 28
+
+template <typename T>
+static bool read(const uint8_t* data, size_t size, size_t offset, T& value)
+{
+    if (offset > size || size - offset < sizeof(T)) {
+        return false;
+    }
+    std::memcpy(&value, data + offset, sizeof(T));
+    return true;
+}
+
+// Converts a relative virtual address to a file offset, using the section table.
+static bool rvaToOffset(const uint8_t* data, size_t size, size_t sections, uint16_t sectionCount, uint32_t rva, size_t& offset)
+{
+    for (uint16_t i = 0; i < sectionCount; ++i) {
+        size_t section = sections + size_t(i) * SECTION_HEADER_SIZE;
+        uint32_t virtualSize, virtualAddress, rawSize, rawPointer;
+        if (!read(data, size, section + 8, virtualSize) ||
+            !read(data, size, section + 12, virtualAddress) ||
+            !read(data, size, section + 16, rawSize) ||
+            !read(data, size, section + 20, rawPointer)) {
+            return false;
+        }
+
+        auto extent = virtualSize ? virtualSize : rawSize;
+        if (virtualAddress <= rva && rva - virtualAddress < extent) {
+            offset = size_t(rawPointer) + (rva - virtualAddress);
+            return true;
+        }
+    }
+    return false;
+}
+
+std::shared_ptr<const ImageIndexInfo> parseImageIndexInfo(const uint8_t* data, size_t size)
+{
+    uint16_t dosSignature;
+    uint32_t ntOffset, ntSignature;
+    if (!read(data, size, 0, dosSignature) || dosSignature != IMAGE_DOS_SIGNATURE ||
+        !read(data, size, 0x3c, ntOffset) ||
+        !read(data, size, ntOffset, ntSignature) || ntSignature != IMAGE_NT_SIGNATURE) {
+        return nullptr;
+    }
+
+    size_t fileHeader = size_t(ntOffset) + 4;
+    uint16_t sectionCount, optionalHeaderSize;
+    uint32_t timeDateStamp;
+    if (!read(data, size, fileHeader + 2, sectionCount) ||
+        !read(data, size, fileHeader + 4, timeDateStamp) ||
+        !read(data, size, fileHeader + 16, optionalHeaderSize)) {
+        return nullptr;
+    }
+
+    size_t optionalHeader = fileHeader + FILE_HEADER_SIZE;
+    uint16_t magic;
+    uint32_t sizeOfImage;
+    if (!read(data, size, optionalHeader, magic) ||
+        !read(data, size, optionalHeader + 56, sizeOfImage)) {
+        return nullptr;
+    }
+
+    size_t directoryCountOffset;
+    if (magic == IMAGE_NT_OPTIONAL_HDR64_MAGIC) {
+        directoryCountOffset = 108;
+    }
+    else if (magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) {
+        directoryCountOffset = 92;
+    }
+    else {
+        return nullptr;
+    }
+
+    uint32_t directoryCount, debugRva, debugSize;
+    size_t debugEntry = optionalHeader + directoryCountOffset + 4 + IMAGE_DIRECTORY_ENTRY_DEBUG * 8;
+    if (!read(data, size, optionalHeader + directoryCountOffset, directoryCount) ||
+        directoryCount <= IMAGE_DIRECTORY_ENTRY_DEBUG ||
+        debugEntry + 8 > optionalHeader + optionalHeaderSize ||
+        !read(data, size, debugEntry, debugRva) ||
+        !read(data, size, debugEntry + 4, debugSize)) {
+        return nullptr;
+    }
+
+    size_t sections = optionalHeader + optionalHeaderSize;
+    size_t debugOffset;
+    if (!rvaToOffset(data, size, sections, sectionCount, debugRva, debugOffset)) {
+        return nullptr;
+    }
+
+    for (uint32_t i = 0; i < debugSize / DEBUG_DIRECTORY_SIZE; ++i) {
+        size_t entry = debugOffset + size_t(i) * DEBUG_DIRECTORY_SIZE;
+        uint32_t type, dataSize, dataPointer;
+        if (!read(data, size, entry + 12, type) ||
+            !read(data, size, entry + 16, dataSize) ||
+            !read(data, size, entry + 24, dataPointer)) {
+            return nullptr;
+        }
+
+        uint32_t signature;
+        if (type != IMAGE_DEBUG_TYPE_CODEVIEW || dataSize < 24 ||
+            !read(data, size, dataPointer, signature) || signature != CODEVIEW_RSDS_SIGNATURE ||
+            dataPointer > size || size - dataPointer < dataSize) {
+            continue;
+        }
+
+        auto info = std::make_shared<ImageIndexInfo>();
+        info->timeDateStamp = timeDateStamp;
+        info->sizeOfImage = sizeOfImage;
+        std::memcpy(info->pdbGuid, data + dataPointer + 4, sizeof(info->pdbGuid));
+        read(data, size, size_t(dataPointer) + 20, info->pdbAge);
+
+        auto path = reinterpret_cast<const char*>(data + dataPointer + 24);
+        auto length = ::strnlen(path, dataSize - 24);
+        size_t start = length;
+        while (start > 0 && path[start - 1] != '\\' && path[start - 1] != '/') {
+            --start;
+        }
+        info->pdbFile = fromUtf8(path + start, length - start);
+        return info;
+    }
+
+    return nullptr;
+}
+
+std::shared_ptr<const ImageIndexInfo> readImageIndexInfo(const std::filesystem::path& path)
+{
+    try {
+        MappedFile file{ path };
+        return parseImageIndexInfo(file.data(), file.size());
+    }
+    catch (const std::exception&) {
+        return nullptr;
+    }
+}
+
+std::shared_ptr<const ImageIndexInfo> ImageIndexCache::get(const std::wstring& imagePath)
+{
+    {
+        std::lock_guard guard(mMutex);
+        auto it = mInfos.find(imagePath);
+        if (it != mInfos.end()) {
+            return it->second;
+        }
+    }
+
+    auto info = readImageIndexInfo(imagePath);
+
+    std::lock_guard guard(mMutex);
+    return mInfos.emplace(imagePath, std::move(info)).first->second;
+}
+
+std::wstring pdbDebugId(const ImageIndexInfo& indexInfo)
+{
+    const auto& guid = indexInfo.pdbGuid;
+
+    // The first three GUID fields are stored little endian.
+    std::wstring result = std::format(L"{:02X}{:02X}{:02X}{:02X}{:02X}{:02X}{:02X}{:02X}",
+        guid[3], guid[2], guid[1], guid[0], guid[5], guid[4], guid[7], guid[6]);
+    for (size_t i = 8; i < sizeof(guid); ++i) {
+        result += std::format(L"{:02X}", guid[i]);
+    }
+    result += std::format(L"{:X}", indexInfo.pdbAge);
+    return result;
+}
+
+bool parsePdbDebugId(std::string_view debugId, ImageIndexInfo& indexInfo)
+{
+    // 32 digits of GUID, then the age without leading zeros.
+    if (debugId.size() <= 32 || debugId.size() > 40) {
+        return false;
+    }
+
+    uint64_t digits[2] = {};
+    uint32_t age = 0;
+    for (size_t i = 0; i < debugId.size(); ++i) {
+        auto character = debugId[i];
+        uint32_t digit = character >= '0' && character <= '9' ? character - '0'
+            : character >= 'A' && character <= 'F' ? character - 'A' + 10
+            : character >= 'a' && character <= 'f' ? character - 'a' + 10
+            : 16;
+        if (digit == 16) {
+            return false;
+        }
+        if (i < 32) {
+            digits[i / 16] = digits[i / 16] << 4 | digit;
+        }
+        else {
+            age = age << 4 | digit;
+        }
+    }
+
+    // Back to the byte order of pdbDebugId.
+    static const size_t order[16] = { 3, 2, 1, 0, 5, 4, 7, 6, 8, 9, 10, 11, 12, 13, 14, 15 };
+    for (size_t i = 0; i < 16; ++i) {
+        indexInfo.pdbGuid[order[i]] = static_cast<uint8_t>(digits[i / 8] >> (8 * (7 - i % 8)));
+    }
+    indexInfo.pdbAge = age;
+    return true;
+}
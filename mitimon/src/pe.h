@@ -0,0 +1,48 @@
+#ifndef PE_H
+#define PE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Identification of an image and of its PDB, as found in its PE headers and CodeView debug record.
+// This is the information symbol servers index files by.
+struct ImageIndexInfo {
+    uint32_t timeDateStamp;
+    uint32_t sizeOfImage;
+
+    // File name of the PDB, without the build path.
+    std::wstring pdbFile;
+    uint8_t pdbGuid[16];
+    uint32_t pdbAge;
+};
+
+// Reads the index information from a PE file on disk. Only the headers and the debug directory get paged in.
+// Returns nullptr if the file cannot be read or has no RSDS CodeView record.
+std::shared_ptr<const ImageIndexInfo> readImageIndexInfo(const std::filesystem::path& path);
+
+// Parses index information from PE file contents.
+std::shared_ptr<const ImageIndexInfo> parseImageIndexInfo(const uint8_t* data, size_t size);
+
+// Debug id of a PDB, as used by symbol servers and Breakpad: the GUID followed by the age, in uppercase hexadecimal.
+std::wstring pdbDebugId(const ImageIndexInfo& indexInfo);
+
+// Fills in the PDB GUID and age from a debug id. Returns false if it is malformed.
+bool parsePdbDebugId(std::string_view debugId, ImageIndexInfo& indexInfo);
+
+// Index information per image path, including failures.
+class ImageIndexCache {
+public:
+    std::shared_ptr<const ImageIndexInfo> get(const std::wstring& imagePath);
+
+private:
+    std::mutex mMutex;
+    std::unordered_map<std::wstring, std::shared_ptr<const ImageIndexInfo>> mInfos;
+};
+
+#endif // PE_H
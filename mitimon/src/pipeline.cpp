@@ -0,0 +1,239 @@
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "capture.h"
+#include "data.h"
+#include "deferred.h"
+#include "filter.h"
+#include "metrics.h"
+#include "output.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "sampler.h"
+#include "source.h"
+#include "symbols.h"
+
+// Degraded events are written without symbolication, when the worker pool is overloaded.
+// Whole records are formatted on the worker, the output writer only has to write them.
+static void writeEvents(Pipeline& pipeline, std::vector<Event>& events, bool degraded)
+{
+    if (events.size() == 1) {
+        std::cout << "Please wait while a new event is being processed..." << std::endl;
+    }
+    else {
+        std::cout << "Please wait while " << events.size() << " new events are being processed..." << std::endl;
+    }
+
+    std::vector<std::vector<std::wstring>> frames(events.size());
+    // Module table lines written along with each event.
+    std::vector<std::string> descriptions(events.size());
+    if (pipeline.moduleTable) {
+        // Cheap enough not to need a degraded form.
+        for (size_t i = 0; i < events.size(); ++i) {
+            size_t lastHit = 0;
+            for (auto& return_address : events[i].stackTrace) {
+                auto address = reinterpret_cast<void*>(return_address);
+                auto [image, offset] = events[i].modules->decompose(address, lastHit);
+                frames[i].push_back(formatDeferredFrame(address, image, offset));
+                if (image) {
+                    pipeline.moduleTable->describe(*image, descriptions[i]);
+                }
+            }
+        }
+    }
+    else if (degraded) {
+        for (size_t i = 0; i < events.size(); ++i) {
+            for (auto& return_address : events[i].stackTrace) {
+                frames[i].push_back(std::format(L"0x{:016x}", return_address));
+            }
+        }
+    }
+    else {
+        std::vector<StackRequest> requests;
+        requests.reserve(events.size());
+        for (size_t i = 0; i < events.size(); ++i) {
+            auto& event = events[i];
+            requests.push_back(StackRequest{ event.modules.get(), event.stackTrace.data(), event.stackTrace.size(), &frames[i] });
+        }
+        symbolicateBatch(*pipeline.session, requests);
+    }
+
+    auto symbolicatedAt = Metrics::now();
+    for (size_t i = 0; i < events.size(); ++i) {
+        auto& event = events[i];
+        Metrics::record(LatencyStage::Symbolicated, symbolicatedAt - event.handledAt);
+
+        auto text = pipeline.output->buffer();
+        text += descriptions[i];
+        if (pipeline.format == OutputFormat::JsonLines) {
+            formatJson(text, event, frames[i], degraded);
+        }
+        else {
+            formatText(text, event, frames[i]);
+        }
+        pipeline.output->submit(event.timestamp, std::move(text));
+    }
+
+    if (events.size() == 1) {
+        std::cout << "The event was successfully processed." << std::endl << std::endl;
+    }
+    else {
+        std::cout << "The events were successfully processed." << std::endl << std::endl;
+    }
+}
+
+static void handleEvents(Pipeline& pipeline, std::vector<Event>& events, bool degraded)
+{
+    if (pipeline.callTree) {
+        for (const auto& event : events) {
+            pipeline.callTree->insert(event.taskName, event.eventId, *event.modules, event.stackTrace);
+        }
+        return;
+    }
+    writeEvents(pipeline, events, degraded);
+}
+
+static void submitEvent(Pipeline& pipeline, Event&& event)
+{
+    if (pipeline.prefetcher) {
+        pipeline.prefetcher->prioritize(*event.modules, event.stackTrace);
+    }
+
+    // The task takes whatever events are waiting when it runs, its own may already have been taken by an earlier one.
+    // A degraded task runs right away on this thread, and takes its own event back. So does a full queue of events,
+    // when degrading.
+    if (!pipeline.events.push(std::move(event))) {
+        std::vector<Event> events;
+        events.push_back(std::move(event));
+        handleEvents(pipeline, events, true);
+        return;
+    }
+    pipeline.pool.submit([&pipeline](bool degraded) {
+        std::vector<Event> events;
+        if (degraded) {
+            pipeline.events.takeNewest(events);
+        }
+        else {
+            pipeline.events.take(pipeline.batchSize, events);
+        }
+        if (!events.empty()) {
+            handleEvents(pipeline, events, degraded);
+        }
+    });
+}
+
+void writeSuppressed(Pipeline& pipeline, const std::vector<StackSampler::Suppressed>& reports)
+{
+    for (const auto& suppressed : reports) {
+        auto text = pipeline.output->buffer();
+        if (pipeline.format == OutputFormat::JsonLines) {
+            formatSuppressedJson(text, suppressed);
+        }
+        else {
+            formatSuppressedText(text, suppressed);
+        }
+        pipeline.output->submit(suppressed.lastTimestamp, std::move(text));
+    }
+}
+
+static void handleEvent(Pipeline& pipeline, CaptureRecord& record, EventDetails& details)
+{
+    auto handledAt = Metrics::now();
+    auto modules = ProcessData::modules(record.pid, record.timestamp);
+
+    if (pipeline.filter) {
+        details.setImageName(ProcessData::imageName(record.pid, record.timestamp));
+        details.setStack(*modules, record.stack);
+        if (pipeline.filter->evaluate(details) != FilterResult::True) {
+            Metrics::add(MetricCounter::EventsFilteredLate);
+            return;
+        }
+    }
+
+    // Events of a stack seen too often are only counted, before anything is decoded.
+    uint64_t signature = 0;
+    if (pipeline.sampler) {
+        signature = stackSignature(record.eventId, *modules, record.stack.data(), record.stack.size());
+        std::vector<StackSampler::Suppressed> reports;
+        bool admitted = pipeline.sampler->admit(signature, record.timestamp, record.taskName, record.eventId, reports);
+        writeSuppressed(pipeline, reports);
+        if (!admitted) {
+            Metrics::add(MetricCounter::EventsSuppressed);
+            return;
+        }
+    }
+
+    std::vector<std::wstring> properties;
+    details.decodeProperties(properties);
+
+    if (pipeline.capture) {
+        pipeline.capture->writeEvent(record.timestamp, record.taskName, record.eventId, record.pid, record.tid,
+            record.stack.data(), record.stack.size(), properties);
+        return;
+    }
+
+    // Defer symbolication to leave the delivering thread responsive to future events.
+    // Use the snapshot of the process modules as of the event on the worker thread, as they may get modified by future events.
+    Metrics::add(MetricCounter::EventsHandled);
+    submitEvent(pipeline, Event{ record.timestamp, record.taskName, record.eventId, record.pid, record.tid,
+        std::move(record.stack), std::move(properties), std::move(modules), handledAt, signature });
+}
+
+void handleRecord(Pipeline& pipeline, CaptureRecord& record, EventDetails* details)
+{
+    switch (record.type) {
+    case CaptureRecordType::KernelImage:
+        ProcessData::setKernelImage(ImageData{ reinterpret_cast<void*>(record.imageBase),
+            static_cast<size_t>(record.imageSize), record.imageTimeStamp, record.imageName, record.indexInfo });
+        if (pipeline.capture) {
+            pipeline.capture->writeKernelImage(record.imageBase, record.imageSize, record.imageTimeStamp, record.imageName,
+                record.indexInfo.get());
+        }
+        break;
+
+    case CaptureRecordType::ProcessStart:
+        ProcessData::add(record.timestamp, record.pid, record.imageName);
+        if (pipeline.capture) {
+            pipeline.capture->writeProcessStart(record.timestamp, record.pid, record.imageName);
+        }
+        break;
+
+    case CaptureRecordType::ProcessStop:
+        ProcessData::remove(record.timestamp, record.pid);
+        if (pipeline.capture) {
+            pipeline.capture->writeProcessStop(record.timestamp, record.pid);
+        }
+        break;
+
+    case CaptureRecordType::ImageLoad:
+    {
+        auto imageBase = reinterpret_cast<void*>(record.imageBase);
+        auto imageSize = static_cast<size_t>(record.imageSize);
+        ImageData::add(record.timestamp, record.pid, imageBase, imageSize, record.imageTimeStamp, record.imageName, record.indexInfo);
+        if (pipeline.capture) {
+            pipeline.capture->writeImageLoad(record.timestamp, record.pid, record.imageBase, record.imageSize,
+                record.imageTimeStamp, record.imageName, record.indexInfo.get());
+        }
+        if (pipeline.prefetcher) {
+            pipeline.prefetcher->enqueue(ImageData{ imageBase, imageSize, record.imageTimeStamp, record.imageName, record.indexInfo });
+        }
+        break;
+    }
+
+    case CaptureRecordType::ImageUnload:
+        ImageData::remove(record.timestamp, record.pid, reinterpret_cast<void*>(record.imageBase));
+        if (pipeline.capture) {
+            pipeline.capture->writeImageUnload(record.timestamp, record.pid, record.imageBase);
+        }
+        break;
+
+    case CaptureRecordType::Event:
+        handleEvent(pipeline, record, *details);
+        break;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <cstddef>
+#include <vector>
+
+#include "calltree.h"
+#include "capture.h"
+#include "deferred.h"
+#include "filter.h"
+#include "output.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "sampler.h"
+#include "source.h"
+#include "symbols.h"
+
+// State shared by the thread delivering the records of the event source and the workers.
+// In aggregation mode, events are added to the call tree instead of being written one by one.
+// In record mode, events are written to the capture as is, from the delivering thread.
+// The filter is evaluated again on the delivering thread, where the image names and the stacks are known.
+// The sampler is only used from the delivering thread.
+// Events wait in the batch queue, and workers take up to batch size of them at once.
+// In deferred mode, there is no symbol session: frames are written as module ids and RVAs, along with the module table.
+struct Pipeline {
+    const EventFilter* filter;
+    StackSampler* sampler;
+    SymbolSession* session;
+    ModuleTable* moduleTable;
+    WorkerPool& pool;
+    BatchQueue<Event>& events;
+    size_t batchSize;
+    OutputWriter* output;
+    OutputFormat format;
+    CallTree* callTree;
+    CaptureWriter* capture;
+    SymbolPrefetcher* prefetcher;
+};
+
+// Handles a record delivered by the event source: process and image records update the process registry,
+// and events go through the filter, the sampler and the workers. Event records must come with their details.
+void handleRecord(Pipeline& pipeline, CaptureRecord& record, EventDetails* details);
+
+// Writes the counts of the events that were not written because of sampling.
+void writeSuppressed(Pipeline& pipeline, const std::vector<StackSampler::Suppressed>& reports);
+
+#endif // PIPELINE_H
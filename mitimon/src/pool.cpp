@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include "pool.h"
+
+WorkerPool::WorkerPool(size_t workerCount, size_t capacity, OverflowPolicy policy) :
+    mCapacity{ std::max<size_t>(capacity, 1) },
+    mPolicy{ policy },
+    mMutex{},
+    mNotEmpty{},
+    mNotFull{},
+    mIdle{},
+    mQueue{},
+    mRunning{ 0 },
+    mStopping{ false },
+    mQueued{ 0 },
+    mDropped{ 0 },
+    mDegraded{ 0 },
+    mCompleted{ 0 },
+    mWorkers{}
+{
+    workerCount = std::max<size_t>(workerCount, 1);
+    mWorkers.reserve(workerCount);
+    for (size_t i = 0; i < workerCount; ++i) {
+        mWorkers.emplace_back([this]() { work(); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard guard(mMutex);
+        mStopping = true;
+    }
+    mNotEmpty.notify_all();
+    mNotFull.notify_all();
+
+    // Workers finish the tasks that are still queued before exiting.
+    for (auto& worker : mWorkers) {
+        worker.join();
+    }
+}
+
+void WorkerPool::submit(Task&& task)
+{
+    {
+        std::unique_lock lock(mMutex);
+
+        if (mQueue.size() >= mCapacity) {
+            switch (mPolicy) {
+            case OverflowPolicy::Block:
+                mNotFull.wait(lock, [this]() { return mQueue.size() < mCapacity || mStopping; });
+                break;
+
+            case OverflowPolicy::DropOldest:
+                mQueue.pop_front();
+                ++mDropped;
+                break;
+
+            case OverflowPolicy::Degrade:
+                lock.unlock();
+                ++mDegraded;
+                run(task, true);
+                return;
+            }
+        }
+
+        mQueue.emplace_back(std::move(task));
+        ++mQueued;
+    }
+    mNotEmpty.notify_one();
+}
+
+void WorkerPool::drain()
+{
+    std::unique_lock lock(mMutex);
+    mIdle.wait(lock, [this]() { return mQueue.empty() && mRunning == 0; });
+}
+
+WorkerPool::Stats WorkerPool::stats() const
+{
+    return Stats{ mQueued.load(), mDropped.load(), mDegraded.load(), mCompleted.load() };
+}
+
+size_t WorkerPool::defaultWorkerCount()
+{
+    return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+}
+
+void WorkerPool::work()
+{
+    for (;;) {
+        Task task;
+        {
+            std::unique_lock lock(mMutex);
+            mNotEmpty.wait(lock, [this]() { return !mQueue.empty() || mStopping; });
+            if (mQueue.empty()) {
+                return;
+            }
+            task = std::move(mQueue.front());
+            mQueue.pop_front();
+            ++mRunning;
+        }
+        mNotFull.notify_one();
+
+        run(task, false);
+
+        bool idle;
+        {
+            std::lock_guard guard(mMutex);
+            idle = --mRunning == 0 && mQueue.empty();
+        }
+        if (idle) {
+            mIdle.notify_all();
+        }
+    }
+}
+
+void WorkerPool::run(Task& task, bool degraded)
+{
+    try {
+        task(degraded);
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+    ++mCompleted;
+}
@@ -0,0 +1,180 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads fed by a bounded queue of tasks.
+class WorkerPool {
+public:
+    // Tasks receive true when they should produce cheap, degraded output because the queue was full.
+    using Task = std::function<void(bool degraded)>;
+
+    enum class OverflowPolicy {
+        // Wait on the submitting thread until there is room in the queue.
+        Block,
+        // Discard the oldest queued task to make room for the new one.
+        DropOldest,
+        // Run the new task right away on the submitting thread, in degraded mode.
+        Degrade,
+    };
+
+    struct Stats {
+        uint64_t queued;
+        uint64_t dropped;
+        uint64_t degraded;
+        uint64_t completed;
+    };
+
+    WorkerPool(size_t workerCount, size_t capacity, OverflowPolicy policy);
+
+    ~WorkerPool();
+
+    WorkerPool(WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    WorkerPool(WorkerPool&&) = delete;
+    WorkerPool& operator=(WorkerPool&&) = delete;
+
+    void submit(Task&& task);
+
+    // Waits until the queued tasks have all run. Tasks submitted meanwhile are waited for too.
+    void drain();
+
+    Stats stats() const;
+
+    static size_t defaultWorkerCount();
+
+private:
+    void work();
+
+    void run(Task& task, bool degraded);
+
+private:
+    size_t mCapacity;
+    OverflowPolicy mPolicy;
+
+    std::mutex mMutex;
+    std::condition_variable mNotEmpty;
+    std::condition_variable mNotFull;
+    std::condition_variable mIdle;
+    std::deque<Task> mQueue;
+    // Tasks taken from the queue by workers and still running.
+    size_t mRunning;
+    bool mStopping;
+
+    std::atomic<uint64_t> mQueued;
+    std::atomic<uint64_t> mDropped;
+    std::atomic<uint64_t> mDegraded;
+    std::atomic<uint64_t> mCompleted;
+
+    std::vector<std::thread> mWorkers;
+};
+
+// Work items queued next to the tasks of a worker pool, so that a task can take several of them at once.
+// Each item gets a task submitted for it, and whichever task runs first takes the items queued by then:
+// under load, items are handled in batches, otherwise one by one without waiting for more.
+// The queue is bounded on its own, as dropping tasks does not drop the items they would have taken.
+template<typename T>
+class BatchQueue {
+public:
+    struct Stats {
+        // Items dropped to make room for newer ones.
+        uint64_t dropped;
+        // Items refused to be handled in degraded mode instead.
+        uint64_t degraded;
+    };
+
+    BatchQueue(size_t capacity, WorkerPool::OverflowPolicy policy) :
+        mCapacity{ std::max<size_t>(capacity, 1) },
+        mPolicy{ policy },
+        mMutex{},
+        mNotFull{},
+        mItems{},
+        mDropped{ 0 },
+        mDegraded{ 0 }
+    {
+    }
+
+    BatchQueue(BatchQueue&) = delete;
+    BatchQueue& operator=(const BatchQueue&) = delete;
+
+    BatchQueue(BatchQueue&&) = delete;
+    BatchQueue& operator=(BatchQueue&&) = delete;
+
+    // When capacity items are waiting, applies the overflow policy: waits until a task takes some, drops the oldest one,
+    // or returns false without taking the item, for the caller to handle it right away in degraded mode.
+    bool push(T&& item)
+    {
+        {
+            std::unique_lock lock(mMutex);
+            if (mItems.size() >= mCapacity) {
+                switch (mPolicy) {
+                case WorkerPool::OverflowPolicy::Block:
+                    mNotFull.wait(lock, [this]() { return mItems.size() < mCapacity; });
+                    break;
+
+                case WorkerPool::OverflowPolicy::DropOldest:
+                    mItems.pop_front();
+                    ++mDropped;
+                    break;
+
+                case WorkerPool::OverflowPolicy::Degrade:
+                    ++mDegraded;
+                    return false;
+                }
+            }
+            mItems.push_back(std::move(item));
+        }
+        return true;
+    }
+
+    // Moves up to max of the oldest items to the batch.
+    void take(size_t max, std::vector<T>& batch)
+    {
+        {
+            std::lock_guard guard(mMutex);
+            while (!mItems.empty() && batch.size() < max) {
+                batch.push_back(std::move(mItems.front()));
+                mItems.pop_front();
+            }
+        }
+        mNotFull.notify_all();
+    }
+
+    // Moves the newest item to the batch, for a task run in degraded mode right after its item was pushed.
+    void takeNewest(std::vector<T>& batch)
+    {
+        {
+            std::lock_guard guard(mMutex);
+            if (!mItems.empty()) {
+                batch.push_back(std::move(mItems.back()));
+                mItems.pop_back();
+            }
+        }
+        mNotFull.notify_all();
+    }
+
+    Stats stats() const { return Stats{ mDropped.load(), mDegraded.load() }; }
+
+private:
+    size_t mCapacity;
+    WorkerPool::OverflowPolicy mPolicy;
+
+    std::mutex mMutex;
+    std::condition_variable mNotFull;
+    std::deque<T> mItems;
+
+    std::atomic<uint64_t> mDropped;
+    std::atomic<uint64_t> mDegraded;
+};
+
+#endif // POOL_H
@@ -0,0 +1,116 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "data.h"
+#include "prefetch.h"
+#include "symbols.h"
+
+SymbolPrefetcher::SymbolPrefetcher(SymbolBackend& backend, size_t concurrency) :
+    mBackend{ backend },
+    mMutex{},
+    mCondition{},
+    mStopping{ false },
+    mHits{},
+    mPending{},
+    mQueued{ 0 },
+    mCompleted{ 0 },
+    mThreads{}
+{
+    concurrency = std::max<size_t>(concurrency, 1);
+    mThreads.reserve(concurrency);
+    for (size_t i = 0; i < concurrency; ++i) {
+        mThreads.emplace_back([this]() { run(); });
+    }
+}
+
+SymbolPrefetcher::~SymbolPrefetcher()
+{
+    {
+        std::lock_guard guard(mMutex);
+        mStopping = true;
+    }
+    mCondition.notify_all();
+
+    // Loads in progress cannot be interrupted, they are waited for.
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+void SymbolPrefetcher::enqueue(const ImageData& imageData)
+{
+    {
+        std::lock_guard guard(mMutex);
+        if (!mHits.emplace(imageData.id(), 0).second) {
+            return;
+        }
+        mPending.push_back(imageData);
+        ++mQueued;
+    }
+    mCondition.notify_one();
+}
+
+void SymbolPrefetcher::prioritize(const ModuleSet& modules, const std::vector<uint64_t>& stack)
+{
+    // Decompose outside of the lock, this only reads the immutable module set.
+    std::vector<uint32_t> imageIds;
+    imageIds.reserve(stack.size());
+    size_t lastHit = 0;
+    for (auto address : stack) {
+        auto [image, offset] = modules.decompose(reinterpret_cast<void*>(address), lastHit);
+        if (image) {
+            imageIds.push_back(image->id());
+        }
+    }
+
+    std::lock_guard guard(mMutex);
+    for (auto imageId : imageIds) {
+        ++mHits[imageId];
+    }
+}
+
+SymbolPrefetcher::Stats SymbolPrefetcher::stats() const
+{
+    std::lock_guard guard(mMutex);
+    return Stats{ mQueued, mCompleted };
+}
+
+void SymbolPrefetcher::run()
+{
+    for (;;) {
+        ImageData imageData;
+        {
+            std::unique_lock lock(mMutex);
+            mCondition.wait(lock, [this]() { return !mPending.empty() || mStopping; });
+            if (mStopping) {
+                return;
+            }
+
+            // There are only as many pending images as images loaded since the last pick, a scan is fine.
+            auto best = mPending.begin();
+            for (auto it = mPending.begin(); it != mPending.end(); ++it) {
+                if (mHits[it->id()] > mHits[best->id()]) {
+                    best = it;
+                }
+            }
+            imageData = *best;
+            mPending.erase(best);
+        }
+
+        try {
+            mBackend.prefetch(imageData);
+        }
+        catch (const std::exception& e) {
+            std::cout << e.what() << std::endl;
+        }
+
+        std::lock_guard guard(mMutex);
+        ++mCompleted;
+    }
+}
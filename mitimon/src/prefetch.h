@@ -0,0 +1,69 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "data.h"
+#include "symbols.h"
+
+// Symbols of loaded images being fetched in the background at the same time, with --prefetch.
+#define PREFETCH_CONCURRENCY 4
+
+// Loads the symbols of images in the background as soon as they get loaded, so that the first
+// events of a process usually find them ready. Among the queued images, the ones that appeared
+// the most in the stacks seen so far are loaded first.
+class SymbolPrefetcher {
+public:
+    struct Stats {
+        uint64_t queued;
+        uint64_t completed;
+    };
+
+    // At most concurrency images are loaded at the same time.
+    SymbolPrefetcher(SymbolBackend& backend, size_t concurrency);
+
+    // Images still queued are left for the events to load.
+    ~SymbolPrefetcher();
+
+    SymbolPrefetcher(SymbolPrefetcher&) = delete;
+    SymbolPrefetcher& operator=(const SymbolPrefetcher&) = delete;
+
+    SymbolPrefetcher(SymbolPrefetcher&&) = delete;
+    SymbolPrefetcher& operator=(SymbolPrefetcher&&) = delete;
+
+    // Queues an image the first time its identity is seen.
+    void enqueue(const ImageData& imageData);
+
+    // Counts the images the frames of a stack belong to.
+    void prioritize(const ModuleSet& modules, const std::vector<uint64_t>& stack);
+
+    Stats stats() const;
+
+private:
+    void run();
+
+private:
+    SymbolBackend& mBackend;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mCondition;
+    bool mStopping;
+
+    // Appearances in stacks by image id, for all the images seen so far.
+    std::unordered_map<uint32_t, uint64_t> mHits;
+    // Queued images, in the order they were loaded.
+    std::vector<ImageData> mPending;
+
+    uint64_t mQueued;
+    uint64_t mCompleted;
+
+    std::vector<std::thread> mThreads;
+};
+
+#endif // PREFETCH_H
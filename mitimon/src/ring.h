@@ -0,0 +1,161 @@
+#ifndef RING_H
+#define RING_H
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// Producer and consumer positions are kept on separate cache lines.
+#define RING_CACHE_LINE_SIZE 64
+
+// Bounded lock-free ring of preallocated slots, with any number of producers and a single consumer.
+// Producers claim a slot with a compare-and-swap and fill it in place, so pushing never allocates, locks or waits:
+// when the ring is full, the record is dropped and counted instead, unless the producer chose to wait for the consumer
+// to free a slot. Each slot carries a sequence number telling whether it is free for the producers or ready for
+// the consumer, as in Dmitry Vyukov's bounded queue.
+template<typename T>
+class MpscRing {
+public:
+    struct Stats {
+        uint64_t pushed;
+        uint64_t dropped;
+        // Pushes which found the ring full and waited for a slot.
+        uint64_t waited;
+        // Highest number of records waiting in the ring at once.
+        uint64_t highWatermark;
+        uint64_t capacity;
+    };
+
+    // The capacity is rounded up to a power of two. All the slots are allocated and touched up front.
+    MpscRing(size_t capacity) :
+        mCapacity{ std::bit_ceil(capacity < 2 ? size_t{ 2 } : capacity) },
+        mSlots{ std::make_unique<Slot[]>(mCapacity) },
+        mPushPosition{ 0 },
+        mDropped{ 0 },
+        mWaited{ 0 },
+        mHighWatermark{ 0 },
+        mPopPosition{ 0 }
+    {
+        for (size_t i = 0; i < mCapacity; ++i) {
+            mSlots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpscRing(MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    MpscRing(MpscRing&&) = delete;
+    MpscRing& operator=(MpscRing&&) = delete;
+
+    // Calls fill with a slot to write the record into. Returns false if the ring was full, fill is not called then.
+    template<typename Fill>
+    bool tryPush(Fill&& fill)
+    {
+        return push(fill, false);
+    }
+
+    // Same as tryPush, but waits for the consumer to free a slot when the ring is full, for records which must not
+    // be lost. This relies on the consumer to keep popping.
+    template<typename Fill>
+    void pushWaiting(Fill&& fill)
+    {
+        push(fill, true);
+    }
+
+    // Calls consume with the oldest record, if any. Only one thread may pop.
+    template<typename Consume>
+    bool tryPop(Consume&& consume)
+    {
+        auto position = mPopPosition.load(std::memory_order_relaxed);
+        auto& slot = mSlots[position & (mCapacity - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != position + 1) {
+            return false;
+        }
+
+        consume(slot.value);
+        slot.sequence.store(position + mCapacity, std::memory_order_release);
+        mPopPosition.store(position + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Stats stats() const
+    {
+        // Claimed slots are counted as pushed, even if they are still being filled.
+        return Stats{
+            mPushPosition.load(std::memory_order_relaxed),
+            mDropped.load(std::memory_order_relaxed),
+            mWaited.load(std::memory_order_relaxed),
+            mHighWatermark.load(std::memory_order_relaxed),
+            mCapacity,
+        };
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    // Returns false if the record was dropped, which only happens without waiting.
+    template<typename Fill>
+    bool push(Fill& fill, bool wait)
+    {
+        auto position = mPushPosition.load(std::memory_order_relaxed);
+        bool waited = false;
+        Slot* slot;
+        for (;;) {
+            slot = &mSlots[position & (mCapacity - 1)];
+            auto sequence = slot->sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (difference == 0) {
+                if (mPushPosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            }
+            else if (difference < 0) {
+                // The slot still holds the record from the previous lap, the consumer is behind.
+                if (!wait) {
+                    mDropped.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+                if (!waited) {
+                    waited = true;
+                    mWaited.fetch_add(1, std::memory_order_relaxed);
+                }
+                std::this_thread::yield();
+                position = mPushPosition.load(std::memory_order_relaxed);
+            }
+            else {
+                position = mPushPosition.load(std::memory_order_relaxed);
+            }
+        }
+
+        fill(slot->value);
+        slot->sequence.store(position + 1, std::memory_order_release);
+
+        // Only pay for a read-modify-write when the watermark actually moves.
+        // The consumer may already be past this record, when other producers pushed more after it.
+        auto popPosition = mPopPosition.load(std::memory_order_relaxed);
+        uint64_t count = position + 1 > popPosition ? position + 1 - popPosition : 0;
+        auto highWatermark = mHighWatermark.load(std::memory_order_relaxed);
+        while (count > highWatermark && !mHighWatermark.compare_exchange_weak(highWatermark, count, std::memory_order_relaxed)) {
+        }
+        return true;
+    }
+
+private:
+    size_t mCapacity;
+    std::unique_ptr<Slot[]> mSlots;
+
+    alignas(RING_CACHE_LINE_SIZE) std::atomic<size_t> mPushPosition;
+    std::atomic<uint64_t> mDropped;
+    std::atomic<uint64_t> mWaited;
+    std::atomic<uint64_t> mHighWatermark;
+
+    alignas(RING_CACHE_LINE_SIZE) std::atomic<size_t> mPopPosition;
+};
+
+#endif // RING_H
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "data.h"
+#include "sampler.h"
+
+#define SIGNATURE_LANES 4
+
+uint64_t stackSignature(int eventId, const ModuleSet& modules, const uint64_t* stackTrace, size_t size)
+{
+    // Frames are spread over independent lanes, so that the multiplications of consecutive frames overlap.
+    uint64_t lanes[SIGNATURE_LANES] = { 0x243f6a8885a308d3, 0x13198a2e03707344, 0xa4093822299f31d0, 0x082efa98ec4e6c89 };
+    lanes[0] ^= static_cast<uint32_t>(eventId);
+
+    size_t lastHit = 0;
+    for (size_t i = 0; i < size; ++i) {
+        auto [image, offset] = modules.decompose(reinterpret_cast<void*>(stackTrace[i]), lastHit);
+        uint64_t frame = image ? (uint64_t{ image->id() } << 40) ^ offset : stackTrace[i];
+
+        auto& lane = lanes[i % SIGNATURE_LANES];
+        lane = (lane ^ frame) * 0x9e3779b97f4a7c15;
+        lane ^= lane >> 29;
+    }
+
+    uint64_t hash = size;
+    for (auto lane : lanes) {
+        hash = (hash ^ lane) * 0xff51afd7ed558ccd;
+        hash ^= hash >> 32;
+    }
+    return hash;
+}
+
+StackSampler::StackSampler(size_t capacity, uint32_t burst, uint64_t refillInterval, uint64_t reportInterval) :
+    mCapacity{ std::max<size_t>(capacity, 1) },
+    mBurst{ burst },
+    mRefillInterval{ refillInterval },
+    mReportInterval{ reportInterval },
+    mEntries{},
+    mIndex{},
+    mStats{}
+{
+}
+
+bool StackSampler::admit(uint64_t signature, uint64_t timestamp, std::wstring_view taskName, int eventId,
+    std::vector<Suppressed>& reports)
+{
+    auto it = mIndex.find(signature);
+    if (it == mIndex.end()) {
+        if (mEntries.size() >= mCapacity) {
+            auto& oldest = mEntries.back();
+            report(oldest, oldest.lastSuppressed, reports);
+            mIndex.erase(oldest.signature);
+            mEntries.pop_back();
+            ++mStats.evictions;
+        }
+
+        mEntries.push_front(Entry{ signature, std::wstring{ taskName }, eventId, mBurst, timestamp, timestamp, 0, 0, 0 });
+        mIndex.emplace(signature, mEntries.begin());
+    }
+    else {
+        mEntries.splice(mEntries.begin(), mEntries, it->second);
+    }
+    auto& entry = mEntries.front();
+
+    // Events may come slightly out of order, earlier timestamps do not refill.
+    if (mRefillInterval && timestamp > entry.refilledAt) {
+        auto intervals = (timestamp - entry.refilledAt) / mRefillInterval;
+        entry.tokens = static_cast<uint32_t>(std::min<uint64_t>(mBurst, entry.tokens + std::min<uint64_t>(intervals, mBurst)));
+        entry.refilledAt += intervals * mRefillInterval;
+    }
+
+    bool admitted = entry.tokens > 0;
+    if (admitted) {
+        --entry.tokens;
+        ++mStats.admitted;
+    }
+    else {
+        if (!entry.suppressed) {
+            entry.firstSuppressed = timestamp;
+        }
+        ++entry.suppressed;
+        entry.lastSuppressed = std::max(entry.lastSuppressed, timestamp);
+        ++mStats.suppressed;
+    }
+
+    // Report before the next event written in full as well, so that counts and events alternate in the output.
+    if (entry.suppressed && (admitted || (timestamp >= entry.reportedAt && timestamp - entry.reportedAt >= mReportInterval))) {
+        report(entry, timestamp, reports);
+    }
+    return admitted;
+}
+
+void StackSampler::flush(std::vector<Suppressed>& reports)
+{
+    for (auto& entry : mEntries) {
+        report(entry, entry.lastSuppressed, reports);
+    }
+}
+
+StackSampler::Stats StackSampler::stats() const
+{
+    auto stats = mStats;
+    stats.signatures = mEntries.size();
+    return stats;
+}
+
+void StackSampler::report(Entry& entry, uint64_t timestamp, std::vector<Suppressed>& reports)
+{
+    if (!entry.suppressed) {
+        return;
+    }
+
+    reports.push_back(Suppressed{ entry.signature, entry.taskName, entry.eventId, entry.suppressed,
+        entry.firstSuppressed, entry.lastSuppressed });
+    entry.suppressed = 0;
+    entry.reportedAt = timestamp;
+}
@@ -0,0 +1,90 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "data.h"
+
+// Hashes the stack of an event as (image identity, offset) pairs, so that the same code path gets the same
+// signature in every process, wherever its images are loaded. Frames outside of any image are hashed by address.
+uint64_t stackSignature(int eventId, const ModuleSet& modules, const uint64_t* stackTrace, size_t size);
+
+// Rate limits events by stack signature, for storms of identical events. Each signature has a token bucket
+// holding up to burst tokens, refilled by one token per refill interval: events are written in full as long as
+// there are tokens, and counted otherwise. The counts are reported once per report interval, when the signature
+// is evicted, and when flushing. Timestamps are ETW timestamps.
+//
+// The least recently seen signatures are evicted beyond the capacity. Only used from the intake thread.
+class StackSampler {
+public:
+    // Events of a signature that were not written.
+    struct Suppressed {
+        uint64_t signature;
+        std::wstring taskName;
+        int eventId;
+        uint64_t count;
+        uint64_t firstTimestamp;
+        uint64_t lastTimestamp;
+    };
+
+    struct Stats {
+        uint64_t admitted;
+        uint64_t suppressed;
+        uint64_t evictions;
+        uint64_t signatures;
+    };
+
+    StackSampler(size_t capacity, uint32_t burst, uint64_t refillInterval, uint64_t reportInterval);
+
+    StackSampler(StackSampler&) = delete;
+    StackSampler& operator=(const StackSampler&) = delete;
+
+    StackSampler(StackSampler&&) = delete;
+    StackSampler& operator=(StackSampler&&) = delete;
+
+    // Returns true if the event should be written in full. Counts due for reporting are appended to reports.
+    bool admit(uint64_t signature, uint64_t timestamp, std::wstring_view taskName, int eventId,
+        std::vector<Suppressed>& reports);
+
+    // Appends the counts not reported yet, of every signature.
+    void flush(std::vector<Suppressed>& reports);
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        uint64_t signature;
+        std::wstring taskName;
+        int eventId;
+        uint32_t tokens;
+        // Refills are counted from here, in whole refill intervals.
+        uint64_t refilledAt;
+        uint64_t reportedAt;
+        uint64_t suppressed;
+        uint64_t firstSuppressed;
+        uint64_t lastSuppressed;
+    };
+
+    // Moves the count of the entry to the reports, if there is one.
+    static void report(Entry& entry, uint64_t timestamp, std::vector<Suppressed>& reports);
+
+private:
+    size_t mCapacity;
+    uint32_t mBurst;
+    uint64_t mRefillInterval;
+    uint64_t mReportInterval;
+
+    // Most recently seen first.
+    std::list<Entry> mEntries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> mIndex;
+
+    Stats mStats;
+};
+
+#endif // SAMPLER_H
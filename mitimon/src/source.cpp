@@ -0,0 +1,195 @@
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cwctype>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "capture.h"
+#include "data.h"
+#include "filter.h"
+#include "source.h"
+#include "synthetic.h"
+
+void EventDetails::setImageName(std::wstring_view imageName)
+{
+    mImageName = imageName;
+}
+
+void EventDetails::setStack(const ModuleSet& modules, const std::vector<uint64_t>& stackTrace)
+{
+    mModules = &modules;
+    mStackTrace = &stackTrace;
+}
+
+bool EventDetails::has(FilterField field)
+{
+    switch (field) {
+    case FilterField::Image:
+        return mImageName.has_value();
+    case FilterField::Stack:
+        return mModules != nullptr;
+    default:
+        return true;
+    }
+}
+
+std::wstring_view EventDetails::imageName()
+{
+    return mImageName.value_or(std::wstring_view{});
+}
+
+bool EventDetails::hasModule(std::wstring_view name)
+{
+    size_t lastHit = 0;
+    for (auto address : *mStackTrace) {
+        auto image = mModules->decompose(reinterpret_cast<void*>(address), lastHit).first;
+        if (!image || image->name().size() != name.size()) {
+            continue;
+        }
+
+        const auto& imageName = image->name();
+        size_t i = 0;
+        while (i < name.size() && static_cast<wchar_t>(std::towlower(imageName[i])) == name[i]) {
+            ++i;
+        }
+        if (i == name.size()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CaptureDetails::decodeProperties(std::vector<std::wstring>& properties)
+{
+    if (properties.empty()) {
+        properties.swap(mRecord.properties);
+        return;
+    }
+    for (auto& property : mRecord.properties) {
+        properties.push_back(std::move(property));
+    }
+    mRecord.properties.clear();
+}
+
+uint32_t CaptureDetails::pid()
+{
+    return mRecord.pid;
+}
+
+std::wstring_view CaptureDetails::taskName()
+{
+    return mRecord.taskName;
+}
+
+int CaptureDetails::eventId()
+{
+    return mRecord.eventId;
+}
+
+bool CaptureDetails::property(std::wstring_view name, FilterValue& value)
+{
+    for (const auto& property : mRecord.properties) {
+        std::wstring_view text{ property };
+        if (text.size() <= name.size() || !text.starts_with(name) || text[name.size()] != L' ') {
+            continue;
+        }
+        text.remove_prefix(name.size() + 1);
+
+        if (text.starts_with(L"L\"") && text.size() >= 3 && text.ends_with(L'"')) {
+            value = std::wstring{ text.substr(2, text.size() - 3) };
+            return true;
+        }
+
+        if (!text.starts_with(L"0x") || text.size() == 2) {
+            return false;
+        }
+        uint64_t number = 0;
+        for (auto character : text.substr(2)) {
+            uint32_t digit = character >= L'0' && character <= L'9' ? character - L'0'
+                : character >= L'a' && character <= L'f' ? character - L'a' + 10
+                : character >= L'A' && character <= L'F' ? character - L'A' + 10
+                : 16;
+            if (digit == 16) {
+                return false;
+            }
+            number = number << 4 | digit;
+        }
+        value = number;
+        return true;
+    }
+    return false;
+}
+
+void RecordSource::run(const Handler& handler)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::optional<uint64_t> startTimestamp;
+
+    CaptureRecord record{};
+    while (next(record)) {
+        if (mStopping.load()) {
+            break;
+        }
+
+        // Records without a timestamp, such as the kernel image, are not paced.
+        if (mPacing == Pacing::RealTime && record.timestamp) {
+            if (!startTimestamp) {
+                startTimestamp = record.timestamp;
+                start = std::chrono::steady_clock::now();
+            }
+            if (!waitFor(record.timestamp, *startTimestamp, start)) {
+                break;
+            }
+        }
+
+        ++mDelivered;
+        if (record.type == CaptureRecordType::Event) {
+            CaptureDetails details{ record };
+            handler(record, &details);
+        }
+        else {
+            handler(record, nullptr);
+        }
+    }
+}
+
+void RecordSource::stop()
+{
+    std::lock_guard guard(mMutex);
+    mStopping.store(true);
+    mStopped.notify_all();
+}
+
+EventSource::Stats RecordSource::stats() const
+{
+    // Nothing is dropped here, the next record waits until the handler returns.
+    return Stats{ mDelivered.load(), 0, 0, 0, 0, 0 };
+}
+
+bool RecordSource::waitFor(uint64_t timestamp, uint64_t startTimestamp, std::chrono::steady_clock::time_point start)
+{
+    // Records slightly out of order are delivered right away.
+    if (timestamp <= startTimestamp) {
+        return true;
+    }
+
+    auto due = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<uint64_t, std::ratio<1, 10000000>>{ timestamp - startTimestamp });
+    std::unique_lock lock(mMutex);
+    return !mStopped.wait_until(lock, due, [this] { return mStopping.load(); });
+}
+
+bool ReplaySource::next(CaptureRecord& record)
+{
+    return mReader.next(record);
+}
+
+bool SyntheticSource::next(CaptureRecord& record)
+{
+    return mWorkload.next(record);
+}
@@ -0,0 +1,187 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "capture.h"
+#include "data.h"
+#include "filter.h"
+#include "synthetic.h"
+
+// The parts of an event which are only decoded on demand: filters read its fields one by one, and the properties
+// are only decoded for the events that get written. The image name and the stack are known to the pipeline,
+// and only available to filters once given.
+class EventDetails : public FilterSubject {
+public:
+    EventDetails() :
+        mImageName{},
+        mModules{ nullptr },
+        mStackTrace{ nullptr }
+    {
+    }
+
+    void setImageName(std::wstring_view imageName);
+
+    // The modules and the stack must outlive the details.
+    void setStack(const ModuleSet& modules, const std::vector<uint64_t>& stackTrace);
+
+    // Appends the properties of the event, as "<name> <value>" strings.
+    virtual void decodeProperties(std::vector<std::wstring>& properties) = 0;
+
+    bool has(FilterField field) override;
+    std::wstring_view imageName() override;
+    bool hasModule(std::wstring_view name) override;
+
+private:
+    std::optional<std::wstring_view> mImageName;
+    const ModuleSet* mModules;
+    const std::vector<uint64_t>* mStackTrace;
+};
+
+// Details of an event whose properties are already decoded into its record, such as the ones of capture files.
+class CaptureDetails : public EventDetails {
+public:
+    // The record must outlive the details.
+    CaptureDetails(CaptureRecord& record) :
+        mRecord{ record }
+    {
+    }
+
+    CaptureDetails(CaptureDetails&) = delete;
+    CaptureDetails& operator=(const CaptureDetails&) = delete;
+
+    CaptureDetails(CaptureDetails&&) = delete;
+    CaptureDetails& operator=(CaptureDetails&&) = delete;
+
+    // Moves the properties out of the record.
+    void decodeProperties(std::vector<std::wstring>& properties) override;
+
+    uint32_t pid() override;
+    std::wstring_view taskName() override;
+    int eventId() override;
+    // Reads the value back from its text, hexadecimal integers and L"quoted" strings being supported.
+    bool property(std::wstring_view name, FilterValue& value) override;
+
+private:
+    CaptureRecord& mRecord;
+};
+
+// Delivers normalized events to the pipeline: the kernel image, process starts and stops, image loads and unloads,
+// and the events of interest, as capture records. Event records come with their details, and may have their
+// properties left to them. Records are delivered in order, from a single thread.
+class EventSource {
+public:
+    struct Stats {
+        uint64_t received;
+        uint64_t dropped;
+        // Records which held up the source until there was room for them.
+        uint64_t waited;
+        // Records whose data did not fit in the usual buffers.
+        uint64_t oversized;
+        uint64_t highWatermark;
+        uint64_t capacity;
+    };
+
+    // The record and the details are only valid during the call.
+    using Handler = std::function<void(CaptureRecord& record, EventDetails* details)>;
+
+    virtual ~EventSource() = default;
+
+    // Delivers the records until the source ends or is stopped. Throws std::runtime_error if the source cannot start.
+    virtual void run(const Handler& handler) = 0;
+
+    // Makes run return, can be called from any thread.
+    virtual void stop() = 0;
+
+    virtual Stats stats() const = 0;
+};
+
+// Source of records generated or read ahead of time, delivered on the thread calling run.
+// They are either delivered as fast as the handler takes them, or paced by their timestamps, as they happened.
+class RecordSource : public EventSource {
+public:
+    enum class Pacing {
+        MaxSpeed,
+        RealTime,
+    };
+
+    RecordSource(Pacing pacing) :
+        mPacing{ pacing },
+        mMutex{},
+        mStopped{},
+        mStopping{ false },
+        mDelivered{ 0 }
+    {
+    }
+
+    void run(const Handler& handler) override;
+
+    void stop() override;
+
+    Stats stats() const override;
+
+protected:
+    // Fills in the next record, reusing its buffers. Returns false at the end.
+    virtual bool next(CaptureRecord& record) = 0;
+
+private:
+    // Waits until the timestamp is due, in ETW timestamp units of 100 ns from the start timestamp.
+    // Returns false if stopped in the meantime.
+    bool waitFor(uint64_t timestamp, uint64_t startTimestamp, std::chrono::steady_clock::time_point start);
+
+private:
+    Pacing mPacing;
+
+    // Only needed for waiting, the flag is checked before each record.
+    std::mutex mMutex;
+    std::condition_variable mStopped;
+    std::atomic<bool> mStopping;
+
+    std::atomic<uint64_t> mDelivered;
+};
+
+// Replays a capture file written with --record.
+class ReplaySource : public RecordSource {
+public:
+    // Throws std::runtime_error if the file cannot be mapped or is not a capture file.
+    ReplaySource(const std::filesystem::path& path, Pacing pacing) :
+        RecordSource{ pacing },
+        mReader{ path }
+    {
+    }
+
+protected:
+    bool next(CaptureRecord& record) override;
+
+private:
+    CaptureReader mReader;
+};
+
+// Generates a synthetic workload, at its configured rate with real time pacing.
+class SyntheticSource : public RecordSource {
+public:
+    SyntheticSource(const SyntheticConfig& config, Pacing pacing) :
+        RecordSource{ pacing },
+        mWorkload{ config }
+    {
+    }
+
+protected:
+    bool next(CaptureRecord& record) override;
+
+private:
+    SyntheticWorkload mWorkload;
+};
+
+#endif // SOURCE_H
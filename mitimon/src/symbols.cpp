@@ -1,174 +1,158 @@
-#include <cstring>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <format>
-#include <iostream>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
+#include "cache.h"
 #include "data.h"
 #include "symbols.h"
-#include "winkrabs.h"
 
-std::atomic<uint32_t> Symbolicator::nextSymbolicatorId{ 1 };
-
-Symbolicator::Symbolicator(const ProcessData&& processData, const std::wstring& symDir, const std::wstring& symPath) :
-    mProcessData{ processData },
-    mProcess{ reinterpret_cast<HANDLE>(nextSymbolicatorId++) },
-    mModuleMap{}
+void SymbolBackend::symbolicateBatch(const ImageData& imageData, const std::vector<size_t>& offsets, std::vector<FrameInfo>& frames)
 {
-    ::SymSetOptions(SYMOPT_IGNORE_NT_SYMPATH);
-
-    if (!::CreateDirectoryW(symDir.c_str(), nullptr) && ::GetLastError() != ERROR_ALREADY_EXISTS) {
-        throw std::runtime_error("CreateDirectoryW failed.");
+    frames.resize(offsets.size());
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        symbolicate(imageData, offsets[i], frames[i]);
     }
+}
 
-    if (!::SymInitializeW(mProcess, symPath.c_str(), FALSE)) {
-        throw std::runtime_error("SymInitializeW failed.");
+std::shared_ptr<const FrameInfo> SymbolSession::symbolicate(const ImageData& imageData, size_t offset)
+{
+    if (auto frame = mFrameCache.find(imageData.id(), offset)) {
+        return frame;
     }
-}
 
+    // Concurrent misses for the same frame may both reach the backend, the last insertion wins.
+    auto result = std::make_shared<FrameInfo>();
+    mBackend.symbolicate(imageData, offset, *result);
 
-Symbolicator::~Symbolicator()
+    mFrameCache.insert(imageData.id(), offset, result);
+    return result;
+}
+
+void SymbolSession::symbolicateBatch(const ImageData& imageData, const std::vector<size_t>& offsets,
+    std::vector<std::shared_ptr<const FrameInfo>>& frames)
 {
-    for (auto& [imageBase, module_] : mModuleMap) {
-        ::SymUnloadModule64(mProcess, module_);
+    frames.resize(offsets.size());
+
+    std::vector<size_t> misses;
+    std::vector<size_t> missOffsets;
+    for (size_t i = 0; i < offsets.size(); ++i) {
+        frames[i] = mFrameCache.find(imageData.id(), offsets[i]);
+        if (!frames[i]) {
+            misses.push_back(i);
+            missOffsets.push_back(offsets[i]);
+        }
+    }
+    if (misses.empty()) {
+        return;
     }
 
-    ::SymCleanup(mProcess);
+    std::vector<FrameInfo> resolved;
+    mBackend.symbolicateBatch(imageData, missOffsets, resolved);
+    for (size_t i = 0; i < misses.size(); ++i) {
+        auto result = std::make_shared<const FrameInfo>(std::move(resolved[i]));
+        mFrameCache.insert(imageData.id(), missOffsets[i], result);
+        frames[misses[i]] = std::move(result);
+    }
 }
 
-std::wstring Symbolicator::symbolicate(void* address)
+std::wstring formatFrame(void* address, const ImageData* image, size_t offset, const FrameInfo* frame)
 {
     std::wstring result{ std::format(L"0x{:016x}", reinterpret_cast<size_t>(address)) };
 
-    auto [imageBase, offset] = mProcessData.decompose(address);
-
-    if (!imageBase) {
+    if (!image) {
         return result;
     }
 
-    const auto& imageData = mProcessData.getImage(imageBase);
+    const auto& imageData = *image;
     result += std::format(L" {}+0x{:x}", imageData.name(), offset);
 
-    if (!load(imageData)) {
+    if (!frame || frame->symbolName.empty()) {
         return result;
     }
-
-    char buffer[sizeof(SYMBOL_INFOW) + MAX_SYM_NAME * sizeof(wchar_t)]{};
-    auto symbol = reinterpret_cast<SYMBOL_INFOW*>(buffer);
-
-    symbol->SizeOfStruct = sizeof(*symbol);
-    symbol->MaxNameLen = MAX_SYM_NAME;
-
-    DWORD64 displacement;
-    if (!::SymFromAddrW(mProcess, reinterpret_cast<DWORD64>(address), &displacement, symbol)) {
-        return result;
+    result += std::format(L" {}!{}+0x{:x}", imageData.name(), frame->symbolName, frame->displacement);
+    if (!frame->inlineName.empty()) {
+        result += std::format(L" [inlined {}]", frame->inlineName);
     }
 
-    result += std::format(L" {}!{}+0x{:x}", imageData.name(), symbol->Name, displacement);
-
-    IMAGEHLP_LINEW64 line{};
-    line.SizeOfStruct = sizeof(line);
-    DWORD lineDisplacement;
-    if (!::SymGetLineFromAddrW64(mProcess, reinterpret_cast<DWORD64>(address), &lineDisplacement, &line)) {
+    if (frame->fileName.empty()) {
         return result;
     }
-    result += std::format(L" {}:{}+0x{:x}", line.FileName, line.LineNumber, lineDisplacement);
+    result += std::format(L" {}:{}+0x{:x}", frame->fileName, frame->lineNumber, frame->lineDisplacement);
     return result;
 }
 
-bool Symbolicator::load(const ImageData& imageData)
+std::wstring Symbolicator::symbolicate(void* address)
 {
-    auto [it, isNew] = mModuleMap.emplace(std::make_pair(imageData.base(), 0));
-
-    if (!isNew) {
-        auto & [imageBase, module_] = *it;
-        return bool(module_);
-    }
-
-    const wchar_t* imagePath = imageData.path().c_str();
-
-    SYMSRV_INDEX_INFOW indexInfo{};
-    indexInfo.sizeofstruct = sizeof(indexInfo);
-    if (!::SymSrvGetFileIndexInfoW(imagePath, &indexInfo, 0)) {
-        return false;
-    }
-
-    std::wcout << L"Downloading symbols file " << indexInfo.pdbfile << L"..." << std::endl;
-
-    wchar_t foundFile[MAX_PATH + 1]{};
-    if (!::SymFindFileInPathW(mProcess, nullptr, indexInfo.pdbfile,
-        &indexInfo.guid, indexInfo.age, 0, SSRVOPT_GUIDPTR, foundFile,
-        nullptr, nullptr)) {
-        return false;
-    }
-
-    const wchar_t* imageName = imageData.name().c_str();
-    auto module_ = ::SymLoadModuleExW(
-        mProcess, nullptr, imagePath, imageName,
-        reinterpret_cast<DWORD64>(imageData.base()), 0, nullptr, 0);
-    if (!module_) {
-        return false;
+    auto [image, offset] = mModules->decompose(address, mLastHit);
+    if (!image) {
+        return formatFrame(address, nullptr, 0, nullptr);
     }
 
-    IMAGEHLP_MODULEW64 moduleInfo{};
-    moduleInfo.SizeOfStruct = sizeof moduleInfo;
-    if (!::SymGetModuleInfoW64(mProcess, module_, &moduleInfo)) {
-        ::SymUnloadModule64(mProcess, module_);
-        return false;
-    }
-
-    it->second = module_;
-    return true;
+    auto frame = mSession.symbolicate(*image, offset);
+    return formatFrame(address, image, offset, frame.get());
 }
 
-ImageData Symbolicator::guessImageFromSymbol(const std::wstring& imagePath, const std::wstring& symbolName, void* symbolAddress)
+void symbolicateBatch(SymbolSession& session, const std::vector<StackRequest>& requests)
 {
-    SYMSRV_INDEX_INFOW indexInfo{};
-    indexInfo.sizeofstruct = sizeof(indexInfo);
-    if (!::SymSrvGetFileIndexInfoW(imagePath.c_str(), &indexInfo, 0)) {
-        return ImageData{};
-    }
-
-    std::wcout << L"Downloading symbols file " << indexInfo.pdbfile << L"..." << std::endl;
-
-    wchar_t foundFile[MAX_PATH + 1]{};
-    if (!::SymFindFileInPathW(mProcess, nullptr, indexInfo.pdbfile,
-        &indexInfo.guid, indexInfo.age, 0, SSRVOPT_GUIDPTR, foundFile,
-        nullptr, nullptr)) {
-        return ImageData{};
+    // Frames found in an image, in the order they get resolved.
+    struct Pending {
+        const ImageData* image;
+        size_t offset;
+        uint32_t request;
+        uint32_t frame;
+    };
+
+    std::vector<Pending> pending;
+    for (size_t r = 0; r < requests.size(); ++r) {
+        const auto& request = requests[r];
+        request.frames->resize(request.size);
+
+        size_t lastHit = 0;
+        for (size_t i = 0; i < request.size; ++i) {
+            auto address = reinterpret_cast<void*>(request.stackTrace[i]);
+            auto [image, offset] = request.modules->decompose(address, lastHit);
+            if (image) {
+                pending.push_back(Pending{ image, offset, static_cast<uint32_t>(r), static_cast<uint32_t>(i) });
+            }
+            else {
+                (*request.frames)[i] = formatFrame(address, nullptr, 0, nullptr);
+            }
+        }
+    }
+
+    std::sort(pending.begin(), pending.end(), [](const Pending& left, const Pending& right) {
+        return left.image->id() != right.image->id() ? left.image->id() < right.image->id() : left.offset < right.offset;
+    });
+
+    std::vector<size_t> offsets;
+    std::vector<std::shared_ptr<const FrameInfo>> frames;
+    for (size_t begin = 0; begin < pending.size();) {
+        auto imageId = pending[begin].image->id();
+        size_t end = begin;
+        offsets.clear();
+        while (end < pending.size() && pending[end].image->id() == imageId) {
+            if (offsets.empty() || offsets.back() != pending[end].offset) {
+                offsets.push_back(pending[end].offset);
+            }
+            ++end;
+        }
+
+        session.symbolicateBatch(*pending[begin].image, offsets, frames);
+
+        size_t next = 0;
+        for (size_t i = begin; i < end; ++i) {
+            const auto& item = pending[i];
+            while (offsets[next] != item.offset) {
+                ++next;
+            }
+            const auto& request = requests[item.request];
+            auto address = reinterpret_cast<void*>(request.stackTrace[item.frame]);
+            (*request.frames)[item.frame] = formatFrame(address, item.image, item.offset, frames[next].get());
+        }
+        begin = end;
     }
-
-    auto module_ = ::SymLoadModuleExW(
-        mProcess, nullptr, imagePath.c_str(), L"_temporary_guess_",
-        0, 0, nullptr, 0);
-    if (!module_) {
-        return ImageData{};
-    }
-
-    IMAGEHLP_MODULEW64 moduleInfo{};
-    moduleInfo.SizeOfStruct = sizeof moduleInfo;
-    if (!::SymGetModuleInfoW64(mProcess, module_, &moduleInfo)) {
-        ::SymUnloadModule64(mProcess, module_);
-        return ImageData{};
-    }
-
-    SYMBOL_INFOW symbol{};
-    symbol.SizeOfStruct = sizeof (symbol);
-    symbol.MaxNameLen = 0;
-    if (!::SymFromNameW(mProcess, std::format(L"_temporary_guess_!{}", symbolName).c_str(), &symbol)) {
-        ::SymUnloadModule64(mProcess, module_);
-        return ImageData{};
-    }
-
-    bool isOnNextPage = (reinterpret_cast<DWORD64>(symbolAddress) & 0xFFFUi64) < (symbol.Address & 0xFFFUi64);
-    DWORD64 symbolPage = reinterpret_cast<DWORD64>(symbolAddress) & ~0xFFFUi64;
-    if (isOnNextPage) {
-        symbolPage -= 0x1000Ui64;
-    }
-
-    DWORD64 guessedImageBase = symbolPage - ((symbol.Address - moduleInfo.BaseOfImage) & ~0xFFFUi64);
-
-    ::SymUnloadModule64(mProcess, module_);
-
-    return ImageData{ reinterpret_cast<void*>(guessedImageBase), moduleInfo.ImageSize, imagePath };
 }
@@ -1,38 +1,94 @@
 #ifndef SYMBOLS_H
 #define SYMBOLS_H
 
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <vector>
 
+#include "cache.h"
 #include "data.h"
-#include "winkrabs.h"
 
-class Symbolicator {
+// Source of symbol and line information for the images, such as PDB files through DbgHelp,
+// or Breakpad symbol files. Backends are called concurrently from all workers.
+class SymbolBackend {
 public:
-    Symbolicator(const ProcessData&& processData, const std::wstring& symDir, const std::wstring& symPath);
+    virtual ~SymbolBackend() = default;
 
-    ~Symbolicator();
+    // Fills in the frame for an offset in an image, leaving it empty if there is no symbol for it.
+    virtual void symbolicate(const ImageData& imageData, size_t offset, FrameInfo& frame) = 0;
 
-    Symbolicator(Symbolicator&) = delete;
-    Symbolicator& operator=(const Symbolicator&) = delete;
+    // Same as symbolicate for offsets of one image in increasing order, filling in one frame per offset.
+    // Backends may look the image up once and resolve the offsets in a single pass.
+    virtual void symbolicateBatch(const ImageData& imageData, const std::vector<size_t>& offsets, std::vector<FrameInfo>& frames);
 
-    Symbolicator(Symbolicator&&) = delete;
-    Symbolicator& operator=(Symbolicator&&) = delete;
+    // Loads the symbols of an image ahead of its first lookup.
+    virtual void prefetch(const ImageData& imageData) = 0;
+};
 
-    std::wstring symbolicate(void* address);
+// Symbolication shared by all events, backed by a frame cache in front of a symbol backend.
+class SymbolSession {
+public:
+    SymbolSession(SymbolBackend& backend, size_t frameCacheBytes) :
+        mBackend{ backend },
+        mFrameCache{ frameCacheBytes }
+    {
+    }
+
+    SymbolSession(SymbolSession&) = delete;
+    SymbolSession& operator=(const SymbolSession&) = delete;
 
-    ImageData guessImageFromSymbol(const std::wstring& imagePath, const std::wstring& symbolName, void* symbolAddress);
+    SymbolSession(SymbolSession&&) = delete;
+    SymbolSession& operator=(SymbolSession&&) = delete;
+
+    // Returns the symbol and line information for an offset in an image, from the frame cache if possible.
+    std::shared_ptr<const FrameInfo> symbolicate(const ImageData& imageData, size_t offset);
+
+    // Same as symbolicate for offsets of one image in increasing order, without duplicates.
+    // The offsets missing from the frame cache are resolved in one backend call.
+    void symbolicateBatch(const ImageData& imageData, const std::vector<size_t>& offsets,
+        std::vector<std::shared_ptr<const FrameInfo>>& frames);
+
+    FrameCache::Stats cacheStats() const { return mFrameCache.stats(); }
 
 private:
-    ProcessData mProcessData;
-    HANDLE mProcess;
-    std::unordered_map<void*, DWORD64> mModuleMap;
+    SymbolBackend& mBackend;
+    FrameCache mFrameCache;
+};
 
-    bool load(const ImageData& imageData);
+// Formats a return address the way symbolicated frames are written, with whatever is known about it.
+std::wstring formatFrame(void* address, const ImageData* image, size_t offset, const FrameInfo* frame);
+
+// Symbolicates the return addresses of one event, against a snapshot of its process modules.
+class Symbolicator {
+public:
+    Symbolicator(SymbolSession& session, ModuleSet::Pointer modules) :
+        mSession{ session },
+        mModules{ std::move(modules) },
+        mLastHit{ 0 }
+    {
+    }
+
+    std::wstring symbolicate(void* address);
 
 private:
-    static std::atomic<uint32_t> nextSymbolicatorId;
+    SymbolSession& mSession;
+    ModuleSet::Pointer mModules;
+    size_t mLastHit;
+};
+
+// The stack of an event to symbolicate in a batch, with one formatted frame appended per return address.
+struct StackRequest {
+    const ModuleSet* modules;
+    const uint64_t* stackTrace;
+    size_t size;
+    std::vector<std::wstring>* frames;
 };
 
+// Symbolicates the stacks of several events together, with the same result as a Symbolicator per event.
+// The frames of all stacks are grouped by image and sorted by offset, each image is resolved in one pass,
+// and the results are scattered back to their stacks.
+void symbolicateBatch(SymbolSession& session, const std::vector<StackRequest>& requests);
+
 #endif // SYMBOLS_H
@@ -0,0 +1,444 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "cache.h"
+#include "mapping.h"
+#include "pe.h"
+#include "symindex.h"
+#include "text.h"
+
+#define FILE_MAGIC "MTMSYM01"
+#define FILE_HEADER_SIZE 64
+#define FUNCTION_ENTRY_SIZE 16
+#define PUBLIC_ENTRY_SIZE 8
+
+template <typename T>
+static void store(uint8_t* destination, T value)
+{
+    std::memcpy(destination, &value, sizeof(value));
+}
+
+template <typename T>
+static T load(const uint8_t* source)
+{
+    T value;
+    std::memcpy(&value, source, sizeof(value));
+    return value;
+}
+
+static void putVarint(std::vector<uint8_t>& buffer, uint64_t value)
+{
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<uint8_t>(value));
+}
+
+static void putSigned(std::vector<uint8_t>& buffer, int64_t value)
+{
+    putVarint(buffer, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+// These return false instead of reading past the end of a corrupted index.
+static bool getVarint(const uint8_t*& position, const uint8_t* end, uint64_t& value)
+{
+    value = 0;
+    for (unsigned shift = 0; position < end && shift < 64; shift += 7) {
+        uint8_t byte = *position++;
+        value |= uint64_t(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool getSigned(const uint8_t*& position, const uint8_t* end, int64_t& value)
+{
+    uint64_t encoded;
+    if (!getVarint(position, end, encoded)) {
+        return false;
+    }
+    value = static_cast<int64_t>(encoded >> 1) ^ -static_cast<int64_t>(encoded & 1);
+    return true;
+}
+
+SymbolIndex::SymbolIndex(const std::filesystem::path& path) :
+    mFile{ std::make_unique<MappedFile>(path) },
+    mContents{},
+    mData{ mFile->data() },
+    mSize{ mFile->size() },
+    mFunctionCount{ 0 },
+    mPublicCount{ 0 },
+    mFunctions{ nullptr },
+    mPublics{ nullptr },
+    mBlocks{ nullptr },
+    mStrings{ nullptr }
+{
+    validate();
+}
+
+SymbolIndex::SymbolIndex(std::vector<uint8_t>&& contents) :
+    mFile{},
+    mContents{ std::move(contents) },
+    mData{ mContents.data() },
+    mSize{ mContents.size() },
+    mFunctionCount{ 0 },
+    mPublicCount{ 0 },
+    mFunctions{ nullptr },
+    mPublics{ nullptr },
+    mBlocks{ nullptr },
+    mStrings{ nullptr }
+{
+    validate();
+}
+
+void SymbolIndex::validate()
+{
+    if (mSize < FILE_HEADER_SIZE || std::memcmp(mData, FILE_MAGIC, 8) != 0 || load<uint32_t>(mData + 56) != mSize) {
+        throw std::runtime_error("Invalid symbol index.");
+    }
+
+    mFunctionCount = load<uint32_t>(mData + 28);
+    mPublicCount = load<uint32_t>(mData + 32);
+    uint32_t functionsOffset = load<uint32_t>(mData + 40);
+    uint32_t publicsOffset = load<uint32_t>(mData + 44);
+    uint32_t blocksOffset = load<uint32_t>(mData + 48);
+    uint32_t stringsOffset = load<uint32_t>(mData + 52);
+
+    if (functionsOffset + uint64_t(mFunctionCount) * FUNCTION_ENTRY_SIZE > mSize ||
+        publicsOffset + uint64_t(mPublicCount) * PUBLIC_ENTRY_SIZE > mSize ||
+        blocksOffset > mSize || stringsOffset > mSize) {
+        throw std::runtime_error("Invalid symbol index.");
+    }
+
+    mFunctions = mData + functionsOffset;
+    mPublics = mData + publicsOffset;
+    mBlocks = mData + blocksOffset;
+    mStrings = mData + stringsOffset;
+}
+
+bool SymbolIndex::matches(const ImageIndexInfo& indexInfo) const
+{
+    return std::memcmp(mData + 8, indexInfo.pdbGuid, sizeof(indexInfo.pdbGuid)) == 0 &&
+        load<uint32_t>(mData + 24) == indexInfo.pdbAge;
+}
+
+std::wstring SymbolIndex::string(uint32_t offset) const
+{
+    const uint8_t* end = mData + mSize;
+    const uint8_t* position = mStrings + offset;
+    uint64_t length;
+    if (offset >= size_t(end - mStrings) || !getVarint(position, end, length) || length > size_t(end - position)) {
+        return std::wstring{};
+    }
+    return fromUtf8(reinterpret_cast<const char*>(position), static_cast<size_t>(length));
+}
+
+// Index of the first entry after the offset, in an array of entries sorted by RVA, knowing that the entries
+// before the start are not after it.
+static uint32_t upperBound(const uint8_t* entries, uint32_t count, size_t entrySize, uint32_t start, uint64_t offset)
+{
+    // Gallop to bracket the entry, then search in between.
+    uint32_t low = start;
+    uint32_t high = count;
+    for (uint64_t step = 1; low < count; step *= 2) {
+        uint32_t probe = low + static_cast<uint32_t>(std::min<uint64_t>(step, count - low)) - 1;
+        if (load<uint32_t>(entries + probe * entrySize) > offset) {
+            high = probe;
+            break;
+        }
+        low = probe + 1;
+    }
+
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        if (load<uint32_t>(entries + middle * entrySize) <= offset) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void SymbolIndex::lookup(uint64_t offset, FrameInfo& frame) const
+{
+    Cursor cursor;
+    lookup(offset, frame, cursor);
+}
+
+void SymbolIndex::lookup(uint64_t offset, FrameInfo& frame, Cursor& cursor) const
+{
+    if (offset > UINT32_MAX) {
+        return;
+    }
+
+    uint32_t function = upperBound(mFunctions, mFunctionCount, FUNCTION_ENTRY_SIZE, cursor.function, offset);
+    cursor.function = function;
+    const uint8_t* entry = function ? mFunctions + (function - 1) * FUNCTION_ENTRY_SIZE : nullptr;
+    if (!entry || offset - load<uint32_t>(entry) >= load<uint32_t>(entry + 4)) {
+        uint32_t public_ = upperBound(mPublics, mPublicCount, PUBLIC_ENTRY_SIZE, cursor.public_, offset);
+        cursor.public_ = public_;
+        if (public_) {
+            entry = mPublics + (public_ - 1) * PUBLIC_ENTRY_SIZE;
+            frame.symbolName = string(load<uint32_t>(entry + 4));
+            frame.displacement = offset - load<uint32_t>(entry);
+        }
+        return;
+    }
+
+    uint32_t functionRva = load<uint32_t>(entry);
+    frame.symbolName = string(load<uint32_t>(entry + 8));
+    frame.displacement = offset - functionRva;
+
+    const uint8_t* end = mData + mSize;
+    const uint8_t* position = mBlocks + load<uint32_t>(entry + 12);
+    if (position >= end) {
+        return;
+    }
+
+    // All lines are decoded to get to the inlined ranges, functions only have a few of them.
+    uint64_t count;
+    if (!getVarint(position, end, count)) {
+        return;
+    }
+    int64_t lineEnd = functionRva;
+    int64_t lineNumber = 0;
+    uint64_t fileName = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        int64_t gap, lineDelta;
+        uint64_t size, file;
+        if (!getSigned(position, end, gap) || !getVarint(position, end, size) ||
+            !getSigned(position, end, lineDelta) || !getVarint(position, end, file)) {
+            return;
+        }
+
+        int64_t lineStart = lineEnd + gap;
+        lineEnd = lineStart + static_cast<int64_t>(size);
+        lineNumber += lineDelta;
+        if (file) {
+            fileName = file - 1;
+        }
+
+        if (int64_t(offset) >= lineStart && int64_t(offset) < lineEnd && frame.fileName.empty()) {
+            frame.fileName = string(static_cast<uint32_t>(fileName));
+            frame.lineNumber = static_cast<uint32_t>(lineNumber);
+            frame.lineDisplacement = static_cast<uint32_t>(int64_t(offset) - lineStart);
+        }
+    }
+
+    if (!getVarint(position, end, count)) {
+        return;
+    }
+    uint64_t innermostDepth = 0;
+    uint64_t innermostName = 0;
+    bool isInlined = false;
+    for (uint64_t i = 0; i < count; ++i) {
+        uint64_t rvaDelta, size, depth, name;
+        if (!getVarint(position, end, rvaDelta) || !getVarint(position, end, size) ||
+            !getVarint(position, end, depth) || !getVarint(position, end, name)) {
+            return;
+        }
+
+        uint64_t inlineStart = functionRva + rvaDelta;
+        if (offset >= inlineStart && offset - inlineStart < size && (!isInlined || depth > innermostDepth)) {
+            isInlined = true;
+            innermostDepth = depth;
+            innermostName = name;
+        }
+    }
+    if (isInlined) {
+        frame.inlineName = string(static_cast<uint32_t>(innermostName));
+    }
+}
+
+std::shared_ptr<const SymbolIndex> SymbolIndex::open(const std::filesystem::path& path, const ImageIndexInfo& indexInfo)
+{
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) {
+        return nullptr;
+    }
+
+    try {
+        auto index = std::make_shared<const SymbolIndex>(path);
+        if (index->matches(indexInfo)) {
+            return index;
+        }
+    }
+    catch (const std::exception& e) {
+        std::cout << e.what() << std::endl;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<const SymbolIndex> SymbolIndex::save(const std::filesystem::path& path, std::vector<uint8_t>&& contents)
+{
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    // Write to a temporary file renamed into place, so that readers never see a partial index.
+    auto temporaryPath = path;
+    temporaryPath += L".tmp";
+    {
+        std::ofstream file{ temporaryPath, std::ios::binary | std::ios::trunc };
+        file.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+        if (!file) {
+            error = std::make_error_code(std::errc::io_error);
+        }
+    }
+    if (!error) {
+        std::filesystem::rename(temporaryPath, path, error);
+    }
+
+    if (!error) {
+        try {
+            return std::make_shared<const SymbolIndex>(path);
+        }
+        catch (const std::exception& e) {
+            std::cout << e.what() << std::endl;
+        }
+    }
+    else {
+        std::filesystem::remove(temporaryPath, error);
+        std::wcout << L"Failed to save symbol index " << path.wstring() << L"." << std::endl;
+    }
+    return std::make_shared<const SymbolIndex>(std::move(contents));
+}
+
+void SymbolIndexWriter::addFunction(uint32_t rva, uint32_t size, std::string_view name)
+{
+    mFunctions.push_back(Function{ rva, size, intern(name) });
+}
+
+void SymbolIndexWriter::addPublic(uint32_t rva, std::string_view name)
+{
+    mPublics.push_back(Public{ rva, intern(name) });
+}
+
+void SymbolIndexWriter::addLine(uint32_t rva, uint32_t size, uint32_t lineNumber, std::string_view fileName)
+{
+    mLines.push_back(Line{ rva, size, lineNumber, intern(fileName) });
+}
+
+void SymbolIndexWriter::addInline(uint32_t rva, uint32_t size, uint32_t depth, std::string_view name)
+{
+    mInlines.push_back(Inline{ rva, size, depth, intern(name) });
+}
+
+uint32_t SymbolIndexWriter::intern(std::string_view text)
+{
+    auto it = mStringOffsets.find(std::string{ text });
+    if (it != mStringOffsets.end()) {
+        return it->second;
+    }
+
+    auto offset = static_cast<uint32_t>(mStrings.size());
+    putVarint(mStrings, text.size());
+    mStrings.insert(mStrings.end(), text.begin(), text.end());
+    mStringOffsets.emplace(std::string{ text }, offset);
+    return offset;
+}
+
+std::vector<uint8_t> SymbolIndexWriter::finish(const ImageIndexInfo& indexInfo)
+{
+    auto byRva = [](const auto& left, const auto& right) { return left.rva < right.rva; };
+    std::stable_sort(mFunctions.begin(), mFunctions.end(), byRva);
+    std::stable_sort(mPublics.begin(), mPublics.end(), byRva);
+    std::stable_sort(mLines.begin(), mLines.end(), byRva);
+    std::stable_sort(mInlines.begin(), mInlines.end(), byRva);
+
+    std::vector<uint8_t> blocks;
+    std::vector<uint32_t> blockOffsets;
+    blockOffsets.reserve(mFunctions.size());
+    for (const auto& function : mFunctions) {
+        blockOffsets.push_back(static_cast<uint32_t>(blocks.size()));
+        auto functionEnd = static_cast<uint32_t>(std::min<uint64_t>(uint64_t(function.rva) + function.size, UINT32_MAX));
+
+        // Functions can overlap, so the ranges within each one are searched for separately.
+        auto firstLine = std::lower_bound(mLines.begin(), mLines.end(), Line{ function.rva, 0, 0, 0 }, byRva);
+        auto lastLine = std::lower_bound(firstLine, mLines.end(), Line{ functionEnd, 0, 0, 0 }, byRva);
+        putVarint(blocks, lastLine - firstLine);
+
+        int64_t lineEnd = function.rva;
+        int64_t lineNumber = 0;
+        uint64_t fileName = UINT64_MAX;
+        for (auto line = firstLine; line != lastLine; ++line) {
+            putSigned(blocks, int64_t(line->rva) - lineEnd);
+            putVarint(blocks, line->size);
+            putSigned(blocks, int64_t(line->lineNumber) - lineNumber);
+            putVarint(blocks, line->fileName == fileName ? 0 : uint64_t(line->fileName) + 1);
+
+            lineEnd = int64_t(line->rva) + line->size;
+            lineNumber = line->lineNumber;
+            fileName = line->fileName;
+        }
+
+        auto firstInline = std::lower_bound(mInlines.begin(), mInlines.end(), Inline{ function.rva, 0, 0, 0 }, byRva);
+        auto lastInline = std::lower_bound(firstInline, mInlines.end(), Inline{ functionEnd, 0, 0, 0 }, byRva);
+        putVarint(blocks, lastInline - firstInline);
+        for (auto inline_ = firstInline; inline_ != lastInline; ++inline_) {
+            putVarint(blocks, inline_->rva - function.rva);
+            putVarint(blocks, inline_->size);
+            putVarint(blocks, inline_->depth);
+            putVarint(blocks, inline_->name);
+        }
+    }
+
+    size_t functionsOffset = FILE_HEADER_SIZE;
+    size_t publicsOffset = functionsOffset + mFunctions.size() * FUNCTION_ENTRY_SIZE;
+    size_t blocksOffset = publicsOffset + mPublics.size() * PUBLIC_ENTRY_SIZE;
+    size_t stringsOffset = blocksOffset + blocks.size();
+    size_t fileSize = stringsOffset + mStrings.size();
+    if (fileSize > UINT32_MAX) {
+        throw std::runtime_error("Symbol index too large.");
+    }
+
+    std::vector<uint8_t> contents(stringsOffset);
+    std::memcpy(contents.data(), FILE_MAGIC, 8);
+    std::memcpy(contents.data() + 8, indexInfo.pdbGuid, sizeof(indexInfo.pdbGuid));
+    store<uint32_t>(contents.data() + 24, indexInfo.pdbAge);
+    store<uint32_t>(contents.data() + 28, static_cast<uint32_t>(mFunctions.size()));
+    store<uint32_t>(contents.data() + 32, static_cast<uint32_t>(mPublics.size()));
+    store<uint32_t>(contents.data() + 40, static_cast<uint32_t>(functionsOffset));
+    store<uint32_t>(contents.data() + 44, static_cast<uint32_t>(publicsOffset));
+    store<uint32_t>(contents.data() + 48, static_cast<uint32_t>(blocksOffset));
+    store<uint32_t>(contents.data() + 52, static_cast<uint32_t>(stringsOffset));
+    store<uint32_t>(contents.data() + 56, static_cast<uint32_t>(fileSize));
+
+    for (size_t i = 0; i < mFunctions.size(); ++i) {
+        uint8_t* entry = contents.data() + functionsOffset + i * FUNCTION_ENTRY_SIZE;
+        store<uint32_t>(entry, mFunctions[i].rva);
+        store<uint32_t>(entry + 4, mFunctions[i].size);
+        store<uint32_t>(entry + 8, mFunctions[i].name);
+        store<uint32_t>(entry + 12, blockOffsets[i]);
+    }
+    for (size_t i = 0; i < mPublics.size(); ++i) {
+        uint8_t* entry = contents.data() + publicsOffset + i * PUBLIC_ENTRY_SIZE;
+        store<uint32_t>(entry, mPublics[i].rva);
+        store<uint32_t>(entry + 4, mPublics[i].name);
+    }
+    std::copy(blocks.begin(), blocks.end(), contents.begin() + blocksOffset);
+    contents.insert(contents.end(), mStrings.begin(), mStrings.end());
+    return contents;
+}
+
+std::filesystem::path symbolIndexPath(const ImageIndexInfo& indexInfo)
+{
+    std::filesystem::path indexFile{ indexInfo.pdbFile };
+    indexFile.replace_extension(L".symidx");
+    return std::filesystem::path{ indexInfo.pdbFile } / pdbDebugId(indexInfo) / indexFile;
+}
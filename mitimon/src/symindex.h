@@ -0,0 +1,148 @@
+#ifndef SYMINDEX_H
+#define SYMINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "cache.h"
+#include "mapping.h"
+#include "pe.h"
+
+// Precompiled symbols of one module, built once from a PDB or Breakpad symbol file and then mapped
+// read-only, so that loading a module does not require parsing anything.
+//
+// All integers are little endian, addresses are RVAs, offsets are relative to the start of the file.
+//
+// File header (64 bytes):
+//   char[8]  "MTMSYM01"
+//   uint8[16] PDB GUID, uint32 PDB age
+//   uint32 function count, uint32 public count, uint32 reserved
+//   uint32 functions offset, uint32 publics offset, uint32 blocks offset, uint32 strings offset
+//   uint32 file size, uint32 reserved
+//
+// Functions, sorted by RVA (16 bytes each): uint32 rva, uint32 size, uint32 name, uint32 offset of its block
+// Publics, sorted by RVA (8 bytes each): uint32 rva, uint32 name
+//
+// Blocks, one per function, with varints and zigzag encoded signed varints:
+//   line count, then for each line, sorted by RVA:
+//     signed RVA delta from the end of the previous line (or the function start), size,
+//     signed line number delta, file name + 1 or 0 for the same file as the previous line
+//   inline count, then for each inlined range: RVA delta from the function start, size, depth, name
+//
+// Block offsets are relative to the first block. Names are offsets in the string table,
+// made of a varint byte count followed by UTF-8 text.
+class SymbolIndex {
+public:
+    // Maps an index file. Throws std::runtime_error if it cannot be mapped or is not a valid index.
+    SymbolIndex(const std::filesystem::path& path);
+
+    // Uses index contents that were just built, when they could not be saved.
+    SymbolIndex(std::vector<uint8_t>&& contents);
+
+    SymbolIndex(SymbolIndex&) = delete;
+    SymbolIndex& operator=(const SymbolIndex&) = delete;
+
+    SymbolIndex(SymbolIndex&&) = delete;
+    SymbolIndex& operator=(SymbolIndex&&) = delete;
+
+    // Returns true if the index was built for this PDB.
+    bool matches(const ImageIndexInfo& indexInfo) const;
+
+    // Where the previous lookup of a batch ended in the arrays sorted by RVA.
+    struct Cursor {
+        uint32_t function = 0;
+        uint32_t public_ = 0;
+    };
+
+    // Fills in the frame from the function covering the offset, or else from the closest public symbol before it.
+    void lookup(uint64_t offset, FrameInfo& frame) const;
+
+    // Same as lookup, for offsets in increasing order: the search starts from the cursor, and gallops from there,
+    // so that offsets close to each other are found in a few steps.
+    void lookup(uint64_t offset, FrameInfo& frame, Cursor& cursor) const;
+
+    // Maps an existing index for a PDB, returns nullptr if there is none or it is unusable.
+    static std::shared_ptr<const SymbolIndex> open(const std::filesystem::path& path, const ImageIndexInfo& indexInfo);
+
+    // Saves index contents and maps them, or keeps them in memory if they cannot be saved.
+    static std::shared_ptr<const SymbolIndex> save(const std::filesystem::path& path, std::vector<uint8_t>&& contents);
+
+private:
+    void validate();
+
+    std::wstring string(uint32_t offset) const;
+
+private:
+    std::unique_ptr<MappedFile> mFile;
+    std::vector<uint8_t> mContents;
+
+    const uint8_t* mData;
+    size_t mSize;
+    uint32_t mFunctionCount;
+    uint32_t mPublicCount;
+    const uint8_t* mFunctions;
+    const uint8_t* mPublics;
+    const uint8_t* mBlocks;
+    const uint8_t* mStrings;
+};
+
+// Collects the symbols of one module, in any order, and encodes them as a symbol index.
+// Names are UTF-8. Lines and inlined ranges outside of any function are dropped.
+class SymbolIndexWriter {
+public:
+    void addFunction(uint32_t rva, uint32_t size, std::string_view name);
+    void addPublic(uint32_t rva, std::string_view name);
+    void addLine(uint32_t rva, uint32_t size, uint32_t lineNumber, std::string_view fileName);
+    void addInline(uint32_t rva, uint32_t size, uint32_t depth, std::string_view name);
+
+    std::vector<uint8_t> finish(const ImageIndexInfo& indexInfo);
+
+private:
+    struct Function {
+        uint32_t rva;
+        uint32_t size;
+        uint32_t name;
+    };
+
+    struct Public {
+        uint32_t rva;
+        uint32_t name;
+    };
+
+    struct Line {
+        uint32_t rva;
+        uint32_t size;
+        uint32_t lineNumber;
+        uint32_t fileName;
+    };
+
+    struct Inline {
+        uint32_t rva;
+        uint32_t size;
+        uint32_t depth;
+        uint32_t name;
+    };
+
+    uint32_t intern(std::string_view text);
+
+private:
+    std::vector<Function> mFunctions;
+    std::vector<Public> mPublics;
+    std::vector<Line> mLines;
+    std::vector<Inline> mInlines;
+
+    std::vector<uint8_t> mStrings;
+    std::unordered_map<std::string, uint32_t> mStringOffsets;
+};
+
+// Location of the index of a PDB in a symbol store, next to where the symbol server puts the PDB:
+// <pdb file>/<debug id>/<pdb file without .pdb>.symidx
+std::filesystem::path symbolIndexPath(const ImageIndexInfo& indexInfo);
+
+#endif // SYMINDEX_H
@@ -0,0 +1,227 @@
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <numeric>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "capture.h"
+#include "data.h"
+#include "symbols.h"
+#include "synthetic.h"
+
+#define SYNTHETIC_KERNEL_BASE 0xfffff80000000000ull
+#define SYNTHETIC_KERNEL_SIZE 0x1000000ull
+#define SYNTHETIC_KERNEL_NAME L"\\SystemRoot\\system32\\ntoskrnl.exe"
+
+// Each process image gets a slot of this size, images are never larger.
+#define SYNTHETIC_IMAGE_BASE 0x7ff000000000ull
+#define SYNTHETIC_IMAGE_SLOT 0x1000000ull
+
+// The first images are loaded by every process, as system libraries are.
+#define SYNTHETIC_SHARED_IMAGES 8u
+
+// One frame in this many is an address outside of any image, as in JIT code.
+#define SYNTHETIC_UNKNOWN_FRAME_RATIO 64
+
+// ETW does not record more frames than this.
+#define SYNTHETIC_MAX_DEPTH 192u
+
+#define SYNTHETIC_START_TIMESTAMP 1000000000ull
+
+std::optional<SyntheticConfig> parseSyntheticConfig(std::string_view spec)
+{
+    SyntheticConfig config;
+    while (!spec.empty()) {
+        auto end = spec.find(',');
+        auto pair = spec.substr(0, end);
+        spec = end == std::string_view::npos ? std::string_view{} : spec.substr(end + 1);
+
+        auto separator = pair.find('=');
+        if (separator == std::string_view::npos) {
+            return std::nullopt;
+        }
+        auto key = pair.substr(0, separator);
+        auto text = pair.substr(separator + 1);
+
+        uint64_t value = 0;
+        auto [last, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        if (error != std::errc{} || last != text.data() + text.size() || (value == 0 && key != "seed")) {
+            return std::nullopt;
+        }
+
+        if (key == "processes") {
+            config.processes = static_cast<uint32_t>(value);
+        }
+        else if (key == "images") {
+            config.images = static_cast<uint32_t>(value);
+        }
+        else if (key == "modules") {
+            config.modules = static_cast<uint32_t>(value);
+        }
+        else if (key == "functions") {
+            config.functions = static_cast<uint32_t>(value);
+        }
+        else if (key == "depth") {
+            config.depth = static_cast<uint32_t>(value);
+        }
+        else if (key == "rate") {
+            config.rate = value;
+        }
+        else if (key == "events") {
+            config.events = value;
+        }
+        else if (key == "seed") {
+            config.seed = value;
+        }
+        else if (key == "batch") {
+            config.batch = static_cast<uint32_t>(value);
+        }
+        else {
+            return std::nullopt;
+        }
+    }
+
+    config.modules = std::min(config.modules, config.images);
+    return config;
+}
+
+SyntheticWorkload::SyntheticWorkload(const SyntheticConfig& config) :
+    mConfig{ config },
+    mRandom{ config.seed },
+    mDepth{ 1.0 / std::max(config.depth, 1u) },
+    mImages{},
+    mProcessImages{},
+    mKernelDone{ false },
+    mProcess{ 0 },
+    mModule{ 0 },
+    mEvent{ 0 },
+    mTimestamp{ SYNTHETIC_START_TIMESTAMP }
+{
+    mConfig.modules = std::min(mConfig.modules, mConfig.images);
+
+    mImages.reserve(mConfig.images);
+    for (uint32_t i = 0; i < mConfig.images; ++i) {
+        mImages.push_back(Image{ 0x10000 * (1 + mRandom() % (SYNTHETIC_IMAGE_SLOT / 0x10000)), 0x50000000u + i });
+    }
+
+    std::vector<uint32_t> images(mConfig.images);
+    std::iota(images.begin(), images.end(), 0);
+    size_t shared = std::min<size_t>(SYNTHETIC_SHARED_IMAGES, mConfig.modules);
+    mProcessImages.reserve(mConfig.processes);
+    for (uint32_t i = 0; i < mConfig.processes; ++i) {
+        std::shuffle(images.begin() + shared, images.end(), mRandom);
+        mProcessImages.emplace_back(images.begin(), images.begin() + mConfig.modules);
+    }
+}
+
+bool SyntheticWorkload::next(CaptureRecord& record)
+{
+    record.stack.clear();
+    record.properties.clear();
+
+    if (!mKernelDone) {
+        mKernelDone = true;
+        record.type = CaptureRecordType::KernelImage;
+        record.timestamp = mTimestamp;
+        record.pid = 0;
+        record.imageName = SYNTHETIC_KERNEL_NAME;
+        record.imageBase = SYNTHETIC_KERNEL_BASE;
+        record.imageSize = SYNTHETIC_KERNEL_SIZE;
+        record.imageTimeStamp = 0x40000000;
+        return true;
+    }
+
+    if (mProcess < mProcessImages.size()) {
+        uint32_t pid = 1000 + 4 * static_cast<uint32_t>(mProcess);
+        record.timestamp = mTimestamp;
+        record.pid = pid;
+        if (mModule == 0) {
+            record.type = CaptureRecordType::ProcessStart;
+            record.imageName = std::format(L"\\Device\\HarddiskVolume1\\Synthetic\\process{}.exe", mProcess);
+        }
+        else {
+            auto image = mProcessImages[mProcess][mModule - 1];
+            record.type = CaptureRecordType::ImageLoad;
+            record.imageName = std::format(L"\\Device\\HarddiskVolume1\\Synthetic\\image{}.dll", image);
+            record.imageBase = SYNTHETIC_IMAGE_BASE + (mModule - 1) * SYNTHETIC_IMAGE_SLOT;
+            record.imageSize = mImages[image].size;
+            record.imageTimeStamp = mImages[image].timeStamp;
+        }
+
+        if (++mModule > mProcessImages[mProcess].size()) {
+            mModule = 0;
+            ++mProcess;
+        }
+        return true;
+    }
+
+    if (mEvent == mConfig.events) {
+        return false;
+    }
+
+    generateEvent(record);
+    return true;
+}
+
+size_t SyntheticWorkload::pickSkewed(size_t count)
+{
+    // The product of two uniform picks favors low indices, roughly as a power law would.
+    return static_cast<size_t>((mRandom() % count) * (mRandom() % count) / count);
+}
+
+uint64_t SyntheticWorkload::returnAddress(uint64_t base, uint32_t image)
+{
+    // Each function has a single return address, at a fixed place in its image.
+    uint64_t function = pickSkewed(mConfig.functions);
+    uint64_t hash = (image * 0x9e3779b97f4a7c15ull) ^ (function * 0xc2b2ae3d27d4eb4full);
+    hash ^= hash >> 29;
+    return base + (hash % (mImages[image].size - 0x100) & ~0xfull) + (function & 0xff);
+}
+
+void SyntheticWorkload::generateEvent(CaptureRecord& record)
+{
+    ++mEvent;
+    mTimestamp = SYNTHETIC_START_TIMESTAMP + mEvent * 10000000 / std::max<uint64_t>(mConfig.rate, 1);
+
+    size_t process = pickSkewed(mProcessImages.size());
+    const auto& images = mProcessImages[process];
+
+    record.type = CaptureRecordType::Event;
+    record.timestamp = mTimestamp;
+    record.pid = 1000 + 4 * static_cast<uint32_t>(process);
+    record.tid = record.pid + 4 * (1 + static_cast<uint32_t>(mRandom() % 8));
+    record.taskName = L"Synthetic";
+    record.eventId = 1 + static_cast<int>(mRandom() % 4);
+    record.properties.push_back(std::format(L"ProcessId 0x{:08x}", record.pid));
+    record.properties.push_back(std::format(L"Sequence 0x{:016x}", mEvent));
+
+    auto depth = std::min(1 + mDepth(mRandom), SYNTHETIC_MAX_DEPTH);
+    uint32_t kernelFrames = std::min<uint32_t>(depth, 1 + mRandom() % 4);
+    for (uint32_t i = 0; i < kernelFrames; ++i) {
+        uint64_t function = pickSkewed(mConfig.functions);
+        record.stack.push_back(SYNTHETIC_KERNEL_BASE + (function * 0x1f3d0 % (SYNTHETIC_KERNEL_SIZE - 0x100)) + 0x10);
+    }
+    for (uint32_t i = kernelFrames; i < depth; ++i) {
+        if (mRandom() % SYNTHETIC_UNKNOWN_FRAME_RATIO == 0) {
+            record.stack.push_back(0x10000000ull + mRandom() % 0x1000000);
+            continue;
+        }
+        size_t module = pickSkewed(images.size());
+        record.stack.push_back(returnAddress(SYNTHETIC_IMAGE_BASE + module * SYNTHETIC_IMAGE_SLOT, images[module]));
+    }
+}
+
+void SyntheticBackend::symbolicate(const ImageData&, size_t offset, FrameInfo& frame)
+{
+    frame.symbolName = std::format(L"function_{:x}", offset & ~size_t{ 0xff });
+    frame.displacement = offset & 0xff;
+}
+
+void SyntheticBackend::prefetch(const ImageData&)
+{
+}
@@ -0,0 +1,91 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "capture.h"
+#include "data.h"
+#include "symbols.h"
+
+// Shape of a synthetic workload.
+struct SyntheticConfig {
+    uint32_t processes = 64;
+    // Distinct images, each process loading modules of them.
+    uint32_t images = 256;
+    uint32_t modules = 48;
+    // Distinct return addresses per image, hot ones being picked more often.
+    uint32_t functions = 512;
+    // Stack depths follow a geometric distribution with this mean, capped to ETW's limit.
+    uint32_t depth = 24;
+    // Events per second, as seen in the event timestamps.
+    uint64_t rate = 10000;
+    uint64_t events = 1000000;
+    uint64_t seed = 1;
+    // Events symbolicated together by the benchmark, 1 for symbolicating each address on its own.
+    uint32_t batch = 1;
+};
+
+// Parses comma separated key=value pairs overriding the defaults, such as "processes=8,events=1000".
+// Returns std::nullopt if a key is unknown or a value is invalid.
+std::optional<SyntheticConfig> parseSyntheticConfig(std::string_view spec);
+
+// Generates the records of a synthetic workload, as found in capture files: the kernel image, the processes
+// with their images loaded, then the events spread across the processes at the configured rate, with stacks
+// going through the kernel and the process images. The same config always produces the same records.
+class SyntheticWorkload {
+public:
+    SyntheticWorkload(const SyntheticConfig& config);
+
+    SyntheticWorkload(SyntheticWorkload&) = delete;
+    SyntheticWorkload& operator=(const SyntheticWorkload&) = delete;
+
+    SyntheticWorkload(SyntheticWorkload&&) = delete;
+    SyntheticWorkload& operator=(SyntheticWorkload&&) = delete;
+
+    // Generates the next record into an existing one, so that its buffers get reused. Returns false at the end.
+    bool next(CaptureRecord& record);
+
+private:
+    struct Image {
+        uint64_t size;
+        uint32_t timeStamp;
+    };
+
+    // Picks an index below count, lower indices being picked more often.
+    size_t pickSkewed(size_t count);
+
+    uint64_t returnAddress(uint64_t base, uint32_t image);
+
+    void generateEvent(CaptureRecord& record);
+
+private:
+    SyntheticConfig mConfig;
+    std::mt19937_64 mRandom;
+    std::geometric_distribution<uint32_t> mDepth;
+
+    std::vector<Image> mImages;
+    // Images loaded by each process, their bases following from their order.
+    std::vector<std::vector<uint32_t>> mProcessImages;
+
+    // Position in the records: the kernel image, then each process followed by its images, then the events.
+    bool mKernelDone;
+    size_t mProcess;
+    size_t mModule;
+    uint64_t mEvent;
+    uint64_t mTimestamp;
+};
+
+// Makes up a symbol per 256 bytes of image, as if functions were that large.
+class SyntheticBackend : public SymbolBackend {
+public:
+    void symbolicate(const ImageData& imageData, size_t offset, FrameInfo& frame) override;
+
+    void prefetch(const ImageData& imageData) override;
+};
+
+#endif // SYNTHETIC_H
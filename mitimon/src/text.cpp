@@ -0,0 +1,84 @@
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "text.h"
+
+std::wstring fromUtf8(const char* text, size_t length)
+{
+    std::wstring result;
+    result.reserve(length);
+    for (size_t i = 0; i < length;) {
+        auto byte = static_cast<uint8_t>(text[i]);
+        uint32_t codePoint = byte;
+        size_t count = 1;
+        if (byte >= 0xf0 && i + 3 < length) {
+            codePoint = ((byte & 0x07u) << 18) | ((text[i + 1] & 0x3fu) << 12) | ((text[i + 2] & 0x3fu) << 6) | (text[i + 3] & 0x3fu);
+            count = 4;
+        }
+        else if (byte >= 0xe0 && i + 2 < length) {
+            codePoint = ((byte & 0x0fu) << 12) | ((text[i + 1] & 0x3fu) << 6) | (text[i + 2] & 0x3fu);
+            count = 3;
+        }
+        else if (byte >= 0xc0 && i + 1 < length) {
+            codePoint = ((byte & 0x1fu) << 6) | (text[i + 1] & 0x3fu);
+            count = 2;
+        }
+        i += count;
+
+        if constexpr (sizeof(wchar_t) == sizeof(uint16_t)) {
+            if (codePoint > 0xffff) {
+                codePoint -= 0x10000;
+                result.push_back(static_cast<wchar_t>(0xd800 + (codePoint >> 10)));
+                result.push_back(static_cast<wchar_t>(0xdc00 + (codePoint & 0x3ff)));
+                continue;
+            }
+        }
+        result.push_back(static_cast<wchar_t>(codePoint));
+    }
+    return result;
+}
+
+std::string toUtf8(const std::wstring& text)
+{
+    std::string result;
+    appendUtf8(result, text);
+    return result;
+}
+
+void appendUtf8(std::string& result, std::wstring_view text)
+{
+    result.reserve(result.size() + text.size());
+    for (size_t i = 0; i < text.size(); ++i) {
+        uint32_t codePoint = static_cast<uint32_t>(text[i]);
+        if constexpr (sizeof(wchar_t) == sizeof(uint16_t)) {
+            if (codePoint >= 0xd800 && codePoint < 0xdc00 && i + 1 < text.size()) {
+                uint32_t low = static_cast<uint16_t>(text[i + 1]);
+                if (low >= 0xdc00 && low < 0xe000) {
+                    codePoint = 0x10000 + ((codePoint - 0xd800) << 10) + (low - 0xdc00);
+                    ++i;
+                }
+            }
+        }
+
+        if (codePoint < 0x80) {
+            result.push_back(static_cast<char>(codePoint));
+        }
+        else if (codePoint < 0x800) {
+            result.push_back(static_cast<char>(0xc0 | (codePoint >> 6)));
+            result.push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+        }
+        else if (codePoint < 0x10000) {
+            result.push_back(static_cast<char>(0xe0 | (codePoint >> 12)));
+            result.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+            result.push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+        }
+        else {
+            result.push_back(static_cast<char>(0xf0 | (codePoint >> 18)));
+            result.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3f)));
+            result.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3f)));
+            result.push_back(static_cast<char>(0x80 | (codePoint & 0x3f)));
+        }
+    }
+}
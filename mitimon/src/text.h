@@ -0,0 +1,18 @@
+#ifndef TEXT_H
+#define TEXT_H
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Decodes UTF-8 text, as found in debug information, into UTF-16 code units on Windows
+// and code points elsewhere. Truncated sequences are decoded byte by byte.
+std::wstring fromUtf8(const char* text, size_t length);
+
+// Encodes UTF-16 code units on Windows, or code points elsewhere, into UTF-8.
+std::string toUtf8(const std::wstring& text);
+
+// Same as toUtf8, appending to existing text.
+void appendUtf8(std::string& result, std::wstring_view text);
+
+#endif // TEXT_H
@@ -1,8 +1,23 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <functional>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
 
+#include "capture.h"
 #include "data.h"
+#include "decoder.h"
+#include "filter.h"
+#include "intake.h"
+#include "metrics.h"
+#include "pe.h"
+#include "source.h"
 #include "trace.h"
-#include "symbols.h"
 #include "winkrabs.h"
 
 #define WINEVENT_KEYWORD_PROCESS 0x10
@@ -15,7 +30,7 @@ enum ProcessProvider {
     ImageUnload = 6,
 };
 
-void Tracer::addProcessProvider()
+void Tracer::addProcessProvider(std::function<void(const EVENT_RECORD& record, const krabs::trace_context& traceContext)>&& callback)
 {
     auto& processProvider = mProviders.emplace_back(L"Microsoft-Windows-Kernel-Process");
     processProvider.any(WINEVENT_KEYWORD_PROCESS | WINEVENT_KEYWORD_IMAGE);
@@ -32,49 +47,348 @@ void Tracer::addProcessProvider()
             )
         )
     );
-    processFilter.add_on_event_callback([](const EVENT_RECORD& record, const krabs::trace_context& traceContext) {
-        krabs::schema schema(record, traceContext.schema_locator);
-        krabs::parser parser(schema);
+    processFilter.add_on_event_callback(std::move(callback));
+    processProvider.add_filter(processFilter);
+}
 
-        switch (schema.event_id()) {
-        case ProcessProvider::ProcessStart:
-        {
-            auto pid = parser.parse<uint32_t>(L"ProcessID");
-            auto imageName = parser.parse<std::wstring>(L"ImageName");
-            ProcessData::add(pid, imageName);
-            break;
+bool readProcessRecord(const EVENT_RECORD& record, const krabs::schema& schema, krabs::parser& parser, CaptureRecord& result)
+{
+    result.timestamp = static_cast<uint64_t>(record.EventHeader.TimeStamp.QuadPart);
+
+    switch (schema.event_id()) {
+    case ProcessProvider::ProcessStart:
+        result.type = CaptureRecordType::ProcessStart;
+        result.pid = parser.parse<uint32_t>(L"ProcessID");
+        result.imageName = parser.parse<std::wstring>(L"ImageName");
+        return true;
+
+    case ProcessProvider::ProcessStop:
+        result.type = CaptureRecordType::ProcessStop;
+        result.pid = parser.parse<uint32_t>(L"ProcessID");
+        return true;
+
+    case ProcessProvider::ImageLoad:
+        result.type = CaptureRecordType::ImageLoad;
+        result.pid = parser.parse<uint32_t>(L"ProcessID");
+        result.imageName = parser.parse<std::wstring>(L"ImageName");
+        result.imageBase = reinterpret_cast<uint64_t>(parser.parse<void*>(L"ImageBase"));
+        result.imageSize = parser.parse<size_t>(L"ImageSize");
+        result.imageTimeStamp = parser.parse<uint32_t>(L"TimeDateStamp");
+        return true;
+
+    case ProcessProvider::ImageUnload:
+        result.type = CaptureRecordType::ImageUnload;
+        result.pid = parser.parse<uint32_t>(L"ProcessID");
+        result.imageBase = reinterpret_cast<uint64_t>(parser.parse<void*>(L"ImageBase"));
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+int propertyType(const EVENT_RECORD& record, const krabs::property& property)
+{
+    int type = property.type();
+    if (type == TDH_INTYPE_POINTER) {
+        if (record.EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) {
+            type = TDH_INTYPE_UINT32;
         }
+        else {
+            type = TDH_INTYPE_UINT64;
+        }
+    }
+    return type;
+}
 
-        case ProcessProvider::ProcessStop:
-        {
-            auto pid = parser.parse<uint32_t>(L"ProcessID");
-            ProcessData::remove(pid);
-            break;
+FieldLayout describeProperty(const EVENT_RECORD& record, const krabs::property& property, const EVENT_PROPERTY_INFO* propertyInfo)
+{
+    auto type = propertyType(record, property);
+    switch (type) {
+    case TDH_INTYPE_UNICODESTRING:
+        if (!propertyInfo) {
+            return FieldLayout{ property.name(), FieldType::Unsupported, static_cast<uint16_t>(type), 0, 0 };
+        }
+        // Lengths are in UTF-16 code units, as in manifests.
+        if (propertyInfo->Flags & PropertyParamLength) {
+            return FieldLayout{ property.name(), FieldType::CountedString, static_cast<uint16_t>(type), 0, propertyInfo->lengthPropertyIndex };
+        }
+        if (propertyInfo->length != 0) {
+            return FieldLayout{ property.name(), FieldType::CountedString, static_cast<uint16_t>(type),
+                static_cast<uint32_t>(propertyInfo->length * sizeof(uint16_t)), 0 };
         }
+        return FieldLayout{ property.name(), FieldType::UnicodeString, static_cast<uint16_t>(type), 0, 0 };
 
-        case ProcessProvider::ImageLoad:
-        {
-            auto pid = parser.parse<uint32_t>(L"ProcessID");
-            auto imageName = parser.parse<std::wstring>(L"ImageName");
-            auto imageBase = parser.parse<void*>(L"ImageBase");
-            auto imageSize = parser.parse<size_t>(L"ImageSize");
-            ImageData::add(pid, imageBase, imageSize, imageName);
-            break;
+    case TDH_INTYPE_INT8:
+    case TDH_INTYPE_UINT8:
+        return FieldLayout{ property.name(), FieldType::UInt8, static_cast<uint16_t>(type), 0, 0 };
+
+    case TDH_INTYPE_INT16:
+    case TDH_INTYPE_UINT16:
+        return FieldLayout{ property.name(), FieldType::UInt16, static_cast<uint16_t>(type), 0, 0 };
+
+    case TDH_INTYPE_INT32:
+    case TDH_INTYPE_UINT32:
+        return FieldLayout{ property.name(), FieldType::UInt32, static_cast<uint16_t>(type), 0, 0 };
+
+    case TDH_INTYPE_INT64:
+    case TDH_INTYPE_UINT64:
+    case TDH_INTYPE_FILETIME:
+        return FieldLayout{ property.name(), FieldType::UInt64, static_cast<uint16_t>(type), 0, 0 };
+
+    // Unsupported types which can still be skipped over.
+    case TDH_INTYPE_FLOAT:
+    case TDH_INTYPE_BOOLEAN:
+    case TDH_INTYPE_HEXINT32:
+        return FieldLayout{ property.name(), FieldType::Unsupported, static_cast<uint16_t>(type), 4, 0 };
+
+    case TDH_INTYPE_DOUBLE:
+    case TDH_INTYPE_HEXINT64:
+        return FieldLayout{ property.name(), FieldType::Unsupported, static_cast<uint16_t>(type), 8, 0 };
+
+    case TDH_INTYPE_GUID:
+    case TDH_INTYPE_SYSTEMTIME:
+        return FieldLayout{ property.name(), FieldType::Unsupported, static_cast<uint16_t>(type), 16, 0 };
+
+    default:
+        return FieldLayout{ property.name(), FieldType::Unsupported, static_cast<uint16_t>(type), 0, 0 };
+    }
+}
+
+// Returns the TDH description of the event as a TRACE_EVENT_INFO, empty if it cannot be read.
+// This is only needed once per schema.
+static std::vector<uint8_t> readEventInformation(const EVENT_RECORD& record)
+{
+    std::vector<uint8_t> information;
+    ULONG size = 0;
+    auto status = ::TdhGetEventInformation(const_cast<EVENT_RECORD*>(&record), 0, nullptr, nullptr, &size);
+    while (status == ERROR_INSUFFICIENT_BUFFER) {
+        information.resize(size);
+        status = ::TdhGetEventInformation(const_cast<EVENT_RECORD*>(&record), 0, nullptr,
+            reinterpret_cast<TRACE_EVENT_INFO*>(information.data()), &size);
+    }
+    if (status != ERROR_SUCCESS) {
+        information.clear();
+    }
+    return information;
+}
+
+const EventDecoder* findDecoder(DecoderCache& decoders, const EVENT_RECORD& record, krabs::parser& parser)
+{
+    const auto& header = record.EventHeader;
+    SchemaKey key{};
+    std::memcpy(key.provider.data(), &header.ProviderId, key.provider.size());
+    key.eventId = header.EventDescriptor.Id;
+    key.version = header.EventDescriptor.Version;
+    key.pointerSize = (header.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) ? 4 : 8;
+
+    return decoders.find(key, [&record, &parser]() {
+        // Properties come in the same order as in the TDH description.
+        auto information = readEventInformation(record);
+        auto info = information.empty() ? nullptr : reinterpret_cast<const TRACE_EVENT_INFO*>(information.data());
+        std::vector<FieldLayout> layout;
+        for (const krabs::property& property : parser.properties()) {
+            auto index = layout.size();
+            auto propertyInfo = info && index < info->TopLevelPropertyCount ? &info->EventPropertyInfoArray[index] : nullptr;
+            layout.push_back(describeProperty(record, property, propertyInfo));
         }
+        return layout;
+    });
+}
 
-        case ProcessProvider::ImageUnload:
-        {
-            auto pid = parser.parse<uint32_t>(L"ProcessID");
-            auto imageBase = parser.parse<void*>(L"ImageBase");
-            ImageData::remove(pid, imageBase);
-            break;
+RecordDetails::RecordDetails(const EVENT_RECORD& record, const krabs::schema_locator& schemaLocator, DecoderCache& decoders) :
+    mRecord{ record },
+    mSchemaLocator{ &schemaLocator },
+    mDecoders{ decoders },
+    mOwnSchema{},
+    mOwnParser{},
+    mSchema{ nullptr },
+    mParser{ nullptr }
+{
+}
+
+RecordDetails::RecordDetails(const EVENT_RECORD& record, const krabs::schema& schema, krabs::parser& parser, DecoderCache& decoders) :
+    mRecord{ record },
+    mSchemaLocator{ nullptr },
+    mDecoders{ decoders },
+    mOwnSchema{},
+    mOwnParser{},
+    mSchema{ &schema },
+    mParser{ &parser }
+{
+}
+
+// Decodes a property through TDH, for the schemas the compiled decoders cannot handle.
+static std::wstring stringify(const EVENT_RECORD& record, krabs::parser& parser, const krabs::property& property)
+{
+    std::wstring result(property.name());
+
+    auto type = propertyType(record, property);
+    switch (type) {
+    case TDH_INTYPE_UNICODESTRING:
+        result += std::format(L" L\"{}\"", parser.parse<std::wstring>(property.name()));
+        break;
+
+    case TDH_INTYPE_INT8:
+    case TDH_INTYPE_UINT8:
+        result += std::format(L" 0x{:02x}", parser.parse<uint8_t>(property.name()));
+        break;
+
+    case TDH_INTYPE_INT16:
+    case TDH_INTYPE_UINT16:
+        result += std::format(L" 0x{:04x}", parser.parse<uint16_t>(property.name()));
+        break;
+
+    case TDH_INTYPE_INT32:
+    case TDH_INTYPE_UINT32:
+        result += std::format(L" 0x{:08x}", parser.parse<uint32_t>(property.name()));
+        break;
+
+    case TDH_INTYPE_INT64:
+    case TDH_INTYPE_UINT64:
+    case TDH_INTYPE_FILETIME:
+        result += std::format(L" 0x{:016x}", parser.parse<uint64_t>(property.name()));
+        break;
+
+    default:
+        result += std::format(L" ? <unsupported data type {}>", static_cast<int>(type));
+        break;
+    }
+
+    return result;
+}
+
+void RecordDetails::decodeProperties(std::vector<std::wstring>& properties)
+{
+    auto& parser = this->parser();
+    auto decoder = findDecoder(mDecoders, mRecord, parser);
+    if (decoder && decoder->decode(static_cast<const uint8_t*>(mRecord.UserData), mRecord.UserDataLength, properties)) {
+        return;
+    }
+
+    if (decoder) {
+        mDecoders.countFallback();
+    }
+    for (const krabs::property& property : parser.properties()) {
+        properties.emplace_back(stringify(mRecord, parser, property));
+    }
+}
+
+uint32_t RecordDetails::pid()
+{
+    return mRecord.EventHeader.ProcessId;
+}
+
+std::wstring_view RecordDetails::taskName()
+{
+    parser();
+    auto taskName = mSchema->task_name();
+    return taskName ? taskName : L"";
+}
+
+int RecordDetails::eventId()
+{
+    return mRecord.EventHeader.EventDescriptor.Id;
+}
+
+bool RecordDetails::property(std::wstring_view name, FilterValue& value)
+{
+    auto& parser = this->parser();
+    auto decoder = findDecoder(mDecoders, mRecord, parser);
+    if (decoder) {
+        return decoder->read(name, static_cast<const uint8_t*>(mRecord.UserData), mRecord.UserDataLength, value);
+    }
+
+    for (const krabs::property& property : parser.properties()) {
+        if (property.name() != name) {
+            continue;
         }
 
+        switch (propertyType(mRecord, property)) {
+        case TDH_INTYPE_UNICODESTRING:
+            value = parser.parse<std::wstring>(property.name());
+            return true;
+
+        case TDH_INTYPE_INT8:
+        case TDH_INTYPE_UINT8:
+            value = uint64_t{ parser.parse<uint8_t>(property.name()) };
+            return true;
+
+        case TDH_INTYPE_INT16:
+        case TDH_INTYPE_UINT16:
+            value = uint64_t{ parser.parse<uint16_t>(property.name()) };
+            return true;
+
+        case TDH_INTYPE_INT32:
+        case TDH_INTYPE_UINT32:
+            value = uint64_t{ parser.parse<uint32_t>(property.name()) };
+            return true;
+
+        case TDH_INTYPE_INT64:
+        case TDH_INTYPE_UINT64:
+        case TDH_INTYPE_FILETIME:
+            value = parser.parse<uint64_t>(property.name());
+            return true;
+
         default:
-            ;
+            return false;
         }
-    });
-    processProvider.add_filter(processFilter);
+    }
+    return false;
+}
+
+krabs::parser& RecordDetails::parser()
+{
+    if (!mParser) {
+        mSchema = &mOwnSchema.emplace(mRecord, *mSchemaLocator);
+        mParser = &mOwnParser.emplace(*mSchema);
+    }
+    return *mParser;
+}
+
+EarlyFilter::EarlyFilter(const EventFilter& filter) :
+    mFilter{ filter },
+    mTrackImages{ filter.uses(FilterField::Image) },
+    mDecoders{},
+    mImageNames{}
+{
+}
+
+void EarlyFilter::trackProcess(const EVENT_RECORD& record, const krabs::trace_context& traceContext)
+{
+    if (!mTrackImages) {
+        return;
+    }
+
+    // The header of process events has the pid of the parent process.
+    auto eventId = record.EventHeader.EventDescriptor.Id;
+    if (eventId == ProcessProvider::ProcessStart) {
+        krabs::schema schema(record, traceContext.schema_locator);
+        krabs::parser parser(schema);
+        auto pid = parser.parse<uint32_t>(L"ProcessID");
+        mImageNames.start(pid, parser.parse<std::wstring>(L"ImageName"));
+    }
+    else if (eventId == ProcessProvider::ProcessStop) {
+        krabs::schema schema(record, traceContext.schema_locator);
+        krabs::parser parser(schema);
+        mImageNames.stop(parser.parse<uint32_t>(L"ProcessID"));
+    }
+}
+
+bool EarlyFilter::accepts(const EVENT_RECORD& record, const krabs::trace_context& traceContext)
+{
+    RecordDetails subject{ record, traceContext.schema_locator, mDecoders };
+    if (mTrackImages) {
+        if (auto imageName = mImageNames.find(record.EventHeader.ProcessId)) {
+            subject.setImageName(*imageName);
+        }
+    }
+
+    if (mFilter.evaluate(subject) == FilterResult::False) {
+        Metrics::add(MetricCounter::EventsFilteredEarly);
+        return false;
+    }
+    return true;
 }
 
 void Tracer::start()
@@ -90,3 +404,137 @@ void Tracer::stop()
 {
     mTrace.stop();
 }
+
+TraceSource::TraceSource(const std::wstring& sessionName, size_t intakeCapacity, const EventFilter* filter) :
+    mDecoders{},
+    mAcgFailure{ 0 },
+    mRecord{},
+    mIndexCache{},
+    mEarlyFilter{},
+    mHandler{ nullptr },
+    mIntake{ intakeCapacity,
+        [this](EventKind kind, const EVENT_RECORD& record, const krabs::schema& schema, krabs::parser& parser,
+            std::vector<ULONG_PTR>&& stackTrace) {
+
+            if (!mHandler) {
+                return;
+            }
+
+            switch (kind) {
+            case EventKind::Process:
+                mRecord.stack.clear();
+                mRecord.properties.clear();
+                if (readProcessRecord(record, schema, parser, mRecord)) {
+                    // Only the headers of each distinct image file get read, once.
+                    if (mRecord.type == CaptureRecordType::ImageLoad) {
+                        mRecord.indexInfo = mIndexCache.get(ImageData::pathFromEtwName(mRecord.imageName));
+                    }
+                    (*mHandler)(mRecord, nullptr);
+                }
+                break;
+
+            case EventKind::Mitigation:
+                deliverEvent(record, schema, parser, std::move(stackTrace));
+                break;
+
+            case EventKind::KernelMemory:
+            {
+                // Test the flag on the raw user data, the event is decoded only if it is an ACG failure.
+                auto decoder = findDecoder(mDecoders, record, parser);
+                if (decoder) {
+                    if (!decoder->test(mAcgFailure, static_cast<const uint8_t*>(record.UserData), record.UserDataLength)) {
+                        return;
+                    }
+                }
+                else if ((parser.parse<uint32_t>(L"AcgFlag") & 0x80000000) == 0) {
+                    return;
+                }
+
+                deliverEvent(record, schema, parser, std::move(stackTrace));
+                break;
+            }
+            }
+        }
+    },
+    mTracer{ sessionName }
+{
+    // ACG failures are told apart from the other kernel memory events by the high bit of AcgFlag.
+    mAcgFailure = mDecoders.addTest(L"AcgFlag", 0x80000000);
+
+    if (filter) {
+        mEarlyFilter.emplace(*filter);
+    }
+    auto accepts = [this](const EVENT_RECORD& record, const krabs::trace_context& traceContext) {
+        return !mEarlyFilter || mEarlyFilter->accepts(record, traceContext);
+    };
+
+    // The process provider will track process creation and image loading,
+    // this is required for symbolication to work.
+    mTracer.addProcessProvider([this](const EVENT_RECORD& record, const krabs::trace_context& traceContext) {
+        if (mEarlyFilter) {
+            mEarlyFilter->trackProcess(record, traceContext);
+        }
+        mIntake.push(EventKind::Process, record);
+    });
+
+    // This adds the real provider we are interested in.
+    mTracer.addCustomProvider(MITIGATIONS_PROVIDER, MITIGATIONS_ANY, accepts,
+        [this](const EVENT_RECORD& record, const krabs::trace_context&)
+        {
+            mIntake.push(EventKind::Mitigation, record);
+        }
+    );
+
+    // This temporarily adds an extra provider for ACG failures.
+    // This provider catches more failures, but we only get kernel stack traces.
+    mTracer.addCustomProvider(KERNEL_MEMORY_PROVIDER, KERNEL_MEMORY_ANY, accepts,
+        [this](const EVENT_RECORD& record, const krabs::trace_context&)
+        {
+            mIntake.push(EventKind::KernelMemory, record);
+        }
+    );
+}
+
+void TraceSource::run(const Handler& handler)
+{
+    mHandler = &handler;
+    try {
+        mTracer.start();
+    }
+    catch (...) {
+        mIntake.stop();
+        mHandler = nullptr;
+        throw;
+    }
+
+    // Deliver the events still in the intake, while the handler is there.
+    mIntake.stop();
+    mHandler = nullptr;
+}
+
+void TraceSource::stop()
+{
+    mTracer.stop();
+}
+
+EventSource::Stats TraceSource::stats() const
+{
+    auto stats = mIntake.stats();
+    return Stats{ stats.pushed, stats.dropped, stats.waited, stats.oversized, stats.highWatermark, stats.capacity };
+}
+
+void TraceSource::deliverEvent(const EVENT_RECORD& record, const krabs::schema& schema, krabs::parser& parser,
+    std::vector<ULONG_PTR>&& stackTrace)
+{
+    mRecord.type = CaptureRecordType::Event;
+    mRecord.timestamp = static_cast<uint64_t>(record.EventHeader.TimeStamp.QuadPart);
+    mRecord.pid = schema.process_id();
+    mRecord.tid = schema.thread_id();
+    mRecord.taskName = schema.task_name();
+    mRecord.eventId = schema.event_id();
+    mRecord.stack = std::move(stackTrace);
+    mRecord.properties.clear();
+
+    RecordDetails details{ record, schema, parser, mDecoders };
+    (*mHandler)(mRecord, &details);
+}
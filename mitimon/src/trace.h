@@ -1,11 +1,30 @@
 #ifndef TRACE_H
 #define TRACE_H
 
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#include "capture.h"
+#include "data.h"
+#include "decoder.h"
+#include "filter.h"
+#include "intake.h"
+#include "pe.h"
+#include "source.h"
 #include "winkrabs.h"
 
+#define MITIGATIONS_PROVIDER L"Microsoft-Windows-Security-Mitigations"
+#define MITIGATIONS_ANY 0x8000000000000000Ui64
+
+// Catches more ACG failures than the mitigations provider, but only with kernel stacks.
+#define KERNEL_MEMORY_PROVIDER L"Microsoft-Windows-Kernel-Memory"
+#define KERNEL_MEMORY_ANY 0x100
+
 class Tracer {
 public:
     Tracer(const std::wstring& sessionName) :
@@ -14,16 +33,24 @@ public:
     {
     }
 
-    void addProcessProvider();
+    // Process start and stop, image load and unload events, to be passed to handleProcessEvent.
+    void addProcessProvider(std::function<void(const EVENT_RECORD& record, const krabs::trace_context& traceContext)>&& callback);
 
     void addCustomProvider(const std::wstring& providerName, ULONGLONG providerAny, auto&& callback)
+    {
+        addCustomProvider(providerName, providerAny, krabs::predicates::any_event, std::forward<decltype(callback)>(callback));
+    }
+
+    // The callback only gets the events the predicate accepts. The predicate runs on the ETW consumer thread.
+    void addCustomProvider(const std::wstring& providerName, ULONGLONG providerAny,
+        std::function<bool(const EVENT_RECORD& record, const krabs::trace_context& traceContext)>&& predicate, auto&& callback)
     {
         auto& customProvider = mProviders.emplace_back(providerName);
 
         customProvider.any(providerAny);
         customProvider.trace_flags(customProvider.trace_flags() | EVENT_ENABLE_PROPERTY_STACK_TRACE);
 
-        krabs::event_filter mitigations_filter(krabs::predicates::any_event);
+        krabs::event_filter mitigations_filter(std::move(predicate));
         mitigations_filter.add_on_event_callback(std::forward<decltype(callback)>(callback));
         customProvider.add_filter(mitigations_filter);
     }
@@ -37,4 +64,124 @@ private:
     std::vector<krabs::provider<>> mProviders;
 };
 
+// Reads a process start or stop, or an image load or unload event, into a record. Returns false for other events.
+bool readProcessRecord(const EVENT_RECORD& record, const krabs::schema& schema, krabs::parser& parser, CaptureRecord& result);
+
+// Pointers are decoded as integers of the size used by the process that issued the event.
+int propertyType(const EVENT_RECORD& record, const krabs::property& property);
+
+// Describes a property for the compiled decoders. The TDH description of the property tells whether a string
+// is counted, krabs properties do not. Strings are unsupported without it.
+FieldLayout describeProperty(const EVENT_RECORD& record, const krabs::property& property, const EVENT_PROPERTY_INFO* propertyInfo);
+
+// Returns the compiled decoder for the schema of the event, nullptr if its layout cannot be compiled.
+const EventDecoder* findDecoder(DecoderCache& decoders, const EVENT_RECORD& record, krabs::parser& parser);
+
+// Details of an event record. The schema is only looked up, and the properties decoded, when needed:
+// through the compiled decoders when the layout allows it, through TDH otherwise.
+class RecordDetails : public EventDetails {
+public:
+    // Looks up the schema on first use.
+    RecordDetails(const EVENT_RECORD& record, const krabs::schema_locator& schemaLocator, DecoderCache& decoders);
+
+    RecordDetails(const EVENT_RECORD& record, const krabs::schema& schema, krabs::parser& parser, DecoderCache& decoders);
+
+    RecordDetails(RecordDetails&) = delete;
+    RecordDetails& operator=(const RecordDetails&) = delete;
+
+    RecordDetails(RecordDetails&&) = delete;
+    RecordDetails& operator=(RecordDetails&&) = delete;
+
+    void decodeProperties(std::vector<std::wstring>& properties) override;
+
+    uint32_t pid() override;
+    std::wstring_view taskName() override;
+    int eventId() override;
+    bool property(std::wstring_view name, FilterValue& value) override;
+
+private:
+    krabs::parser& parser();
+
+private:
+    const EVENT_RECORD& mRecord;
+    const krabs::schema_locator* mSchemaLocator;
+    DecoderCache& mDecoders;
+    std::optional<krabs::schema> mOwnSchema;
+    std::optional<krabs::parser> mOwnParser;
+    const krabs::schema* mSchema;
+    krabs::parser* mParser;
+};
+
+// Evaluates an event filter in the provider callbacks, on the ETW consumer thread, so that the events which
+// cannot match are dropped before being copied. Image names come from the process events seen on the same thread,
+// processes started before the trace are unknown. Stacks are not looked at, tests on them are left to the intake thread.
+class EarlyFilter {
+public:
+    EarlyFilter(const EventFilter& filter);
+
+    EarlyFilter(EarlyFilter&) = delete;
+    EarlyFilter& operator=(const EarlyFilter&) = delete;
+
+    EarlyFilter(EarlyFilter&&) = delete;
+    EarlyFilter& operator=(EarlyFilter&&) = delete;
+
+    // To be called with the events of the process provider.
+    void trackProcess(const EVENT_RECORD& record, const krabs::trace_context& traceContext);
+
+    // Returns false if the event cannot match the filter.
+    bool accepts(const EVENT_RECORD& record, const krabs::trace_context& traceContext);
+
+private:
+    const EventFilter& mFilter;
+    bool mTrackImages;
+    DecoderCache mDecoders;
+    ProcessImageNames mImageNames;
+};
+
+// Live events from ETW: process and image events, and mitigation events, ACG failures being caught by the kernel
+// memory provider as well. Provider callbacks run on the ETW consumer thread, where any stall risks losing events:
+// they only copy the events, which are decoded and delivered in order on the intake thread. With a filter,
+// the events which cannot match it are dropped in the provider callbacks, before being copied.
+class TraceSource : public EventSource {
+public:
+    // The filter must outlive the source.
+    TraceSource(const std::wstring& sessionName, size_t intakeCapacity, const EventFilter* filter);
+
+    TraceSource(TraceSource&) = delete;
+    TraceSource& operator=(const TraceSource&) = delete;
+
+    TraceSource(TraceSource&&) = delete;
+    TraceSource& operator=(TraceSource&&) = delete;
+
+    // Returns once the trace stopped and the events left in the intake were delivered.
+    void run(const Handler& handler) override;
+
+    void stop() override;
+
+    Stats stats() const override;
+
+    DecoderCache::Stats decoderStats() const { return mDecoders.stats(); }
+
+private:
+    void deliverEvent(const EVENT_RECORD& record, const krabs::schema& schema, krabs::parser& parser,
+        std::vector<ULONG_PTR>&& stackTrace);
+
+private:
+    // Only used from the intake thread.
+    DecoderCache mDecoders;
+    size_t mAcgFailure;
+    CaptureRecord mRecord;
+    // PDB identity of the loaded images, read while their file is there.
+    ImageIndexCache mIndexCache;
+
+    // Only used from the ETW consumer thread.
+    std::optional<EarlyFilter> mEarlyFilter;
+
+    // Set while running, events are only delivered then.
+    const Handler* mHandler;
+
+    EventIntake mIntake;
+    Tracer mTracer;
+};
+
 #endif // TRACE_H
@@ -12,7 +12,9 @@
 #include <winerror.h>
 
 #include <DbgHelp.h>
+#include <winhttp.h>
 
 #pragma comment(lib, "dbghelp.lib")
+#pragma comment(lib, "winhttp.lib")
 
 #endif // WINKRABS_H
@@ -0,0 +1,238 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "breakpad.h"
+#include "cache.h"
+#include "check.h"
+#include "data.h"
+#include "pe.h"
+#include "symindex.h"
+
+// Identity of fixtures/symbols/sample64.pdb, the PDB of fixtures/sample64.dll.
+#define SAMPLE_DEBUG_ID "123456789ABCDEF00123456789ABCDEF3"
+
+// Large enough for the parse to be split across threads, in ranges of at least 4 MB.
+#define LARGE_FUNCTION_COUNT 200000
+
+struct Expected {
+    uint64_t offset;
+    const wchar_t* symbolName;
+    uint64_t displacement;
+    const wchar_t* fileName;
+    uint32_t lineNumber;
+    const wchar_t* inlineName;
+};
+
+static const Expected SAMPLE_FRAMES[] = {
+    { 0x1005, L"main", 0x5, L"c:\\src\\main.cpp", 10, L"" },
+    { 0x1012, L"main", 0x12, L"c:\\src\\helper.h", 30, L"Helper::compute()" },
+    { 0x101a, L"main", 0x1a, L"c:\\src\\helper.h", 30, L"Helper::inner()" },
+    { 0x1040, L"main", 0x40, L"c:\\src\\main.cpp", 14, L"" },
+    { 0x1120, L"shared(int)", 0x20, L"c:\\src\\main.cpp", 50, L"" },
+    // Outside of any function, from the closest public symbol.
+    { 0x1250, L"exported", 0x50, L"", 0, L"" },
+    { 0x1310, L"another_exported", 0x10, L"", 0, L"" },
+    { 0x900, L"", 0, L"", 0, L"" },
+};
+
+template<typename Module>
+static void checkFrames(const Module& module_)
+{
+    for (const auto& expected : SAMPLE_FRAMES) {
+        FrameInfo frame{};
+        module_.lookup(expected.offset, frame);
+        CHECK(frame.symbolName == expected.symbolName);
+        CHECK(frame.displacement == expected.displacement);
+        CHECK(frame.fileName == expected.fileName);
+        CHECK(frame.lineNumber == expected.lineNumber);
+        CHECK(frame.inlineName == expected.inlineName);
+    }
+}
+
+static ImageIndexInfo sampleIndexInfo()
+{
+    ImageIndexInfo indexInfo{};
+    indexInfo.pdbFile = L"sample64.pdb";
+    parsePdbDebugId(SAMPLE_DEBUG_ID, indexInfo);
+    return indexInfo;
+}
+
+static void testModule(const std::filesystem::path& symbols)
+{
+    BreakpadModule module_{ symbols / breakpadSymbolPath(sampleIndexInfo()), 4 };
+    CHECK(module_.debugId() == SAMPLE_DEBUG_ID);
+
+    // STACK and INFO records are skipped.
+    auto stats = module_.stats();
+    CHECK(stats.functions == 2);
+    CHECK(stats.lines == 4);
+    CHECK(stats.publics == 2);
+    CHECK(stats.inlines == 2);
+
+    checkFrames(module_);
+}
+
+static void testCrlf(const std::filesystem::path& symbols, const TempDirectory& temp)
+{
+    std::ifstream input{ symbols / breakpadSymbolPath(sampleIndexInfo()) };
+    auto path = temp.path() / "crlf.sym";
+    {
+        std::ofstream output{ path, std::ios::binary };
+        std::string line;
+        while (std::getline(input, line)) {
+            output << line << "\r\n";
+        }
+    }
+
+    BreakpadModule module_{ path, 1 };
+    CHECK(module_.debugId() == SAMPLE_DEBUG_ID);
+    checkFrames(module_);
+}
+
+static void testNotSymbols(const std::filesystem::path& fixtures)
+{
+    bool thrown = false;
+    try {
+        BreakpadModule module_{ fixtures / "sample64.dll", 1 };
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+// Parsing in ranges on separate threads gives the same records as a single pass.
+static void testParallelParse(const TempDirectory& temp)
+{
+    auto path = temp.path() / "large.sym";
+    {
+        std::ofstream output{ path, std::ios::binary };
+        output << "MODULE windows x86_64 " SAMPLE_DEBUG_ID " large.pdb\n";
+        output << "FILE 0 c:\\src\\large.cpp\n";
+        for (uint64_t i = 0; i < LARGE_FUNCTION_COUNT; ++i) {
+            auto address = 0x1000 + i * 0x100;
+            output << std::format("FUNC {:x} 80 0 function_{}\n{:x} 40 {} 0\n{:x} 40 {} 0\n",
+                address, i, address, i * 2, address + 0x40, i * 2 + 1);
+            if (i % 10 == 0) {
+                output << std::format("PUBLIC {:x} 0 public_{}\n", address + 0x80, i);
+            }
+        }
+    }
+    CHECK(std::filesystem::file_size(path) > 8 * 1024 * 1024);
+
+    BreakpadModule single{ path, 1 };
+    BreakpadModule parallel{ path, 8 };
+
+    auto singleStats = single.stats();
+    auto parallelStats = parallel.stats();
+    CHECK(singleStats.functions == LARGE_FUNCTION_COUNT);
+    CHECK(parallelStats.functions == LARGE_FUNCTION_COUNT);
+    CHECK(parallelStats.lines == LARGE_FUNCTION_COUNT * 2);
+    CHECK(parallelStats.publics == LARGE_FUNCTION_COUNT / 10);
+
+    for (uint64_t offset = 0x1000; offset < 0x1000 + LARGE_FUNCTION_COUNT * 0x100; offset += 0x1234) {
+        FrameInfo expected{};
+        single.lookup(offset, expected);
+        FrameInfo frame{};
+        parallel.lookup(offset, frame);
+        CHECK(frame.symbolName == expected.symbolName);
+        CHECK(frame.displacement == expected.displacement);
+        CHECK(frame.lineNumber == expected.lineNumber);
+    }
+
+    FrameInfo last{};
+    parallel.lookup(0x1000 + (LARGE_FUNCTION_COUNT - 1) * 0x100 + 0x50, last);
+    CHECK(last.symbolName == std::format(L"function_{}", LARGE_FUNCTION_COUNT - 1));
+    CHECK(last.lineNumber == (LARGE_FUNCTION_COUNT - 1) * 2 + 1);
+}
+
+// The backend converts the symbol file of the store to an index next to it, which later backends map instead.
+static void testBackend(const std::filesystem::path& symbols, const TempDirectory& temp)
+{
+    auto store = temp.path() / "store";
+    std::filesystem::copy(symbols, store, std::filesystem::copy_options::recursive);
+    auto indexInfo = sampleIndexInfo();
+
+    {
+        BreakpadBackend backend{ store, 2 };
+        auto index = backend.module(indexInfo);
+        CHECK(index);
+        if (index) {
+            checkFrames(*index);
+        }
+        // Loaded once.
+        CHECK(backend.module(indexInfo) == index);
+    }
+    CHECK(std::filesystem::is_regular_file(store / symbolIndexPath(indexInfo)));
+
+    std::filesystem::remove(store / breakpadSymbolPath(indexInfo));
+    {
+        BreakpadBackend backend{ store, 2 };
+        auto index = backend.module(indexInfo);
+        CHECK(index);
+        if (index) {
+            checkFrames(*index);
+        }
+    }
+
+    // A symbol file is only used for the PDB it was written for.
+    auto otherInfo = indexInfo;
+    otherInfo.pdbAge = 4;
+    auto otherPath = store / breakpadSymbolPath(otherInfo);
+    std::filesystem::create_directories(otherPath.parent_path());
+    std::filesystem::copy_file(symbols / breakpadSymbolPath(indexInfo), otherPath);
+    BreakpadBackend backend{ store, 2 };
+    CHECK(!backend.module(otherInfo));
+
+    otherInfo.pdbFile = L"missing.pdb";
+    CHECK(!backend.module(otherInfo));
+}
+
+// Images are symbolicated with the PDB identity recorded when they were loaded, not with that of whatever file is at
+// their path by then. Images recorded without one are read from their path.
+static void testRecordedIdentity(const std::filesystem::path& fixtures, const TempDirectory& temp)
+{
+    auto store = temp.path() / "recorded";
+    std::filesystem::copy(fixtures / "symbols", store, std::filesystem::copy_options::recursive);
+    BreakpadBackend backend{ store, 2 };
+    auto indexInfo = std::make_shared<const ImageIndexInfo>(sampleIndexInfo());
+
+    auto symbolName = [&backend](const ImageData& image) {
+        FrameInfo frame{};
+        backend.symbolicate(image, 0x1005, frame);
+        return frame.symbolName;
+    };
+
+    auto dllPath = (fixtures / "sample64.dll").wstring();
+    CHECK(symbolName(ImageData{ nullptr, 0x2000, 0, (temp.path() / "gone" / "sample64.dll").wstring(), indexInfo }) == L"main");
+    CHECK(symbolName(ImageData{ nullptr, 0x2000, 0, dllPath }) == L"main");
+
+    auto otherInfo = std::make_shared<ImageIndexInfo>(sampleIndexInfo());
+    otherInfo->pdbAge = 4;
+    CHECK(symbolName(ImageData{ nullptr, 0x3000, 0, dllPath, otherInfo }).empty());
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        std::cout << "Usage: breakpad_test <fixtures directory>" << std::endl;
+        return 1;
+    }
+    std::filesystem::path fixtures{ argv[1] };
+    auto symbols = fixtures / "symbols";
+    TempDirectory temp;
+
+    testModule(symbols);
+    testCrlf(symbols, temp);
+    testNotSymbols(fixtures);
+    testParallelParse(temp);
+    testBackend(symbols, temp);
+    testRecordedIdentity(fixtures, temp);
+    return checkResult();
+}
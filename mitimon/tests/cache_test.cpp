@@ -0,0 +1,164 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cache.h"
+#include "check.h"
+#include "data.h"
+#include "symbols.h"
+
+#define CONCURRENT_THREADS 8
+#define CONCURRENT_LOOKUPS 20000
+#define CONCURRENT_KEYS 1000
+
+static std::shared_ptr<const FrameInfo> makeFrame(uint32_t imageId, uint64_t offset)
+{
+    return std::make_shared<const FrameInfo>(FrameInfo{ std::format(L"function_{}_{:x}", imageId, offset), 0, L"", 0, 0, L"" });
+}
+
+// Resolves every offset to a name of its own, except those past the end of the symbols, and counts the calls.
+class CountingBackend : public SymbolBackend {
+public:
+    void symbolicate(const ImageData& imageData, size_t offset, FrameInfo& frame) override
+    {
+        ++calls;
+        if (offset < 0x1000) {
+            frame.symbolName = std::format(L"{}_{:x}", imageData.name(), offset);
+        }
+    }
+
+    void prefetch(const ImageData&) override {}
+
+    std::atomic<int> calls{ 0 };
+};
+
+// Frames of the same length all take the same number of bytes, so that the cap is a number of entries.
+static size_t entryBytes()
+{
+    FrameCache cache{ 1 << 20 };
+    cache.insert(1, 0x1000, makeFrame(1, 0x1000));
+    return cache.stats().bytes;
+}
+
+// The least recently used frames of a shard go first once it is over its share of the cap.
+static void testEviction()
+{
+    auto bytes = entryBytes();
+    FrameCache cache{ 200 * bytes };
+
+    // Offsets of the same length, so that all frames have the same size.
+    for (uint64_t i = 0; i < 2000; ++i) {
+        cache.insert(1, 0x1000 + i, makeFrame(1, 0x1000 + i));
+        // The first frame is kept in use, the second never is again.
+        CHECK(cache.find(1, 0x1000));
+    }
+
+    auto stats = cache.stats();
+    CHECK(stats.bytes <= 200 * bytes);
+    CHECK(stats.bytes == stats.entries * bytes);
+    CHECK(stats.entries > 100);
+    CHECK(stats.evictions == 2000 - stats.entries);
+    CHECK(stats.hits == 2000);
+    CHECK(stats.misses == 0);
+
+    CHECK(!cache.find(1, 0x1001));
+    auto last = cache.find(1, 0x1000 + 1999);
+    CHECK(last && last->symbolName == L"function_1_17cf");
+    auto kept = cache.find(1, 0x1000);
+    CHECK(kept && kept->symbolName == L"function_1_1000");
+
+    stats = cache.stats();
+    CHECK(stats.hits == 2002);
+    CHECK(stats.misses == 1);
+
+    // Inserting the same key again replaces the frame without counting it twice.
+    cache.insert(1, 0x1000, makeFrame(2, 0x1000));
+    CHECK(cache.find(1, 0x1000)->symbolName == L"function_2_1000");
+    CHECK(cache.stats().entries == stats.entries);
+}
+
+// Offsets without symbols are remembered as well, and images of the same identity share their frames.
+static void testSession()
+{
+    CountingBackend backend;
+    SymbolSession session{ backend, 1 << 20 };
+
+    ImageData first{ reinterpret_cast<void*>(0x10000000), 0x10000, 0x5f0a1b2c, L"\\Device\\HarddiskVolume3\\app\\shared.dll" };
+    ImageData second{ reinterpret_cast<void*>(0x7ff600000000), 0x10000, 0x5f0a1b2c, L"\\Device\\HarddiskVolume3\\app\\shared.dll" };
+    ImageData other{ reinterpret_cast<void*>(0x20000000), 0x10000, 0x5f0a1b2d, L"\\Device\\HarddiskVolume3\\app\\shared.dll" };
+    CHECK(first.id() == second.id());
+    CHECK(first.id() != other.id());
+
+    auto frame = session.symbolicate(first, 0x10);
+    CHECK(frame->symbolName == L"shared_10");
+    CHECK(session.symbolicate(second, 0x10) == frame);
+    CHECK(backend.calls == 1);
+    CHECK(session.symbolicate(other, 0x10) != frame);
+    CHECK(backend.calls == 2);
+
+    // Negative entries.
+    CHECK(session.symbolicate(first, 0x2000)->symbolName.empty());
+    CHECK(session.symbolicate(second, 0x2000)->symbolName.empty());
+    CHECK(backend.calls == 3);
+
+    std::vector<std::shared_ptr<const FrameInfo>> frames;
+    session.symbolicateBatch(second, { 0x10, 0x20, 0x2000, 0x3000 }, frames);
+    CHECK(frames.size() == 4 && frames[0] == frame && frames[1]->symbolName == L"shared_20" && frames[3]->symbolName.empty());
+    CHECK(backend.calls == 5);
+
+    auto stats = session.cacheStats();
+    CHECK(stats.entries == 5);
+    CHECK(stats.hits == 4);
+    CHECK(stats.misses == 5);
+    CHECK(stats.evictions == 0);
+}
+
+// Workers looking up and inserting the same keys always get the frame of the key they asked for.
+static void testConcurrent()
+{
+    // Large enough that nothing is evicted.
+    FrameCache cache{ 64 << 20 };
+    std::atomic<uint64_t> found{ 0 };
+    std::atomic<bool> mismatch{ false };
+    {
+        std::vector<std::jthread> threads;
+        for (int thread = 0; thread < CONCURRENT_THREADS; ++thread) {
+            threads.emplace_back([&cache, &found, &mismatch, thread]() {
+                for (uint64_t i = 0; i < CONCURRENT_LOOKUPS; ++i) {
+                    auto imageId = static_cast<uint32_t>(1 + i % 7);
+                    auto offset = (i * 2654435761 + thread) % CONCURRENT_KEYS;
+                    if (auto frame = cache.find(imageId, offset)) {
+                        ++found;
+                        if (frame->symbolName != std::format(L"function_{}_{:x}", imageId, offset)) {
+                            mismatch = true;
+                        }
+                    }
+                    else {
+                        cache.insert(imageId, offset, makeFrame(imageId, offset));
+                    }
+                }
+            });
+        }
+    }
+
+    CHECK(!mismatch);
+    auto stats = cache.stats();
+    CHECK(stats.hits == found.load());
+    CHECK(stats.hits + stats.misses == uint64_t{ CONCURRENT_THREADS } * CONCURRENT_LOOKUPS);
+    CHECK(stats.evictions == 0);
+    CHECK(stats.entries <= 7 * CONCURRENT_KEYS);
+    CHECK(stats.entries > 0);
+}
+
+int main()
+{
+    testEviction();
+    testSession();
+    testConcurrent();
+    return checkResult();
+}
@@ -0,0 +1,297 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "capture.h"
+#include "check.h"
+#include "pe.h"
+
+static const uint64_t SAMPLE_STACK[] = { 0xfffff80000001234, 0x7ff600001000, 0x7ff600000ff0, 0x7ff600123456 };
+static const char SAMPLE_DEBUG_ID[] = "44E4EC8C2F41492B9369D6B9A059577C2";
+
+// Writes the records of fixtures/sample.mtmcap. The records of fixtures/sample_v1.mtmcap are the same,
+// without the PDB identity of the images.
+static void writeSample(const std::filesystem::path& path)
+{
+    ImageIndexInfo indexInfo{ 0x5f0a1b2c, 0x9000000, L"xul.pdb", {}, 0 };
+    parsePdbDebugId(SAMPLE_DEBUG_ID, indexInfo);
+
+    CaptureWriter writer{ path };
+    writer.writeKernelImage(0xfffff80000000000, 0x1000000, 0x11223344, L"\\SystemRoot\\system32\\ntoskrnl.exe", nullptr);
+    writer.writeProcessStart(1000, 100, L"\\Device\\HarddiskVolume3\\Program Files\\Mozilla Firefox\\firefox.exe");
+    writer.writeImageLoad(1010, 100, 0x7ff600000000, 0x9000000, 0x5f0a1b2c,
+        L"\\Device\\HarddiskVolume3\\Program Files\\Mozilla Firefox\\xul.dll", &indexInfo);
+    writer.writeEvent(2000, L"ProhibitDynamicCode", 1, 100, 200, SAMPLE_STACK, std::size(SAMPLE_STACK),
+        { L"100", L"C:\\Users\\\U0001F600\\file" });
+    // Timestamps may go backwards.
+    writer.writeEvent(1990, L"Empty", -5, 100, 201, nullptr, 0, {});
+    writer.writeImageUnload(3000, 100, 0x7ff600000000);
+    writer.writeProcessStop(4000, 100);
+}
+
+static std::vector<uint8_t> readFile(const std::filesystem::path& path)
+{
+    std::ifstream file{ path, std::ios::binary };
+    return std::vector<uint8_t>{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+}
+
+static void writeFile(const std::filesystem::path& path, const std::vector<uint8_t>& contents)
+{
+    std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+    file.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+}
+
+static void checkSample(CaptureReader& reader, bool hasIndexInfo)
+{
+    CHECK(reader.chunkCount() == 1);
+    CaptureRecord record{};
+
+    CHECK(reader.next(record));
+    CHECK(record.type == CaptureRecordType::KernelImage);
+    CHECK(record.imageBase == 0xfffff80000000000);
+    CHECK(record.imageSize == 0x1000000);
+    CHECK(record.imageTimeStamp == 0x11223344);
+    CHECK(record.imageName == L"\\SystemRoot\\system32\\ntoskrnl.exe");
+    CHECK(!record.indexInfo);
+
+    CHECK(reader.next(record));
+    CHECK(record.type == CaptureRecordType::ProcessStart);
+    CHECK(record.timestamp == 1000);
+    CHECK(record.pid == 100);
+    CHECK(record.imageName == L"\\Device\\HarddiskVolume3\\Program Files\\Mozilla Firefox\\firefox.exe");
+
+    CHECK(reader.next(record));
+    CHECK(record.type == CaptureRecordType::ImageLoad);
+    CHECK(record.timestamp == 1010);
+    CHECK(record.imageBase == 0x7ff600000000);
+    CHECK(record.imageSize == 0x9000000);
+    CHECK(record.imageTimeStamp == 0x5f0a1b2c);
+    CHECK(record.imageName == L"\\Device\\HarddiskVolume3\\Program Files\\Mozilla Firefox\\xul.dll");
+    CHECK(!record.indexInfo == !hasIndexInfo);
+    if (record.indexInfo) {
+        CHECK(record.indexInfo->timeDateStamp == 0x5f0a1b2c);
+        CHECK(record.indexInfo->sizeOfImage == 0x9000000);
+        CHECK(record.indexInfo->pdbFile == L"xul.pdb");
+        auto debugId = pdbDebugId(*record.indexInfo);
+        CHECK(debugId == std::wstring(std::begin(SAMPLE_DEBUG_ID), std::end(SAMPLE_DEBUG_ID) - 1));
+    }
+
+    CHECK(reader.next(record));
+    CHECK(record.type == CaptureRecordType::Event);
+    CHECK(record.timestamp == 2000);
+    CHECK(record.taskName == L"ProhibitDynamicCode");
+    CHECK(record.eventId == 1);
+    CHECK(record.tid == 200);
+    CHECK((record.stack == std::vector<uint64_t>(std::begin(SAMPLE_STACK), std::end(SAMPLE_STACK))));
+    // The surrogate pair of the UTF-16 string gives a single character where wchar_t holds code points.
+    CHECK((record.properties == std::vector<std::wstring>{ L"100", L"C:\\Users\\\U0001F600\\file" }));
+
+    // Buffers of the previous record are reused, but nothing of it is left.
+    CHECK(reader.next(record));
+    CHECK(record.timestamp == 1990);
+    CHECK(record.taskName == L"Empty");
+    CHECK(record.eventId == -5);
+    CHECK(record.stack.empty());
+    CHECK(record.properties.empty());
+
+    CHECK(reader.next(record));
+    CHECK(record.type == CaptureRecordType::ImageUnload);
+    CHECK(record.imageBase == 0x7ff600000000);
+
+    CHECK(reader.next(record));
+    CHECK(record.type == CaptureRecordType::ProcessStop);
+    CHECK(record.timestamp == 4000);
+
+    CHECK(!reader.next(record));
+}
+
+// The checked in captures keep being read, and the writer still produces the latest one byte for byte.
+static void testFixture(const std::filesystem::path& fixtures, const TempDirectory& temp)
+{
+    {
+        CaptureReader reader{ fixtures / "sample_v1.mtmcap" };
+        checkSample(reader, false);
+    }
+
+    CaptureReader reader{ fixtures / "sample.mtmcap" };
+    checkSample(reader, true);
+
+    reader.seek(0);
+    CaptureRecord record{};
+    CHECK(reader.next(record));
+    CHECK(record.type == CaptureRecordType::KernelImage);
+
+    auto path = temp.path() / "sample.mtmcap";
+    writeSample(path);
+    CHECK(readFile(path) == readFile(fixtures / "sample.mtmcap"));
+
+    // Versions to come are not guessed at.
+    auto contents = readFile(path);
+    contents[8] = 3;
+    writeFile(path, contents);
+    bool thrown = false;
+    try {
+        CaptureReader future{ path };
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+static void testChunks(const TempDirectory& temp)
+{
+    auto path = temp.path() / "chunks.mtmcap";
+    std::vector<std::wstring> properties{ std::wstring(1000, L'x') };
+    {
+        CaptureWriter writer{ path };
+        for (uint64_t i = 0; i < 2000; ++i) {
+            writer.writeEvent(i * 10, L"Task", 1, 1, static_cast<uint32_t>(i), SAMPLE_STACK, std::size(SAMPLE_STACK), properties);
+        }
+    }
+
+    CaptureReader reader{ path };
+    CHECK(reader.chunkCount() > 1);
+    CaptureRecord record{};
+    uint64_t count = 0;
+    while (reader.next(record)) {
+        CHECK(record.tid == count);
+        CHECK(record.timestamp == count * 10);
+        ++count;
+    }
+    CHECK(count == 2000);
+
+    // Chunks start from their own timestamp.
+    reader.seek(1);
+    CHECK(reader.next(record));
+    CHECK(record.timestamp == reader.chunkTimestamp(1));
+    CHECK(record.timestamp == record.tid * 10);
+}
+
+// Flushed records are read back while the capture is still being written, or if it is never closed.
+static void testFlush(const TempDirectory& temp)
+{
+    auto path = temp.path() / "flushed.mtmcap";
+    CaptureWriter writer{ path };
+    writer.writeProcessStart(1, 10, L"first.exe");
+    writer.flush();
+    // Nothing new since the last flush.
+    writer.flush();
+    writer.writeProcessStart(2, 20, L"second.exe");
+    writer.flush();
+    writer.writeProcessStart(3, 30, L"pending.exe");
+
+    {
+        CaptureReader reader{ path };
+        CHECK(reader.chunkCount() == 2);
+        CaptureRecord record{};
+        CHECK(reader.next(record));
+        CHECK(record.imageName == L"first.exe");
+        CHECK(reader.next(record));
+        CHECK(record.timestamp == 2);
+        CHECK(record.imageName == L"second.exe");
+        CHECK(!reader.next(record));
+    }
+
+    writer.close();
+    CaptureReader reader{ path };
+    CHECK(reader.chunkCount() == 3);
+}
+
+// Reading every truncation of the sample, and the sample with any of its bytes changed, either throws
+// std::runtime_error or gives records, without reading past the end of the file. Captures that were not closed
+// are read from their complete chunks.
+static void testCorrupted(const std::filesystem::path& fixtures, const TempDirectory& temp)
+{
+    auto contents = readFile(fixtures / "sample.mtmcap");
+    auto path = temp.path() / "corrupted.mtmcap";
+    auto readAll = [&path]() {
+        size_t count = 0;
+        try {
+            CaptureReader reader{ path };
+            CaptureRecord record{};
+            while (reader.next(record)) {
+                ++count;
+            }
+        }
+        catch (const std::runtime_error&) {
+        }
+        return count;
+    };
+
+    // Without the index and footer, the chunk is found by scanning.
+    size_t chunkEnd = contents.size() - 24 - 16;
+    for (size_t size = 1; size < contents.size(); ++size) {
+        writeFile(path, std::vector<uint8_t>(contents.begin(), contents.begin() + size));
+        auto count = readAll();
+        CHECK(size < chunkEnd ? count == 0 : count == 7);
+    }
+
+    for (size_t offset = 0; offset < contents.size(); ++offset) {
+        for (uint8_t value : { uint8_t{ 0 }, uint8_t{ 0x7f }, uint8_t{ 0xff } }) {
+            auto corrupted = contents;
+            corrupted[offset] = value;
+            writeFile(path, corrupted);
+            readAll();
+        }
+    }
+}
+
+// Counts are checked against the bytes left in the chunk before anything is allocated for them.
+static void testHugeCounts(const TempDirectory& temp)
+{
+    auto path = temp.path() / "huge.mtmcap";
+    {
+        CaptureWriter writer{ path };
+        writer.writeEvent(1, L"", 0, 1, 1, SAMPLE_STACK, 1, {});
+    }
+    auto contents = readFile(path);
+
+    // Type, timestamp, pid, empty task name, event id and tid, then the stack count, at the start of the chunk.
+    size_t stackCountOffset = 16 + 24 + 6;
+    CHECK(contents[stackCountOffset] == 1);
+    for (size_t countOffset : { stackCountOffset, contents.size() - 24 - 16 - 1 }) {
+        auto corrupted = contents;
+        // A varint of 2^63, the last record being a property count.
+        std::vector<uint8_t> count{ 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x80, 0x01 };
+        corrupted.erase(corrupted.begin() + countOffset);
+        corrupted.insert(corrupted.begin() + countOffset, count.begin(), count.end());
+        // Drops the index, which no longer matches, and grows the chunk by the bytes inserted.
+        corrupted.erase(corrupted.end() - 24 - 16, corrupted.end());
+        corrupted[16 + 4] += static_cast<uint8_t>(count.size() - 1);
+        writeFile(path, corrupted);
+
+        bool thrown = false;
+        try {
+            CaptureReader reader{ path };
+            CaptureRecord record{};
+            reader.next(record);
+        }
+        catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        CHECK(thrown);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        std::cout << "Usage: capture_test <fixtures directory>" << std::endl;
+        return 1;
+    }
+    std::filesystem::path fixtures{ argv[1] };
+    TempDirectory temp;
+
+    testFixture(fixtures, temp);
+    testChunks(temp);
+    testFlush(temp);
+    testCorrupted(fixtures, temp);
+    testHugeCounts(temp);
+    return checkResult();
+}
@@ -0,0 +1,57 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <random>
+
+// Failed checks are reported and counted, and the test fails at the end if any did.
+inline int checkFailures = 0;
+
+#define CHECK(condition)                                                                                    \
+    do {                                                                                                    \
+        if (!(condition)) {                                                                                 \
+            std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << std::endl;      \
+            ++checkFailures;                                                                                \
+        }                                                                                                   \
+    } while (false)
+
+// Returned from main.
+inline int checkResult()
+{
+    if (checkFailures) {
+        std::cout << checkFailures << " checks failed." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// Directory for the files written by a test, removed with them at the end.
+class TempDirectory {
+public:
+    TempDirectory() :
+        mPath{ std::filesystem::temp_directory_path() / std::format("mitimon-test-{:x}", std::random_device{}()) }
+    {
+        std::filesystem::create_directories(mPath);
+    }
+
+    ~TempDirectory()
+    {
+        std::error_code error;
+        std::filesystem::remove_all(mPath, error);
+    }
+
+    TempDirectory(TempDirectory&) = delete;
+    TempDirectory& operator=(const TempDirectory&) = delete;
+
+    TempDirectory(TempDirectory&&) = delete;
+    TempDirectory& operator=(TempDirectory&&) = delete;
+
+    const std::filesystem::path& path() const { return mPath; }
+
+private:
+    std::filesystem::path mPath;
+};
+
+#endif // CHECK_H
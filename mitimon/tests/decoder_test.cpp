@@ -0,0 +1,134 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <variant>
+#include <vector>
+
+#include "check.h"
+#include "decoder.h"
+
+// Builds user data the way ETW lays it out, little endian and unaligned.
+class UserData {
+public:
+    template<typename T>
+    UserData& add(T value)
+    {
+        auto size = mBytes.size();
+        mBytes.resize(size + sizeof value);
+        std::memcpy(mBytes.data() + size, &value, sizeof value);
+        return *this;
+    }
+
+    UserData& addString(const std::u16string& value)
+    {
+        for (auto unit : value) {
+            add<uint16_t>(unit);
+        }
+        return *this;
+    }
+
+    const uint8_t* data() const { return mBytes.data(); }
+    size_t size() const { return mBytes.size(); }
+
+private:
+    std::vector<uint8_t> mBytes;
+};
+
+// A counted path, as in the mitigation events, followed by properties which are found after it.
+static const std::vector<FieldLayout> COUNTED_LAYOUT = {
+    { L"ProcessPathLength", FieldType::UInt16, 0, 0, 0 },
+    { L"ProcessPath", FieldType::CountedString, 0, 0, 0 },
+    { L"ProcessId", FieldType::UInt32, 0, 0, 0 },
+    { L"Name", FieldType::UnicodeString, 0, 0, 0 },
+};
+
+static void testCountedString()
+{
+    auto decoder = EventDecoder::compile(COUNTED_LAYOUT, { FieldTest{ L"ProcessId", 0x1000 } });
+    CHECK(decoder);
+    if (!decoder) {
+        return;
+    }
+
+    // The counted string has no terminator, the next property follows right after it.
+    UserData userData;
+    userData.add<uint16_t>(3).addString(u"a\\b").add<uint32_t>(0x1234).addString(u"xy").add<uint16_t>(0);
+
+    std::vector<std::wstring> properties;
+    CHECK(decoder->decode(userData.data(), userData.size(), properties));
+    CHECK((properties == std::vector<std::wstring>{ L"ProcessPathLength 0x0003", L"ProcessPath L\"a\\b\"",
+        L"ProcessId 0x00001234", L"Name L\"xy\"" }));
+    CHECK(decoder->test(0, userData.data(), userData.size()));
+
+    FilterValue value;
+    CHECK(decoder->read(L"ProcessPath", userData.data(), userData.size(), value));
+    CHECK(std::get<std::wstring>(value) == L"a\\b");
+    CHECK(decoder->read(L"ProcessId", userData.data(), userData.size(), value));
+    CHECK(std::get<uint64_t>(value) == 0x1234);
+
+    // A terminator within the count ends the string early, the count still gives its size.
+    UserData terminated;
+    terminated.add<uint16_t>(4).addString(u"ab").add<uint16_t>(0).addString(u"c").add<uint32_t>(7).add<uint16_t>(0);
+    properties.clear();
+    CHECK(decoder->decode(terminated.data(), terminated.size(), properties));
+    CHECK(properties.size() == 4 && properties[1] == L"ProcessPath L\"ab\"" && properties[2] == L"ProcessId 0x00000007");
+
+    // A count past the end of the user data does not match the layout.
+    UserData overlong;
+    overlong.add<uint16_t>(100).addString(u"abc");
+    properties.clear();
+    CHECK(!decoder->decode(overlong.data(), overlong.size(), properties));
+    CHECK(properties.empty());
+    CHECK(!decoder->read(L"ProcessPath", overlong.data(), overlong.size(), value));
+    CHECK(!decoder->test(0, overlong.data(), overlong.size()));
+}
+
+// Strings of a fixed length leave the properties after them at a fixed offset.
+static void testFixedLengthString()
+{
+    std::vector<FieldLayout> layout = {
+        { L"Tag", FieldType::CountedString, 0, 8, 0 },
+        { L"Flags", FieldType::UInt32, 0, 0, 0 },
+    };
+    auto decoder = EventDecoder::compile(layout, { FieldTest{ L"Flags", 0x80000000 } });
+    CHECK(decoder);
+    if (!decoder) {
+        return;
+    }
+
+    UserData userData;
+    userData.addString(u"ab").add<uint16_t>(0).add<uint16_t>(0).add<uint32_t>(0x80000001);
+    std::vector<std::wstring> properties;
+    CHECK(decoder->decode(userData.data(), userData.size(), properties));
+    CHECK((properties == std::vector<std::wstring>{ L"Tag L\"ab\"", L"Flags 0x80000001" }));
+    CHECK(decoder->test(0, userData.data(), userData.size()));
+}
+
+// The length of a counted string must come from an integer property before it.
+static void testRejectedLayouts()
+{
+    auto layout = COUNTED_LAYOUT;
+    layout[1].lengthField = 1;
+    CHECK(!EventDecoder::compile(layout, {}));
+    layout[1].lengthField = 2;
+    CHECK(!EventDecoder::compile(layout, {}));
+
+    layout = COUNTED_LAYOUT;
+    layout[3].type = FieldType::CountedString;
+    layout[3].lengthField = 1;
+    CHECK(!EventDecoder::compile(layout, {}));
+
+    // Strings of unknown kind can only be skipped when last.
+    layout = COUNTED_LAYOUT;
+    layout[1].type = FieldType::Unsupported;
+    CHECK(!EventDecoder::compile(layout, {}));
+}
+
+int main()
+{
+    testCountedString();
+    testFixedLengthString();
+    testRejectedLayouts();
+    return checkResult();
+}
@@ -0,0 +1,221 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "breakpad.h"
+#include "cache.h"
+#include "check.h"
+#include "data.h"
+#include "deferred.h"
+#include "pe.h"
+#include "symbols.h"
+#include "text.h"
+
+// Identity of fixtures/symbols/sample64.pdb.
+#define SAMPLE_DEBUG_ID "123456789ABCDEF00123456789ABCDEF3"
+#define SAMPLE_BASE 0x7ffa50800000
+
+// Offsets in the sample module, resolved to functions, inlined calls, public symbols or nothing.
+static const uint64_t SAMPLE_OFFSETS[] = { 0x1005, 0x101a, 0x1120, 0x1250, 0x900, 0x1005 };
+
+static std::shared_ptr<const ImageIndexInfo> makeIndexInfo(uint32_t age)
+{
+    auto indexInfo = std::make_shared<ImageIndexInfo>();
+    indexInfo->pdbFile = L"sample64.pdb";
+    parsePdbDebugId(SAMPLE_DEBUG_ID, *indexInfo);
+    indexInfo->pdbAge = age;
+    return indexInfo;
+}
+
+static std::string readFile(const std::filesystem::path& path)
+{
+    std::ifstream file{ path, std::ios::binary };
+    return std::string{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+}
+
+// Writes the same events as the deferred output and as the regular output, the frames of the latter being
+// symbolicated by the backend as the workers do.
+class EventWriter {
+public:
+    EventWriter(SymbolBackend& backend) :
+        mBackend{ backend },
+        mModuleTable{},
+        mDeferred{},
+        mExpected{},
+        mFrames{ 0 },
+        mFramesResolved{ 0 }
+    {
+    }
+
+    struct Frame {
+        uint64_t address;
+        const ImageData* image;
+    };
+
+    // Lines end with \r\n when the file went through a text conversion.
+    void write(const std::vector<Frame>& frames, bool crlf)
+    {
+        std::string deferred;
+        std::string expected;
+        std::string header = "\n\nTaskName ProhibitDynamicCode\nEventId 1\nProcessId 0x00000064\nThreadId 0x000000c8\n\nCall Stack:\n";
+        std::string descriptions;
+        deferred += header;
+        expected += header;
+
+        for (const auto& frame : frames) {
+            auto address = reinterpret_cast<void*>(frame.address);
+            if (!frame.image) {
+                deferred += "   ";
+                appendUtf8(deferred, formatDeferredFrame(address, nullptr, 0));
+                expected += "   ";
+                appendUtf8(expected, formatFrame(address, nullptr, 0, nullptr));
+            }
+            else {
+                auto offset = frame.address - reinterpret_cast<uint64_t>(frame.image->base());
+                mModuleTable.describe(*frame.image, descriptions);
+                deferred += "   ";
+                appendUtf8(deferred, formatDeferredFrame(address, frame.image, offset));
+
+                FrameInfo frameInfo{};
+                mBackend.symbolicate(*frame.image, offset, frameInfo);
+                expected += "   ";
+                appendUtf8(expected, formatFrame(address, frame.image, offset, &frameInfo));
+                ++mFrames;
+                mFramesResolved += !frameInfo.symbolName.empty();
+            }
+            deferred += "\n";
+            expected += "\n";
+        }
+        deferred += "\nProcessId 100\n\n";
+        expected += "\nProcessId 100\n\n";
+
+        mDeferred += lineEndings(descriptions + deferred, crlf);
+        mExpected += lineEndings(expected, crlf);
+    }
+
+    size_t modules() const { return mModuleTable.size(); }
+    size_t frames() const { return mFrames; }
+    size_t framesResolved() const { return mFramesResolved; }
+    const std::string& deferred() const { return mDeferred; }
+    const std::string& expected() const { return mExpected; }
+
+private:
+    static std::string lineEndings(const std::string& text, bool crlf)
+    {
+        if (!crlf) {
+            return text;
+        }
+        std::string result;
+        for (auto character : text) {
+            if (character == '\n') {
+                result += '\r';
+            }
+            result += character;
+        }
+        return result;
+    }
+
+private:
+    SymbolBackend& mBackend;
+    ModuleTable mModuleTable;
+    std::string mDeferred;
+    std::string mExpected;
+    size_t mFrames;
+    size_t mFramesResolved;
+};
+
+// The resolved file reads as if the events had been symbolicated while monitoring, and the module lines are gone.
+static void testResolve(const std::filesystem::path& fixtures, const TempDirectory& temp)
+{
+    auto store = temp.path() / "store";
+    std::filesystem::copy(fixtures / "symbols", store, std::filesystem::copy_options::recursive);
+
+    // With symbols in the store, without a PDB identity, and with an identity the store has no symbols for.
+    ImageData sample{ reinterpret_cast<void*>(SAMPLE_BASE), 0x2000, 0x5f0a1b2c,
+        L"\\Device\\HarddiskVolume3\\app\\sample64.dll", makeIndexInfo(3) };
+    ImageData unreadable{ reinterpret_cast<void*>(0x7ffa60000000), 0x2000, 0x11111111,
+        (temp.path() / "gone" / "unreadable.dll").wstring() };
+    ImageData unknown{ reinterpret_cast<void*>(0x7ffa70000000), 0x2000, 0x22222222,
+        L"\\Device\\HarddiskVolume3\\app\\unknown.dll", makeIndexInfo(4) };
+
+    // Frames are symbolicated the regular way from a store of their own, so that neither reuses the index of the other.
+    auto expectedStore = temp.path() / "expected";
+    std::filesystem::copy(fixtures / "symbols", expectedStore, std::filesystem::copy_options::recursive);
+    BreakpadBackend backend{ expectedStore, 1 };
+    EventWriter writer{ backend };
+    std::vector<EventWriter::Frame> frames;
+    for (auto offset : SAMPLE_OFFSETS) {
+        frames.push_back(EventWriter::Frame{ SAMPLE_BASE + offset, &sample });
+    }
+    frames.push_back(EventWriter::Frame{ 0x7ffa60001234, &unreadable });
+    frames.push_back(EventWriter::Frame{ 0xfffff80012345678, nullptr });
+    frames.push_back(EventWriter::Frame{ 0x7ffa70001005, &unknown });
+    writer.write(frames, false);
+
+    // Modules already described are only referenced.
+    writer.write({ { SAMPLE_BASE + 0x1040, &sample }, { 0x12345, nullptr }, { 0x7ffa60000010, &unreadable } }, true);
+
+    auto path = temp.path() / "output.txt";
+    {
+        std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+        file << writer.deferred();
+    }
+    CHECK(writer.deferred().find("Module\t") != std::string::npos);
+    CHECK(writer.deferred().find("\t-\t-\t") != std::string::npos);
+    CHECK(writer.deferred().find("\r\n") != std::string::npos);
+
+    auto stats = resolveDeferred(path, store, 2);
+    auto resolved = readFile(path);
+    if (resolved != writer.expected()) {
+        std::cout << "Resolved:\n" << resolved << "Expected:\n" << writer.expected();
+    }
+    CHECK(resolved == writer.expected());
+
+    CHECK(stats.modules == 3);
+    CHECK(writer.modules() == 3);
+    CHECK(stats.modulesFound == 1);
+    CHECK(stats.frames == writer.frames());
+    CHECK(stats.framesResolved == writer.framesResolved());
+    CHECK(stats.framesResolved == 6);
+
+    // The symbols were indexed into the store, and nothing is left behind.
+    CHECK(std::filesystem::is_regular_file(store / symbolIndexPath(*sample.indexInfo())));
+    CHECK(!std::filesystem::exists(temp.path() / "output.txt.tmp"));
+}
+
+// A file without modules is left as it was.
+static void testNothingToResolve(const TempDirectory& temp)
+{
+    auto path = temp.path() / "plain.txt";
+    std::string text = "\n\nTaskName Task\r\nCall Stack:\n   0x0000000000001234\n   garbage m+0x\n";
+    {
+        std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+        file << text;
+    }
+
+    auto stats = resolveDeferred(path, temp.path() / "empty", 1);
+    CHECK(readFile(path) == text);
+    CHECK(stats.modules == 0);
+    CHECK(stats.frames == 0);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        std::cout << "Usage: deferred_test <fixtures directory>" << std::endl;
+        return 1;
+    }
+    std::filesystem::path fixtures{ argv[1] };
+    TempDirectory temp;
+
+    testResolve(fixtures, temp);
+    testNothingToResolve(temp);
+    return checkResult();
+}
@@ -0,0 +1,146 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "download.h"
+#include "mock_server.h"
+
+static std::string readFile(const std::filesystem::path& path)
+{
+    std::ifstream file{ path, std::ios::binary };
+    return std::string{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+}
+
+static std::string makeContents(size_t size)
+{
+    std::string contents;
+    for (size_t i = 0; contents.size() < size; ++i) {
+        contents += std::format("FUNC {:x} 10 0 function_{}\n", i * 0x10, i);
+    }
+    contents.resize(size);
+    return contents;
+}
+
+// Concurrent requests for the same file share a single download.
+static void testCoalesced(MockSymbolServer& server, const TempDirectory& temp)
+{
+    auto contents = makeContents(100000);
+    server.addFile("/xul.pdb/0123ABCD1/xul.sym", contents);
+    server.setDelay(std::chrono::milliseconds(300));
+
+    SymbolDownloader downloader{ temp.path() / "coalesced", { server.url() }, 4 };
+    std::atomic<int> fetched{ 0 };
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 8; ++i) {
+            threads.emplace_back([&downloader, &fetched]() {
+                fetched += downloader.fetch("xul.pdb/0123ABCD1/xul.sym");
+            });
+        }
+    }
+    server.setDelay(std::chrono::milliseconds(0));
+
+    CHECK(fetched.load() == 8);
+    CHECK(server.requests("/xul.pdb/0123ABCD1/xul.sym") == 1);
+    CHECK(readFile(temp.path() / "coalesced/xul.pdb/0123ABCD1/xul.sym") == contents);
+
+    auto stats = downloader.stats();
+    CHECK(stats.requests == 8);
+    CHECK(stats.downloads == 1);
+    CHECK(stats.coalesced == 7);
+    CHECK(stats.bytes == contents.size());
+
+    // Files already in the store are not requested again.
+    CHECK(downloader.fetch("xul.pdb/0123ABCD1/xul.sym"));
+    CHECK(server.requests("/xul.pdb/0123ABCD1/xul.sym") == 1);
+}
+
+static void testBoundedConnections(MockSymbolServer& server, const TempDirectory& temp)
+{
+    for (int i = 0; i < 6; ++i) {
+        server.addFile(std::format("/module{}.pdb/1/module{}.sym", i, i), makeContents(1000));
+    }
+    server.setDelay(std::chrono::milliseconds(100));
+
+    SymbolDownloader downloader{ temp.path() / "bounded", { server.url() }, 2 };
+    std::atomic<int> fetched{ 0 };
+    {
+        std::vector<std::jthread> threads;
+        for (int i = 0; i < 6; ++i) {
+            threads.emplace_back([&downloader, &fetched, i]() {
+                fetched += downloader.fetch(std::format("module{}.pdb/1/module{}.sym", i, i));
+            });
+        }
+    }
+    server.setDelay(std::chrono::milliseconds(0));
+
+    CHECK(fetched.load() == 6);
+    CHECK(server.maxConnections() <= 2);
+}
+
+// An interrupted download resumes from the partial file, which only replaces the file in the store once complete.
+static void testResumed(MockSymbolServer& server, const TempDirectory& temp)
+{
+    auto contents = makeContents(200000);
+    server.addFile("/resumed.pdb/2/resumed.sym", contents);
+
+    auto store = temp.path() / "resumed";
+    SymbolDownloader downloader{ store, { server.url() }, 4 };
+    server.cutNextAfter(50000);
+    CHECK(!downloader.fetch("resumed.pdb/2/resumed.sym"));
+    CHECK(!std::filesystem::exists(store / "resumed.pdb/2/resumed.sym"));
+    CHECK(std::filesystem::file_size(store / "resumed.pdb/2/resumed.sym.partial") == 50000);
+
+    CHECK(downloader.fetch("resumed.pdb/2/resumed.sym"));
+    CHECK(readFile(store / "resumed.pdb/2/resumed.sym") == contents);
+    CHECK(!std::filesystem::exists(store / "resumed.pdb/2/resumed.sym.partial"));
+    CHECK((server.ranges() == std::vector<uint64_t>{ 50000 }));
+
+    auto stats = downloader.stats();
+    CHECK(stats.downloads == 1);
+    CHECK(stats.resumed == 1);
+    CHECK(stats.failures == 1);
+    CHECK(stats.bytes == contents.size());
+}
+
+// Servers are tried in order, and redirects are followed.
+static void testServers(MockSymbolServer& server, const TempDirectory& temp)
+{
+    server.addRedirect("/second/moved.pdb/3/moved.sym", "/storage/moved.sym");
+    server.addFile("/storage/moved.sym", "MODULE windows x86_64 3 moved.pdb\n");
+
+    auto store = temp.path() / "servers";
+    SymbolDownloader downloader{ store, { server.url() + "/first", server.url() + "/second" }, 4 };
+    CHECK(downloader.fetch("moved.pdb/3/moved.sym"));
+    CHECK(server.requests("/first/moved.pdb/3/moved.sym") == 1);
+    CHECK(server.requests("/storage/moved.sym") == 1);
+    CHECK(readFile(store / "moved.pdb/3/moved.sym") == "MODULE windows x86_64 3 moved.pdb\n");
+
+    // Files missing from all servers leave nothing behind, and are requested again later.
+    CHECK(!downloader.fetch("missing.pdb/4/missing.sym"));
+    CHECK(!downloader.fetch("missing.pdb/4/missing.sym"));
+    CHECK(server.requests("/second/missing.pdb/4/missing.sym") == 2);
+    CHECK(!std::filesystem::exists(store / "missing.pdb/4/missing.sym.partial"));
+    CHECK(downloader.stats().failures == 2);
+}
+
+int main()
+{
+    MockSymbolServer server;
+    TempDirectory temp;
+
+    testCoalesced(server, temp);
+    testBoundedConnections(server, temp);
+    testResumed(server, temp);
+    testServers(server, temp);
+    return checkResult();
+}
@@ -0,0 +1,180 @@
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "capture.h"
+#include "check.h"
+#include "data.h"
+#include "filter.h"
+#include "pipeline.h"
+#include "pool.h"
+#include "source.h"
+
+#define FIREFOX_PID 100
+#define XUL_BASE 0x7ff600000000
+#define XUL_SIZE 0x9000000
+
+static const wchar_t FIREFOX_IMAGE[] = L"\\Device\\HarddiskVolume3\\Program Files\\Mozilla Firefox\\firefox.exe";
+static const wchar_t XUL_IMAGE[] = L"\\Device\\HarddiskVolume3\\Program Files\\Mozilla Firefox\\xul.dll";
+
+static CaptureRecord makeEvent(uint64_t timestamp)
+{
+    CaptureRecord record{};
+    record.type = CaptureRecordType::Event;
+    record.timestamp = timestamp;
+    record.taskName = L"ProhibitDynamicCode";
+    record.eventId = 1;
+    record.pid = FIREFOX_PID;
+    record.tid = 200;
+    record.stack = { XUL_BASE + 0x1234, 0x7ff700000000 };
+    return record;
+}
+
+// As the ETW callbacks do, with the process names tracked from the process events and no stack.
+static FilterResult evaluateEarly(const EventFilter& filter, uint64_t timestamp)
+{
+    ProcessImageNames imageNames;
+    imageNames.start(FIREFOX_PID, FIREFOX_IMAGE);
+
+    auto record = makeEvent(timestamp);
+    CaptureDetails details{ record };
+    if (filter.uses(FilterField::Image)) {
+        if (auto imageName = imageNames.find(FIREFOX_PID)) {
+            details.setImageName(*imageName);
+        }
+    }
+    return filter.evaluate(details);
+}
+
+// As the intake thread does, with the process registry: returns whether the event made it to the capture.
+static bool handleLate(const EventFilter& filter, uint64_t timestamp, const std::filesystem::path& path)
+{
+    {
+        WorkerPool pool{ 1, 4, WorkerPool::OverflowPolicy::Block };
+        BatchQueue<Event> events{ 4, WorkerPool::OverflowPolicy::Block };
+        CaptureWriter capture{ path };
+        Pipeline pipeline{ &filter, nullptr, nullptr, nullptr, pool, events, 1, nullptr, OutputFormat::Text, nullptr,
+            &capture, nullptr };
+
+        CaptureRecord record{};
+        record.type = CaptureRecordType::ProcessStart;
+        record.timestamp = timestamp;
+        record.pid = FIREFOX_PID;
+        record.imageName = FIREFOX_IMAGE;
+        handleRecord(pipeline, record, nullptr);
+
+        record.type = CaptureRecordType::ImageLoad;
+        record.timestamp = timestamp + 1;
+        record.imageBase = XUL_BASE;
+        record.imageSize = XUL_SIZE;
+        record.imageTimeStamp = 0x5f0a1b2c;
+        record.imageName = XUL_IMAGE;
+        handleRecord(pipeline, record, nullptr);
+
+        auto event = makeEvent(timestamp + 2);
+        CaptureDetails details{ event };
+        handleRecord(pipeline, event, &details);
+    }
+
+    CaptureReader reader{ path };
+    CaptureRecord record{};
+    while (reader.next(record)) {
+        if (record.type == CaptureRecordType::Event) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Image names and module names are derived alike on both paths: an event rejected early would not have matched late,
+// and filters on the image alone are settled early.
+static void testEarlyAndLate(const TempDirectory& temp)
+{
+    struct Case {
+        const char* expression;
+        bool matches;
+    };
+    const Case cases[] = {
+        { "image == \"firefox.exe\"", true },
+        { "image == \"FIREFOX.EXE\"", true },
+        { "image == \"*.exe\"", true },
+        { "image == \"firefox\"", false },
+        { "image != \"firefox.exe\"", false },
+        { "stack(\"xul.dll\")", true },
+        { "stack(\"XUL.DLL\")", true },
+        { "stack(\"xul\")", true },
+        { "stack(\"xul.exe\")", true },
+        { "stack(\"ntdll.dll\")", false },
+        { "!stack(\"xul.dll\")", false },
+        { "image == \"firefox.exe\" && stack(\"xul.dll\")", true },
+        { "image == \"firefox.exe\" && !stack(\"xul\")", false },
+    };
+
+    uint64_t timestamp = 1000;
+    for (const auto& test : cases) {
+        EventFilter filter{ test.expression };
+        auto early = evaluateEarly(filter, timestamp);
+        if (!filter.uses(FilterField::Stack)) {
+            CHECK((early == FilterResult::True) == test.matches);
+        }
+        else if (test.matches) {
+            CHECK(early != FilterResult::False);
+        }
+
+        auto matchesLate = handleLate(filter, timestamp, temp.path() / "filtered.mtmcap");
+        if (matchesLate != test.matches) {
+            std::cout << "Late filtering mismatch: " << test.expression << std::endl;
+        }
+        CHECK(matchesLate == test.matches);
+        timestamp += 1000;
+    }
+}
+
+// Has no field, so that no test is settled and every operand stays on the stack until the end.
+class UnknownSubject : public FilterSubject {
+public:
+    bool has(FilterField) override { return false; }
+    uint32_t pid() override { return 0; }
+    std::wstring_view imageName() override { return {}; }
+    std::wstring_view taskName() override { return {}; }
+    int eventId() override { return 0; }
+    bool property(std::wstring_view, FilterValue&) override { return false; }
+    bool hasModule(std::wstring_view) override { return false; }
+};
+
+// Each parenthesis leaves the left operands of both || and && pending, twice as many operands as nesting levels.
+static void testPendingOperands()
+{
+    std::string expression;
+    for (int i = 0; i < FILTER_MAX_DEPTH - 1; ++i) {
+        expression += "pid == 1 || pid == 100 && (";
+    }
+    expression += "pid == 100";
+    expression.append(FILTER_MAX_DEPTH - 1, ')');
+
+    EventFilter filter{ expression };
+    CHECK(evaluateEarly(filter, 0) == FilterResult::True);
+    UnknownSubject unknown;
+    CHECK(filter.evaluate(unknown) == FilterResult::Unknown);
+
+    // One more level is too much nesting.
+    bool thrown = false;
+    try {
+        EventFilter{ "pid == 1 || pid == 100 && (" + expression + ")" };
+    }
+    catch (const std::runtime_error&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+}
+
+int main()
+{
+    TempDirectory temp;
+    testEarlyAndLate(temp);
+    testPendingOperands();
+    return checkResult();
+}
@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+# Writes the minimal PE files used by pe_test.cpp, with the headers, a section and a debug directory only.
+# The GUID {12345678-9ABC-DEF0-0123-456789ABCDEF} has the debug id 123456789ABCDEF00123456789ABCDEF followed by the age.
+
+import struct
+import uuid
+
+GUID = uuid.UUID("12345678-9abc-def0-0123-456789abcdef").bytes_le
+DEBUG_TYPE_CODEVIEW = 2
+DEBUG_TYPE_POGO = 13
+
+
+def rsds(age, pdb_path):
+    return b"RSDS" + GUID + struct.pack("<I", age) + pdb_path.encode() + b"\0"
+
+
+def pe(pe64, time_date_stamp, size_of_image, debug_entries):
+    """debug_entries: list of (type, payload) written after the debug directory, None for no debug directory."""
+    optional_size = 240 if pe64 else 224
+    directories = 112 if pe64 else 96
+    file = bytearray(0x400)
+
+    struct.pack_into("<H", file, 0, 0x5a4d)
+    struct.pack_into("<I", file, 0x3c, 0x40)
+    struct.pack_into("<I", file, 0x40, 0x4550)
+    struct.pack_into("<HHIIIHH", file, 0x44, 0x8664 if pe64 else 0x14c, 1, time_date_stamp, 0, 0, optional_size, 0x2022)
+
+    optional = 0x58
+    struct.pack_into("<H", file, optional, 0x20b if pe64 else 0x10b)
+    struct.pack_into("<I", file, optional + 56, size_of_image)
+    struct.pack_into("<I", file, optional + directories - 4, 16)
+
+    # A single section, mapping RVA 0x1000 to file offset 0x200.
+    section = optional + optional_size
+    struct.pack_into("<8sIIII", file, section, b".rdata", 0x200, 0x1000, 0x200, 0x200)
+
+    if debug_entries is not None:
+        struct.pack_into("<II", file, optional + directories + 6 * 8, 0x1000, 28 * len(debug_entries))
+        data = 0x200 + 28 * len(debug_entries)
+        for i, (debug_type, payload) in enumerate(debug_entries):
+            struct.pack_into("<IIHHIIII", file, 0x200 + 28 * i, 0, time_date_stamp, 0, 0, debug_type, len(payload),
+                0x1000 + data - 0x200, data)
+            file[data:data + len(payload)] = payload
+            data += len(payload)
+    return bytes(file)
+
+
+def write(name, contents):
+    with open(name, "wb") as file:
+        file.write(contents)
+
+
+write("sample64.dll", pe(True, 0x5f0a1b2c, 0x12000, [(DEBUG_TYPE_CODEVIEW, rsds(3, "C:\\build\\obj\\sample64.pdb"))]))
+# The CodeView record comes after another debug record.
+write("sample32.dll", pe(False, 0x01020304, 0x8000,
+    [(DEBUG_TYPE_POGO, b"PGU\0" + bytes(12)), (DEBUG_TYPE_CODEVIEW, rsds(0x1a, "/build/sample32.pdb"))]))
+write("nodebug.dll", pe(True, 0x5f0a1b2c, 0x12000, None))
@@ -0,0 +1,211 @@
+#ifndef MOCK_SERVER_H
+#define MOCK_SERVER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// HTTP/1.0 server on the loopback interface, serving files from memory and counting the requests for each path.
+// Range requests are honored, and responses can be delayed or cut short to exercise concurrent and resumed downloads.
+class MockSymbolServer {
+public:
+    MockSymbolServer() :
+        mListener{ ::socket(AF_INET, SOCK_STREAM, 0) },
+        mPort{ 0 },
+        mMutex{},
+        mFiles{},
+        mRedirects{},
+        mRequests{},
+        mOrder{},
+        mRanges{},
+        mDelay{ std::chrono::milliseconds(0) },
+        mCutAfter{ 0 },
+        mConnections{ 0 },
+        mMaxConnections{ 0 },
+        mThread{}
+    {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof address;
+        if (::bind(mListener, reinterpret_cast<sockaddr*>(&address), sizeof address) != 0 ||
+            ::listen(mListener, 64) != 0 ||
+            ::getsockname(mListener, reinterpret_cast<sockaddr*>(&address), &length) != 0) {
+            std::cout << "Cannot listen on the loopback interface." << std::endl;
+            std::exit(1);
+        }
+        mPort = ntohs(address.sin_port);
+        mThread = std::jthread([this](std::stop_token stopToken) { serve(stopToken); });
+    }
+
+    ~MockSymbolServer()
+    {
+        mThread.request_stop();
+        ::shutdown(mListener, SHUT_RDWR);
+        ::close(mListener);
+    }
+
+    MockSymbolServer(MockSymbolServer&) = delete;
+    MockSymbolServer& operator=(const MockSymbolServer&) = delete;
+
+    MockSymbolServer(MockSymbolServer&&) = delete;
+    MockSymbolServer& operator=(MockSymbolServer&&) = delete;
+
+    std::string url() const { return std::format("http://127.0.0.1:{}", mPort); }
+
+    void addFile(const std::string& path, const std::string& contents)
+    {
+        std::lock_guard guard(mMutex);
+        mFiles[path] = contents;
+    }
+
+    void addRedirect(const std::string& path, const std::string& location)
+    {
+        std::lock_guard guard(mMutex);
+        mRedirects[path] = location;
+    }
+
+    // Responses wait this long before their body.
+    void setDelay(std::chrono::milliseconds delay) { mDelay = delay; }
+
+    // The next response only sends this many bytes of its body before closing the connection.
+    void cutNextAfter(size_t size) { mCutAfter = size; }
+
+    size_t requests(const std::string& path)
+    {
+        std::lock_guard guard(mMutex);
+        return mRequests[path];
+    }
+
+    // Paths requested, in order.
+    std::vector<std::string> order()
+    {
+        std::lock_guard guard(mMutex);
+        return mOrder;
+    }
+
+    // Offsets requested with a Range header, in order.
+    std::vector<uint64_t> ranges()
+    {
+        std::lock_guard guard(mMutex);
+        return mRanges;
+    }
+
+    int maxConnections() const { return mMaxConnections.load(); }
+
+private:
+    void serve(std::stop_token stopToken)
+    {
+        std::vector<std::jthread> handlers;
+        while (!stopToken.stop_requested()) {
+            int connection = ::accept(mListener, nullptr, nullptr);
+            if (connection < 0) {
+                break;
+            }
+            handlers.emplace_back([this, connection]() {
+                auto open = ++mConnections;
+                auto max = mMaxConnections.load();
+                while (open > max && !mMaxConnections.compare_exchange_weak(max, open)) {
+                }
+                handle(connection);
+                --mConnections;
+                ::close(connection);
+            });
+        }
+    }
+
+    void handle(int connection)
+    {
+        std::string request;
+        char buffer[4096];
+        while (request.find("\r\n\r\n") == std::string::npos) {
+            auto count = ::recv(connection, buffer, sizeof buffer, 0);
+            if (count <= 0) {
+                return;
+            }
+            request.append(buffer, static_cast<size_t>(count));
+        }
+
+        auto pathStart = request.find(' ') + 1;
+        auto path = request.substr(pathStart, request.find(' ', pathStart) - pathStart);
+        uint64_t offset = 0;
+        auto range = request.find("Range: bytes=");
+        if (range != std::string::npos) {
+            offset = std::strtoull(request.c_str() + range + 13, nullptr, 10);
+        }
+
+        std::string response;
+        std::string body;
+        {
+            std::lock_guard guard(mMutex);
+            ++mRequests[path];
+            mOrder.push_back(path);
+            if (range != std::string::npos) {
+                mRanges.push_back(offset);
+            }
+
+            auto redirect = mRedirects.find(path);
+            auto file = mFiles.find(path);
+            if (redirect != mRedirects.end()) {
+                response = std::format("HTTP/1.0 302 Found\r\nLocation: {}\r\n\r\n", redirect->second);
+            }
+            else if (file == mFiles.end()) {
+                response = "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+            }
+            else if (offset >= file->second.size() && offset) {
+                response = "HTTP/1.0 416 Range Not Satisfiable\r\nContent-Length: 0\r\n\r\n";
+            }
+            else {
+                body = file->second.substr(offset);
+                response = std::format("HTTP/1.0 {}\r\nContent-Length: {}\r\n\r\n",
+                    offset ? "206 Partial Content" : "200 OK", body.size());
+            }
+        }
+
+        std::this_thread::sleep_for(mDelay.load());
+        if (auto cutAfter = mCutAfter.exchange(0); cutAfter && cutAfter < body.size()) {
+            body.resize(cutAfter);
+        }
+        response += body;
+        for (size_t sent = 0; sent < response.size();) {
+            auto count = ::send(connection, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+            if (count <= 0) {
+                return;
+            }
+            sent += static_cast<size_t>(count);
+        }
+    }
+
+private:
+    int mListener;
+    uint16_t mPort;
+
+    std::mutex mMutex;
+    std::map<std::string, std::string> mFiles;
+    std::map<std::string, std::string> mRedirects;
+    std::map<std::string, size_t> mRequests;
+    std::vector<std::string> mOrder;
+    std::vector<uint64_t> mRanges;
+
+    std::atomic<std::chrono::milliseconds> mDelay;
+    std::atomic<size_t> mCutAfter;
+    std::atomic<int> mConnections;
+    std::atomic<int> mMaxConnections;
+
+    std::jthread mThread;
+};
+
+#endif // MOCK_SERVER_H
@@ -0,0 +1,128 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "pe.h"
+
+// Fixtures written by fixtures/make_pe.py.
+#define GUID_DEBUG_ID L"123456789ABCDEF00123456789ABCDEF"
+
+static std::vector<uint8_t> readFile(const std::filesystem::path& path)
+{
+    std::ifstream file{ path, std::ios::binary };
+    return std::vector<uint8_t>{ std::istreambuf_iterator<char>{ file }, std::istreambuf_iterator<char>{} };
+}
+
+static void testSamples(const std::filesystem::path& fixtures)
+{
+    auto info64 = readImageIndexInfo(fixtures / "sample64.dll");
+    CHECK(info64);
+    if (info64) {
+        CHECK(info64->timeDateStamp == 0x5f0a1b2c);
+        CHECK(info64->sizeOfImage == 0x12000);
+        CHECK(info64->pdbFile == L"sample64.pdb");
+        CHECK(info64->pdbAge == 3);
+        CHECK(pdbDebugId(*info64) == GUID_DEBUG_ID L"3");
+    }
+
+    // The CodeView record is found after another debug record, in a PE32 file.
+    auto info32 = readImageIndexInfo(fixtures / "sample32.dll");
+    CHECK(info32);
+    if (info32) {
+        CHECK(info32->timeDateStamp == 0x01020304);
+        CHECK(info32->sizeOfImage == 0x8000);
+        CHECK(info32->pdbFile == L"sample32.pdb");
+        CHECK(pdbDebugId(*info32) == GUID_DEBUG_ID L"1A");
+    }
+
+    CHECK(!readImageIndexInfo(fixtures / "nodebug.dll"));
+    CHECK(!readImageIndexInfo(fixtures / "missing.dll"));
+}
+
+// Every truncation of a file is rejected without reading past its end, until the whole CodeView record is there.
+static void testTruncated(const std::filesystem::path& fixtures)
+{
+    auto contents = readFile(fixtures / "sample64.dll");
+    CHECK(contents.size() == 0x400);
+
+    // The record starts after the single debug directory entry, with the path and its terminator last.
+    size_t recordEnd = 0x200 + 28 + 24 + std::strlen("C:\\build\\obj\\sample64.pdb") + 1;
+    for (size_t size = 0; size <= contents.size(); ++size) {
+        // Copied to a buffer of the exact size, so that reads past the end are caught by sanitizers.
+        std::vector<uint8_t> prefix(contents.begin(), contents.begin() + size);
+        auto info = parseImageIndexInfo(prefix.data(), prefix.size());
+        if (size < recordEnd) {
+            CHECK(!info);
+        }
+        else {
+            CHECK(info && info->pdbFile == L"sample64.pdb");
+        }
+    }
+}
+
+// Corrupted offsets and counts are rejected.
+static void testCorrupted(const std::filesystem::path& fixtures)
+{
+    auto contents = readFile(fixtures / "sample64.dll");
+
+    auto badNtOffset = contents;
+    badNtOffset[0x3c] = 0xff;
+    badNtOffset[0x3f] = 0x7f;
+    CHECK(!parseImageIndexInfo(badNtOffset.data(), badNtOffset.size()));
+
+    auto badDebugPointer = contents;
+    badDebugPointer[0x200 + 24 + 3] = 0x10;
+    CHECK(!parseImageIndexInfo(badDebugPointer.data(), badDebugPointer.size()));
+
+    auto badMagic = contents;
+    badMagic[0x58] = 0;
+    CHECK(!parseImageIndexInfo(badMagic.data(), badMagic.size()));
+}
+
+static void testDebugIds()
+{
+    ImageIndexInfo info{};
+    CHECK(parsePdbDebugId("123456789abcdef00123456789ABCDEF2b", info));
+    CHECK(info.pdbAge == 0x2b);
+    CHECK(pdbDebugId(info) == GUID_DEBUG_ID L"2B");
+
+    CHECK(!parsePdbDebugId("123456789ABCDEF00123456789ABCDEF", info));
+    CHECK(!parsePdbDebugId("123456789ABCDEF00123456789ABCDEG1", info));
+    CHECK(!parsePdbDebugId("123456789ABCDEF00123456789ABCDEF123456789", info));
+}
+
+static void testCache(const std::filesystem::path& fixtures)
+{
+    ImageIndexCache cache;
+    auto path = (fixtures / "sample64.dll").wstring();
+    auto first = cache.get(path);
+    CHECK(first);
+    CHECK(cache.get(path) == first);
+
+    // Failures are cached too.
+    auto missing = (fixtures / "missing.dll").wstring();
+    CHECK(!cache.get(missing));
+    CHECK(!cache.get(missing));
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 2) {
+        std::cout << "Usage: pe_test <fixtures directory>" << std::endl;
+        return 1;
+    }
+    std::filesystem::path fixtures{ argv[1] };
+
+    testSamples(fixtures);
+    testTruncated(fixtures);
+    testCorrupted(fixtures);
+    testDebugIds();
+    testCache(fixtures);
+    return checkResult();
+}
@@ -0,0 +1,208 @@
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <future>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "pool.h"
+
+// Occupies the single worker of a pool until released, so that the following tasks stay queued.
+class BusyWorker {
+public:
+    BusyWorker(WorkerPool& pool)
+    {
+        std::promise<void> started;
+        auto startedFuture = started.get_future();
+        pool.submit([&started, release = mRelease.get_future().share()](bool) {
+            started.set_value();
+            release.wait();
+        });
+        startedFuture.wait();
+    }
+
+    void release() { mRelease.set_value(); }
+
+private:
+    std::promise<void> mRelease;
+};
+
+static void testBlock()
+{
+    std::atomic<int> runs{ 0 };
+    std::atomic<int> degradedRuns{ 0 };
+    std::vector<std::jthread> producers;
+    {
+        WorkerPool pool{ 2, 4, WorkerPool::OverflowPolicy::Block };
+        for (int producer = 0; producer < 4; ++producer) {
+            producers.emplace_back([&pool, &runs, &degradedRuns]() {
+                for (int i = 0; i < 1000; ++i) {
+                    pool.submit([&runs, &degradedRuns](bool degraded) {
+                        ++runs;
+                        degradedRuns += degraded;
+                    });
+                }
+            });
+        }
+        producers.clear();
+
+        auto stats = pool.stats();
+        CHECK(stats.queued == 4000);
+        CHECK(stats.dropped == 0);
+        CHECK(stats.degraded == 0);
+    }
+    // The pool runs the tasks left when destroyed.
+    CHECK(runs.load() == 4000);
+    CHECK(degradedRuns.load() == 0);
+}
+
+static void testDropOldest()
+{
+    std::vector<int> ran;
+    WorkerPool::Stats stats{};
+    {
+        WorkerPool pool{ 1, 4, WorkerPool::OverflowPolicy::DropOldest };
+        BusyWorker busy{ pool };
+        for (int i = 0; i < 10; ++i) {
+            pool.submit([&ran, i](bool) { ran.push_back(i); });
+        }
+        busy.release();
+        // Waits for the worker, which the pool joins.
+        while (pool.stats().completed < 5) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        stats = pool.stats();
+    }
+    CHECK(stats.dropped == 6);
+    CHECK(stats.completed == 5);
+    CHECK((ran == std::vector<int>{ 6, 7, 8, 9 }));
+}
+
+static void testDegrade()
+{
+    std::vector<int> degradedRuns;
+    std::atomic<int> runs{ 0 };
+    {
+        WorkerPool pool{ 1, 4, WorkerPool::OverflowPolicy::Degrade };
+        BusyWorker busy{ pool };
+        auto submitter = std::this_thread::get_id();
+        for (int i = 0; i < 10; ++i) {
+            pool.submit([&degradedRuns, &runs, submitter, i](bool degraded) {
+                if (degraded) {
+                    // Degraded tasks run right away, on the submitting thread.
+                    CHECK(std::this_thread::get_id() == submitter);
+                    degradedRuns.push_back(i);
+                }
+                ++runs;
+            });
+        }
+        CHECK(pool.stats().degraded == 6);
+        busy.release();
+    }
+    CHECK((degradedRuns == std::vector<int>{ 4, 5, 6, 7, 8, 9 }));
+    CHECK(runs.load() == 10);
+}
+
+// Draining waits for the queued tasks and the running ones, and the pool takes tasks again afterwards.
+static void testDrain()
+{
+    std::atomic<int> runs{ 0 };
+    WorkerPool pool{ 2, 100, WorkerPool::OverflowPolicy::Block };
+    for (int round = 1; round <= 3; ++round) {
+        for (int i = 0; i < 50; ++i) {
+            pool.submit([&runs](bool) {
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+                ++runs;
+            });
+        }
+        pool.drain();
+        CHECK(runs.load() == round * 50);
+        CHECK(pool.stats().completed == static_cast<uint64_t>(round * 50));
+    }
+
+    // Returns right away when idle.
+    pool.drain();
+}
+
+static void testBatchQueue()
+{
+    BatchQueue<int> queue{ 10, WorkerPool::OverflowPolicy::Block };
+    for (int i = 0; i < 5; ++i) {
+        queue.push(int{ i });
+    }
+
+    std::vector<int> batch;
+    queue.take(3, batch);
+    CHECK((batch == std::vector<int>{ 0, 1, 2 }));
+
+    batch.clear();
+    queue.takeNewest(batch);
+    CHECK((batch == std::vector<int>{ 4 }));
+
+    batch.clear();
+    queue.take(3, batch);
+    CHECK((batch == std::vector<int>{ 3 }));
+
+    batch.clear();
+    queue.take(3, batch);
+    CHECK(batch.empty());
+}
+
+// A full batch queue applies the overflow policy to its items, whatever happens to the tasks.
+static void testBatchQueueOverflow()
+{
+    std::vector<int> batch;
+
+    BatchQueue<int> dropping{ 4, WorkerPool::OverflowPolicy::DropOldest };
+    for (int i = 0; i < 10; ++i) {
+        CHECK(dropping.push(int{ i }));
+    }
+    dropping.take(10, batch);
+    CHECK((batch == std::vector<int>{ 6, 7, 8, 9 }));
+    CHECK(dropping.stats().dropped == 6);
+
+    BatchQueue<int> degrading{ 4, WorkerPool::OverflowPolicy::Degrade };
+    for (int i = 0; i < 10; ++i) {
+        int item = i;
+        CHECK(degrading.push(std::move(item)) == (i < 4));
+    }
+    batch.clear();
+    degrading.take(10, batch);
+    CHECK((batch == std::vector<int>{ 0, 1, 2, 3 }));
+    CHECK(degrading.stats().degraded == 6);
+    CHECK(degrading.stats().dropped == 0);
+
+    // The producer waits for a take to make room.
+    BatchQueue<int> blocking{ 4, WorkerPool::OverflowPolicy::Block };
+    std::atomic<int> pushed{ 0 };
+    std::jthread producer([&blocking, &pushed]() {
+        for (int i = 0; i < 6; ++i) {
+            blocking.push(int{ i });
+            ++pushed;
+        }
+    });
+    while (pushed.load() < 4) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(pushed.load() == 4);
+
+    batch.clear();
+    blocking.take(2, batch);
+    producer.join();
+    blocking.take(10, batch);
+    CHECK((batch == std::vector<int>{ 0, 1, 2, 3, 4, 5 }));
+    CHECK(blocking.stats().dropped == 0);
+}
+
+int main()
+{
+    testBlock();
+    testDropOldest();
+    testDegrade();
+    testDrain();
+    testBatchQueue();
+    testBatchQueueOverflow();
+    return checkResult();
+}
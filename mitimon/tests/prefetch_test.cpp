@@ -0,0 +1,148 @@
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "breakpad.h"
+#include "check.h"
+#include "data.h"
+#include "download.h"
+#include "mock_server.h"
+#include "pe.h"
+#include "prefetch.h"
+
+#define IMAGE_SIZE 0x100000
+
+// An image recorded with its PDB identity, whose symbol file the server has. Each base gets its own debug id.
+struct TestImage {
+    ImageData imageData;
+    std::string symbolPath;
+};
+
+static TestImage addImage(MockSymbolServer& server, const std::string& name, uint64_t base)
+{
+    auto debugId = std::format("{:016X}{:016X}1", base, 0);
+    auto indexInfo = std::make_shared<ImageIndexInfo>(ImageIndexInfo{ 0x5f0a1b2c, IMAGE_SIZE, {}, {}, 0 });
+    indexInfo->pdbFile = std::wstring(name.begin(), name.end()) + L".pdb";
+    parsePdbDebugId(debugId, *indexInfo);
+
+    auto symbolPath = std::format("/{}.pdb/{}/{}.sym", name, debugId, name);
+    server.addFile(symbolPath, std::format("MODULE windows x86_64 {} {}.pdb\nFUNC 1000 10 0 {}_function\n", debugId, name, name));
+
+    auto imageName = L"\\Device\\HarddiskVolume3\\app\\" + std::wstring(name.begin(), name.end()) + L".dll";
+    return TestImage{ ImageData{ reinterpret_cast<void*>(base), IMAGE_SIZE, 0x5f0a1b2c, imageName, indexInfo }, symbolPath };
+}
+
+static void waitForCompletion(const SymbolPrefetcher& prefetcher, uint64_t count)
+{
+    while (prefetcher.stats().completed < count) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+// Images are queued once per identity, and a symbol file shared by several images is fetched once.
+static void testFetchedOnce(const TempDirectory& temp)
+{
+    MockSymbolServer server;
+    auto store = temp.path() / "once";
+    SymbolDownloader downloader{ store, { server.url() }, 4 };
+    BreakpadBackend backend{ store, 1, &downloader };
+
+    auto image = addImage(server, "once", 0x10000000);
+    // Another copy of the same build, from another path.
+    ImageData copyData{ reinterpret_cast<void*>(0x20000000), IMAGE_SIZE, 0x5f0a1b2c,
+        L"\\Device\\HarddiskVolume3\\copy\\once.dll", std::make_shared<ImageIndexInfo>(*image.imageData.indexInfo()) };
+
+    SymbolPrefetcher prefetcher{ backend, PREFETCH_CONCURRENCY };
+    for (int i = 0; i < 3; ++i) {
+        prefetcher.enqueue(image.imageData);
+        prefetcher.enqueue(copyData);
+    }
+    waitForCompletion(prefetcher, 2);
+
+    auto stats = prefetcher.stats();
+    CHECK(stats.queued == 2);
+    CHECK(stats.completed == 2);
+    CHECK(server.requests(image.symbolPath) == 1);
+
+    // The symbols are ready for the events.
+    FrameInfo frame{};
+    backend.symbolicate(image.imageData, 0x1004, frame);
+    CHECK(frame.symbolName == L"once_function");
+    CHECK(server.requests(image.symbolPath) == 1);
+}
+
+// While the only thread is busy, the queued images that appeared the most in stacks move ahead of the others.
+static void testPriority(const TempDirectory& temp)
+{
+    MockSymbolServer server;
+    auto store = temp.path() / "priority";
+    SymbolDownloader downloader{ store, { server.url() }, 4 };
+    BreakpadBackend backend{ store, 1, &downloader };
+
+    auto busy = addImage(server, "busy", 0x10000000);
+    auto rare = addImage(server, "rare", 0x20000000);
+    auto common = addImage(server, "common", 0x30000000);
+    auto frequent = addImage(server, "frequent", 0x40000000);
+
+    SymbolPrefetcher prefetcher{ backend, 1 };
+    server.setDelay(std::chrono::milliseconds(300));
+    prefetcher.enqueue(busy.imageData);
+    while (server.requests(busy.symbolPath) == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    server.setDelay(std::chrono::milliseconds(0));
+
+    prefetcher.enqueue(rare.imageData);
+    prefetcher.enqueue(common.imageData);
+    prefetcher.enqueue(frequent.imageData);
+
+    auto modules = ModuleSet::empty()->withImage(rare.imageData)->withImage(common.imageData)->withImage(frequent.imageData);
+    prefetcher.prioritize(*modules, { 0x40001000, 0x40002000, 0x30001000, 0x40003000 });
+    prefetcher.prioritize(*modules, { 0x30001000, 0x40001000, 0x50000000 });
+    waitForCompletion(prefetcher, 4);
+
+    CHECK((server.order() == std::vector<std::string>{ busy.symbolPath, frequent.symbolPath, common.symbolPath, rare.symbolPath }));
+}
+
+// No more symbol files than the prefetch threads are requested at the same time, though the downloader allows more.
+static void testConcurrency(const TempDirectory& temp)
+{
+    MockSymbolServer server;
+    auto store = temp.path() / "concurrency";
+    SymbolDownloader downloader{ store, { server.url() }, PREFETCH_CONCURRENCY * 4 };
+    BreakpadBackend backend{ store, 1, &downloader };
+
+    std::vector<TestImage> images;
+    for (int i = 0; i < PREFETCH_CONCURRENCY * 3; ++i) {
+        images.push_back(addImage(server, std::format("module{}", i), uint64_t{ 0x10000000 } * (i + 1)));
+    }
+
+    server.setDelay(std::chrono::milliseconds(100));
+    SymbolPrefetcher prefetcher{ backend, PREFETCH_CONCURRENCY };
+    for (const auto& image : images) {
+        prefetcher.enqueue(image.imageData);
+    }
+    waitForCompletion(prefetcher, images.size());
+    server.setDelay(std::chrono::milliseconds(0));
+
+    CHECK(server.maxConnections() <= PREFETCH_CONCURRENCY);
+    CHECK(server.maxConnections() > 1);
+    for (const auto& image : images) {
+        CHECK(server.requests(image.symbolPath) == 1);
+    }
+}
+
+int main()
+{
+    TempDirectory temp;
+
+    testFetchedOnce(temp);
+    testPriority(temp);
+    testConcurrency(temp);
+    return checkResult();
+}
@@ -0,0 +1,164 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "check.h"
+#include "ring.h"
+
+#define STRESS_PRODUCERS 4
+#define STRESS_RECORDS_PER_PRODUCER 100000
+#define STRESS_CAPACITY 256
+
+// Large enough for a torn write to show, as a payload word disagreeing with the others.
+struct Record {
+    uint32_t producer;
+    uint32_t sequence;
+    uint64_t payload[15];
+};
+
+static void testSingleThread()
+{
+    MpscRing<int> ring{ 5 };
+    CHECK(ring.stats().capacity == 8);
+
+    // Wraps around the slots a few times.
+    int next = 0;
+    for (int lap = 0; lap < 3; ++lap) {
+        for (int i = 0; i < 8; ++i) {
+            CHECK(ring.tryPush([value = lap * 8 + i](int& slot) { slot = value; }));
+        }
+        bool called = false;
+        CHECK(!ring.tryPush([&called](int&) { called = true; }));
+        CHECK(!called);
+
+        for (int i = 0; i < 8; ++i) {
+            CHECK(ring.tryPop([&next](int value) { CHECK(value == next++); }));
+        }
+        CHECK(!ring.tryPop([](int) { CHECK(false); }));
+    }
+
+    auto stats = ring.stats();
+    CHECK(stats.pushed == 24);
+    CHECK(stats.dropped == 3);
+    CHECK(stats.highWatermark == 8);
+}
+
+// Producers push as fast as they can while the consumer pops: every record is either popped whole, once and in the
+// order of its producer, or counted as dropped. Waiting producers never drop any.
+static void testStress(bool wait)
+{
+    MpscRing<Record> ring{ STRESS_CAPACITY };
+    std::atomic<int> producersLeft{ STRESS_PRODUCERS };
+    std::vector<uint64_t> accepted(STRESS_PRODUCERS);
+
+    std::vector<int64_t> lastSequence(STRESS_PRODUCERS, -1);
+    uint64_t popped = 0;
+    uint64_t torn = 0;
+    uint64_t reordered = 0;
+    auto consume = [&lastSequence, &popped, &torn, &reordered](const Record& record) {
+        ++popped;
+        for (auto word : record.payload) {
+            torn += word != (uint64_t{ record.producer } << 32 | record.sequence);
+        }
+        reordered += record.sequence <= lastSequence[record.producer];
+        lastSequence[record.producer] = record.sequence;
+    };
+
+    std::jthread consumer([&ring, &producersLeft, &consume]() {
+        while (producersLeft.load() > 0) {
+            if (!ring.tryPop(consume)) {
+                std::this_thread::yield();
+            }
+        }
+        while (ring.tryPop(consume)) {
+        }
+    });
+
+    {
+        std::vector<std::jthread> producers;
+        for (uint32_t producer = 0; producer < STRESS_PRODUCERS; ++producer) {
+            producers.emplace_back([&ring, &producersLeft, &accepted, producer, wait]() {
+                for (uint32_t sequence = 0; sequence < STRESS_RECORDS_PER_PRODUCER; ++sequence) {
+                    auto fill = [producer, sequence](Record& record) {
+                        record.producer = producer;
+                        record.sequence = sequence;
+                        for (auto& word : record.payload) {
+                            word = uint64_t{ producer } << 32 | sequence;
+                        }
+                    };
+                    if (wait) {
+                        ring.pushWaiting(fill);
+                        ++accepted[producer];
+                    }
+                    else {
+                        accepted[producer] += ring.tryPush(fill);
+                    }
+                }
+                --producersLeft;
+            });
+        }
+    }
+    consumer.join();
+
+    uint64_t acceptedTotal = 0;
+    for (auto count : accepted) {
+        acceptedTotal += count;
+    }
+
+    auto stats = ring.stats();
+    CHECK(torn == 0);
+    CHECK(reordered == 0);
+    CHECK(popped == acceptedTotal);
+    CHECK(stats.pushed == acceptedTotal);
+    if (wait) {
+        CHECK(popped == uint64_t{ STRESS_PRODUCERS } * STRESS_RECORDS_PER_PRODUCER);
+        CHECK(stats.dropped == 0);
+    }
+    else {
+        CHECK(stats.pushed + stats.dropped == uint64_t{ STRESS_PRODUCERS } * STRESS_RECORDS_PER_PRODUCER);
+    }
+    CHECK(stats.highWatermark <= STRESS_CAPACITY);
+}
+
+// A producer waiting on a full ring goes on once the consumer pops, after the records already there.
+static void testWaiting()
+{
+    MpscRing<int> ring{ 2 };
+    CHECK(ring.tryPush([](int& slot) { slot = 1; }));
+    CHECK(ring.tryPush([](int& slot) { slot = 2; }));
+
+    std::atomic<bool> pushed{ false };
+    std::jthread producer([&ring, &pushed]() {
+        ring.pushWaiting([](int& slot) { slot = 3; });
+        pushed = true;
+    });
+    while (ring.stats().waited == 0) {
+        std::this_thread::yield();
+    }
+    CHECK(!pushed);
+
+    int next = 1;
+    while (next <= 3) {
+        if (!ring.tryPop([&next](int value) { CHECK(value == next++); })) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(pushed);
+
+    auto stats = ring.stats();
+    CHECK(stats.pushed == 3);
+    CHECK(stats.dropped == 0);
+    CHECK(stats.waited == 1);
+}
+
+int main()
+{
+    testSingleThread();
+    testWaiting();
+    testStress(false);
+    testStress(true);
+    return checkResult();
+}
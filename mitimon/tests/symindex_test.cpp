@@ -0,0 +1,170 @@
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include "cache.h"
+#include "check.h"
+#include "pe.h"
+#include "symindex.h"
+
+static const char DEBUG_ID[] = "44E4EC8C2F41492B9369D6B9A059577C2";
+
+static ImageIndexInfo makeIndexInfo()
+{
+    ImageIndexInfo indexInfo{ 0x5f0a1b2c, 0x9000000, L"xul.pdb", {}, 0 };
+    parsePdbDebugId(DEBUG_ID, indexInfo);
+    return indexInfo;
+}
+
+// Records are added out of order, as the symbol files list them.
+static std::vector<uint8_t> buildIndex(const ImageIndexInfo& indexInfo)
+{
+    SymbolIndexWriter writer;
+    writer.addFunction(0x2000, 0x100, "second");
+    writer.addFunction(0x1000, 0x80, "first(int)");
+    writer.addFunction(0x3000, 0x40, "\xc3\xa9t\xc3\xa9");
+    writer.addPublic(0x1800, "public_after_first");
+    writer.addPublic(0x500, "public_start");
+
+    writer.addLine(0x1010, 0x10, 42, "a.cpp");
+    writer.addLine(0x1000, 0x10, 40, "a.cpp");
+    // A gap, then another file and a line number going backwards.
+    writer.addLine(0x1040, 0x20, 7, "b.h");
+    writer.addLine(0x2000, 0x100, 1000, "c.cpp");
+    // Outside of any function, dropped.
+    writer.addLine(0x1900, 0x10, 1, "dropped.cpp");
+
+    writer.addInline(0x2010, 0x40, 0, "outer");
+    writer.addInline(0x2020, 0x10, 1, "inner");
+    writer.addInline(0x2080, 0x10, 0, "other");
+    return writer.finish(indexInfo);
+}
+
+static FrameInfo lookup(const SymbolIndex& index, uint64_t offset)
+{
+    FrameInfo frame{};
+    index.lookup(offset, frame);
+    return frame;
+}
+
+static void checkLookups(const SymbolIndex& index)
+{
+    auto frame = lookup(index, 0x1014);
+    CHECK(frame.symbolName == L"first(int)");
+    CHECK(frame.displacement == 0x14);
+    CHECK(frame.fileName == L"a.cpp");
+    CHECK(frame.lineNumber == 42);
+    CHECK(frame.lineDisplacement == 4);
+    CHECK(frame.inlineName.empty());
+
+    frame = lookup(index, 0x1045);
+    CHECK(frame.fileName == L"b.h" && frame.lineNumber == 7 && frame.lineDisplacement == 5);
+
+    // In the function, between its lines.
+    frame = lookup(index, 0x1030);
+    CHECK(frame.symbolName == L"first(int)" && frame.fileName.empty());
+
+    // The innermost inlined call covering the offset.
+    frame = lookup(index, 0x2024);
+    CHECK(frame.symbolName == L"second" && frame.lineNumber == 1000 && frame.inlineName == L"inner");
+    CHECK(lookup(index, 0x2030).inlineName == L"outer");
+    CHECK(lookup(index, 0x2088).inlineName == L"other");
+    CHECK(lookup(index, 0x2090).inlineName.empty());
+
+    CHECK(lookup(index, 0x3000).symbolName == L"été");
+
+    // Past the end of a function, the closest public symbol before the offset.
+    frame = lookup(index, 0x1900);
+    CHECK(frame.symbolName == L"public_after_first" && frame.displacement == 0x100 && frame.fileName.empty());
+    frame = lookup(index, 0x1090);
+    CHECK(frame.symbolName == L"public_start" && frame.displacement == 0xb90);
+    CHECK(lookup(index, 0x400).symbolName.empty());
+    CHECK(lookup(index, uint64_t{ 1 } << 32).symbolName.empty());
+
+    // Batches going through the offsets in increasing order find the same frames.
+    SymbolIndex::Cursor cursor;
+    for (uint64_t offset = 0; offset < 0x3100; offset += 0x8) {
+        FrameInfo batched{};
+        index.lookup(offset, batched, cursor);
+        auto single = lookup(index, offset);
+        CHECK(batched.symbolName == single.symbolName && batched.displacement == single.displacement &&
+            batched.fileName == single.fileName && batched.lineNumber == single.lineNumber &&
+            batched.inlineName == single.inlineName);
+    }
+}
+
+static void writeFile(const std::filesystem::path& path, const std::vector<uint8_t>& contents)
+{
+    std::ofstream file{ path, std::ios::binary | std::ios::trunc };
+    file.write(reinterpret_cast<const char*>(contents.data()), contents.size());
+}
+
+static void testRoundTrip(const TempDirectory& temp)
+{
+    auto indexInfo = makeIndexInfo();
+    auto path = temp.path() / symbolIndexPath(indexInfo);
+    CHECK(path.filename() == "xul.symidx");
+
+    auto saved = SymbolIndex::save(path, buildIndex(indexInfo));
+    CHECK(saved && saved->matches(indexInfo));
+    if (saved) {
+        checkLookups(*saved);
+    }
+
+    auto opened = SymbolIndex::open(path, indexInfo);
+    CHECK(opened);
+    if (opened) {
+        checkLookups(*opened);
+    }
+
+    // Indexes that could not be saved are used from memory.
+    SymbolIndex inMemory{ buildIndex(indexInfo) };
+    checkLookups(inMemory);
+}
+
+// Indexes of another PDB, and broken ones, are not used.
+static void testRejected(const TempDirectory& temp)
+{
+    auto indexInfo = makeIndexInfo();
+    auto path = temp.path() / "rejected.symidx";
+    CHECK(!SymbolIndex::open(path, indexInfo));
+
+    auto contents = buildIndex(indexInfo);
+    writeFile(path, contents);
+    CHECK(SymbolIndex::open(path, indexInfo));
+
+    auto otherGuid = indexInfo;
+    otherGuid.pdbGuid[15] ^= 1;
+    CHECK(!SymbolIndex::open(path, otherGuid));
+    auto otherAge = indexInfo;
+    ++otherAge.pdbAge;
+    CHECK(!SymbolIndex::open(path, otherAge));
+
+    for (size_t size : { size_t{ 0 }, size_t{ 10 }, size_t{ 63 }, size_t{ 64 }, contents.size() - 1 }) {
+        writeFile(path, std::vector<uint8_t>(contents.begin(), contents.begin() + size));
+        CHECK(!SymbolIndex::open(path, indexInfo));
+    }
+
+    auto badMagic = contents;
+    badMagic[7] = '2';
+    writeFile(path, badMagic);
+    CHECK(!SymbolIndex::open(path, indexInfo));
+
+    // Function entries past the end of the file.
+    auto badCount = contents;
+    badCount[28 + 3] = 0x10;
+    writeFile(path, badCount);
+    CHECK(!SymbolIndex::open(path, indexInfo));
+}
+
+int main()
+{
+    TempDirectory temp;
+
+    testRoundTrip(temp);
+    testRejected(temp);
+    return checkResult();
+}
@@ -0,0 +1,195 @@
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "check.h"
+#include "data.h"
+
+#define PID 100
+#define GRACE_PERIOD 1000
+
+static ImageData makeImage(uint64_t base, const std::wstring& name)
+{
+    return ImageData{ reinterpret_cast<void*>(base), 0x10000, 0x5f0a1b2c, L"\\Device\\HarddiskVolume3\\app\\" + name };
+}
+
+// Name of the module found at the address in the modules of the pid at the timestamp, or "none" without modules.
+static std::wstring moduleAt(const ModuleTimeline& timeline, uint64_t timestamp, uint64_t address)
+{
+    auto modules = timeline.modules(PID, timestamp);
+    if (!modules) {
+        return L"none";
+    }
+    size_t lastHit = 0;
+    auto [image, offset] = modules->decompose(reinterpret_cast<void*>(address), lastHit);
+    return image ? image->name() : L"";
+}
+
+// Events are matched with the instance of their pid that was running when they happened, never with a later one.
+static void testPidReuse()
+{
+    ModuleTimeline timeline{ GRACE_PERIOD };
+    auto kernel = ModuleSet::empty()->withImage(makeImage(0xfffff80000000000, L"ntoskrnl.exe"));
+
+    CHECK(timeline.addProcess(1000, PID, L"\\Device\\HarddiskVolume3\\app\\first.exe", kernel));
+    CHECK(timeline.addImage(1010, PID, makeImage(0x10000000, L"first.dll")));
+    CHECK(timeline.removeProcess(1100, PID));
+    CHECK(timeline.addProcess(1500, PID, L"\\Device\\HarddiskVolume3\\app\\second.exe", kernel));
+    CHECK(timeline.addImage(1510, PID, makeImage(0x10000000, L"second.dll")));
+
+    // Before the first instance: not the modules of either.
+    CHECK(!timeline.modules(PID, 999));
+    CHECK(timeline.imageName(PID, 999).empty());
+    CHECK(!timeline.modules(PID + 1, 1200));
+
+    CHECK(timeline.imageName(PID, 1000) == L"first.exe");
+    CHECK(moduleAt(timeline, 1005, 0x10001000) == L"");
+    CHECK(moduleAt(timeline, 1005, 0xfffff80000001000) == L"ntoskrnl");
+    CHECK(moduleAt(timeline, 1010, 0x10001000) == L"first");
+    // Handled after the first instance stopped, before the pid was reused.
+    CHECK(moduleAt(timeline, 1200, 0x10001000) == L"first");
+    CHECK(timeline.imageName(PID, 1200) == L"first.exe");
+
+    CHECK(timeline.imageName(PID, 1500) == L"second.exe");
+    CHECK(moduleAt(timeline, 1505, 0x10001000) == L"");
+    CHECK(moduleAt(timeline, 1600, 0x10001000) == L"second");
+
+    // Changes apply to the latest instance only.
+    CHECK(timeline.removeImage(1700, PID, reinterpret_cast<void*>(0x10000000)));
+    CHECK(!timeline.removeImage(1710, PID, reinterpret_cast<void*>(0x10000000)));
+    CHECK(moduleAt(timeline, 1700, 0x10001000) == L"");
+    CHECK(moduleAt(timeline, 1200, 0x10001000) == L"first");
+
+    auto stats = timeline.stats();
+    CHECK(stats.processes == 2);
+    CHECK(stats.versions == 5);
+    CHECK(stats.retiredProcesses == 0);
+}
+
+// Stopped instances are kept for the grace period after they stopped, and superseded versions for the grace period
+// after the next one started.
+static void testRetirement()
+{
+    ModuleTimeline timeline{ GRACE_PERIOD };
+    CHECK(timeline.addProcess(1000, PID, L"first.exe", ModuleSet::empty()));
+    CHECK(timeline.addImage(1010, PID, makeImage(0x10000000, L"first.dll")));
+    CHECK(timeline.removeProcess(1100, PID));
+    CHECK(timeline.addProcess(1500, PID, L"second.exe", ModuleSet::empty()));
+
+    timeline.retire(1100 + GRACE_PERIOD);
+    CHECK(moduleAt(timeline, 1050, 0x10001000) == L"first");
+    CHECK(timeline.stats().processes == 2);
+
+    timeline.retire(1100 + GRACE_PERIOD + 1);
+    auto stats = timeline.stats();
+    CHECK(stats.processes == 1);
+    CHECK(stats.versions == 1);
+    CHECK(stats.retiredProcesses == 1);
+    // The second instance started later, the event is from neither.
+    CHECK(!timeline.modules(PID, 1050));
+    CHECK(timeline.imageName(PID, 1050).empty());
+    CHECK(timeline.imageName(PID, 1500) == L"second.exe");
+
+    // The last version that started before the grace period stays, events may still be handled against it.
+    CHECK(timeline.addImage(2000, PID, makeImage(0x20000000, L"a.dll")));
+    CHECK(timeline.addImage(2500, PID, makeImage(0x30000000, L"b.dll")));
+    CHECK(timeline.addImage(3600, PID, makeImage(0x40000000, L"c.dll")));
+    CHECK(timeline.stats().versions == 2);
+    CHECK(moduleAt(timeline, 2600, 0x20001000) == L"a");
+    CHECK(moduleAt(timeline, 2600, 0x30001000) == L"b");
+    CHECK(moduleAt(timeline, 2600, 0x40001000) == L"");
+    CHECK(moduleAt(timeline, 3600, 0x40001000) == L"c");
+
+    // Events older than the versions kept have no known modules.
+    CHECK(!timeline.modules(PID, 2100));
+    CHECK(!timeline.modules(PID, 1600));
+    CHECK(timeline.imageName(PID, 1600) == L"second.exe");
+
+    // The current version of a running process is never retired.
+    timeline.retire(100000);
+    CHECK(timeline.stats().processes == 1);
+    CHECK(moduleAt(timeline, 100000, 0x40001000) == L"c");
+}
+
+// Without a grace period, the whole history is kept, as when replaying.
+static void testWholeHistory()
+{
+    ModuleTimeline timeline{ UINT64_MAX };
+    for (uint64_t i = 0; i < 10; ++i) {
+        CHECK(timeline.addProcess(i * 100, PID, L"app.exe", ModuleSet::empty()));
+        CHECK(timeline.addImage(i * 100 + 10, PID, makeImage(0x10000000 + i * 0x100000, L"app.dll")));
+        CHECK(timeline.removeProcess(i * 100 + 50, PID));
+    }
+    timeline.retire(UINT64_MAX);
+
+    auto stats = timeline.stats();
+    CHECK(stats.processes == 10);
+    CHECK(stats.versions == 20);
+    CHECK(stats.retiredProcesses == 0);
+    for (uint64_t i = 0; i < 10; ++i) {
+        CHECK(moduleAt(timeline, i * 100 + 20, 0x10001000 + i * 0x100000) == L"app");
+        CHECK(moduleAt(timeline, i * 100 + 5, 0x10001000 + i * 0x100000) == L"");
+    }
+}
+
+// Sets of many images, changed in random order, find the same images as a plain map, and earlier versions are left
+// as they were.
+static void testModuleSet()
+{
+    std::mt19937_64 random{ 1 };
+    std::uniform_int_distribution<uint64_t> slots(0, 199);
+    std::map<uint64_t, uint64_t> expected;
+    std::vector<std::pair<ModuleSet::Pointer, std::map<uint64_t, uint64_t>>> versions;
+    auto modules = ModuleSet::empty();
+
+    for (int step = 0; step < 2000; ++step) {
+        auto base = 0x10000000 + slots(random) * 0x100000;
+        // Mostly loads first, then mostly unloads, so that chunks are split and merged.
+        bool load = step < 1000 ? step % 4 != 0 : step % 4 == 0;
+        ModuleSet::Pointer changed;
+        if (load) {
+            changed = modules->withImage(makeImage(base, L"image.dll"));
+            CHECK(!changed == expected.count(base));
+            expected.emplace(base, base);
+        }
+        else {
+            changed = modules->withoutImage(reinterpret_cast<void*>(base));
+            CHECK(!changed != expected.count(base));
+            expected.erase(base);
+        }
+        if (changed) {
+            modules = changed;
+        }
+        CHECK(modules->size() == expected.size());
+        if (step % 100 == 0) {
+            versions.emplace_back(modules, expected);
+        }
+    }
+
+    for (const auto& [set, images] : versions) {
+        size_t lastHit = 0;
+        for (uint64_t slot = 0; slot < 200; ++slot) {
+            auto base = 0x10000000 + slot * 0x100000;
+            bool loaded = images.count(base) != 0;
+            CHECK((set->getImage(reinterpret_cast<void*>(base)) != nullptr) == loaded);
+            auto [image, offset] = set->decompose(reinterpret_cast<void*>(base + 0x1234), lastHit);
+            CHECK((image != nullptr) == loaded);
+            CHECK(!image || (image->base() == reinterpret_cast<void*>(base) && offset == 0x1234));
+            // Between two images.
+            CHECK(!set->decompose(reinterpret_cast<void*>(base + 0x20000), lastHit).first);
+        }
+        CHECK(!set->decompose(reinterpret_cast<void*>(0x1000), lastHit).first);
+    }
+}
+
+int main()
+{
+    testPidReuse();
+    testRetirement();
+    testWholeHistory();
+    testModuleSet();
+    return checkResult();
+}